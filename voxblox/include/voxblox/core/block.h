@@ -13,8 +13,12 @@
 namespace voxblox {
 
 namespace Update {
-/// Status of which derived things still need to be updated.
-enum Status { kMap, kMesh, kEsdf, kCount };
+/**
+ * Status of which derived things still need to be updated. Every consumer
+ * has its own flag and clears only that one, kCoarseEsdf is the one of the
+ * coarse far-field ESDF.
+ */
+enum Status { kMap, kMesh, kEsdf, kCoarseEsdf, kCount };
 }  // namespace Update
 
 /** An n x n x n container holding VoxelType. It is aware of its 3D position and
@@ -27,21 +31,40 @@ class Block {
   typedef std::shared_ptr<Block<VoxelType> > Ptr;
   typedef std::shared_ptr<const Block<VoxelType> > ConstPtr;
 
+  /**
+   * Bitmask over the sub-bricks of a block. The voxels of a block are grouped
+   * into kSubBricksPerSide^3 cubic sub-bricks, each with one bit, so updates
+   * can be tracked at a finer granularity than the whole block.
+   */
+  typedef uint64_t SubBrickMask;
+  static constexpr size_t kSubBricksPerSide = 4u;
+  static constexpr SubBrickMask kAllSubBricks = ~static_cast<SubBrickMask>(0u);
+
   Block(size_t voxels_per_side, FloatingPoint voxel_size, const Point& origin)
       : has_data_(false),
         voxels_per_side_(voxels_per_side),
         voxel_size_(voxel_size),
         origin_(origin),
-        updated_(false) {
+        updated_(false),
+        num_saturated_free_voxels_(0),
+        writable_version_(0u) {
     num_voxels_ = voxels_per_side_ * voxels_per_side_ * voxels_per_side_;
     voxel_size_inv_ = 1.0 / voxel_size_;
     block_size_ = voxels_per_side_ * voxel_size_;
     block_size_inv_ = 1.0 / block_size_;
+    sub_brick_voxels_per_side_ =
+        (voxels_per_side_ + kSubBricksPerSide - 1u) / kSubBricksPerSide;
+    for (std::atomic<SubBrickMask>& mask : updated_sub_bricks_) {
+      mask.store(0u, std::memory_order_relaxed);
+    }
     voxels_.reset(new VoxelType[num_voxels_]);
   }
 
   explicit Block(const BlockProto& proto);
 
+  /// Deep copy constructor.
+  explicit Block(const Block& other);
+
   ~Block() {}
 
   /// Index calculations.
@@ -178,6 +201,113 @@ class Block {
   }
   void set_has_data(bool has_data) { has_data_ = has_data; }
 
+  /// Number of voxels along each side of a sub-brick.
+  size_t sub_brick_voxels_per_side() const {
+    return sub_brick_voxels_per_side_;
+  }
+  /// Number of sub-bricks along each side, at most kSubBricksPerSide.
+  size_t num_sub_bricks_per_side() const {
+    return (voxels_per_side_ + sub_brick_voxels_per_side_ - 1u) /
+           sub_brick_voxels_per_side_;
+  }
+
+  inline size_t computeSubBrickIndexFromVoxelIndex(
+      const VoxelIndex& index) const {
+    DCHECK(isValidVoxelIndex(index));
+    const size_t sub_brick_index =
+        index.x() / sub_brick_voxels_per_side_ +
+        kSubBricksPerSide * (index.y() / sub_brick_voxels_per_side_ +
+                             kSubBricksPerSide *
+                                 (index.z() / sub_brick_voxels_per_side_));
+    DCHECK_LT(sub_brick_index, 8u * sizeof(SubBrickMask));
+    return sub_brick_index;
+  }
+
+  /**
+   * Marks the sub-brick containing the voxel as updated for all update types
+   * and sets all update flags. Thread safe with respect to the sub-brick
+   * masks.
+   */
+  inline void setVoxelUpdated(const VoxelIndex& index) {
+    const SubBrickMask bit = static_cast<SubBrickMask>(1u)
+                             << computeSubBrickIndexFromVoxelIndex(index);
+    for (std::atomic<SubBrickMask>& mask : updated_sub_bricks_) {
+      // Most voxels are in sub-bricks that are already marked, so check
+      // before doing the more expensive atomic read-modify-write.
+      if ((mask.load(std::memory_order_relaxed) & bit) == 0u) {
+        mask.fetch_or(bit, std::memory_order_relaxed);
+      }
+    }
+    updated_.set();
+  }
+
+  /// Marks all voxels of the block as updated for all update types.
+  void setAllVoxelsUpdated() {
+    for (std::atomic<SubBrickMask>& mask : updated_sub_bricks_) {
+      mask.store(kAllSubBricks, std::memory_order_relaxed);
+    }
+    updated_.set();
+  }
+
+  /**
+   * Returns the sub-bricks that were updated since the flag was last reset
+   * with resetUpdated(). Blocks that were flagged through updated() directly
+   * report all sub-bricks. Note that setting a flag through updated() does
+   * not clear a partial mask from an earlier update, so code that marks whole
+   * blocks should use setAllVoxelsUpdated() instead.
+   */
+  SubBrickMask getUpdatedSubBricks(const Update::Status status) const {
+    if (!updated_[status]) {
+      return 0u;
+    }
+    const SubBrickMask mask =
+        updated_sub_bricks_[status].load(std::memory_order_relaxed);
+    return (mask == 0u) ? kAllSubBricks : mask;
+  }
+
+  /// Clears the update flag together with its sub-brick mask.
+  void resetUpdated(const Update::Status status) {
+    updated_.reset(status);
+    updated_sub_bricks_[status].store(0u, std::memory_order_relaxed);
+  }
+
+  /**
+   * Gets the linear indices of all voxels inside the sub-bricks of the mask,
+   * in increasing order.
+   */
+  void getLinearIndicesOfSubBricks(const SubBrickMask mask,
+                                   std::vector<size_t>* linear_indices) const;
+
+  /**
+   * Summary of the free space in this block: the number of voxels that have
+   * reached the maximum weight and lie at least the truncation distance in
+   * front of any surface. Free space updates can't change these voxels any
+   * more. It is maintained by the TSDF integrators, which only count voxels
+   * that saturate through their updates, so it never overestimates the actual
+   * number. Code that modifies the voxels directly has to reset it.
+   */
+  int num_saturated_free_voxels() const {
+    return num_saturated_free_voxels_.load(std::memory_order_relaxed);
+  }
+  bool isSaturatedFreeSpace() const {
+    return num_saturated_free_voxels() == static_cast<int>(num_voxels_);
+  }
+  /// Thread safe.
+  void updateNumSaturatedFreeVoxels(const int change) {
+    num_saturated_free_voxels_.fetch_add(change, std::memory_order_relaxed);
+  }
+  void resetNumSaturatedFreeVoxels() {
+    num_saturated_free_voxels_.store(0, std::memory_order_relaxed);
+  }
+
+  /**
+   * Version of the layer that may write to this block in place. Any other
+   * layer holding it shares it with a snapshot and has to copy it first, see
+   * Layer::getSnapshot().
+   */
+  uint64_t writable_version() const { return writable_version_; }
+  void set_writable_version(uint64_t version) { writable_version_ = version; }
+
   // Serialization.
   void getProto(BlockProto* proto) const;
   void serializeToIntegers(std::vector<uint32_t>* data) const;
@@ -212,6 +342,16 @@ class Block {
 
   /// Is set to true when data is updated.
   std::bitset<Update::kCount> updated_;
+
+  /// Which sub-bricks were updated, per update type. See getUpdatedSubBricks.
+  std::atomic<SubBrickMask> updated_sub_bricks_[Update::kCount];
+  size_t sub_brick_voxels_per_side_;
+
+  /// See num_saturated_free_voxels().
+  std::atomic<int> num_saturated_free_voxels_;
+
+  /// See writable_version().
+  uint64_t writable_version_;
 };
 
 }  // namespace voxblox
@@ -9,6 +9,12 @@
 
 namespace voxblox {
 
+template <typename VoxelType>
+constexpr size_t Block<VoxelType>::kSubBricksPerSide;
+template <typename VoxelType>
+constexpr typename Block<VoxelType>::SubBrickMask
+    Block<VoxelType>::kAllSubBricks;
+
 template <typename VoxelType>
 size_t Block<VoxelType>::computeLinearIndexFromVoxelIndex(
     const VoxelIndex& index) const {
@@ -70,6 +76,22 @@ bool Block<VoxelType>::isValidVoxelIndex(const VoxelIndex& index) const {
   return true;
 }
 
+template <typename VoxelType>
+Block<VoxelType>::Block(const Block& other)
+    : Block(other.voxels_per_side_, other.voxel_size_, other.origin_) {
+  has_data_ = other.has_data_;
+  updated_ = other.updated_;
+  for (size_t status = 0u; status < Update::kCount; ++status) {
+    updated_sub_bricks_[status].store(
+        other.updated_sub_bricks_[status].load(std::memory_order_relaxed),
+        std::memory_order_relaxed);
+  }
+  num_saturated_free_voxels_.store(other.num_saturated_free_voxels(),
+                                   std::memory_order_relaxed);
+  std::copy(other.voxels_.get(), other.voxels_.get() + num_voxels_,
+            voxels_.get());
+}
+
 template <typename VoxelType>
 Block<VoxelType>::Block(const BlockProto& proto)
     : Block(proto.voxels_per_side(), proto.voxel_size(),
@@ -117,7 +139,9 @@ void Block<VoxelType>::mergeBlock(const Block<VoxelType>& other_block) {
     return;
   } else {
     has_data() = true;
-    updated().set();
+    setAllVoxelsUpdated();
+    // The merged voxels are not tracked by the free space summary.
+    resetNumSaturatedFreeVoxels();
 
     for (IndexElement voxel_idx = 0;
          voxel_idx < static_cast<IndexElement>(num_voxels()); ++voxel_idx) {
@@ -128,6 +152,41 @@ void Block<VoxelType>::mergeBlock(const Block<VoxelType>& other_block) {
   }
 }
 
+template <typename VoxelType>
+void Block<VoxelType>::getLinearIndicesOfSubBricks(
+    const SubBrickMask mask, std::vector<size_t>* linear_indices) const {
+  CHECK_NOTNULL(linear_indices);
+  linear_indices->clear();
+  if (mask == 0u) {
+    return;
+  }
+
+  const size_t num_sub_bricks_x = num_sub_bricks_per_side();
+  // Iterate in z-y-x order, so the indices come out sorted.
+  for (size_t z = 0u; z < voxels_per_side_; ++z) {
+    const size_t sub_brick_z = z / sub_brick_voxels_per_side_;
+    for (size_t y = 0u; y < voxels_per_side_; ++y) {
+      const size_t sub_brick_y = y / sub_brick_voxels_per_side_;
+      const size_t row_sub_brick_index =
+          kSubBricksPerSide * (sub_brick_y + kSubBricksPerSide * sub_brick_z);
+      const size_t row_linear_index =
+          voxels_per_side_ * (y + voxels_per_side_ * z);
+      for (size_t sub_brick_x = 0u; sub_brick_x < num_sub_bricks_x;
+           ++sub_brick_x) {
+        if ((mask >> (row_sub_brick_index + sub_brick_x) & 1u) == 0u) {
+          continue;
+        }
+        const size_t x_begin = sub_brick_x * sub_brick_voxels_per_side_;
+        const size_t x_end =
+            std::min(x_begin + sub_brick_voxels_per_side_, voxels_per_side_);
+        for (size_t x = x_begin; x < x_end; ++x) {
+          linear_indices->push_back(row_linear_index + x);
+        }
+      }
+    }
+  }
+}
+
 template <typename VoxelType>
 size_t Block<VoxelType>::getMemorySize() const {
   size_t size = 0u;
@@ -142,6 +201,9 @@ size_t Block<VoxelType>::getMemorySize() const {
 
   size += sizeof(has_data_);
   size += sizeof(updated_);
+  size += sizeof(num_saturated_free_voxels_);
+  size += sizeof(updated_sub_bricks_);
+  size += sizeof(sub_brick_voxels_per_side_);
 
   if (num_voxels_ > 0u) {
     size += (num_voxels_ * sizeof(voxels_[0]));
@@ -0,0 +1,119 @@
+#ifndef VOXBLOX_CORE_BLOCK_QUERY_CACHE_H_
+#define VOXBLOX_CORE_BLOCK_QUERY_CACHE_H_
+
+#include <cstdint>
+
+#include "voxblox/core/block.h"
+#include "voxblox/core/common.h"
+#include "voxblox/core/layer.h"
+
+namespace voxblox {
+
+/**
+ * Remembers the last few blocks looked up in layers of the voxel type, so
+ * queries close to each other cost an array compare instead of a hash map
+ * lookup. An entry is only used while the epoch of its layer is the one it
+ * was looked up at, so blocks removed from the layer since are never
+ * returned. The entries hold on to their blocks, which stay alive until they
+ * are evicted even if the layer drops them.
+ *
+ * Not thread safe, every thread should use its own, e.g. the one from
+ * getThreadLocal(). Queries that miss are not cached, so blocks allocated in
+ * the meantime are always found.
+ */
+template <typename VoxelType>
+class BlockQueryCache {
+ public:
+  static constexpr size_t kNumEntries = 8u;
+
+  BlockQueryCache() : next_entry_(0u), last_hit_(0u) {}
+
+  /// The cache of the calling thread.
+  static BlockQueryCache& getThreadLocal() {
+    static thread_local BlockQueryCache cache;
+    return cache;
+  }
+
+  /// Same as Layer::getBlockPtrByIndex().
+  typename Block<VoxelType>::ConstPtr getBlockPtrByIndex(
+      const Layer<VoxelType>& layer, const BlockIndex& index) {
+    const uint64_t epoch = layer.epoch();
+    // Consecutive queries most likely hit the same block again.
+    if (isHit(entries_[last_hit_], layer, epoch, index)) {
+      return entries_[last_hit_].block;
+    }
+    for (size_t i = 0u; i < kNumEntries; ++i) {
+      if (isHit(entries_[i], layer, epoch, index)) {
+        last_hit_ = i;
+        return entries_[i].block;
+      }
+    }
+
+    typename Block<VoxelType>::ConstPtr block =
+        layer.getBlockPtrByIndex(index);
+    if (block) {
+      Entry& entry = entries_[next_entry_];
+      entry.layer = &layer;
+      entry.epoch = epoch;
+      entry.index = index;
+      entry.block = block;
+      last_hit_ = next_entry_;
+      next_entry_ = (next_entry_ + 1u) % kNumEntries;
+    }
+    return block;
+  }
+
+  /// Same as Layer::getBlockPtrByCoordinates().
+  typename Block<VoxelType>::ConstPtr getBlockPtrByCoordinates(
+      const Layer<VoxelType>& layer, const Point& coords) {
+    return getBlockPtrByIndex(layer,
+                              layer.computeBlockIndexFromCoordinates(coords));
+  }
+
+  /// Same as Layer::getVoxelPtrByCoordinates().
+  const VoxelType* getVoxelPtrByCoordinates(const Layer<VoxelType>& layer,
+                                            const Point& coords) {
+    typename Block<VoxelType>::ConstPtr block =
+        getBlockPtrByCoordinates(layer, coords);
+    if (!block) {
+      return nullptr;
+    }
+    return block->getVoxelPtrByCoordinates(coords);
+  }
+
+  /// Drops all entries, releasing their blocks.
+  void clear() {
+    for (Entry& entry : entries_) {
+      entry = Entry();
+    }
+  }
+
+ private:
+  struct Entry {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    Entry() : layer(nullptr), epoch(0u), index(BlockIndex::Zero()) {}
+
+    const Layer<VoxelType>* layer;
+    uint64_t epoch;
+    BlockIndex index;
+    typename Block<VoxelType>::ConstPtr block;
+  };
+
+  static bool isHit(const Entry& entry, const Layer<VoxelType>& layer,
+                    const uint64_t epoch, const BlockIndex& index) {
+    return entry.layer == &layer && entry.index == index &&
+           entry.epoch == epoch;
+  }
+
+  Entry entries_[kNumEntries];
+  size_t next_entry_;
+  size_t last_hit_;
+};
+
+template <typename VoxelType>
+constexpr size_t BlockQueryCache<VoxelType>::kNumEntries;
+
+}  // namespace voxblox
+
+#endif  // VOXBLOX_CORE_BLOCK_QUERY_CACHE_H_
@@ -4,14 +4,17 @@
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <glog/logging.h>
 
+#include "voxblox/core/block_query_cache.h"
 #include "voxblox/core/common.h"
 #include "voxblox/core/layer.h"
 #include "voxblox/core/voxel.h"
 #include "voxblox/interpolator/interpolator.h"
 #include "voxblox/io/layer_io.h"
+#include "voxblox/utils/thread_pool.h"
 
 namespace voxblox {
 /**
@@ -29,13 +32,45 @@ class EsdfMap {
 
     FloatingPoint esdf_voxel_size = 0.2;
     size_t esdf_voxels_per_side = 16u;
+
+    /**
+     * If non-zero, the map also holds a coarse ESDF layer for far-field
+     * distances, with voxels this many times larger along each axis. See
+     * EsdfCoarseIntegrator.
+     */
+    size_t esdf_coarse_downsampling = 0u;
+    /**
+     * Distances at or above this are looked up in the coarse layer, should
+     * be the max distance of the ESDF integrator of the fine layer.
+     */
+    FloatingPoint esdf_coarse_fallback_distance_m = 2.0;
+
+    /// Number of threads answering the batch queries.
+    size_t batch_query_threads = 1u;
+
+    /**
+     * How the interpolated gradients are computed. With kTricubic the
+     * interpolated distances are tricubic as well, to match the gradients.
+     */
+    GradientMethod gradient_method = GradientMethod::kCentralDifferences;
   };
 
   explicit EsdfMap(const Config& config)
       : esdf_layer_(new Layer<EsdfVoxel>(config.esdf_voxel_size,
                                          config.esdf_voxels_per_side)),
-        interpolator_(esdf_layer_.get()) {
+        interpolator_(esdf_layer_.get()),
+        coarse_fallback_distance_(config.esdf_coarse_fallback_distance_m),
+        batch_query_threads_(config.batch_query_threads),
+        gradient_method_(config.gradient_method) {
     block_size_ = config.esdf_voxel_size * config.esdf_voxels_per_side;
+    resetBatchThreadPool();
+    if (config.esdf_coarse_downsampling > 0u) {
+      coarse_esdf_layer_.reset(new Layer<EsdfVoxel>(
+          config.esdf_voxel_size * config.esdf_coarse_downsampling,
+          config.esdf_voxels_per_side));
+      coarse_interpolator_.reset(
+          new Interpolator<EsdfVoxel>(coarse_esdf_layer_.get()));
+    }
   }
 
   /// Creates a new EsdfMap based on a COPY of this layer.
@@ -44,7 +79,11 @@ class EsdfMap {
 
   /// Creates a new EsdfMap that contains this layer.
   explicit EsdfMap(Layer<EsdfVoxel>::Ptr layer)
-      : esdf_layer_(layer), interpolator_(CHECK_NOTNULL(esdf_layer_.get())) {
+      : esdf_layer_(layer),
+        interpolator_(CHECK_NOTNULL(esdf_layer_.get())),
+        coarse_fallback_distance_(0.0),
+        batch_query_threads_(1u),
+        gradient_method_(GradientMethod::kCentralDifferences) {
     block_size_ = layer->block_size();
   }
 
@@ -57,6 +96,31 @@ class EsdfMap {
 
   const Layer<EsdfVoxel>& getEsdfLayer() const { return *esdf_layer_; }
 
+  /// The coarse far-field layer, nullptr if the map has none.
+  Layer<EsdfVoxel>* getCoarseEsdfLayerPtr() { return coarse_esdf_layer_.get(); }
+  const Layer<EsdfVoxel>* getCoarseEsdfLayerConstPtr() const {
+    return coarse_esdf_layer_.get();
+  }
+  bool hasCoarseEsdfLayer() const { return coarse_esdf_layer_ != nullptr; }
+
+  /**
+   * Returns a map with snapshots of the layers and the same settings, for
+   * queries that should neither wait for nor see later updates of this map.
+   * See Layer::getSnapshot().
+   */
+  Ptr getSnapshot();
+
+  size_t batch_query_threads() const { return batch_query_threads_; }
+  void setBatchQueryThreads(size_t batch_query_threads) {
+    batch_query_threads_ = batch_query_threads;
+    resetBatchThreadPool();
+  }
+
+  GradientMethod gradient_method() const { return gradient_method_; }
+  void setGradientMethod(GradientMethod gradient_method) {
+    gradient_method_ = gradient_method;
+  }
+
   FloatingPoint block_size() const { return block_size_; }
   FloatingPoint voxel_size() const { return esdf_layer_->voxel_size(); }
 
@@ -66,6 +130,9 @@ class EsdfMap {
    * These accessors use Vector3d and doubles explicitly rather than
    * FloatingPoint to have a standard, cast-free interface to planning
    * functions.
+   * With a coarse layer, positions that are unknown in the ESDF layer or
+   * further than the fallback distance from the surfaces get their distance
+   * (and gradient) from the coarse layer instead.
    */
   bool getDistanceAtPosition(const Eigen::Vector3d& position,
                              double* distance) const;
@@ -89,7 +156,9 @@ class EsdfMap {
   template <typename MatrixType>
   using EigenDRef = Eigen::Ref<MatrixType, 0, EigenDStride>;
 
-  // Convenience functions for querying many points at once from Python
+  // Convenience functions for querying many points at once from Python.
+  // The queries are answered by Interpolator::batchGetDistanceAndGradient(),
+  // with the same results as the single queries.
   void batchGetDistanceAtPosition(
       EigenDRef<const Eigen::Matrix<double, 3, Eigen::Dynamic>>& positions,
       Eigen::Ref<Eigen::VectorXd> distances,
@@ -120,6 +189,26 @@ class EsdfMap {
       Eigen::Ref<Eigen::VectorXd> distances, unsigned int max_points) const;
 
  protected:
+  /**
+   * Batch queries of the interpolated distances and optionally gradients,
+   * with the fallback to the coarse layer of the single queries.
+   */
+  void batchGetDistanceAndGradient(const Pointcloud& positions,
+                                   std::vector<FloatingPoint>* distances,
+                                   Pointcloud* gradients,
+                                   std::vector<uint8_t>* success) const;
+
+  /// Single interpolated or nearest query of one of the layers.
+  bool getDistanceAndGradient(const Interpolator<EsdfVoxel>& interpolator,
+                              const Point& position, bool interpolate,
+                              FloatingPoint* distance, Point* gradient) const;
+
+  void resetBatchThreadPool() {
+    batch_thread_pool_.reset(batch_query_threads_ > 1u
+                                 ? new ThreadPool(batch_query_threads_)
+                                 : nullptr);
+  }
+
   FloatingPoint block_size_;
 
   // The layers.
@@ -127,6 +216,20 @@ class EsdfMap {
 
   // Interpolator for the layer.
   Interpolator<EsdfVoxel> interpolator_;
+
+  // The optional coarse layer for far-field distances, and its interpolator.
+  Layer<EsdfVoxel>::Ptr coarse_esdf_layer_;
+  std::unique_ptr<Interpolator<EsdfVoxel>> coarse_interpolator_;
+  FloatingPoint coarse_fallback_distance_;
+
+  size_t batch_query_threads_;
+  /**
+   * The threads of the batch queries, started once instead of for every
+   * query and shared with the snapshots. Batch queries from several threads
+   * take turns on it. nullptr if the queries run on the calling thread only.
+   */
+  std::shared_ptr<ThreadPool> batch_thread_pool_;
+  GradientMethod gradient_method_;
 };
 
 }  // namespace voxblox
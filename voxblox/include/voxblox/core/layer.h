@@ -1,7 +1,12 @@
 #ifndef VOXBLOX_CORE_LAYER_H_
 #define VOXBLOX_CORE_LAYER_H_
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
 
@@ -13,6 +18,7 @@
 #include "voxblox/core/block_hash.h"
 #include "voxblox/core/common.h"
 #include "voxblox/core/voxel.h"
+#include "voxblox/utils/approx_hash_array.h"
 
 namespace voxblox {
 
@@ -30,9 +36,14 @@ class Layer {
   typedef
       typename AnyIndexHashMapType<typename BlockType::Ptr>::type BlockHashMap;
   typedef typename std::pair<BlockIndex, typename BlockType::Ptr> BlockMapPair;
+  typedef typename BlockType::SubBrickMask SubBrickMask;
 
   explicit Layer(FloatingPoint voxel_size, size_t voxels_per_side)
-      : voxel_size_(voxel_size), voxels_per_side_(voxels_per_side) {
+      : voxel_size_(voxel_size),
+        voxels_per_side_(voxels_per_side),
+        version_(getNewEpoch()),
+        num_shared_blocks_(0u),
+        epoch_(getNewEpoch()) {
     CHECK_GT(voxel_size_, 0.0f);
     voxel_size_inv_ = 1.0 / voxel_size_;
 
@@ -58,7 +69,7 @@ class Layer {
     if (it == block_map_.end()) {
       LOG(FATAL) << "Accessed unallocated block at " << index.transpose();
     }
-    return *(it->second);
+    return *getBlockPtr(it);
   }
 
   inline BlockType& getBlockByIndex(const BlockIndex& index) {
@@ -66,14 +77,14 @@ class Layer {
     if (it == block_map_.end()) {
       LOG(FATAL) << "Accessed unallocated block at " << index.transpose();
     }
-    return *(it->second);
+    return *getWritableBlockPtr(it);
   }
 
   inline typename BlockType::ConstPtr getBlockPtrByIndex(
       const BlockIndex& index) const {
     typename BlockHashMap::const_iterator it = block_map_.find(index);
     if (it != block_map_.end()) {
-      return it->second;
+      return getBlockPtr(it);
     } else {
       return typename BlockType::ConstPtr();
     }
@@ -82,7 +93,7 @@ class Layer {
   inline typename BlockType::Ptr getBlockPtrByIndex(const BlockIndex& index) {
     typename BlockHashMap::iterator it = block_map_.find(index);
     if (it != block_map_.end()) {
-      return it->second;
+      return getWritableBlockPtr(it);
     } else {
       return typename BlockType::Ptr();
     }
@@ -96,7 +107,7 @@ class Layer {
       const BlockIndex& index) {
     typename BlockHashMap::iterator it = block_map_.find(index);
     if (it != block_map_.end()) {
-      return it->second;
+      return getWritableBlockPtr(it);
     } else {
       return allocateNewBlock(index);
     }
@@ -141,6 +152,7 @@ class Layer {
 
     DCHECK(insert_status.first->second);
     DCHECK_EQ(insert_status.first->first, index);
+    insert_status.first->second->set_writable_version(version_);
     return insert_status.first->second;
   }
 
@@ -149,6 +161,7 @@ class Layer {
     return allocateNewBlock(computeBlockIndexFromCoordinates(coords));
   }
 
+  /// The layer takes over the block, which must not be in any other layer.
   inline void insertBlock(
       const std::pair<const BlockIndex, typename Block<VoxelType>::Ptr>&
           block_pair) {
@@ -158,13 +171,27 @@ class Layer {
                                  << insert_status.first->first.transpose();
 
     DCHECK(insert_status.first->second);
+    insert_status.first->second->set_writable_version(version_);
   }
 
-  void removeBlock(const BlockIndex& index) { block_map_.erase(index); }
-  void removeAllBlocks() { block_map_.clear(); }
+  void removeBlock(const BlockIndex& index) {
+    typename BlockHashMap::iterator it = block_map_.find(index);
+    if (it != block_map_.end()) {
+      releaseBlock(*it->second);
+      block_map_.erase(it);
+      detached_updates_.erase(index);
+      invalidateEpoch();
+    }
+  }
+  void removeAllBlocks() {
+    block_map_.clear();
+    detached_updates_.clear();
+    num_shared_blocks_.store(0u, std::memory_order_release);
+    invalidateEpoch();
+  }
 
   void removeBlockByCoordinates(const Point& coords) {
-    block_map_.erase(computeBlockIndexFromCoordinates(coords));
+    removeBlock(computeBlockIndexFromCoordinates(coords));
   }
 
   void removeDistantBlocks(const Point& center, const double max_distance) {
@@ -177,7 +204,7 @@ class Layer {
       }
     }
     for (const BlockIndex& index : needs_erasing) {
-      block_map_.erase(index);
+      removeBlock(index);
     }
   }
 
@@ -191,19 +218,83 @@ class Layer {
     }
   }
 
+  /// The blocks with the update flag set, see getUpdatedSubBricks().
   void getAllUpdatedBlocks(Update::Status bit, BlockIndexList* blocks) const {
     CHECK_NOTNULL(blocks);
     blocks->clear();
     for (const std::pair<const BlockIndex, typename BlockType::Ptr>& kv :
          block_map_) {
-      if (kv.second->updated()[bit]) {
+      if (kv.second->updated()[bit] ||
+          getDetachedUpdatedSubBricks(kv.first, bit) != 0u) {
         blocks->emplace_back(kv.first);
       }
     }
   }
 
+  /**
+   * The sub-bricks of the block that were updated since its flag was last
+   * reset, see Block::getUpdatedSubBricks(). Unlike the flags of the block
+   * itself this includes the flags getSnapshot() took out of it, so code
+   * that may run on a layer with snapshots has to use this and
+   * resetUpdated() of the layer.
+   */
+  SubBrickMask getUpdatedSubBricks(const BlockIndex& index,
+                                   const Update::Status status) const {
+    SubBrickMask mask = getDetachedUpdatedSubBricks(index, status);
+    typename BlockHashMap::const_iterator it = block_map_.find(index);
+    if (it != block_map_.end()) {
+      mask |= getBlockPtr(it)->getUpdatedSubBricks(status);
+    }
+    return mask;
+  }
+
+  /**
+   * Clears the update flag of the block. Blocks shared with a snapshot hold
+   * no flags, so this never copies them.
+   */
+  void resetUpdated(const BlockIndex& index, const Update::Status status) {
+    typename UpdateMaskMap::iterator update_it = detached_updates_.find(index);
+    if (update_it != detached_updates_.end()) {
+      UpdateMasks& masks = update_it->second;
+      masks[status] = 0u;
+      if (std::all_of(masks.begin(), masks.end(),
+                      [](const SubBrickMask mask) { return mask == 0u; })) {
+        detached_updates_.erase(update_it);
+      }
+    }
+    typename BlockHashMap::iterator it = block_map_.find(index);
+    if (it != block_map_.end() && getBlockPtr(it)->updated()[status]) {
+      getWritableBlockPtr(it)->resetUpdated(status);
+    }
+  }
+
   size_t getNumberOfAllocatedBlocks() const { return block_map_.size(); }
 
+  /**
+   * Changes whenever a block is removed from the layer or replaced, so
+   * anything holding on to the blocks it looked up can tell whether they
+   * are still the ones in the layer. Unique across all layers of the voxel
+   * type, see BlockQueryCache.
+   */
+  uint64_t epoch() const { return epoch_.load(std::memory_order_acquire); }
+
+  /**
+   * Returns a copy of the layer that shares all blocks with it, which is
+   * cheap as no voxels are copied. Blocks shared by the two layers are copied
+   * the first time either layer hands them out for writing, so the snapshot
+   * keeps the current state of the layer while integration continues on this
+   * one, and readers of the snapshot never wait for the integration.
+   * Must not be called while other threads access this layer. Block pointers
+   * obtained for writing before must not be written to afterwards. Reading
+   * the layers from multiple threads while blocks are written is as safe as
+   * it was without snapshots.
+   *
+   * The update flags are moved out of the blocks into both layers before
+   * they are shared, so clearing them afterwards, e.g. once a snapshot was
+   * meshed, doesn't copy the blocks. See getUpdatedSubBricks().
+   */
+  Ptr getSnapshot();
+
   bool hasBlock(const BlockIndex& block_index) const {
     return block_map_.count(block_index) > 0;
   }
@@ -292,7 +383,60 @@ class Layer {
 
   std::string getType() const;
 
+  static uint64_t getNewEpoch() {
+    static std::atomic<uint64_t> next_epoch(1u);
+    return next_epoch.fetch_add(1u, std::memory_order_relaxed);
+  }
+  void invalidateEpoch() {
+    epoch_.store(getNewEpoch(), std::memory_order_release);
+  }
+
+  /**
+   * Returns the block of the map entry. While blocks are shared with a
+   * snapshot the entry can be replaced by a concurrent writer, so it is only
+   * read under the lock of the block then.
+   */
+  typename BlockType::Ptr getBlockPtr(
+      typename BlockHashMap::const_iterator it) const;
+  /// Same, but first replaces the block with a copy if it is shared.
+  typename BlockType::Ptr getWritableBlockPtr(
+      typename BlockHashMap::iterator it);
+  /// Updates the shared block count for a block leaving the map.
+  void releaseBlock(const BlockType& block) {
+    if (block.writable_version() != version_) {
+      num_shared_blocks_.fetch_sub(1u, std::memory_order_release);
+    }
+  }
+
+  /// The update flags of a block, as masks of updated sub-bricks.
+  typedef std::array<SubBrickMask, Update::kCount> UpdateMasks;
+  typedef typename AnyIndexHashMapType<UpdateMasks>::type UpdateMaskMap;
+
+  SubBrickMask getDetachedUpdatedSubBricks(const BlockIndex& index,
+                                           const Update::Status status) const {
+    if (detached_updates_.empty()) {
+      return 0u;
+    }
+    typename UpdateMaskMap::const_iterator it = detached_updates_.find(index);
+    return (it == detached_updates_.end()) ? 0u : it->second[status];
+  }
+
   BlockHashMap block_map_;
+  /**
+   * Update flags that getSnapshot() took out of the blocks, as a non-zero
+   * mask per flag that is set.
+   */
+  UpdateMaskMap detached_updates_;
+
+  /// Blocks of other versions are shared with snapshots, see getSnapshot().
+  uint64_t version_;
+  /// Number of blocks in the map that are not of this version.
+  std::atomic<size_t> num_shared_blocks_;
+  /// Guard the map entries of shared blocks, by block index.
+  mutable ApproxHashArray<6, std::mutex, BlockIndex, AnyIndexHash>
+      block_mutexes_;
+
+  std::atomic<uint64_t> epoch_;
 };
 
 }  // namespace voxblox
@@ -3,6 +3,7 @@
 
 #include <fstream>  // NOLINT
 #include <limits>
+#include <mutex>
 #include <string>
 #include <utility>
 
@@ -24,7 +25,10 @@ namespace voxblox {
 template <typename VoxelType>
 Layer<VoxelType>::Layer(const LayerProto& proto)
     : voxel_size_(proto.voxel_size()),
-      voxels_per_side_(proto.voxels_per_side()) {
+      voxels_per_side_(proto.voxels_per_side()),
+      version_(getNewEpoch()),
+      num_shared_blocks_(0u),
+      epoch_(getNewEpoch()) {
   CHECK_EQ(getType().compare(proto.type()), 0)
       << "Incorrect voxel type, proto type: " << proto.type()
       << " layer type: " << getType();
@@ -52,7 +56,8 @@ void Layer<VoxelType>::getProto(LayerProto* proto) const {
 }
 
 template <typename VoxelType>
-Layer<VoxelType>::Layer(const Layer& other) {
+Layer<VoxelType>::Layer(const Layer& other)
+    : version_(getNewEpoch()), num_shared_blocks_(0u), epoch_(getNewEpoch()) {
   voxel_size_ = other.voxel_size_;
   voxel_size_inv_ = other.voxel_size_inv_;
   voxels_per_side_ = other.voxels_per_side_;
@@ -60,10 +65,10 @@ Layer<VoxelType>::Layer(const Layer& other) {
   block_size_ = other.block_size_;
   block_size_inv_ = other.block_size_inv_;
 
-  for (const typename BlockHashMap::value_type& key_value_pair :
-       other.block_map_) {
-    const BlockIndex& block_idx = key_value_pair.first;
-    const typename BlockType::Ptr& block_ptr = key_value_pair.second;
+  for (typename BlockHashMap::const_iterator it = other.block_map_.begin();
+       it != other.block_map_.end(); ++it) {
+    const BlockIndex& block_idx = it->first;
+    const typename BlockType::Ptr block_ptr = other.getBlockPtr(it);
     CHECK(block_ptr);
 
     typename BlockType::Ptr new_block = allocateBlockPtrByIndex(block_idx);
@@ -188,6 +193,63 @@ bool Layer<VoxelType>::saveBlocksToStream(bool include_all_blocks,
   return true;
 }
 
+template <typename VoxelType>
+typename Layer<VoxelType>::Ptr Layer<VoxelType>::getSnapshot() {
+  // Blocks with update flags were written since the last snapshot, so they
+  // aren't shared yet.
+  for (const typename BlockHashMap::value_type& pair : block_map_) {
+    BlockType& block = *pair.second;
+    if (block.updated().none()) {
+      continue;
+    }
+    UpdateMasks& masks = detached_updates_[pair.first];
+    for (size_t status = 0u; status < Update::kCount; ++status) {
+      masks[status] |=
+          block.getUpdatedSubBricks(static_cast<Update::Status>(status));
+      block.resetUpdated(static_cast<Update::Status>(status));
+    }
+  }
+
+  Ptr snapshot = aligned_shared<Layer>(voxel_size_, voxels_per_side_);
+  snapshot->block_map_ = block_map_;
+  snapshot->detached_updates_ = detached_updates_;
+  snapshot->num_shared_blocks_.store(block_map_.size(),
+                                     std::memory_order_release);
+
+  // None of the blocks is of the new version, so this layer copies them
+  // before writing from now on.
+  version_ = getNewEpoch();
+  num_shared_blocks_.store(block_map_.size(), std::memory_order_release);
+  return snapshot;
+}
+
+template <typename VoxelType>
+typename Layer<VoxelType>::BlockType::Ptr Layer<VoxelType>::getBlockPtr(
+    typename BlockHashMap::const_iterator it) const {
+  if (num_shared_blocks_.load(std::memory_order_acquire) == 0u) {
+    return it->second;
+  }
+  std::lock_guard<std::mutex> lock(block_mutexes_.get(it->first));
+  return it->second;
+}
+
+template <typename VoxelType>
+typename Layer<VoxelType>::BlockType::Ptr
+Layer<VoxelType>::getWritableBlockPtr(typename BlockHashMap::iterator it) {
+  if (num_shared_blocks_.load(std::memory_order_acquire) == 0u) {
+    return it->second;
+  }
+  std::lock_guard<std::mutex> lock(block_mutexes_.get(it->first));
+  typename BlockType::Ptr& block = it->second;
+  if (block->writable_version() != version_) {
+    block = std::make_shared<BlockType>(*block);
+    block->set_writable_version(version_);
+    num_shared_blocks_.fetch_sub(1u, std::memory_order_release);
+    invalidateEpoch();
+  }
+  return block;
+}
+
 template <typename VoxelType>
 bool Layer<VoxelType>::addBlockFromProto(const BlockProto& block_proto,
                                          BlockMergingStrategy strategy) {
@@ -196,6 +258,7 @@ bool Layer<VoxelType>::addBlockFromProto(const BlockProto& block_proto,
 
   if (isCompatible(block_proto)) {
     typename BlockType::Ptr block_ptr(new BlockType(block_proto));
+    block_ptr->set_writable_version(version_);
     const BlockIndex block_index = getGridIndexFromOriginPoint<BlockIndex>(
         block_ptr->origin(), block_size_inv_);
     switch (strategy) {
@@ -205,6 +268,7 @@ bool Layer<VoxelType>::addBlockFromProto(const BlockProto& block_proto,
         block_map_[block_index] = block_ptr;
         break;
       case BlockMergingStrategy::kReplace:
+        removeBlock(block_index);
         block_map_[block_index] = block_ptr;
         break;
       case BlockMergingStrategy::kDiscard:
@@ -215,7 +279,7 @@ bool Layer<VoxelType>::addBlockFromProto(const BlockProto& block_proto,
         if (it == block_map_.end()) {
           block_map_[block_index] = block_ptr;
         } else {
-          it->second->mergeBlock(*block_ptr);
+          getWritableBlockPtr(it)->mergeBlock(*block_ptr);
         }
       } break;
       default:
@@ -224,7 +288,7 @@ bool Layer<VoxelType>::addBlockFromProto(const BlockProto& block_proto,
         return false;
     }
     // Mark that this block has been updated.
-    block_map_[block_index]->updated().set();
+    getBlockPtrByIndex(block_index)->setAllVoxelsUpdated();
   } else {
     LOG(ERROR)
         << "The blocks from this protobuf are not compatible with this layer!";
@@ -67,6 +67,11 @@ class TsdfMap {
   }
   const Layer<TsdfVoxel>& getTsdfLayer() const { return *tsdf_layer_; }
 
+  /// Returns a map with a snapshot of the layer, see Layer::getSnapshot().
+  Ptr getSnapshot() {
+    return aligned_shared<TsdfMap>(tsdf_layer_->getSnapshot());
+  }
+
   FloatingPoint block_size() const { return block_size_; }
   FloatingPoint voxel_size() const { return tsdf_layer_->voxel_size(); }
 
@@ -16,26 +16,34 @@ struct TsdfVoxel {
 };
 
 struct EsdfVoxel {
+  /// Offset from a voxel to its parent, in voxels.
+  typedef Eigen::Matrix<int8_t, 3, 1> ParentOffset;
+
+  EsdfVoxel()
+      : observed(false), hallucinated(false), in_queue(false), fixed(false) {}
+
   float distance = 0.0f;
 
-  bool observed = false;
   /**
-   * Whether the voxel was copied from the TSDF (false) or created from a pose
-   * or some other source (true). This member is not serialized!!!
+   * Relative direction toward parent. If itself, then either uninitialized
+   * or in the fixed frontier. Only 8 bits per axis are stored, see
+   * EsdfIntegrator::propagateToNeighbor() for parents that are further away.
    */
-  bool hallucinated = false;
-  bool in_queue = false;
-  bool fixed = false;
+  ParentOffset parent = ParentOffset::Zero();
 
+  // The flags are packed into a single byte, to fit the voxel into 8 bytes.
+  bool observed : 1;
   /**
-   * Relative direction toward parent. If itself, then either uninitialized
-   * or in the fixed frontier.
+   * Whether the voxel was copied from the TSDF (false) or created from a pose
+   * or some other source (true). This member is not serialized!!!
    */
-  Eigen::Vector3i parent = Eigen::Vector3i::Zero();
-
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  bool hallucinated : 1;
+  bool in_queue : 1;
+  bool fixed : 1;
 };
 
+static_assert(sizeof(EsdfVoxel) == 8u, "EsdfVoxel should be packed.");
+
 struct OccupancyVoxel {
   float probability_log = 0.0f;
   bool observed = false;
@@ -0,0 +1,179 @@
+#ifndef VOXBLOX_INTEGRATOR_BLOCK_OPEN_SETS_H_
+#define VOXBLOX_INTEGRATOR_BLOCK_OPEN_SETS_H_
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "voxblox/core/block_hash.h"
+#include "voxblox/core/common.h"
+#include "voxblox/core/layer.h"
+#include "voxblox/utils/bucket_queue.h"
+#include "voxblox/utils/thread_pool.h"
+
+namespace voxblox {
+
+/**
+ * An open set of a wavefront propagation, split by block so the blocks can
+ * be propagated in parallel rounds. Each round propagates the lowest bucket
+ * over all block queues, so few voxels are propagated before their final
+ * distance is known. The updates that cross a block border are collected
+ * during a round and exchanged after it, in a fixed order, so the result
+ * doesn't depend on the number of threads.
+ *
+ * NeighborUpdateType is what a block sends to a voxel of a neighboring block,
+ * it needs a GlobalIndex neighbor_index. StatsType is the per block state of
+ * the propagation, e.g. counts for logging.
+ */
+template <typename VoxelType, typename NeighborUpdateType, typename StatsType>
+class BlockOpenSets {
+ public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  /// The open set of one block.
+  struct BlockOpenSet {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    BlockOpenSet(Block<VoxelType>* _block, int num_buckets, double max_val)
+        : block(_block), queue(num_buckets, max_val), stats() {}
+
+    Block<VoxelType>* block;
+    /// Linear indices of the queued voxels of the block.
+    BucketQueue<size_t> queue;
+    /// Updates of neighboring blocks, exchanged after each round.
+    AlignedVector<NeighborUpdateType> neighbor_updates;
+    StatsType stats;
+  };
+
+  BlockOpenSets(Layer<VoxelType>* layer, int num_buckets, double max_val)
+      : layer_(layer),
+        num_buckets_(num_buckets),
+        max_val_(max_val),
+        num_rounds_(0u) {
+    CHECK_NOTNULL(layer_);
+  }
+
+  /// Queues the voxel, whose block must be allocated, at the distance.
+  void push(const GlobalIndex& global_index, const FloatingPoint distance) {
+    BlockIndex block_index;
+    VoxelIndex voxel_index;
+    getBlockAndVoxelIndexFromGlobalVoxelIndex(
+        global_index, layer_->voxels_per_side(), &block_index, &voxel_index);
+    const std::pair<AnyIndexHashMapType<size_t>::type::iterator, bool> result =
+        block_open_set_indices_.emplace(block_index, block_open_sets_.size());
+    if (result.second) {
+      typename Block<VoxelType>::Ptr block =
+          layer_->getBlockPtrByIndex(block_index);
+      CHECK(block);
+      block_open_sets_.emplace_back(
+          new BlockOpenSet(block.get(), num_buckets_, max_val_));
+    }
+    BlockOpenSet* block_open_set =
+        block_open_sets_[result.first->second].get();
+    block_open_set->queue.push(
+        block_open_set->block->computeLinearIndexFromVoxelIndex(voxel_index),
+        distance);
+  }
+
+  /// Moves the voxels of the open set over, skipping unallocated ones.
+  void pushAll(BucketQueue<GlobalIndex>* open_set) {
+    CHECK_NOTNULL(open_set);
+    while (!open_set->empty()) {
+      const GlobalIndex global_index = open_set->front();
+      open_set->pop();
+      const VoxelType* voxel = layer_->getVoxelPtrByGlobalIndex(global_index);
+      if (voxel != nullptr) {
+        push(global_index, voxel->distance);
+      }
+    }
+  }
+
+  /**
+   * Propagates the open set in rounds until it is empty.
+   * propagate_block(max_bucket_index, block_open_set) propagates the voxels
+   * of a block up to the bucket, updating the voxels inside of the block
+   * directly and collecting the others in neighbor_updates. It runs on the
+   * threads of the pool, each block on one thread only.
+   * relax(update, neighbor_voxel, stats) applies an update to the voxel of
+   * the neighboring block, with the stats of the block that sent it, and
+   * returns whether the voxel needs to be queued. It runs on the calling
+   * thread.
+   */
+  template <typename PropagateBlockFunction, typename RelaxFunction>
+  void process(ThreadPool* thread_pool,
+               const PropagateBlockFunction& propagate_block,
+               const RelaxFunction& relax) {
+    CHECK_NOTNULL(thread_pool);
+    std::vector<BlockOpenSet*> active_block_open_sets;
+    while (true) {
+      int bucket_index = std::numeric_limits<int>::max();
+      for (const std::unique_ptr<BlockOpenSet>& block_open_set :
+           block_open_sets_) {
+        if (!block_open_set->queue.empty()) {
+          bucket_index =
+              std::min(bucket_index, block_open_set->queue.frontBucketIndex());
+        }
+      }
+      if (bucket_index == std::numeric_limits<int>::max()) {
+        break;
+      }
+      active_block_open_sets.clear();
+      for (const std::unique_ptr<BlockOpenSet>& block_open_set :
+           block_open_sets_) {
+        if (!block_open_set->queue.empty() &&
+            block_open_set->queue.frontBucketIndex() <= bucket_index) {
+          active_block_open_sets.push_back(block_open_set.get());
+        }
+      }
+      ++num_rounds_;
+
+      std::atomic<size_t> next_index(0u);
+      thread_pool->run(
+          [&active_block_open_sets, &next_index, &propagate_block,
+           bucket_index]() {
+            size_t i;
+            while ((i = next_index++) < active_block_open_sets.size()) {
+              propagate_block(bucket_index, active_block_open_sets[i]);
+            }
+          },
+          active_block_open_sets.size());
+
+      for (BlockOpenSet* block_open_set : active_block_open_sets) {
+        for (const NeighborUpdateType& update :
+             block_open_set->neighbor_updates) {
+          VoxelType* neighbor_voxel =
+              layer_->getVoxelPtrByGlobalIndex(update.neighbor_index);
+          if (neighbor_voxel != nullptr &&
+              relax(update, neighbor_voxel, &block_open_set->stats)) {
+            push(update.neighbor_index, neighbor_voxel->distance);
+            neighbor_voxel->in_queue = true;
+          }
+        }
+        block_open_set->neighbor_updates.clear();
+      }
+    }
+  }
+
+  const std::vector<std::unique_ptr<BlockOpenSet> >& block_open_sets() const {
+    return block_open_sets_;
+  }
+  size_t num_rounds() const { return num_rounds_; }
+
+ private:
+  Layer<VoxelType>* layer_;
+  int num_buckets_;
+  double max_val_;
+
+  std::vector<std::unique_ptr<BlockOpenSet> > block_open_sets_;
+  AnyIndexHashMapType<size_t>::type block_open_set_indices_;
+  size_t num_rounds_;
+};
+
+}  // namespace voxblox
+
+#endif  // VOXBLOX_INTEGRATOR_BLOCK_OPEN_SETS_H_
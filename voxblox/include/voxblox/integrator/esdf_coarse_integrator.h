@@ -0,0 +1,88 @@
+#ifndef VOXBLOX_INTEGRATOR_ESDF_COARSE_INTEGRATOR_H_
+#define VOXBLOX_INTEGRATOR_ESDF_COARSE_INTEGRATOR_H_
+
+#include <glog/logging.h>
+#include <Eigen/Core>
+
+#include "voxblox/core/layer.h"
+#include "voxblox/core/voxel.h"
+#include "voxblox/integrator/esdf_integrator.h"
+
+namespace voxblox {
+
+/**
+ * Builds the coarse far-field ESDF layer of a multi-resolution ESDF, see
+ * EsdfMap::Config::esdf_coarse_downsampling. The TSDF is downsampled into a
+ * coarse TSDF layer, keeping the observed voxel closest to the surface out of
+ * each group of fine voxels, which is then propagated by its own
+ * EsdfIntegrator. With the coarse voxels, a large max distance costs a
+ * fraction of the memory and time it would take at the TSDF resolution.
+ */
+class EsdfCoarseIntegrator {
+ public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  /**
+   * The config is the one of the coarse ESDF, usually the one of the fine
+   * ESDF with a larger max distance. The coarse voxel size has to be a
+   * multiple of the TSDF voxel size that divides the voxels per side.
+   */
+  EsdfCoarseIntegrator(const EsdfIntegrator::Config& config,
+                       Layer<TsdfVoxel>* tsdf_layer,
+                       Layer<EsdfVoxel>* coarse_esdf_layer);
+
+  /**
+   * Switches the TSDF layer that the next updates downsample, see
+   * EsdfIntegrator::setTsdfLayer().
+   */
+  void setTsdfLayer(Layer<TsdfVoxel>* tsdf_layer);
+
+  /**
+   * Downsamples the TSDF blocks flagged with Update::kCoarseEsdf, clears
+   * their flags and incrementally updates the coarse ESDF. The kEsdf flags
+   * of the fine ESDF are not touched, so this works with a fine ESDF that is
+   * limited to a window around the robot.
+   */
+  void updateFromTsdfLayer();
+
+  /**
+   * Downsamples the whole TSDF, clearing the coarse ESDF and all
+   * Update::kCoarseEsdf flags in the process.
+   */
+  void updateFromTsdfLayerBatch();
+
+  /// Downsamples the given TSDF blocks and updates the coarse ESDF.
+  void updateFromTsdfBlocks(const BlockIndexList& tsdf_blocks,
+                            bool incremental);
+
+  /// Clears the coarse TSDF and the state of the integrator.
+  void clear() {
+    coarse_tsdf_layer_.removeAllBlocks();
+    esdf_integrator_.clear();
+  }
+
+  /// Number of TSDF voxels per coarse voxel, along each axis.
+  size_t downsampling() const { return downsampling_; }
+
+  const Layer<TsdfVoxel>& getCoarseTsdfLayer() const {
+    return coarse_tsdf_layer_;
+  }
+
+ protected:
+  /**
+   * Writes the TSDF block into its part of the coarse TSDF layer, and returns
+   * the index of the coarse block.
+   */
+  BlockIndex downsampleBlock(const Block<TsdfVoxel>& tsdf_block);
+
+  Layer<TsdfVoxel>* tsdf_layer_;
+  float min_weight_;
+  size_t downsampling_;
+
+  Layer<TsdfVoxel> coarse_tsdf_layer_;
+  EsdfIntegrator esdf_integrator_;
+};
+
+}  // namespace voxblox
+
+#endif  // VOXBLOX_INTEGRATOR_ESDF_COARSE_INTEGRATOR_H_
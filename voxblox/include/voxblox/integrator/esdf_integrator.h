@@ -11,8 +11,10 @@
 
 #include "voxblox/core/layer.h"
 #include "voxblox/core/voxel.h"
+#include "voxblox/integrator/block_open_sets.h"
 #include "voxblox/integrator/integrator_utils.h"
 #include "voxblox/utils/bucket_queue.h"
+#include "voxblox/utils/distance_transform.h"
 #include "voxblox/utils/neighbor_tools.h"
 #include "voxblox/utils/timing.h"
 
@@ -75,11 +77,56 @@ class EsdfIntegrator {
      */
     FloatingPoint clear_sphere_radius = 1.5;
     FloatingPoint occupied_sphere_radius = 5.0;
+
+    /**
+     * Number of threads propagating the open set. With more than one, the
+     * open set is split into one queue per block, and the blocks propagate
+     * their voxels in parallel rounds. The updates that cross a block border
+     * are exchanged between the rounds. With a min_diff_m of 0 and quasi
+     * euclidean distances, the result is the same as with one thread.
+     */
+    size_t integrator_threads = 1u;
+
+    /**
+     * Whether batch updates run a euclidean distance transform instead of
+     * propagating the distances through the observed voxels. A voxel gets
+     * the straight-line distance to the closest fixed voxel of the same sign
+     * plus the TSDF distance of that voxel. This approximates the smallest
+     * such sum over all fixed voxels of the same sign: it is at least that
+     * sum, and less than min_distance_m above it, as the TSDF distances of
+     * fixed voxels are below min_distance_m. It ignores whether the voxels
+     * in between were observed. The transform runs on dense chunks of
+     * blocks, on integrator_threads threads.
+     */
+    bool distance_transform_batch = false;
+
+    /**
+     * Half of the side length of an axis-aligned box around the robot that
+     * incremental updates are limited to, see setWindowCenter(). ESDF blocks
+     * that leave the box are removed, and TSDF blocks that enter it are
+     * propagated as a whole, so the cost of an update only depends on the
+     * size of the box. Zero or less to update the whole map.
+     * TSDF blocks outside of the box keep their Update::kEsdf flag until
+     * they are inside of it again. Finding and clearing them would cost an
+     * iteration over the whole map, and the flag doesn't matter, as blocks
+     * that enter the box are propagated as a whole anyway.
+     */
+    FloatingPoint window_half_size_m = 0.0;
   };
 
   EsdfIntegrator(const Config& config, Layer<TsdfVoxel>* tsdf_layer,
                  Layer<EsdfVoxel>* esdf_layer);
 
+  /**
+   * Switches the TSDF layer that the next updates read from, keeping the
+   * state of the integrator. E.g. to update from a snapshot of the TSDF
+   * layer, see Layer::getSnapshot(), without holding up the integration
+   * into the layer itself. The TSDF blocks are only read, so blocks shared
+   * with the snapshot are not copied, and the update flags are cleared in
+   * the snapshot only.
+   */
+  void setTsdfLayer(Layer<TsdfVoxel>* tsdf_layer);
+
   /**
    *Used for planning - allocates sphere around as observed but occupied,
    * and clears space in a smaller sphere around current position.
@@ -93,9 +140,17 @@ class EsdfIntegrator {
    * process.
    */
   void updateFromTsdfLayerBatch();
+  /**
+   * Batch update with a euclidean distance transform, see
+   * Config::distance_transform_batch. The distances are independent of
+   * full_euclidean_distance, and the parents point to the closest fixed
+   * voxel if it is near enough to be stored.
+   */
+  void updateFromTsdfLayerBatchDistanceTransform();
   /**
    * Incrementally update from the TSDF layer, optionally clearing the updated
-   * flag of all changed TSDF voxels.
+   * flag of all changed TSDF voxels. Only the updated sub-bricks of the TSDF
+   * blocks are propagated, see Layer::getUpdatedSubBricks().
    */
   void updateFromTsdfLayer(bool clear_updated_flag);
 
@@ -106,6 +161,16 @@ class EsdfIntegrator {
   void updateFromTsdfBlocks(const BlockIndexList& tsdf_blocks,
                             bool incremental = false);
 
+  /**
+   * Same as above, but only propagates the voxels inside the given sub-bricks
+   * of each TSDF block. Blocks that don't exist in the ESDF layer yet are
+   * always propagated as a whole.
+   */
+  void updateFromTsdfBlocks(
+      const BlockIndexList& tsdf_blocks,
+      const std::vector<Block<TsdfVoxel>::SubBrickMask>& sub_brick_masks,
+      bool incremental);
+
   /**
    * For incremental updates, the raise set contains all fixed voxels whose
    * distances have INCREASED since last iteration. This means that all voxels
@@ -123,6 +188,15 @@ class EsdfIntegrator {
    */
   void processOpenSet();
 
+  /**
+   * Parallel version of processOpenSet(), see Config::integrator_threads.
+   * Each round propagates the lowest bucket of all block queues. The result
+   * doesn't depend on the number of threads, but as the voxels are processed
+   * in a different order, a few voxels where the sign flips may differ from
+   * the serial version.
+   */
+  void processOpenSetParallel();
+
   /**
    * For new voxels, etc. -- update its value from its neighbors. Sort of the
    * inverse of what the open set does (pushes the value of voxels *TO* its
@@ -130,6 +204,15 @@ class EsdfIntegrator {
    */
   bool updateVoxelFromNeighbors(const GlobalIndex& global_index);
 
+  /**
+   * Moves the window of the incremental updates to the given robot position,
+   * see Config::window_half_size_m. The ESDF follows with the next update.
+   * Does nothing if there is no window.
+   */
+  void setWindowCenter(const Point& center);
+  /// Whether the block is inside the window, always true without a window.
+  bool isBlockInWindow(const BlockIndex& block_index) const;
+
   // Convenience functions.
   inline bool isFixed(FloatingPoint dist_m) const {
     return std::abs(dist_m) < config_.min_distance_m;
@@ -154,6 +237,93 @@ class EsdfIntegrator {
   }
 
  protected:
+  /// Counts of the voxel updates of the open set, for logging.
+  struct OpenSetStats {
+    size_t num_updates = 0u;
+    size_t num_inside = 0u;
+    size_t num_outside = 0u;
+    size_t num_flipped = 0u;
+  };
+
+  /// Update of a voxel in a neighboring block, see processOpenSetParallel().
+  struct NeighborUpdate {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    GlobalIndex neighbor_index;
+    /// Index of the neighbor in the neighborhood of the voxel.
+    unsigned int neighbor_idx;
+    /// The voxel at the time of the update.
+    EsdfVoxel voxel;
+  };
+
+  typedef BlockOpenSets<EsdfVoxel, NeighborUpdate, OpenSetStats>
+      EsdfBlockOpenSets;
+  /// The open set of one block, see processOpenSetParallel().
+  typedef EsdfBlockOpenSets::BlockOpenSet BlockOpenSet;
+
+  /// Scratch memory of the distance transform of one chunk of blocks.
+  struct DistanceTransformChunk {
+    /// Signed TSDF distance of the fixed voxels, kInfinity for all others.
+    std::vector<float> fixed_distances;
+    /// Squared distance in voxels to the closest fixed voxel.
+    std::vector<float> squared_distances;
+    /// Index of the closest fixed voxel.
+    std::vector<uint32_t> closest_fixed_voxels;
+
+    SquaredDistanceTransform1d transform;
+    std::vector<float> line_values;
+    std::vector<float> line_distances;
+    std::vector<uint32_t> line_closest_voxels;
+    std::vector<uint32_t> line_argmins;
+  };
+
+  /// Largest side length of the chunks of the batch transform, in blocks.
+  static constexpr IndexElement kDistanceTransformChunkBlocks = 8;
+  /**
+   * Side length in voxels of the dense grid of a chunk, including the halo
+   * of the max distance around it, so at most 2^21 voxels of 12 bytes each,
+   * per thread. The chunks are made smaller to stay below it, and if a
+   * single block with the halo doesn't fit, the halo and with it the max
+   * distance are cut.
+   */
+  static constexpr IndexElement kDistanceTransformMaxGridSide = 128;
+
+  /**
+   * Computes the distances of the given blocks of a chunk. The distance
+   * transform runs on a dense grid of all voxels between the min and max
+   * global voxel index, which should cover the fixed voxels up to the max
+   * distance around the blocks. Voxels farther away get the default
+   * distance.
+   */
+  void updateChunkWithDistanceTransform(const GlobalIndex& min_voxel_index,
+                                        const GlobalIndex& max_voxel_index,
+                                        const FloatingPoint max_distance,
+                                        const BlockIndexList& blocks,
+                                        DistanceTransformChunk* chunk) const;
+
+  /**
+   * Removes the ESDF blocks outside of the window, and collects the TSDF
+   * blocks inside of it that were updated or that have no ESDF block yet.
+   */
+  void getUpdatedBlocksInWindow(BlockIndexList* tsdf_blocks);
+
+  /**
+   * Lowers the distance of the neighbor at neighbor_idx of the voxel, if it
+   * is shorter to go through the voxel. Returns whether the neighbor changed.
+   */
+  bool propagateToNeighbor(const EsdfVoxel& voxel,
+                           const unsigned int neighbor_idx,
+                           EsdfVoxel* neighbor_voxel,
+                           OpenSetStats* stats) const;
+
+  /**
+   * Propagates the voxels of the block up to the given bucket of its queue.
+   * Neighbors inside the block are updated directly, the others are collected
+   * in neighbor_updates.
+   */
+  void propagateBlockOpenSet(const int max_bucket_index,
+                             BlockOpenSet* block_open_set) const;
+
   Config config_;
 
   Layer<TsdfVoxel>* tsdf_layer_;
@@ -176,6 +346,11 @@ class EsdfIntegrator {
   FloatingPoint voxel_size_;
 
   IndexSet updated_blocks_;
+
+  /// Window of the incremental updates, see Config::window_half_size_m.
+  bool has_window_center_;
+  BlockIndex window_center_;
+  IndexElement window_half_size_blocks_;
 };
 
 }  // namespace voxblox
@@ -11,8 +11,10 @@
 
 #include "voxblox/core/layer.h"
 #include "voxblox/core/voxel.h"
+#include "voxblox/integrator/block_open_sets.h"
 #include "voxblox/integrator/integrator_utils.h"
 #include "voxblox/utils/bucket_queue.h"
+#include "voxblox/utils/neighbor_tools.h"
 #include "voxblox/utils/timing.h"
 
 namespace voxblox {
@@ -36,20 +38,61 @@ class EsdfOccIntegrator {
     FloatingPoint default_distance_m = 2.0;
     /// Number of buckets for the bucketed priority queue.
     int num_buckets = 20;
+    /**
+     * Number of threads propagating the open set. With more than one, the
+     * open set is split into one queue per block, and the blocks propagate
+     * their voxels in parallel rounds. The updates that cross a block border
+     * are exchanged between the rounds.
+     */
+    size_t integrator_threads = 1u;
   };
 
   EsdfOccIntegrator(const Config& config, Layer<OccupancyVoxel>* occ_layer,
                     Layer<EsdfVoxel>* esdf_layer);
 
   /**
-   * Fixed is overloaded as occupied in this case.
-   * Only batch operations are currently supported for the occupancy map.
+   * Fixed is overloaded as occupied in this case. Clears the current ESDF
+   * layer.
    */
   void updateFromOccLayerBatch();
-  void updateFromOccBlocks(const BlockIndexList& occ_blocks);
+  /**
+   * Incrementally updates from the occupancy blocks flagged for an ESDF
+   * update, optionally clearing the flag. Only the updated sub-bricks of
+   * the blocks are checked, see Layer::getUpdatedSubBricks().
+   */
+  void updateFromOccLayer(bool clear_updated_flag);
+  /**
+   * Voxels that became occupied lower the distances around them, voxels that
+   * became free raise the distances of the voxels they were the parent of.
+   * Not incremental only works on an empty ESDF layer.
+   */
+  void updateFromOccBlocks(const BlockIndexList& occ_blocks,
+                           bool incremental = false);
+  void updateFromOccBlocks(
+      const BlockIndexList& occ_blocks,
+      const std::vector<Block<OccupancyVoxel>::SubBrickMask>& sub_brick_masks,
+      bool incremental);
+
+  /**
+   * Invalidates the voxels that had a voxel of the raise set as parent, and
+   * adds the voxels around them to the open set.
+   */
+  void processRaiseSet();
 
   void processOpenSet();
 
+  /**
+   * Parallel version of processOpenSet(), see Config::integrator_threads.
+   * Gives the same distances as the serial version.
+   */
+  void processOpenSetParallel();
+
+  /// Clears the state of the integrator.
+  void clear() {
+    open_.clear();
+    raise_ = AlignedQueue<GlobalIndex>();
+  }
+
   /**
    * Uses 26-connectivity and quasi-Euclidean distances.
    * Directions is the direction that the neighbor voxel lives in. If you
@@ -66,6 +109,49 @@ class EsdfOccIntegrator {
                    VoxelIndex* neighbor_voxel_index) const;
 
  protected:
+  /// Update of a voxel in a neighboring block, see processOpenSetParallel().
+  struct NeighborUpdate {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    GlobalIndex neighbor_index;
+    /// Index of the neighbor in the neighborhood of the voxel.
+    unsigned int neighbor_idx;
+    /// Distance of the voxel at the time of the update.
+    FloatingPoint distance;
+  };
+
+  /// Number of voxel updates of a block, for logging.
+  typedef size_t NumUpdates;
+  typedef BlockOpenSets<EsdfVoxel, NeighborUpdate, NumUpdates>
+      EsdfBlockOpenSets;
+  /// The open set of one block, see processOpenSetParallel().
+  typedef EsdfBlockOpenSets::BlockOpenSet BlockOpenSet;
+
+  /**
+   * Lowers the distance of the neighbor at neighbor_idx of a voxel at the
+   * given distance, if it is shorter to go through the voxel. Returns whether
+   * the neighbor changed.
+   */
+  bool propagateToNeighbor(const FloatingPoint distance,
+                           const unsigned int neighbor_idx,
+                           EsdfVoxel* neighbor_voxel) const;
+
+  /**
+   * Sets the distance of the current voxel of the neighborhood from its
+   * closest neighbor. Returns whether there was a neighbor within the max
+   * distance.
+   */
+  bool updateVoxelFromNeighbors(BlockNeighborhood<EsdfVoxel>* neighborhood,
+                                EsdfVoxel* voxel) const;
+
+  /**
+   * Propagates the voxels of the block up to the given bucket of its queue.
+   * Neighbors inside the block are updated directly, the others are collected
+   * in neighbor_updates.
+   */
+  void propagateBlockOpenSet(const int max_bucket_index,
+                             BlockOpenSet* block_open_set) const;
+
   Config config_;
 
   Layer<OccupancyVoxel>* occ_layer_;
@@ -75,13 +161,13 @@ class EsdfOccIntegrator {
    * Open Queue for incremental updates. Contains global voxel indices
    * for the ESDF layer.
    */
-  BucketQueue<VoxelKey> open_;
+  BucketQueue<GlobalIndex> open_;
 
   /** Raise set for updates; these are values that used to be in the fixed
    * frontier and now have a higher value, or their children which need to have
    * their values invalidated.
    */
-  AlignedQueue<VoxelKey> raise_;
+  AlignedQueue<GlobalIndex> raise_;
 
   size_t esdf_voxels_per_side_;
   FloatingPoint esdf_voxel_size_;
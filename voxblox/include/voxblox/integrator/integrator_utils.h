@@ -125,6 +125,247 @@ class RayCaster {
   uint current_step_;
 };
 
+/**
+ * Integer-only version of the RayCaster (Amanatides-Woo 3D DDA). The start and
+ * end points are quantized once to a fixed-point grid relative to the start
+ * voxel, after which the traversal only uses integer additions and
+ * comparisons. For every ordered pair of axes (i, j) the error term
+ * n_i * |d_j| is kept, where n_i is the fixed-point distance to the next
+ * boundary along axis i and d_j the fixed-point ray extent along axis j.
+ * Comparing these cross terms is equivalent to comparing the ray parameters
+ * t_i and t_j, without any division.
+ *
+ * Visits the same voxels in the same order as the RayCaster (including the
+ * number of steps and tie-breaking towards x, then y, then z), but can emit
+ * whole runs of indices per call through nextRayIndices. Since the ray
+ * parameters are not accumulated in floating point, it does not drift on long
+ * rays, where the RayCaster can occasionally swap two steps near a tie. Like
+ * the RayCaster, this class assumes PRE-SCALED coordinates.
+ */
+class IntegerRayCaster {
+ public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  IntegerRayCaster(const Point& origin, const Point& point_G,
+                   const bool is_clearing_ray,
+                   const bool voxel_carving_enabled,
+                   const FloatingPoint max_ray_length_m,
+                   const FloatingPoint voxel_size_inv,
+                   const FloatingPoint truncation_distance,
+                   const bool cast_from_origin = true);
+
+  IntegerRayCaster(const Point& start_scaled, const Point& end_scaled);
+
+  /// returns false if ray terminates at ray_index, true otherwise
+  inline bool nextRayIndex(GlobalIndex* ray_index) {
+    return nextRayIndices(1u, ray_index) > 0u;
+  }
+
+  /**
+   * Writes up to max_num_indices consecutive voxel indices of the ray to
+   * ray_indices and returns the number of indices written. Returns 0 once the
+   * ray has been fully traversed.
+   */
+  size_t nextRayIndices(const size_t max_num_indices,
+                        GlobalIndex* ray_indices) {
+    DCHECK(ray_indices != nullptr);
+    const size_t num_indices =
+        std::min(max_num_indices, numRemainingRayIndices());
+
+    // Work on local copies, such that the traversal state stays in registers.
+    LongIndexElement x = curr_index_.x();
+    LongIndexElement y = curr_index_.y();
+    LongIndexElement z = curr_index_.z();
+    int64_t xy = cross_error_[0][1], xz = cross_error_[0][2];
+    int64_t yx = cross_error_[1][0], yz = cross_error_[1][2];
+    int64_t zx = cross_error_[2][0], zy = cross_error_[2][1];
+
+    for (size_t i = 0u; i < num_indices; ++i) {
+      ray_indices[i] = GlobalIndex(x, y, z);
+      // Same tie-breaking as Eigen's minCoeff in the RayCaster: the lowest
+      // axis wins if the ray parameters are equal.
+      if (xy <= yx && xz <= zx) {
+        x += ray_step_signs_.x();
+        xy += cross_error_step_[1];
+        xz += cross_error_step_[2];
+      } else if (yz <= zy) {
+        y += ray_step_signs_.y();
+        yx += cross_error_step_[0];
+        yz += cross_error_step_[2];
+      } else {
+        z += ray_step_signs_.z();
+        zx += cross_error_step_[0];
+        zy += cross_error_step_[1];
+      }
+    }
+
+    curr_index_ = GlobalIndex(x, y, z);
+    cross_error_[0][1] = xy;
+    cross_error_[0][2] = xz;
+    cross_error_[1][0] = yx;
+    cross_error_[1][2] = yz;
+    cross_error_[2][0] = zx;
+    cross_error_[2][1] = zy;
+    current_step_ += num_indices;
+    return num_indices;
+  }
+
+  /**
+   * Skips all voxels of the ray that lie inside the given block, such that the
+   * next returned index is the first voxel after the ray left the block, or
+   * the ray is done if it ends inside of it. Nothing is skipped if the next
+   * voxel is outside of the block. Takes constant time, and the remaining
+   * voxels are exactly the ones the ray would have visited after stepping
+   * through the block.
+   */
+  void skipBlock(const BlockIndex& block_index,
+                 const IndexElement voxels_per_side);
+
+  /// Number of voxel indices that have not yet been returned.
+  inline size_t numRemainingRayIndices() const {
+    return (current_step_ > ray_length_in_steps_)
+               ? 0u
+               : static_cast<size_t>(ray_length_in_steps_ - current_step_) +
+                     1u;
+  }
+
+ private:
+  friend class PacketRayCaster;
+
+  void setupRayCaster(const Point& start_scaled, const Point& end_scaled);
+
+  GlobalIndex curr_index_;
+  AnyIndex ray_step_signs_;
+
+  /// cross_error_[i][j] = n_i * |d_j|, see class description. The diagonal is
+  /// unused.
+  int64_t cross_error_[3][3];
+  /// Increment of cross_error_[i][j] when stepping along axis i: one voxel in
+  /// fixed-point units times |d_j|.
+  int64_t cross_error_step_[3];
+
+  uint ray_length_in_steps_;
+  uint current_step_;
+};
+
+/**
+ * Traverses a packet of up to kMaxPacketSize rays in lockstep, using the same
+ * integer DDA as the IntegerRayCaster. The state of all rays is stored as
+ * structure of arrays, such that advancing the whole packet by one voxel is a
+ * branch-free loop over the lanes which the compiler can vectorize. Neighboring
+ * rays of a scan traverse nearly identical voxels, so consumers can also share
+ * block lookups between the rays of a packet.
+ *
+ * Every ray of the packet visits exactly the same voxels as it would with the
+ * IntegerRayCaster. Like the RayCaster, this class assumes PRE-SCALED
+ * coordinates.
+ */
+class PacketRayCaster {
+ public:
+  static constexpr size_t kMaxPacketSize = 8u;
+
+  PacketRayCaster() : num_rays_(0u) {}
+
+  /// Adds a ray to the packet and returns its ray id, i.e. its lane.
+  size_t addRay(const Point& origin, const Point& point_G,
+                const bool is_clearing_ray, const bool voxel_carving_enabled,
+                const FloatingPoint max_ray_length_m,
+                const FloatingPoint voxel_size_inv,
+                const FloatingPoint truncation_distance,
+                const bool cast_from_origin = true);
+
+  /// Adds a ray to the packet and returns its ray id, i.e. its lane.
+  size_t addRay(const Point& start_scaled, const Point& end_scaled);
+
+  /// Stops the traversal of a ray, e.g. if it is not informative anymore.
+  inline void terminateRay(const size_t ray_id) {
+    DCHECK_LT(ray_id, num_rays_);
+    remaining_steps_[ray_id] = 0;
+  }
+
+  /// Same as IntegerRayCaster::skipBlock for a single ray of the packet.
+  void skipBlock(const size_t ray_id, const BlockIndex& block_index,
+                 const IndexElement voxels_per_side);
+
+  /// Removes all rays from the packet.
+  inline void clear() {
+    num_rays_ = 0u;
+    std::fill(remaining_steps_, remaining_steps_ + kMaxPacketSize, 0);
+  }
+
+  inline size_t numRays() const { return num_rays_; }
+  inline bool isFull() const { return num_rays_ == kMaxPacketSize; }
+
+  /**
+   * Advances all rays of the packet by one voxel. For every ray that has not
+   * terminated yet, its current voxel index is written to ray_indices[ray_id]
+   * and ray_active[ray_id] is set to true, for all others ray_active[ray_id]
+   * is set to false. Both arrays need to hold kMaxPacketSize elements. Returns
+   * the number of active rays, i.e. 0 once all rays have been traversed.
+   */
+  inline size_t nextRayIndices(GlobalIndex* ray_indices, bool* ray_active) {
+    DCHECK(ray_indices != nullptr);
+    DCHECK(ray_active != nullptr);
+
+    size_t num_active_rays = 0u;
+    for (size_t i = 0u; i < num_rays_; ++i) {
+      ray_active[i] = remaining_steps_[i] > 0;
+      num_active_rays += ray_active[i];
+      ray_indices[i] = GlobalIndex(x_[i], y_[i], z_[i]);
+    }
+    for (size_t i = num_rays_; i < kMaxPacketSize; ++i) {
+      ray_active[i] = false;
+    }
+
+    // Branch-free step of all lanes, inactive and unused lanes have no
+    // remaining steps and are masked out.
+    for (size_t i = 0u; i < kMaxPacketSize; ++i) {
+      const int64_t active = remaining_steps_[i] > 0;
+      const int64_t step_x =
+          active & (xy_[i] <= yx_[i]) & (xz_[i] <= zx_[i]);
+      const int64_t step_y = active & (step_x ^ 1) & (yz_[i] <= zy_[i]);
+      const int64_t step_z = active & (step_x ^ 1) & (step_y ^ 1);
+
+      x_[i] += step_x * sign_x_[i];
+      y_[i] += step_y * sign_y_[i];
+      z_[i] += step_z * sign_z_[i];
+      xy_[i] += step_x * error_step_y_[i];
+      xz_[i] += step_x * error_step_z_[i];
+      yx_[i] += step_y * error_step_x_[i];
+      yz_[i] += step_y * error_step_z_[i];
+      zx_[i] += step_z * error_step_x_[i];
+      zy_[i] += step_z * error_step_y_[i];
+      remaining_steps_[i] -= active;
+    }
+    return num_active_rays;
+  }
+
+ private:
+  size_t addRay(const IntegerRayCaster& ray_caster);
+
+  size_t num_rays_;
+
+  // Per ray state, see IntegerRayCaster. Unused lanes are zero, as the step
+  // loop reads all of them.
+  int64_t x_[kMaxPacketSize] = {};
+  int64_t y_[kMaxPacketSize] = {};
+  int64_t z_[kMaxPacketSize] = {};
+  int64_t sign_x_[kMaxPacketSize] = {};
+  int64_t sign_y_[kMaxPacketSize] = {};
+  int64_t sign_z_[kMaxPacketSize] = {};
+  int64_t xy_[kMaxPacketSize] = {};
+  int64_t xz_[kMaxPacketSize] = {};
+  int64_t yx_[kMaxPacketSize] = {};
+  int64_t yz_[kMaxPacketSize] = {};
+  int64_t zx_[kMaxPacketSize] = {};
+  int64_t zy_[kMaxPacketSize] = {};
+  int64_t error_step_x_[kMaxPacketSize] = {};
+  int64_t error_step_y_[kMaxPacketSize] = {};
+  int64_t error_step_z_[kMaxPacketSize] = {};
+  /// Number of voxels that have not yet been returned, 0 for unused lanes.
+  int64_t remaining_steps_[kMaxPacketSize] = {};
+};
+
 /**
  * This function assumes PRE-SCALED coordinates, where one unit = one voxel
  * size. The indices are also returned in this scales coordinate system, which
@@ -134,12 +375,14 @@ inline void castRay(const Point& start_scaled, const Point& end_scaled,
                     AlignedVector<GlobalIndex>* indices) {
   CHECK_NOTNULL(indices);
 
-  RayCaster ray_caster(start_scaled, end_scaled);
+  IntegerRayCaster ray_caster(start_scaled, end_scaled);
 
-  GlobalIndex ray_index;
-  while (ray_caster.nextRayIndex(&ray_index)) {
-    indices->push_back(ray_index);
-  }
+  // The length of the ray is known upfront, so all indices can be written in
+  // a single run.
+  const size_t num_indices_before = indices->size();
+  indices->resize(num_indices_before + ray_caster.numRemainingRayIndices());
+  ray_caster.nextRayIndices(indices->size() - num_indices_before,
+                            indices->data() + num_indices_before);
 }
 
 /**
@@ -147,9 +147,9 @@ class OccupancyIntegrator {
 
       if (!block || block_idx != last_block_idx) {
         block = layer_->allocateBlockPtrByIndex(block_idx);
-        block->updated().set();
         last_block_idx = block_idx;
       }
+      block->setVoxelUpdated(local_voxel_idx);
 
       OccupancyVoxel& occ_voxel = block->getVoxelByVoxelIndex(local_voxel_idx);
       updateOccupancyVoxel(occupied, &occ_voxel);
@@ -165,9 +165,9 @@ class OccupancyIntegrator {
 
       if (!block || block_idx != last_block_idx) {
         block = layer_->allocateBlockPtrByIndex(block_idx);
-        block->updated().set();
         last_block_idx = block_idx;
       }
+      block->setVoxelUpdated(local_voxel_idx);
 
       OccupancyVoxel& occ_voxel = block->getVoxelByVoxelIndex(local_voxel_idx);
       updateOccupancyVoxel(occupied, &occ_voxel);
@@ -66,6 +66,13 @@ class TsdfIntegratorBase {
     bool use_weight_dropoff = true;
     bool use_sparsity_compensation_factor = false;
     float sparsity_compensation_factor = 1.0f;
+    /**
+     * If true, rays jump over blocks that only contain saturated free space,
+     * as long as the block is outside of their surface band. See
+     * Block::num_saturated_free_voxels(). The fast integrator doesn't count
+     * the skipped voxels towards its ray collisions.
+     */
+    bool skip_saturated_free_space_blocks = false;
 
     size_t integrator_threads = std::thread::hardware_concurrency();
 
@@ -73,6 +80,12 @@ class TsdfIntegratorBase {
     /// rays. Options: "mixed", "sorted"
     std::string integration_order_mode = "mixed";
 
+    /// simple and fast integrator specific, traverses packets of neighboring
+    /// rays in lockstep, see PacketRayCaster. Requires
+    /// integration_order_mode "mixed", and is disabled with a warning
+    /// otherwise.
+    bool use_ray_packets = false;
+
     /// merge integrator specific
     bool enable_anti_grazing = false;
 
@@ -143,17 +156,67 @@ class TsdfIntegratorBase {
                                            Block<TsdfVoxel>::Ptr* last_block,
                                            BlockIndex* last_block_idx);
 
+  /// The last block accessed by every ray of a ray packet.
+  struct PacketBlockCache {
+    Block<TsdfVoxel>::Ptr blocks[PacketRayCaster::kMaxPacketSize];
+    BlockIndex block_indices[PacketRayCaster::kMaxPacketSize];
+  };
+
+  /**
+   * Same as above for the ray ray_id of a ray packet. As the rays of a packet
+   * mostly traverse the same blocks, a block that has already been looked up
+   * by another ray of the packet is reused instead of querying the layer
+   * again. Thread safe.
+   */
+  TsdfVoxel* allocateStorageAndGetVoxelPtr(const GlobalIndex& global_voxel_idx,
+                                           const size_t ray_id,
+                                           PacketBlockCache* block_cache);
+
+  /// Number of ray packets needed to cover all points of a pointcloud.
+  static size_t getNumRayPackets(const size_t num_points) {
+    return (num_points + PacketRayCaster::kMaxPacketSize - 1u) /
+           PacketRayCaster::kMaxPacketSize;
+  }
+
   /**
    * Merges temporarily stored blocks into the main layer. NOT thread safe, see
    * allocateStorageAndGetVoxelPtr for more details.
    */
   void updateLayerWithStoredBlocks();
 
-  /// Updates tsdf_voxel, Thread safe.
+  /**
+   * Updates tsdf_voxel and the free space summary of tsdf_block, which needs
+   * to be the block containing the voxel. Thread safe.
+   */
   void updateTsdfVoxel(const Point& origin, const Point& point_G,
                        const GlobalIndex& global_voxel_index,
                        const Color& color, const float weight,
-                       TsdfVoxel* tsdf_voxel);
+                       TsdfVoxel* tsdf_voxel, Block<TsdfVoxel>* tsdf_block);
+
+  /// Thread safe.
+  inline bool isSaturatedFreeSpaceVoxel(const TsdfVoxel& tsdf_voxel) const {
+    return tsdf_voxel.weight >= config_.max_weight &&
+           tsdf_voxel.distance >= config_.default_truncation_distance;
+  }
+
+  /// The block a ray is currently traversing, see isInSaturatedFreeSpace.
+  struct SaturatedFreeSpaceCache {
+    BlockIndex block_idx =
+        BlockIndex::Constant(std::numeric_limits<IndexElement>::max());
+    bool is_saturated_free_space = false;
+  };
+
+  /**
+   * Returns true if the voxel lies in a block that only contains saturated
+   * free space and the whole block is at least the truncation distance in
+   * front of point_G. Updating any voxel of such a block with the ray from
+   * origin to point_G doesn't change it, so the ray can jump to the end of
+   * the block with IntegerRayCaster::skipBlock. The result is cached per
+   * block in cache. Thread safe.
+   */
+  bool isInSaturatedFreeSpace(const GlobalIndex& global_voxel_idx,
+                              const Point& origin, const Point& point_G,
+                              SaturatedFreeSpaceCache* cache) const;
 
   /// Calculates TSDF distance, Thread safe.
   float computeDistance(const Point& origin, const Point& point_G,
@@ -227,6 +290,16 @@ class SimpleTsdfIntegrator : public TsdfIntegratorBase {
                          const Pointcloud& points_C, const Colors& colors,
                          const bool freespace_points,
                          ThreadSafeIndex* index_getter);
+
+  /**
+   * Same as integrateFunction, but casts packets of consecutive points at
+   * once. packet_index_getter returns the packet indices.
+   */
+  void integratePacketFunction(const Transformation& T_G_C,
+                               const Pointcloud& points_C,
+                               const Colors& colors,
+                               const bool freespace_points,
+                               ThreadSafeIndex* packet_index_getter);
 };
 
 /**
@@ -295,6 +368,16 @@ class FastTsdfIntegrator : public TsdfIntegratorBase {
                          const bool freespace_points,
                          ThreadSafeIndex* index_getter);
 
+  /**
+   * Same as integrateFunction, but casts packets of consecutive points at
+   * once. packet_index_getter returns the packet indices.
+   */
+  void integratePacketFunction(const Transformation& T_G_C,
+                               const Pointcloud& points_C,
+                               const Colors& colors,
+                               const bool freespace_points,
+                               ThreadSafeIndex* packet_index_getter);
+
   void integratePointCloud(const Transformation& T_G_C,
                            const Pointcloud& points_C, const Colors& colors,
                            const bool freespace_points = false);
@@ -2,13 +2,39 @@
 #define VOXBLOX_INTERPOLATOR_INTERPOLATOR_H_
 
 #include <memory>
+#include <vector>
 
+#include "voxblox/core/block_query_cache.h"
 #include "voxblox/core/common.h"
 #include "voxblox/core/layer.h"
 #include "voxblox/core/voxel.h"
+#include "voxblox/utils/thread_pool.h"
 
 namespace voxblox {
 
+/**
+ * How Interpolator::getDistanceAndGradient() and
+ * Interpolator::batchGetDistanceAndGradient() get the gradient. Both default
+ * to kCentralDifferences, so their gradients match getGradient().
+ */
+enum class GradientMethod {
+  /**
+   * Central differences of the trilinear interpolation one voxel to either
+   * side, as getGradient() does. The default.
+   */
+  kCentralDifferences,
+  /**
+   * Derivative of the trilinear interpolation, from the same 8 voxels as the
+   * distance. Cheapest, but not continuous across the voxel boundaries.
+   */
+  kTrilinear,
+  /**
+   * Tricubic Catmull-Rom interpolation of the distance and its derivative,
+   * from the 64 voxels around the position. The gradient is continuous.
+   */
+  kTricubic
+};
+
 /**
  * Interpolates voxels to give distances and gradients
  */
@@ -33,6 +59,15 @@ class Interpolator {
   bool getVoxel(const Point& pos, VoxelType* voxel,
                 bool interpolate = false) const;
 
+  /**
+   * Distance and gradient in one pass, with the gradient from the given
+   * method. With the tricubic method the distance is tricubic too, otherwise
+   * it is the trilinear one of getDistance().
+   */
+  bool getDistanceAndGradient(
+      const Point& pos, FloatingPoint* distance, Point* grad,
+      GradientMethod method = GradientMethod::kCentralDifferences) const;
+
   /**
    * This tries to use whatever information is available to interpolate the
    * distance and gradient -- if only one side is available, for instance,
@@ -46,6 +81,34 @@ class Interpolator {
   bool getNearestDistanceAndWeight(const Point& pos, FloatingPoint* distance,
                                    float* weight) const;
 
+  /**
+   * Interpolated distances and gradients of many positions at once, the same
+   * as getDistance() and getGradient() with interpolation. The queries are
+   * grouped by block, so the blocks around a group are only looked up once
+   * instead of once per voxel of each interpolation, and the distance and
+   * gradient share their voxels. The groups are split across num_threads,
+   * which are started for this call only, see the overload below to reuse
+   * them. The gradients can be nullptr to only get the distances, then only
+   * the voxels of the distance interpolation have to be observed for a query
+   * to succeed. success is 1 for the queries that succeeded, 0 otherwise.
+   */
+  void batchGetDistanceAndGradient(
+      const Pointcloud& positions, std::vector<FloatingPoint>* distances,
+      Pointcloud* gradients, std::vector<uint8_t>* success,
+      size_t num_threads = 1u,
+      GradientMethod method = GradientMethod::kCentralDifferences) const;
+
+  /**
+   * The same, with the groups split across the threads of the pool, or all
+   * answered by the calling thread if it is nullptr.
+   */
+  void batchGetDistanceAndGradient(const Pointcloud& positions,
+                                   std::vector<FloatingPoint>* distances,
+                                   Pointcloud* gradients,
+                                   std::vector<uint8_t>* success,
+                                   ThreadPool* thread_pool,
+                                   GradientMethod method) const;
+
   bool setIndexes(const Point& pos, BlockIndex* block_index,
                   InterpIndexes* voxel_indexes) const;
 
@@ -53,6 +116,46 @@ class Interpolator {
                            InterpVector* q_vector) const;
 
  private:
+  /// Block lookups of the single queries, through the cache of the thread.
+  typename Block<VoxelType>::ConstPtr getBlockPtrByIndex(
+      const BlockIndex& index) const;
+  typename Block<VoxelType>::ConstPtr getBlockPtrByCoordinates(
+      const Point& pos) const;
+
+  /// The 3x3x3 blocks around the block of one or more queries.
+  struct BatchNeighborBlocks {
+    explicit BatchNeighborBlocks(const BlockIndex& _block_index);
+
+    BlockIndex block_index;
+    /// Looked up on first use, nullptr if not allocated.
+    const Block<VoxelType>* blocks[27];
+    bool looked_up[27];
+  };
+
+  /**
+   * Index of the voxel the interpolation of the position starts from, the one
+   * at the lower corner of the 8 voxels around it.
+   */
+  GlobalIndex getBatchBaseIndex(const Point& pos, Point* voxel_offset) const;
+
+  /**
+   * Returns the voxel at an index relative to the block of the neighbor
+   * blocks, which can be up to one block outside it, or nullptr if its block
+   * is not allocated.
+   */
+  const VoxelType* getBatchVoxel(const VoxelIndex& voxel_index,
+                                 BatchNeighborBlocks* neighbor_blocks) const;
+
+  /**
+   * One query of batchGetDistanceAndGradient(), the neighbor blocks have to
+   * be the ones around the block of the base index of the position.
+   */
+  bool getBatchDistanceAndGradient(const Point& pos,
+                                   const GradientMethod method,
+                                   BatchNeighborBlocks* neighbor_blocks,
+                                   FloatingPoint* distance,
+                                   Point* gradient) const;
+
   /**
    * Q vector from http://spie.org/samples/PM159.pdf
    * Relates the interpolation distance of any arbitrary point inside a voxel
@@ -67,6 +170,17 @@ class Interpolator {
                            const VoxelType** voxels,
                            InterpVector* q_vector) const;
 
+  /**
+   * Tricubic interpolation from the 4x4x4 voxels around the position, the
+   * base index, relative to the block of the neighbor blocks, is the second
+   * one along each axis. The gradient can be nullptr.
+   */
+  bool getTricubicDistanceAndGradient(const VoxelIndex& base_voxel_index,
+                                      const Point& voxel_offset,
+                                      BatchNeighborBlocks* neighbor_blocks,
+                                      FloatingPoint* distance,
+                                      Point* gradient) const;
+
   bool getInterpDistance(const Point& pos, FloatingPoint* distance) const;
 
   bool getNearestDistance(const Point& pos, FloatingPoint* distance) const;
@@ -92,6 +206,10 @@ class Interpolator {
                                     const VoxelType** voxels,
                                     TGetter (*getter)(const VoxelType&));
 
+  /// Trilinear interpolation of the values at the 8 voxels.
+  static FloatingPoint interpData(const InterpVector& q_vector,
+                                  const InterpVector& data);
+
   static VoxelType interpVoxel(const InterpVector& q_vector,
                                const VoxelType** voxels);
 
@@ -1,7 +1,12 @@
 #ifndef VOXBLOX_INTERPOLATOR_INTERPOLATOR_INL_H_
 #define VOXBLOX_INTERPOLATOR_INTERPOLATOR_INL_H_
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <memory>
+#include <numeric>
+#include <utility>
 
 #include "voxblox/utils/evaluation_utils.h"
 
@@ -11,6 +16,20 @@ template <typename VoxelType>
 Interpolator<VoxelType>::Interpolator(const Layer<VoxelType>* layer)
     : layer_(layer) {}
 
+template <typename VoxelType>
+typename Block<VoxelType>::ConstPtr
+Interpolator<VoxelType>::getBlockPtrByIndex(const BlockIndex& index) const {
+  return BlockQueryCache<VoxelType>::getThreadLocal().getBlockPtrByIndex(
+      *layer_, index);
+}
+
+template <typename VoxelType>
+typename Block<VoxelType>::ConstPtr
+Interpolator<VoxelType>::getBlockPtrByCoordinates(const Point& pos) const {
+  return BlockQueryCache<VoxelType>::getThreadLocal().getBlockPtrByCoordinates(
+      *layer_, pos);
+}
+
 template <typename VoxelType>
 bool Interpolator<VoxelType>::getDistance(const Point& pos,
                                           FloatingPoint* distance,
@@ -49,7 +68,7 @@ bool Interpolator<VoxelType>::getGradient(const Point& pos, Point* grad,
   CHECK_NOTNULL(grad);
 
   typename Layer<VoxelType>::BlockType::ConstPtr block_ptr =
-      layer_->getBlockPtrByCoordinates(pos);
+      getBlockPtrByCoordinates(pos);
   if (block_ptr == nullptr) {
     return false;
   }
@@ -74,6 +93,20 @@ bool Interpolator<VoxelType>::getGradient(const Point& pos, Point* grad,
   return true;
 }
 
+template <typename VoxelType>
+bool Interpolator<VoxelType>::getDistanceAndGradient(
+    const Point& pos, FloatingPoint* distance, Point* grad,
+    GradientMethod method) const {
+  CHECK_NOTNULL(distance);
+  CHECK_NOTNULL(grad);
+  CHECK_GE(layer_->voxels_per_side(), 2u);
+  Point voxel_offset;
+  BatchNeighborBlocks neighbor_blocks(getBlockIndexFromGlobalVoxelIndex(
+      getBatchBaseIndex(pos, &voxel_offset), layer_->voxels_per_side_inv()));
+  return getBatchDistanceAndGradient(pos, method, &neighbor_blocks, distance,
+                                     grad);
+}
+
 template <typename VoxelType>
 bool Interpolator<VoxelType>::getAdaptiveDistanceAndGradient(
     const Point& pos, FloatingPoint* distance, Point* grad) const {
@@ -97,7 +130,7 @@ bool Interpolator<VoxelType>::getAdaptiveDistanceAndGradient(
   // above, but also allow finite difference methods other than central
   // difference (left difference, right difference).
   typename Layer<VoxelType>::BlockType::ConstPtr block_ptr =
-      layer_->getBlockPtrByCoordinates(pos);
+      getBlockPtrByCoordinates(pos);
   if (block_ptr == nullptr) {
     return false;
   }
@@ -153,6 +186,303 @@ bool Interpolator<VoxelType>::getAdaptiveDistanceAndGradient(
   return true;
 }
 
+template <typename VoxelType>
+void Interpolator<VoxelType>::batchGetDistanceAndGradient(
+    const Pointcloud& positions, std::vector<FloatingPoint>* distances,
+    Pointcloud* gradients, std::vector<uint8_t>* success, size_t num_threads,
+    GradientMethod method) const {
+  std::unique_ptr<ThreadPool> thread_pool;
+  if (num_threads > 1u) {
+    thread_pool.reset(new ThreadPool(num_threads));
+  }
+  batchGetDistanceAndGradient(positions, distances, gradients, success,
+                              thread_pool.get(), method);
+}
+
+template <typename VoxelType>
+void Interpolator<VoxelType>::batchGetDistanceAndGradient(
+    const Pointcloud& positions, std::vector<FloatingPoint>* distances,
+    Pointcloud* gradients, std::vector<uint8_t>* success,
+    ThreadPool* thread_pool, GradientMethod method) const {
+  CHECK_NOTNULL(distances);
+  CHECK_NOTNULL(success);
+  CHECK_GE(layer_->voxels_per_side(), 2u);
+  const size_t num_queries = positions.size();
+  distances->assign(num_queries, 0.0f);
+  success->assign(num_queries, 0u);
+  if (gradients != nullptr) {
+    gradients->assign(num_queries, Point::Zero());
+  }
+
+  // Sort the queries by the block of their interpolation, so each group of
+  // queries in the same block shares its block lookups.
+  const FloatingPoint voxels_per_side_inv = layer_->voxels_per_side_inv();
+  BlockIndexList query_blocks(num_queries);
+  for (size_t i = 0u; i < num_queries; ++i) {
+    Point voxel_offset;
+    query_blocks[i] = getBlockIndexFromGlobalVoxelIndex(
+        getBatchBaseIndex(positions[i], &voxel_offset), voxels_per_side_inv);
+  }
+  std::vector<size_t> order(num_queries);
+  std::iota(order.begin(), order.end(), 0u);
+  std::sort(order.begin(), order.end(),
+            [&query_blocks](const size_t a, const size_t b) {
+              return std::lexicographical_compare(
+                  query_blocks[a].data(), query_blocks[a].data() + 3,
+                  query_blocks[b].data(), query_blocks[b].data() + 3);
+            });
+  std::vector<size_t> group_begins;
+  for (size_t i = 0u; i < num_queries; ++i) {
+    if (i == 0u || query_blocks[order[i]] != query_blocks[order[i - 1u]]) {
+      group_begins.push_back(i);
+    }
+  }
+  group_begins.push_back(num_queries);
+
+  // Every query writes only its own outputs, so the groups are independent.
+  std::atomic<size_t> next_group(0u);
+  auto process_groups = [&]() {
+    size_t group;
+    while ((group = next_group++) + 1u < group_begins.size()) {
+      BatchNeighborBlocks neighbor_blocks(
+          query_blocks[order[group_begins[group]]]);
+      for (size_t i = group_begins[group]; i < group_begins[group + 1u];
+           ++i) {
+        const size_t query = order[i];
+        (*success)[query] = getBatchDistanceAndGradient(
+            positions[query], method, &neighbor_blocks, &(*distances)[query],
+            gradients == nullptr ? nullptr : &(*gradients)[query]);
+      }
+    }
+  };
+  if (thread_pool == nullptr) {
+    process_groups();
+  } else {
+    thread_pool->run(process_groups, group_begins.size() - 1u);
+  }
+}
+
+template <typename VoxelType>
+Interpolator<VoxelType>::BatchNeighborBlocks::BatchNeighborBlocks(
+    const BlockIndex& _block_index)
+    : block_index(_block_index) {
+  std::fill(blocks, blocks + 27, nullptr);
+  std::fill(looked_up, looked_up + 27, false);
+}
+
+template <typename VoxelType>
+GlobalIndex Interpolator<VoxelType>::getBatchBaseIndex(
+    const Point& pos, Point* voxel_offset) const {
+  DCHECK(voxel_offset != nullptr);
+  // Voxel centers are at half voxels, shift them to the grid points.
+  const Point scaled_pos =
+      pos * layer_->voxel_size_inv() - Point::Constant(0.5);
+  const Point base = scaled_pos.array().floor();
+  *voxel_offset = scaled_pos - base;
+  return base.cast<LongIndexElement>();
+}
+
+template <typename VoxelType>
+const VoxelType* Interpolator<VoxelType>::getBatchVoxel(
+    const VoxelIndex& voxel_index,
+    BatchNeighborBlocks* neighbor_blocks) const {
+  DCHECK(neighbor_blocks != nullptr);
+  const IndexElement vps = static_cast<IndexElement>(layer_->voxels_per_side());
+  VoxelIndex block_voxel_index = voxel_index;
+  size_t slot = 13u;
+  size_t slot_stride = 1u;
+  for (unsigned int i = 0u; i < 3u; ++i) {
+    if (block_voxel_index(i) < 0) {
+      block_voxel_index(i) += vps;
+      slot -= slot_stride;
+    } else if (block_voxel_index(i) >= vps) {
+      block_voxel_index(i) -= vps;
+      slot += slot_stride;
+    }
+    slot_stride *= 3u;
+  }
+  DCHECK((block_voxel_index.array() >= 0).all() &&
+         (block_voxel_index.array() < vps).all());
+
+  if (!neighbor_blocks->looked_up[slot]) {
+    const BlockIndex block_index =
+        neighbor_blocks->block_index +
+        BlockIndex(static_cast<IndexElement>(slot % 3u) - 1,
+                   static_cast<IndexElement>((slot / 3u) % 3u) - 1,
+                   static_cast<IndexElement>(slot / 9u) - 1);
+    neighbor_blocks->blocks[slot] =
+        layer_->getBlockPtrByIndex(block_index).get();
+    neighbor_blocks->looked_up[slot] = true;
+  }
+  const Block<VoxelType>* block = neighbor_blocks->blocks[slot];
+  if (block == nullptr) {
+    return nullptr;
+  }
+  return &block->getVoxelByVoxelIndex(block_voxel_index);
+}
+
+template <typename VoxelType>
+bool Interpolator<VoxelType>::getBatchDistanceAndGradient(
+    const Point& pos, const GradientMethod method,
+    BatchNeighborBlocks* neighbor_blocks, FloatingPoint* distance,
+    Point* gradient) const {
+  DCHECK(neighbor_blocks != nullptr);
+  DCHECK(distance != nullptr);
+  Point voxel_offset;
+  const GlobalIndex base_index = getBatchBaseIndex(pos, &voxel_offset);
+  const BlockIndex& block_index = neighbor_blocks->block_index;
+  const GlobalIndex block_origin_index =
+      getGlobalVoxelIndexFromBlockAndVoxelIndex(
+          block_index, VoxelIndex::Zero(), layer_->voxels_per_side());
+  const VoxelIndex base_voxel_index =
+      (base_index - block_origin_index).cast<IndexElement>();
+  if (method == GradientMethod::kTricubic) {
+    return getTricubicDistanceAndGradient(base_voxel_index, voxel_offset,
+                                          neighbor_blocks, distance, gradient);
+  }
+
+  // clang-format off
+  InterpVector q_vector;
+  q_vector <<
+      1,
+      voxel_offset[0],
+      voxel_offset[1],
+      voxel_offset[2],
+      voxel_offset[0] * voxel_offset[1],
+      voxel_offset[1] * voxel_offset[2],
+      voxel_offset[2] * voxel_offset[0],
+      voxel_offset[0] * voxel_offset[1] * voxel_offset[2];
+  // clang-format on
+
+  // Gathers the 8 voxels of the interpolation shifted by a voxel along the
+  // given axis and direction, sign 0 is no shift. Same corner order as
+  // setIndexes().
+  auto gather = [this, &base_voxel_index, neighbor_blocks](
+      const unsigned int axis, const int sign, InterpVector* data) {
+    for (unsigned int corner = 0u; corner < 8u; ++corner) {
+      VoxelIndex voxel_index =
+          base_voxel_index + VoxelIndex((corner >> 2u) & 1u,
+                                        (corner >> 1u) & 1u, corner & 1u);
+      voxel_index(axis) += sign;
+      const VoxelType* voxel = getBatchVoxel(voxel_index, neighbor_blocks);
+      if (voxel == nullptr || !utils::isObservedVoxel(*voxel)) {
+        return false;
+      }
+      (*data)[corner] = getVoxelSdf(*voxel);
+    }
+    return true;
+  };
+
+  InterpVector data;
+  if (!gather(0u, 0, &data)) {
+    return false;
+  }
+  *distance = interpData(q_vector, data);
+  if (gradient == nullptr) {
+    return true;
+  }
+
+  const FloatingPoint voxel_size = layer_->voxel_size();
+  if (method == GradientMethod::kTrilinear) {
+    // Derivatives of the Q vector along each axis, in voxels.
+    // clang-format off
+    InterpVector q_vector_dx;
+    q_vector_dx <<
+        0, 1, 0, 0,
+        voxel_offset[1],
+        0,
+        voxel_offset[2],
+        voxel_offset[1] * voxel_offset[2];
+    InterpVector q_vector_dy;
+    q_vector_dy <<
+        0, 0, 1, 0,
+        voxel_offset[0],
+        voxel_offset[2],
+        0,
+        voxel_offset[0] * voxel_offset[2];
+    InterpVector q_vector_dz;
+    q_vector_dz <<
+        0, 0, 0, 1,
+        0,
+        voxel_offset[1],
+        voxel_offset[0],
+        voxel_offset[0] * voxel_offset[1];
+    // clang-format on
+    *gradient = Point(interpData(q_vector_dx, data),
+                      interpData(q_vector_dy, data),
+                      interpData(q_vector_dz, data)) /
+                voxel_size;
+    return true;
+  }
+
+  // Central differences of the interpolation one voxel to either side, like
+  // getGradient(). The shifted voxels mostly overlap the unshifted ones, and
+  // all of them come from the blocks that are already looked up.
+  for (unsigned int i = 0u; i < 3u; ++i) {
+    InterpVector data_minus;
+    InterpVector data_plus;
+    if (!gather(i, -1, &data_minus) || !gather(i, 1, &data_plus)) {
+      return false;
+    }
+    (*gradient)(i) = (interpData(q_vector, data_plus) -
+                      interpData(q_vector, data_minus)) /
+                     (2 * voxel_size);
+  }
+  return true;
+}
+
+template <typename VoxelType>
+bool Interpolator<VoxelType>::getTricubicDistanceAndGradient(
+    const VoxelIndex& base_voxel_index, const Point& voxel_offset,
+    BatchNeighborBlocks* neighbor_blocks, FloatingPoint* distance,
+    Point* gradient) const {
+  DCHECK(distance != nullptr);
+  // Catmull-Rom weights of the 4 voxels along each axis and their
+  // derivatives. They reproduce linear distances exactly.
+  FloatingPoint weights[3][4];
+  FloatingPoint derivatives[3][4];
+  for (unsigned int i = 0u; i < 3u; ++i) {
+    const FloatingPoint t = voxel_offset[i];
+    const FloatingPoint t2 = t * t;
+    const FloatingPoint t3 = t2 * t;
+    weights[i][0] = 0.5f * (-t3 + 2.0f * t2 - t);
+    weights[i][1] = 0.5f * (3.0f * t3 - 5.0f * t2 + 2.0f);
+    weights[i][2] = 0.5f * (-3.0f * t3 + 4.0f * t2 + t);
+    weights[i][3] = 0.5f * (t3 - t2);
+    derivatives[i][0] = 0.5f * (-3.0f * t2 + 4.0f * t - 1.0f);
+    derivatives[i][1] = 0.5f * (9.0f * t2 - 10.0f * t);
+    derivatives[i][2] = 0.5f * (-9.0f * t2 + 8.0f * t + 1.0f);
+    derivatives[i][3] = 0.5f * (3.0f * t2 - 2.0f * t);
+  }
+
+  FloatingPoint value = 0.0f;
+  Point value_derivative = Point::Zero();
+  for (int z = 0; z < 4; ++z) {
+    for (int y = 0; y < 4; ++y) {
+      for (int x = 0; x < 4; ++x) {
+        const VoxelType* voxel = getBatchVoxel(
+            base_voxel_index + VoxelIndex(x - 1, y - 1, z - 1),
+            neighbor_blocks);
+        if (voxel == nullptr || !utils::isObservedVoxel(*voxel)) {
+          return false;
+        }
+        const FloatingPoint voxel_distance = getVoxelSdf(*voxel);
+        value += weights[0][x] * weights[1][y] * weights[2][z] * voxel_distance;
+        value_derivative +=
+            Point(derivatives[0][x] * weights[1][y] * weights[2][z],
+                  weights[0][x] * derivatives[1][y] * weights[2][z],
+                  weights[0][x] * weights[1][y] * derivatives[2][z]) *
+            voxel_distance;
+      }
+    }
+  }
+  *distance = value;
+  if (gradient != nullptr) {
+    *gradient = value_derivative * layer_->voxel_size_inv();
+  }
+  return true;
+}
+
 template <typename VoxelType>
 bool Interpolator<VoxelType>::setIndexes(const Point& pos,
                                          BlockIndex* block_index,
@@ -160,7 +490,7 @@ bool Interpolator<VoxelType>::setIndexes(const Point& pos,
   // get voxel index
   *block_index = layer_->computeBlockIndexFromCoordinates(pos);
   typename Layer<VoxelType>::BlockType::ConstPtr block_ptr =
-      layer_->getBlockPtrByIndex(*block_index);
+      getBlockPtrByIndex(*block_index);
   if (block_ptr == nullptr) {
     return false;
   }
@@ -231,7 +561,7 @@ bool Interpolator<VoxelType>::getVoxelsAndQVector(
   // for each voxel index
   for (size_t i = 0; i < static_cast<size_t>(voxel_indexes.cols()); ++i) {
     typename Layer<VoxelType>::BlockType::ConstPtr block_ptr =
-        layer_->getBlockPtrByIndex(block_index);
+        getBlockPtrByIndex(block_index);
     if (block_ptr == nullptr) {
       return false;
     }
@@ -247,7 +577,7 @@ bool Interpolator<VoxelType>::getVoxelsAndQVector(
           voxel_index(j) -= block_ptr->voxels_per_side();
         }
       }
-      block_ptr = layer_->getBlockPtrByIndex(new_block_index);
+      block_ptr = getBlockPtrByIndex(new_block_index);
       if (block_ptr == nullptr) {
         return false;
       }
@@ -304,7 +634,7 @@ bool Interpolator<VoxelType>::getNearestDistance(
   CHECK_NOTNULL(distance);
 
   typename Layer<VoxelType>::BlockType::ConstPtr block_ptr =
-      layer_->getBlockPtrByCoordinates(pos);
+      getBlockPtrByCoordinates(pos);
   if (block_ptr == nullptr) {
     return false;
   }
@@ -338,7 +668,7 @@ bool Interpolator<VoxelType>::getNearestWeight(const Point& pos,
   CHECK_NOTNULL(weight);
 
   typename Layer<VoxelType>::BlockType::ConstPtr block_ptr =
-      layer_->getBlockPtrByCoordinates(pos);
+      getBlockPtrByCoordinates(pos);
   if (block_ptr == nullptr) {
     return false;
   }
@@ -372,7 +702,7 @@ bool Interpolator<VoxelType>::getNearestVoxel(const Point& pos,
   CHECK_NOTNULL(voxel);
 
   typename Layer<VoxelType>::BlockType::ConstPtr block_ptr =
-      layer_->getBlockPtrByCoordinates(pos);
+      getBlockPtrByCoordinates(pos);
   if (block_ptr == nullptr) {
     return false;
   }
@@ -389,7 +719,7 @@ bool Interpolator<VoxelType>::getNearestDistanceAndWeight(
   CHECK_NOTNULL(weight);
 
   typename Layer<VoxelType>::BlockType::ConstPtr block_ptr =
-      layer_->getBlockPtrByCoordinates(pos);
+      getBlockPtrByCoordinates(pos);
   if (block_ptr == nullptr) {
     return false;
   }
@@ -454,7 +784,12 @@ inline FloatingPoint Interpolator<VoxelType>::interpMember(
   for (int i = 0; i < data.size(); ++i) {
     data[i] = static_cast<FloatingPoint>((*getter)(*voxels[i]));
   }
+  return interpData(q_vector, data);
+}
 
+template <typename VoxelType>
+inline FloatingPoint Interpolator<VoxelType>::interpData(
+    const InterpVector& q_vector, const InterpVector& data) {
   // FROM PAPER (http://spie.org/samples/PM159.pdf)
   // clang-format off
   static const InterpTable interp_table =
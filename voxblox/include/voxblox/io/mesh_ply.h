@@ -27,6 +27,7 @@
 #include <iostream>
 #include <string>
 
+#include "voxblox/io/ply_writer.h"
 #include "voxblox/mesh/mesh_layer.h"
 
 namespace voxblox {
@@ -47,12 +48,29 @@ bool outputMeshLayerAsPly(const std::string& filename,
 
 /**
  * @param connected_mesh if true vertices will be shared between triangles
+ * @param format binary files are much smaller and faster to write and read
  */
 bool outputMeshLayerAsPly(const std::string& filename,
                           const bool connected_mesh,
-                          const MeshLayer& mesh_layer);
+                          const MeshLayer& mesh_layer,
+                          const io::PlyFormat format = io::PlyFormat::kAscii);
+
+/**
+ * Writes the mesh layer block by block, without building the combined mesh in
+ * memory. The vertices and faces are buffered in two temporary files next to
+ * filename until the header can be written, which are removed afterwards.
+ * @param connected_mesh if true vertices will be shared between triangles
+ * within tiles of tile_size_in_blocks blocks per side, so only one tile is
+ * held in memory at a time. Vertices on tile borders are not merged.
+ */
+bool outputMeshLayerAsPlyStreamed(
+    const std::string& filename, const MeshLayer& mesh_layer,
+    const io::PlyFormat format = io::PlyFormat::kBinaryLittleEndian,
+    const bool connected_mesh = true, const size_t tile_size_in_blocks = 8u,
+    const FloatingPoint vertex_proximity_threshold = 1e-10);
 
-bool outputMeshAsPly(const std::string& filename, const Mesh& mesh);
+bool outputMeshAsPly(const std::string& filename, const Mesh& mesh,
+                     const io::PlyFormat format = io::PlyFormat::kAscii);
 
 }  // namespace voxblox
 
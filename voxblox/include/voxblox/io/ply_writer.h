@@ -1,8 +1,11 @@
 #ifndef VOXBLOX_IO_PLY_WRITER_H_
 #define VOXBLOX_IO_PLY_WRITER_H_
 
+#include <algorithm>
+#include <cstring>
 #include <fstream>  // NOLINT
 #include <string>
+#include <vector>
 
 #include <glog/logging.h>
 
@@ -11,6 +14,35 @@
 namespace voxblox {
 
 namespace io {
+
+/// Encoding of the body of a .ply file, the header is always ASCII.
+enum class PlyFormat { kAscii, kBinaryLittleEndian };
+
+inline const char* getPlyFormatString(const PlyFormat format) {
+  return (format == PlyFormat::kAscii) ? "ascii 1.0"
+                                       : "binary_little_endian 1.0";
+}
+
+/// Byte order of the host, known at compile time so no check is left at run
+/// time. Hosts that don't define __BYTE_ORDER__ are assumed little-endian.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+constexpr bool kIsBigEndianHost = true;
+#else
+constexpr bool kIsBigEndianHost = false;
+#endif
+
+/// Appends the bytes of the value in little-endian order.
+template <typename Type>
+inline void appendLittleEndian(const Type value, std::vector<char>* buffer) {
+  DCHECK(buffer != nullptr);
+  char bytes[sizeof(Type)];
+  std::memcpy(bytes, &value, sizeof(Type));
+  if (kIsBigEndianHost) {
+    std::reverse(bytes, bytes + sizeof(Type));
+  }
+  buffer->insert(buffer->end(), bytes, bytes + sizeof(Type));
+}
+
 /**
  * Writes a mesh to a .ply file. For reference on the format, see:
  *  http://paulbourke.net/dataformats/ply/
@@ -19,15 +51,17 @@ class PlyWriter {
  public:
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
-  explicit PlyWriter(const std::string& filename)
+  explicit PlyWriter(const std::string& filename,
+                     const PlyFormat format = PlyFormat::kAscii)
       : header_written_(false),
         parameters_set_(false),
         vertices_total_(0),
         vertices_written_(0),
         has_color_(false),
-        file_(filename) {}
+        format_(format),
+        file_(filename, std::ios::out | std::ios::binary) {}
 
-  virtual ~PlyWriter() {}
+  virtual ~PlyWriter() { flushBuffer(); }
 
   void addVerticesWithProperties(size_t num_vertices, bool has_color) {
     vertices_total_ = num_vertices;
@@ -50,20 +84,20 @@ class PlyWriter {
       return false;
     }
 
-    file_ << "ply" << std::endl;
-    file_ << "format ascii 1.0" << std::endl;
-    file_ << "element vertex " << vertices_total_ << std::endl;
-    file_ << "property float x" << std::endl;
-    file_ << "property float y" << std::endl;
-    file_ << "property float z" << std::endl;
+    file_ << "ply\n";
+    file_ << "format " << getPlyFormatString(format_) << "\n";
+    file_ << "element vertex " << vertices_total_ << "\n";
+    file_ << "property float x\n";
+    file_ << "property float y\n";
+    file_ << "property float z\n";
 
     if (has_color_) {
-      file_ << "property uchar red" << std::endl;
-      file_ << "property uchar green" << std::endl;
-      file_ << "property uchar blue" << std::endl;
+      file_ << "property uchar red\n";
+      file_ << "property uchar green\n";
+      file_ << "property uchar blue\n";
     }
 
-    file_ << "end_header" << std::endl;
+    file_ << "end_header\n";
 
     header_written_ = true;
     return true;
@@ -78,7 +112,12 @@ class PlyWriter {
     if (vertices_written_ >= vertices_total_ || has_color_) {
       return false;
     }
-    file_ << coord.x() << " " << coord.y() << " " << coord.z() << std::endl;
+    if (format_ == PlyFormat::kAscii) {
+      file_ << coord.x() << " " << coord.y() << " " << coord.z() << "\n";
+    } else {
+      appendCoordinates(coord);
+    }
+    ++vertices_written_;
     return true;
   }
 
@@ -91,13 +130,24 @@ class PlyWriter {
     if (vertices_written_ >= vertices_total_ || !has_color_) {
       return false;
     }
-    file_ << coord.x() << " " << coord.y() << " " << coord.z() << " ";
-    file_ << static_cast<int>(rgb.r) << " " << static_cast<int>(rgb.g) << " "
-          << static_cast<int>(rgb.b) << std::endl;
+    if (format_ == PlyFormat::kAscii) {
+      file_ << coord.x() << " " << coord.y() << " " << coord.z() << " ";
+      file_ << static_cast<int>(rgb.r) << " " << static_cast<int>(rgb.g) << " "
+            << static_cast<int>(rgb.b) << "\n";
+    } else {
+      appendCoordinates(coord);
+      buffer_.push_back(static_cast<char>(rgb.r));
+      buffer_.push_back(static_cast<char>(rgb.g));
+      buffer_.push_back(static_cast<char>(rgb.b));
+    }
+    ++vertices_written_;
     return true;
   }
 
-  void closeFile() { file_.close(); }
+  void closeFile() {
+    flushBuffer();
+    file_.close();
+  }
 
  private:
   bool header_written_;
@@ -105,9 +155,30 @@ class PlyWriter {
 
   size_t vertices_total_;
   size_t vertices_written_;
+  void appendCoordinates(const Point& coord) {
+    appendLittleEndian(static_cast<float>(coord.x()), &buffer_);
+    appendLittleEndian(static_cast<float>(coord.y()), &buffer_);
+    appendLittleEndian(static_cast<float>(coord.z()), &buffer_);
+    if (buffer_.size() >= kBufferSize) {
+      flushBuffer();
+    }
+  }
+
+  void flushBuffer() {
+    if (!buffer_.empty()) {
+      file_.write(buffer_.data(), buffer_.size());
+      buffer_.clear();
+    }
+  }
+
+  /// Binary vertices are collected and written in chunks of this many bytes.
+  static constexpr size_t kBufferSize = 1u << 16;
+
   bool has_color_;
+  PlyFormat format_;
 
   std::ofstream file_;
+  std::vector<char> buffer_;
 };
 
 }  // namespace io
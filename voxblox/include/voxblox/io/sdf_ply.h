@@ -167,7 +167,8 @@ template <typename VoxelType>
 bool outputLayerAsPly(const Layer<VoxelType>& layer,
                       const std::string& filename, PlyOutputTypes type,
                       const float sdf_color_range = 0.3f,
-                      const float max_sdf_value_to_output = 0.3f) {
+                      const float max_sdf_value_to_output = 0.3f,
+                      const PlyFormat format = PlyFormat::kAscii) {
   CHECK(!filename.empty());
   switch (type) {
     case PlyOutputTypes::kSdfColoredDistanceField: {
@@ -177,7 +178,7 @@ bool outputLayerAsPly(const Layer<VoxelType>& layer,
         return false;
       }
 
-      return outputMeshAsPly(filename, point_cloud);
+      return outputMeshAsPly(filename, point_cloud, format);
     }
     case PlyOutputTypes::kSdfIsosurface: {
       constexpr bool kConnectedMesh = false;
@@ -186,7 +187,7 @@ bool outputLayerAsPly(const Layer<VoxelType>& layer,
       if (!convertLayerToMesh(layer, &mesh, kConnectedMesh)) {
         return false;
       }
-      return outputMeshAsPly(filename, mesh);
+      return outputMeshAsPly(filename, mesh, format);
     }
     case PlyOutputTypes::kSdfIsosurfaceConnected: {
       constexpr bool kConnectedMesh = true;
@@ -195,7 +196,7 @@ bool outputLayerAsPly(const Layer<VoxelType>& layer,
       if (!convertLayerToMesh(layer, &mesh, kConnectedMesh)) {
         return false;
       }
-      return outputMeshAsPly(filename, mesh);
+      return outputMeshAsPly(filename, mesh, format);
     }
 
     default:
@@ -25,6 +25,7 @@
 
 #include <cstdint>
 #include <memory>
+#include <vector>
 
 #include "voxblox/core/common.h"
 
@@ -42,13 +43,25 @@ struct Mesh {
 
   static constexpr FloatingPoint kInvalidBlockSize = -1.0;
 
+  /// Bitmask over the sub-meshes, one bit per sub-brick of the block.
+  typedef uint64_t SubMeshMask;
+  static constexpr size_t kNumSubMeshes = 8u * sizeof(SubMeshMask);
+
   Mesh()
-      : block_size(kInvalidBlockSize), origin(Point::Zero()), updated(false) {
+      : block_size(kInvalidBlockSize),
+        origin(Point::Zero()),
+        updated(false),
+        updated_sub_meshes(0u),
+        lod_level(0u) {
     // Do nothing.
   }
 
   Mesh(FloatingPoint _block_size, const Point& _origin)
-      : block_size(_block_size), origin(_origin), updated(false) {
+      : block_size(_block_size),
+        origin(_origin),
+        updated(false),
+        updated_sub_meshes(0u),
+        lod_level(0u) {
     CHECK_GT(block_size, 0.0);
   }
   virtual ~Mesh() {}
@@ -57,6 +70,25 @@ struct Mesh {
   inline bool hasNormals() const { return !normals.empty(); }
   inline bool hasColors() const { return !colors.empty(); }
   inline bool hasTriangles() const { return !indices.empty(); }
+  inline bool hasSubMeshes() const { return !sub_mesh_offsets.empty(); }
+
+  /// Vertices [begin, end) of a sub-mesh. Only valid if hasSubMeshes().
+  inline size_t getSubMeshBegin(const size_t sub_mesh_index) const {
+    DCHECK(sub_mesh_index < kNumSubMeshes);
+    return sub_mesh_offsets[sub_mesh_index];
+  }
+  inline size_t getSubMeshEnd(const size_t sub_mesh_index) const {
+    DCHECK(sub_mesh_index < kNumSubMeshes);
+    return sub_mesh_offsets[sub_mesh_index + 1u];
+  }
+
+  /// Number of levels of detail, including the full resolution mesh itself.
+  inline size_t getNumLodLevels() const { return lod_meshes.size() + 1u; }
+  /// The mesh at the given level of detail, the finest one being level 0.
+  inline const Mesh& getLodMesh(const size_t level) const {
+    DCHECK(level < getNumLodLevels());
+    return (level == 0u) ? *this : *lod_meshes[level - 1u];
+  }
 
   inline size_t size() const { return vertices.size(); }
   inline size_t getMemorySize() const {
@@ -67,9 +99,18 @@ struct Mesh {
     size_bytes +=
         sizeof(VertexIndexList) + indices.size() * sizeof(VertexIndex);
 
+    size_bytes += sizeof(std::vector<size_t>) +
+                  sub_mesh_offsets.size() * sizeof(size_t);
+
+    for (const Ptr& lod_mesh : lod_meshes) {
+      size_bytes += sizeof(Ptr) + lod_mesh->getMemorySize();
+    }
+
     size_bytes += sizeof(block_size);
     size_bytes += sizeof(origin);
     size_bytes += sizeof(updated);
+    size_bytes += sizeof(updated_sub_meshes);
+    size_bytes += sizeof(lod_level);
     return size_bytes;
   }
 
@@ -78,6 +119,9 @@ struct Mesh {
     normals.clear();
     colors.clear();
     indices.clear();
+    sub_mesh_offsets.clear();
+    lod_meshes.clear();
+    updated_sub_meshes = 0u;
   }
 
   inline void clearTriangles() { indices.clear(); }
@@ -147,6 +191,8 @@ struct Mesh {
     for (const size_t index : other_mesh.indices) {
       indices.push_back(index + num_vertices_before);
     }
+    // The vertices are no longer grouped by sub-brick.
+    sub_mesh_offsets.clear();
   }
 
   Pointcloud vertices;
@@ -154,10 +200,33 @@ struct Mesh {
   Pointcloud normals;
   Colors colors;
 
+  /**
+   * Optional split of a block mesh into one sub-mesh per sub-brick of the
+   * block, see Block::SubBrickMask. If set, it holds kNumSubMeshes + 1 entries
+   * and the vertices of sub-mesh i are [sub_mesh_offsets[i],
+   * sub_mesh_offsets[i + 1]). This allows re-meshing and publishing only the
+   * parts of a block that changed.
+   */
+  std::vector<size_t> sub_mesh_offsets;
+
+  /**
+   * Coarser versions of the mesh, lod_meshes[l - 1] being level of detail l,
+   * see MeshIntegratorConfig::num_lod_levels. They are stored as separate
+   * triangles and always replaced as a whole.
+   */
+  std::vector<Ptr> lod_meshes;
+
   FloatingPoint block_size;
   Point origin;
 
   bool updated;
+  /**
+   * If updated is set, the sub-meshes that changed since the mesh was last
+   * published. Zero means the whole mesh changed.
+   */
+  SubMeshMask updated_sub_meshes;
+  /// The level of detail the mesh was last published at.
+  size_t lod_level;
 };
 
 }  // namespace voxblox
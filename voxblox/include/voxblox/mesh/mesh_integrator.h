@@ -24,6 +24,7 @@
 #define VOXBLOX_MESH_MESH_INTEGRATOR_H_
 
 #include <algorithm>
+#include <limits>
 #include <list>
 #include <memory>
 #include <string>
@@ -52,6 +53,27 @@ struct MeshIntegratorConfig {
 
   size_t integrator_threads = std::thread::hardware_concurrency();
 
+  /**
+   * Split the block meshes into one sub-mesh per sub-brick and only re-mesh
+   * the sub-bricks that contain a cube with an updated corner voxel.
+   */
+  bool incremental_meshing = false;
+
+  /**
+   * Share the vertices between the triangles of a block mesh, instead of
+   * giving every triangle its own vertices. Doesn't apply to the sub-meshes
+   * of incremental meshing.
+   */
+  bool share_vertices = false;
+
+  /**
+   * Number of coarser levels of detail kept per block mesh, see
+   * Mesh::lod_meshes. Level l is meshed from every 2^l-th voxel of the block,
+   * so it has roughly 4^-l times the triangles of the full resolution mesh.
+   * Levels that don't divide the voxels per side are skipped.
+   */
+  size_t num_lod_levels = 0u;
+
   inline std::string print() const {
     std::stringstream ss;
     // clang-format off
@@ -59,6 +81,9 @@ struct MeshIntegratorConfig {
     ss << " - use_color:                 " << use_color << "\n";
     ss << " - min_weight:                " << min_weight << "\n";
     ss << " - integrator_threads:        " << integrator_threads << "\n";
+    ss << " - incremental_meshing:       " << incremental_meshing << "\n";
+    ss << " - share_vertices:            " << share_vertices << "\n";
+    ss << " - num_lod_levels:            " << num_lod_levels << "\n";
     ss << "==============================================================\n";
     // clang-format on
     return ss.str();
@@ -74,6 +99,41 @@ class MeshIntegrator {
  public:
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
+  typedef typename Block<VoxelType>::SubBrickMask SubBrickMask;
+  typedef typename AnyIndexHashMapType<SubBrickMask>::type SubBrickMaskMap;
+
+  /**
+   * The SDF values of a block padded by one voxel towards its upper
+   * neighbors, which covers the corners of all cubes of the block. Looking up
+   * the neighbor blocks once per block saves the hash lookups per border
+   * cube, and the cubes can be extracted from one contiguous array.
+   */
+  struct SdfHalo {
+    /// The block itself followed by its neighbors at offsets (x, y, z) in
+    /// {0, 1}^3, indexed by x + 2 * y + 4 * z. Missing blocks are nullptr.
+    const Block<VoxelType>* blocks[8];
+    IndexElement voxels_per_side = 0;
+    /// voxels_per_side + 1.
+    IndexElement side = 0;
+    std::vector<FloatingPoint> sdf;
+    /// Whether the voxel is observed, i.e. its SDF value can be used.
+    std::vector<uint8_t> valid;
+
+    /// Scratch space of extractMeshFromSdfHalo().
+    static constexpr size_t kNoVertex = std::numeric_limits<size_t>::max();
+    VoxelIndex edges_begin;
+    AnyIndex num_edge_corners;
+    std::vector<size_t> edge_vertices;
+    Pointcloud edge_points;
+    Pointcloud edge_normals;
+    std::vector<uint8_t> cube_configs;
+
+    inline size_t getIndex(const IndexElement x, const IndexElement y,
+                           const IndexElement z) const {
+      return x + side * (y + side * z);
+    }
+  };
+
   void initFromSdfLayer(const Layer<VoxelType>& sdf_layer) {
     voxel_size_ = sdf_layer.voxel_size();
     block_size_ = sdf_layer.block_size();
@@ -135,6 +195,11 @@ class MeshIntegrator {
         << "If you would like to modify the updated flag in the blocks, please "
         << "use the constructor that provides a non-const link to the sdf "
         << "layer!";
+    if (config_.incremental_meshing) {
+      generateSubBrickMeshes(only_mesh_updated_blocks, clear_updated_flag);
+      return;
+    }
+
     BlockIndexList all_tsdf_blocks;
     if (only_mesh_updated_blocks) {
       sdf_layer_const_->getAllUpdatedBlocks(Update::kMesh, &all_tsdf_blocks);
@@ -154,88 +219,490 @@ class MeshIntegrator {
     for (size_t i = 0; i < config_.integrator_threads; ++i) {
       integration_threads.emplace_back(
           &MeshIntegrator::generateMeshBlocksFunction, this, all_tsdf_blocks,
-          clear_updated_flag, index_getter.get());
+          index_getter.get());
     }
 
     for (std::thread& thread : integration_threads) {
       thread.join();
     }
+
+    if (clear_updated_flag) {
+      resetMeshUpdatedFlags(all_tsdf_blocks);
+    }
   }
 
-  void generateMeshBlocksFunction(const BlockIndexList& all_tsdf_blocks,
-                                  bool clear_updated_flag,
-                                  ThreadSafeIndex* index_getter) {
-    DCHECK(index_getter != nullptr);
-    CHECK(!clear_updated_flag || (sdf_layer_mutable_ != nullptr))
+  /**
+   * Incremental version of generateMesh(). Only re-meshes the sub-bricks that
+   * contain a cube with a corner voxel in an updated sub-brick, see
+   * Layer::getUpdatedSubBricks(). The cubes on the lower faces of a block
+   * belong to its neighbors, so these are updated as well.
+   */
+  void generateSubBrickMeshes(bool only_mesh_updated_blocks,
+                              bool clear_updated_flag) {
+    SubBrickMaskMap sub_bricks_to_mesh;
+    BlockIndexList tsdf_blocks;
+    if (only_mesh_updated_blocks) {
+      sdf_layer_const_->getAllUpdatedBlocks(Update::kMesh, &tsdf_blocks);
+      for (const BlockIndex& block_index : tsdf_blocks) {
+        const Block<VoxelType>& block =
+            sdf_layer_const_->getBlockByIndex(block_index);
+        addSubBricksWithUpdatedCubes(
+            block_index,
+            sdf_layer_const_->getUpdatedSubBricks(block_index, Update::kMesh),
+            block.num_sub_bricks_per_side(), &sub_bricks_to_mesh);
+      }
+    } else {
+      sdf_layer_const_->getAllAllocatedBlocks(&tsdf_blocks);
+      for (const BlockIndex& block_index : tsdf_blocks) {
+        sub_bricks_to_mesh[block_index] = Block<VoxelType>::kAllSubBricks;
+      }
+    }
+
+    BlockIndexList blocks_to_mesh;
+    std::vector<SubBrickMask> sub_brick_masks;
+    blocks_to_mesh.reserve(sub_bricks_to_mesh.size());
+    sub_brick_masks.reserve(sub_bricks_to_mesh.size());
+    for (const std::pair<const BlockIndex, SubBrickMask>& kv :
+         sub_bricks_to_mesh) {
+      blocks_to_mesh.push_back(kv.first);
+      sub_brick_masks.push_back(kv.second);
+      mesh_layer_->allocateMeshPtrByIndex(kv.first);
+    }
+
+    std::unique_ptr<ThreadSafeIndex> index_getter(
+        new MixedThreadSafeIndex(blocks_to_mesh.size()));
+
+    std::list<std::thread> integration_threads;
+    for (size_t i = 0; i < config_.integrator_threads; ++i) {
+      integration_threads.emplace_back(
+          &MeshIntegrator::generateSubBrickMeshesFunction, this,
+          blocks_to_mesh, sub_brick_masks, index_getter.get());
+    }
+
+    for (std::thread& thread : integration_threads) {
+      thread.join();
+    }
+
+    if (clear_updated_flag) {
+      resetMeshUpdatedFlags(blocks_to_mesh);
+    }
+  }
+
+  /**
+   * Clears the mesh update flags of the blocks. This is done through the
+   * layer after the meshing threads are done, as the layer keeps the flags
+   * of blocks shared with snapshots, see Layer::getUpdatedSubBricks().
+   */
+  void resetMeshUpdatedFlags(const BlockIndexList& tsdf_blocks) {
+    CHECK(sdf_layer_mutable_ != nullptr)
         << "If you would like to modify the updated flag in the blocks, please "
         << "use the constructor that provides a non-const link to the sdf "
         << "layer!";
+    for (const BlockIndex& block_index : tsdf_blocks) {
+      sdf_layer_mutable_->resetUpdated(block_index, Update::kMesh);
+    }
+  }
+
+  /**
+   * Adds the sub-bricks whose cubes have a corner voxel in one of the updated
+   * sub-bricks of the block. The cubes of a voxel are the ones with their
+   * minimum corner at the voxel or one voxel below it along any axis.
+   */
+  void addSubBricksWithUpdatedCubes(const BlockIndex& block_index,
+                                    const SubBrickMask updated_sub_bricks,
+                                    const size_t num_sub_bricks_per_side,
+                                    SubBrickMaskMap* sub_bricks_to_mesh) const {
+    DCHECK(sub_bricks_to_mesh != nullptr);
+    constexpr IndexElement kSubBricksPerSide =
+        Block<VoxelType>::kSubBricksPerSide;
+    const IndexElement last_sub_brick =
+        static_cast<IndexElement>(num_sub_bricks_per_side) - 1;
+
+    for (IndexElement bit = 0; bit < kSubBricksPerSide * kSubBricksPerSide *
+                                         kSubBricksPerSide;
+         ++bit) {
+      if ((updated_sub_bricks >> bit & 1u) == 0u) {
+        continue;
+      }
+      const AnyIndex sub_brick(bit % kSubBricksPerSide,
+                               (bit / kSubBricksPerSide) % kSubBricksPerSide,
+                               bit / (kSubBricksPerSide * kSubBricksPerSide));
+      if ((sub_brick.array() > last_sub_brick).any()) {
+        continue;
+      }
+
+      for (unsigned int i = 0u; i < 8u; ++i) {
+        AnyIndex cube_sub_brick = sub_brick - cube_index_offsets_.col(i);
+        BlockIndex neighbor_index = block_index;
+        for (unsigned int j = 0u; j < 3u; ++j) {
+          if (cube_sub_brick(j) < 0) {
+            cube_sub_brick(j) = last_sub_brick;
+            --neighbor_index(j);
+          }
+        }
+        if (neighbor_index != block_index &&
+            !sdf_layer_const_->hasBlock(neighbor_index)) {
+          continue;
+        }
+        (*sub_bricks_to_mesh)[neighbor_index] |=
+            static_cast<SubBrickMask>(1u)
+            << (cube_sub_brick.x() +
+                kSubBricksPerSide * (cube_sub_brick.y() +
+                                     kSubBricksPerSide * cube_sub_brick.z()));
+      }
+    }
+  }
+
+  void generateSubBrickMeshesFunction(
+      const BlockIndexList& tsdf_blocks,
+      const std::vector<SubBrickMask>& sub_brick_masks,
+      ThreadSafeIndex* index_getter) {
+    DCHECK(index_getter != nullptr);
+    DCHECK_EQ(tsdf_blocks.size(), sub_brick_masks.size());
+
+    size_t list_idx;
+    while (index_getter->getNextIndex(&list_idx)) {
+      const BlockIndex& block_idx = tsdf_blocks[list_idx];
+      updateMeshForSubBricks(block_idx, sub_brick_masks[list_idx]);
+    }
+  }
+
+  void generateMeshBlocksFunction(const BlockIndexList& all_tsdf_blocks,
+                                  ThreadSafeIndex* index_getter) {
+    DCHECK(index_getter != nullptr);
 
     size_t list_idx;
     while (index_getter->getNextIndex(&list_idx)) {
       const BlockIndex& block_idx = all_tsdf_blocks[list_idx];
       updateMeshForBlock(block_idx);
-      if (clear_updated_flag) {
-        typename Block<VoxelType>::Ptr block =
-            sdf_layer_mutable_->getBlockPtrByIndex(block_idx);
-        block->updated().reset(Update::kMesh);
-      }
     }
   }
 
   void extractBlockMesh(typename Block<VoxelType>::ConstPtr block,
                         Mesh::Ptr mesh) {
     DCHECK(block != nullptr);
+    SdfHalo halo;
+    initSdfHalo(block->block_index(), *block, &halo);
+    extractBlockMesh(*block, &halo, mesh.get());
+  }
+
+  /// Fills the whole halo, which must be initialized for the block.
+  void extractBlockMesh(const Block<VoxelType>& block, SdfHalo* halo,
+                        Mesh* mesh) {
+    DCHECK(halo != nullptr);
+    DCHECK(mesh != nullptr);
+
+    const IndexElement vps = block.voxels_per_side();
+    const VoxelIndex begin = VoxelIndex::Zero();
+    const VoxelIndex end = VoxelIndex::Constant(vps);
+    fillSdfHalo(begin, end, halo);
+
+    VertexIndex next_mesh_index = mesh->vertices.size();
+    extractMeshFromSdfHalo(block, config_.share_vertices, begin, end, halo,
+                           &next_mesh_index, mesh);
+  }
+
+  /**
+   * Extracts the cubes with their minimum corner inside the sub-brick. The
+   * halo must be initialized for the block.
+   */
+  void extractSubBrickMesh(const Block<VoxelType>& block,
+                           const size_t sub_brick_index, SdfHalo* halo,
+                           Mesh* mesh) {
+    DCHECK(halo != nullptr);
     DCHECK(mesh != nullptr);
+    constexpr size_t kSubBricksPerSide = Block<VoxelType>::kSubBricksPerSide;
+    const IndexElement vps = block.voxels_per_side();
+    const IndexElement sub_brick_size = block.sub_brick_voxels_per_side();
+
+    const VoxelIndex begin =
+        sub_brick_size *
+        VoxelIndex(sub_brick_index % kSubBricksPerSide,
+                   (sub_brick_index / kSubBricksPerSide) % kSubBricksPerSide,
+                   sub_brick_index / (kSubBricksPerSide * kSubBricksPerSide));
+    if ((begin.array() >= vps).any()) {
+      return;
+    }
+    const VoxelIndex end =
+        (begin.array() + sub_brick_size).min(vps).matrix();
+
+    fillSdfHalo(begin, end, halo);
+    // Sub-meshes are stored as separate triangles, see Mesh::sub_mesh_offsets.
+    constexpr bool kShareVertices = false;
+    VertexIndex next_mesh_index = mesh->vertices.size();
+    extractMeshFromSdfHalo(block, kShareVertices, begin, end, halo,
+                           &next_mesh_index, mesh);
+  }
 
-    IndexElement vps = block->voxels_per_side();
-    VertexIndex next_mesh_index = 0;
-
-    VoxelIndex voxel_index;
-    for (voxel_index.x() = 0; voxel_index.x() < vps - 1; ++voxel_index.x()) {
-      for (voxel_index.y() = 0; voxel_index.y() < vps - 1; ++voxel_index.y()) {
-        for (voxel_index.z() = 0; voxel_index.z() < vps - 1;
-             ++voxel_index.z()) {
-          Point coords = block->computeCoordinatesFromVoxelIndex(voxel_index);
-          extractMeshInsideBlock(*block, voxel_index, coords, &next_mesh_index,
-                                 mesh.get());
+  /// Looks up the upper neighbors of the block and allocates the halo.
+  void initSdfHalo(const BlockIndex& block_index,
+                   const Block<VoxelType>& block, SdfHalo* halo) const {
+    DCHECK(halo != nullptr);
+    halo->blocks[0] = &block;
+    for (unsigned int i = 1u; i < 8u; ++i) {
+      const BlockIndex neighbor_index =
+          block_index + BlockIndex(i & 1u, (i >> 1) & 1u, (i >> 2) & 1u);
+      typename Block<VoxelType>::ConstPtr neighbor_block =
+          sdf_layer_const_->getBlockPtrByIndex(neighbor_index);
+      halo->blocks[i] = neighbor_block.get();
+    }
+
+    halo->voxels_per_side = block.voxels_per_side();
+    halo->side = halo->voxels_per_side + 1;
+    const size_t num_voxels = halo->side * halo->side * halo->side;
+    halo->sdf.assign(num_voxels, 0.0f);
+    halo->valid.assign(num_voxels, 0u);
+  }
+
+  /// Copies the corner voxels of the cubes [begin, end) into the halo.
+  void fillSdfHalo(const VoxelIndex& begin, const VoxelIndex& end,
+                   SdfHalo* halo) const {
+    DCHECK(halo != nullptr);
+    const IndexElement vps = halo->voxels_per_side;
+    for (IndexElement z = begin.z(); z <= end.z(); ++z) {
+      const bool next_z = z == vps;
+      const IndexElement local_z = next_z ? 0 : z;
+      for (IndexElement y = begin.y(); y <= end.y(); ++y) {
+        const bool next_y = y == vps;
+        const IndexElement local_y = next_y ? 0 : y;
+        const size_t row_index = halo->getIndex(0, y, z);
+        const size_t local_row_index = vps * (local_y + vps * local_z);
+        for (IndexElement x = begin.x(); x <= end.x(); ++x) {
+          const bool next_x = x == vps;
+          const Block<VoxelType>* block =
+              halo->blocks[next_x + 2 * next_y + 4 * next_z];
+          const size_t index = row_index + x;
+          if (block == nullptr) {
+            halo->valid[index] = 0u;
+            continue;
+          }
+          const VoxelType& voxel = block->getVoxelByLinearIndex(
+              local_row_index + (next_x ? 0 : x));
+          halo->valid[index] = utils::getSdfIfValid(voxel, config_.min_weight,
+                                                    &(halo->sdf[index]));
         }
       }
     }
+  }
 
-    // Max X plane
-    // takes care of edge (x_max, y_max, z),
-    // takes care of edge (x_max, y, z_max).
-    voxel_index.x() = vps - 1;
-    for (voxel_index.z() = 0; voxel_index.z() < vps; voxel_index.z()++) {
-      for (voxel_index.y() = 0; voxel_index.y() < vps; voxel_index.y()++) {
-        Point coords = block->computeCoordinatesFromVoxelIndex(voxel_index);
-        extractMeshOnBorder(*block, voxel_index, coords, &next_mesh_index,
-                            mesh.get());
+  /**
+   * Slice-based marching cubes over the cubes with their minimum corner in
+   * [begin, end), reading the corners from the filled halo. Border and
+   * interior cubes are handled the same way. The configurations of a row of
+   * cubes are computed in one branch-free loop, and each edge vertex is only
+   * interpolated once and then shared by all cubes of the edge. If
+   * share_vertices is set, the triangles index these shared vertices and each
+   * vertex normal is the average of its triangles' normals. Otherwise every
+   * triangle gets its own vertices, as with MarchingCubes::meshCube().
+   */
+  void extractMeshFromSdfHalo(const Block<VoxelType>& block,
+                              const bool share_vertices,
+                              const VoxelIndex& begin, const VoxelIndex& end,
+                              SdfHalo* halo, VertexIndex* next_mesh_index,
+                              Mesh* mesh) const {
+    DCHECK(halo != nullptr);
+    DCHECK(next_mesh_index != nullptr);
+    DCHECK(mesh != nullptr);
+
+    const AnyIndex num_cubes = end - begin;
+    if ((num_cubes.array() <= 0).any()) {
+      return;
+    }
+    halo->edges_begin = begin;
+    halo->num_edge_corners = num_cubes + AnyIndex::Ones();
+    halo->edge_vertices.assign(3u * halo->num_edge_corners.prod(),
+                               SdfHalo::kNoVertex);
+    halo->edge_points.clear();
+    halo->edge_normals.clear();
+    halo->cube_configs.resize(num_cubes.x());
+
+    for (IndexElement z = begin.z(); z < end.z(); ++z) {
+      for (IndexElement y = begin.y(); y < end.y(); ++y) {
+        // The corners of the row of cubes, see cube_index_offsets_ for their
+        // order.
+        const size_t index_00 = halo->getIndex(begin.x(), y, z);
+        const size_t index_10 = halo->getIndex(begin.x(), y + 1, z);
+        const size_t index_01 = halo->getIndex(begin.x(), y, z + 1);
+        const size_t index_11 = halo->getIndex(begin.x(), y + 1, z + 1);
+        const FloatingPoint* sdf_00 = &halo->sdf[index_00];
+        const FloatingPoint* sdf_10 = &halo->sdf[index_10];
+        const FloatingPoint* sdf_01 = &halo->sdf[index_01];
+        const FloatingPoint* sdf_11 = &halo->sdf[index_11];
+        const uint8_t* valid_00 = &halo->valid[index_00];
+        const uint8_t* valid_10 = &halo->valid[index_10];
+        const uint8_t* valid_01 = &halo->valid[index_01];
+        const uint8_t* valid_11 = &halo->valid[index_11];
+        uint8_t* cube_configs = halo->cube_configs.data();
+
+        // Branch-free, so the compiler can vectorize it. Cubes with
+        // unobserved corners get the empty configuration.
+        for (IndexElement i = 0; i < num_cubes.x(); ++i) {
+          const uint8_t config = static_cast<uint8_t>(
+              (sdf_00[i] < 0.0f) | (sdf_00[i + 1] < 0.0f) << 1 |
+              (sdf_10[i + 1] < 0.0f) << 2 | (sdf_10[i] < 0.0f) << 3 |
+              (sdf_01[i] < 0.0f) << 4 | (sdf_01[i + 1] < 0.0f) << 5 |
+              (sdf_11[i + 1] < 0.0f) << 6 | (sdf_11[i] < 0.0f) << 7);
+          const uint8_t all_neighbors_observed =
+              valid_00[i] & valid_00[i + 1] & valid_10[i + 1] & valid_10[i] &
+              valid_01[i] & valid_01[i + 1] & valid_11[i + 1] & valid_11[i];
+          cube_configs[i] =
+              config & static_cast<uint8_t>(-all_neighbors_observed);
+        }
+
+        for (IndexElement i = 0; i < num_cubes.x(); ++i) {
+          const int* table_row = MarchingCubes::kTriangleTable[cube_configs[i]];
+          const VoxelIndex cube_index(begin.x() + i, y, z);
+          for (int table_col = 0; table_row[table_col] != -1;
+               table_col += 3) {
+            // Reverse the order of the table, as MarchingCubes::meshCube.
+            const size_t v0 =
+                getEdgeVertex(block, cube_index, table_row[table_col + 2], halo);
+            const size_t v1 =
+                getEdgeVertex(block, cube_index, table_row[table_col + 1], halo);
+            const size_t v2 =
+                getEdgeVertex(block, cube_index, table_row[table_col], halo);
+            const Point& p0 = halo->edge_points[v0];
+            const Point& p1 = halo->edge_points[v1];
+            const Point& p2 = halo->edge_points[v2];
+            const Point normal = (p1 - p0).cross(p2 - p0).normalized();
+
+            if (share_vertices) {
+              mesh->indices.push_back(*next_mesh_index + v0);
+              mesh->indices.push_back(*next_mesh_index + v1);
+              mesh->indices.push_back(*next_mesh_index + v2);
+              halo->edge_normals[v0] += normal;
+              halo->edge_normals[v1] += normal;
+              halo->edge_normals[v2] += normal;
+            } else {
+              mesh->vertices.push_back(p0);
+              mesh->vertices.push_back(p1);
+              mesh->vertices.push_back(p2);
+              mesh->indices.push_back(*next_mesh_index);
+              mesh->indices.push_back(*next_mesh_index + 1);
+              mesh->indices.push_back(*next_mesh_index + 2);
+              mesh->normals.push_back(normal);
+              mesh->normals.push_back(normal);
+              mesh->normals.push_back(normal);
+              *next_mesh_index += 3;
+            }
+          }
+        }
       }
     }
 
-    // Max Y plane.
-    // takes care of edge (x, y_max, z_max),
-    // without corner (x_max, y_max, z_max).
-    voxel_index.y() = vps - 1;
-    for (voxel_index.z() = 0; voxel_index.z() < vps; voxel_index.z()++) {
-      for (voxel_index.x() = 0; voxel_index.x() < vps - 1; voxel_index.x()++) {
-        Point coords = block->computeCoordinatesFromVoxelIndex(voxel_index);
-        extractMeshOnBorder(*block, voxel_index, coords, &next_mesh_index,
-                            mesh.get());
+    if (share_vertices) {
+      for (size_t i = 0u; i < halo->edge_points.size(); ++i) {
+        mesh->vertices.push_back(halo->edge_points[i]);
+        const FloatingPoint length = halo->edge_normals[i].norm();
+        if (length > kEpsilon) {
+          mesh->normals.push_back(halo->edge_normals[i] / length);
+        } else {
+          mesh->normals.push_back(Point(0.0f, 0.0f, 1.0f));
+        }
       }
+      *next_mesh_index += halo->edge_points.size();
     }
+  }
 
-    // Max Z plane.
-    voxel_index.z() = vps - 1;
-    for (voxel_index.y() = 0; voxel_index.y() < vps - 1; voxel_index.y()++) {
-      for (voxel_index.x() = 0; voxel_index.x() < vps - 1; voxel_index.x()++) {
-        Point coords = block->computeCoordinatesFromVoxelIndex(voxel_index);
-        extractMeshOnBorder(*block, voxel_index, coords, &next_mesh_index,
-                            mesh.get());
+  /**
+   * Returns the index of the vertex on an edge of the cube in
+   * halo->edge_points, interpolating it if no other cube did so yet. Edges
+   * are identified by their lower corner and their axis, so they are always
+   * interpolated in the same direction.
+   */
+  size_t getEdgeVertex(const Block<VoxelType>& block,
+                       const VoxelIndex& cube_index, const int edge_index,
+                       SdfHalo* halo) const {
+    DCHECK(halo != nullptr);
+    DCHECK_GE(edge_index, 0);
+    DCHECK_LT(edge_index, 12);
+    const int* pair = MarchingCubes::kEdgeIndexPairs[edge_index];
+    const VoxelIndex corner_a = cube_index + cube_index_offsets_.col(pair[0]);
+    const VoxelIndex corner_b = cube_index + cube_index_offsets_.col(pair[1]);
+    const VoxelIndex lower_corner = corner_a.cwiseMin(corner_b);
+    const VoxelIndex upper_corner = corner_a.cwiseMax(corner_b);
+    const int axis = (corner_a.x() != corner_b.x())
+                         ? 0
+                         : ((corner_a.y() != corner_b.y()) ? 1 : 2);
+
+    const AnyIndex local_corner = lower_corner - halo->edges_begin;
+    const size_t edge_key =
+        3u * (local_corner.x() +
+              halo->num_edge_corners.x() *
+                  (local_corner.y() +
+                   halo->num_edge_corners.y() * local_corner.z())) +
+        axis;
+    DCHECK_LT(edge_key, halo->edge_vertices.size());
+
+    size_t& vertex_index = halo->edge_vertices[edge_key];
+    if (vertex_index == SdfHalo::kNoVertex) {
+      vertex_index = halo->edge_points.size();
+      halo->edge_points.push_back(MarchingCubes::interpolateVertex(
+          block.computeCoordinatesFromVoxelIndex(lower_corner),
+          block.computeCoordinatesFromVoxelIndex(upper_corner),
+          halo->sdf[halo->getIndex(lower_corner.x(), lower_corner.y(),
+                                   lower_corner.z())],
+          halo->sdf[halo->getIndex(upper_corner.x(), upper_corner.y(),
+                                   upper_corner.z())]));
+      halo->edge_normals.push_back(Point::Zero());
+    }
+    return vertex_index;
+  }
+
+  /**
+   * Re-extracts the sub-meshes of the given sub-bricks and keeps the others.
+   * Meshes that are not split into sub-meshes yet are extracted as a whole.
+   */
+  virtual void updateMeshForSubBricks(const BlockIndex& block_index,
+                                      SubBrickMask sub_bricks) {
+    Mesh::Ptr mesh = mesh_layer_->getMeshPtrByIndex(block_index);
+    typename Block<VoxelType>::ConstPtr block =
+        sdf_layer_const_->getBlockPtrByIndex(block_index);
+
+    if (!block) {
+      LOG(ERROR) << "Trying to mesh a non-existent block at index: "
+                 << block_index.transpose();
+      return;
+    }
+    if (!mesh->hasSubMeshes()) {
+      sub_bricks = Block<VoxelType>::kAllSubBricks;
+    }
+
+    SdfHalo halo;
+    initSdfHalo(block_index, *block, &halo);
+
+    Mesh new_mesh;
+    new_mesh.sub_mesh_offsets.resize(Mesh::kNumSubMeshes + 1u);
+    Mesh sub_mesh;
+    for (size_t i = 0u; i < Mesh::kNumSubMeshes; ++i) {
+      new_mesh.sub_mesh_offsets[i] = new_mesh.vertices.size();
+      if ((sub_bricks >> i & 1u) != 0u) {
+        sub_mesh.clear();
+        extractSubBrickMesh(*block, i, &halo, &sub_mesh);
+        if (config_.use_color) {
+          updateMeshColor(*block, &sub_mesh);
+        }
+        appendVertices(sub_mesh, 0u, sub_mesh.vertices.size(), &new_mesh);
+      } else {
+        appendVertices(*mesh, mesh->getSubMeshBegin(i), mesh->getSubMeshEnd(i),
+                       &new_mesh);
       }
     }
+    new_mesh.sub_mesh_offsets.back() = new_mesh.vertices.size();
+
+    mesh->vertices.swap(new_mesh.vertices);
+    mesh->normals.swap(new_mesh.normals);
+    mesh->colors.swap(new_mesh.colors);
+    mesh->indices.swap(new_mesh.indices);
+    mesh->sub_mesh_offsets.swap(new_mesh.sub_mesh_offsets);
+    updateLodMeshes(*block, sub_bricks, &halo, mesh.get());
+
+    if (!mesh->updated) {
+      mesh->updated_sub_meshes = sub_bricks;
+    } else if (mesh->updated_sub_meshes != 0u) {
+      mesh->updated_sub_meshes |= sub_bricks;
+    }
+    mesh->updated = true;
   }
 
   virtual void updateMeshForBlock(const BlockIndex& block_index) {
@@ -251,111 +718,127 @@ class MeshIntegrator {
                  << block_index.transpose();
       return;
     }
-    extractBlockMesh(block, mesh);
+    SdfHalo halo;
+    initSdfHalo(block_index, *block, &halo);
+    extractBlockMesh(*block, &halo, mesh.get());
     // Update colors if needed.
     if (config_.use_color) {
       updateMeshColor(*block, mesh.get());
     }
+    updateLodMeshes(*block, Block<VoxelType>::kAllSubBricks, &halo,
+                    mesh.get());
 
     mesh->updated = true;
   }
 
-  void extractMeshInsideBlock(const Block<VoxelType>& block,
-                              const VoxelIndex& index, const Point& coords,
-                              VertexIndex* next_mesh_index, Mesh* mesh) {
-    DCHECK(next_mesh_index != nullptr);
+  /**
+   * Re-extracts the coarser levels of detail of the block mesh, see
+   * MeshIntegratorConfig::num_lod_levels. The halo must be initialized for the
+   * block and already filled for the re-meshed sub-bricks, only the others
+   * are read from the layer.
+   */
+  void updateLodMeshes(const Block<VoxelType>& block,
+                       const SubBrickMask filled_sub_bricks, SdfHalo* halo,
+                       Mesh* mesh) {
+    DCHECK(halo != nullptr);
     DCHECK(mesh != nullptr);
+    mesh->lod_meshes.clear();
+    if (config_.num_lod_levels == 0u) {
+      return;
+    }
 
-    Eigen::Matrix<FloatingPoint, 3, 8> cube_coord_offsets =
-        cube_index_offsets_.cast<FloatingPoint>() * voxel_size_;
-    Eigen::Matrix<FloatingPoint, 3, 8> corner_coords;
-    Eigen::Matrix<FloatingPoint, 8, 1> corner_sdf;
-    bool all_neighbors_observed = true;
-
-    for (unsigned int i = 0; i < 8; ++i) {
-      VoxelIndex corner_index = index + cube_index_offsets_.col(i);
-      const VoxelType& voxel = block.getVoxelByVoxelIndex(corner_index);
-
-      if (!utils::getSdfIfValid(voxel, config_.min_weight, &(corner_sdf(i)))) {
-        all_neighbors_observed = false;
-        break;
+    constexpr size_t kSubBricksPerSide = Block<VoxelType>::kSubBricksPerSide;
+    const IndexElement vps = block.voxels_per_side();
+    const IndexElement sub_brick_size = block.sub_brick_voxels_per_side();
+    for (size_t i = 0u; i < Mesh::kNumSubMeshes; ++i) {
+      if ((filled_sub_bricks >> i & 1u) != 0u) {
+        continue;
       }
-
-      corner_coords.col(i) = coords + cube_coord_offsets.col(i);
+      const VoxelIndex begin =
+          sub_brick_size *
+          VoxelIndex(i % kSubBricksPerSide,
+                     (i / kSubBricksPerSide) % kSubBricksPerSide,
+                     i / (kSubBricksPerSide * kSubBricksPerSide));
+      if ((begin.array() >= vps).any()) {
+        continue;
+      }
+      fillSdfHalo(begin, (begin.array() + sub_brick_size).min(vps).matrix(),
+                  halo);
     }
-
-    if (all_neighbors_observed) {
-      MarchingCubes::meshCube(corner_coords, corner_sdf, next_mesh_index, mesh);
+    for (size_t level = 1u; level <= config_.num_lod_levels; ++level) {
+      const IndexElement stride = static_cast<IndexElement>(1) << level;
+      if (stride > vps || vps % stride != 0) {
+        break;
+      }
+      Mesh::Ptr lod_mesh = std::make_shared<Mesh>(mesh->block_size,
+                                                  mesh->origin);
+      extractLodMesh(block, stride, *halo, lod_mesh.get());
+      if (config_.use_color) {
+        updateMeshColor(block, lod_mesh.get());
+      }
+      mesh->lod_meshes.push_back(lod_mesh);
     }
   }
 
-  void extractMeshOnBorder(const Block<VoxelType>& block,
-                           const VoxelIndex& index, const Point& coords,
-                           VertexIndex* next_mesh_index, Mesh* mesh) {
+  /**
+   * Marching cubes over the cubes spanning stride voxels per side, i.e. over
+   * the block downsampled by stride. The neighbor blocks downsampled the same
+   * way share the corners on the block borders, so a layer meshed at one
+   * level of detail is free of cracks.
+   */
+  void extractLodMesh(const Block<VoxelType>& block, const IndexElement stride,
+                      const SdfHalo& halo, Mesh* mesh) const {
     DCHECK(mesh != nullptr);
-
+    const IndexElement vps = block.voxels_per_side();
     Eigen::Matrix<FloatingPoint, 3, 8> cube_coord_offsets =
-        cube_index_offsets_.cast<FloatingPoint>() * voxel_size_;
+        cube_index_offsets_.cast<FloatingPoint>() * voxel_size_ * stride;
     Eigen::Matrix<FloatingPoint, 3, 8> corner_coords;
     Eigen::Matrix<FloatingPoint, 8, 1> corner_sdf;
-    bool all_neighbors_observed = true;
-    corner_coords.setZero();
-    corner_sdf.setZero();
-
-    for (unsigned int i = 0; i < 8; ++i) {
-      VoxelIndex corner_index = index + cube_index_offsets_.col(i);
-
-      if (block.isValidVoxelIndex(corner_index)) {
-        const VoxelType& voxel = block.getVoxelByVoxelIndex(corner_index);
-
-        if (!utils::getSdfIfValid(voxel, config_.min_weight,
-                                  &(corner_sdf(i)))) {
-          all_neighbors_observed = false;
-          break;
-        }
-
-        corner_coords.col(i) = coords + cube_coord_offsets.col(i);
-      } else {
-        // We have to access a different block.
-        BlockIndex block_offset = BlockIndex::Zero();
-
-        for (unsigned int j = 0u; j < 3u; j++) {
-          if (corner_index(j) < 0) {
-            block_offset(j) = -1;
-            corner_index(j) = corner_index(j) + voxels_per_side_;
-          } else if (corner_index(j) >=
-                     static_cast<IndexElement>(voxels_per_side_)) {
-            block_offset(j) = 1;
-            corner_index(j) = corner_index(j) - voxels_per_side_;
+    VertexIndex next_mesh_index = mesh->vertices.size();
+
+    for (IndexElement z = 0; z < vps; z += stride) {
+      for (IndexElement y = 0; y < vps; y += stride) {
+        for (IndexElement x = 0; x < vps; x += stride) {
+          const VoxelIndex cube_index(x, y, z);
+          bool all_neighbors_observed = true;
+          for (unsigned int i = 0u; i < 8u; ++i) {
+            const VoxelIndex corner_index =
+                cube_index + stride * cube_index_offsets_.col(i);
+            const size_t index = halo.getIndex(
+                corner_index.x(), corner_index.y(), corner_index.z());
+            if (halo.valid[index] == 0u) {
+              all_neighbors_observed = false;
+              break;
+            }
+            corner_sdf(i) = halo.sdf[index];
           }
-        }
-
-        BlockIndex neighbor_index = block.block_index() + block_offset;
-
-        if (sdf_layer_const_->hasBlock(neighbor_index)) {
-          const Block<VoxelType>& neighbor_block =
-              sdf_layer_const_->getBlockByIndex(neighbor_index);
-
-          CHECK(neighbor_block.isValidVoxelIndex(corner_index));
-          const VoxelType& voxel =
-              neighbor_block.getVoxelByVoxelIndex(corner_index);
-
-          if (!utils::getSdfIfValid(voxel, config_.min_weight,
-                                    &(corner_sdf(i)))) {
-            all_neighbors_observed = false;
-            break;
+          if (!all_neighbors_observed) {
+            continue;
           }
-
-          corner_coords.col(i) = coords + cube_coord_offsets.col(i);
-        } else {
-          all_neighbors_observed = false;
-          break;
+          const Point origin = block.computeCoordinatesFromVoxelIndex(
+              cube_index);
+          corner_coords = cube_coord_offsets.colwise() + origin;
+          MarchingCubes::meshCube(corner_coords, corner_sdf, &next_mesh_index,
+                                  mesh);
         }
       }
     }
+  }
 
-    if (all_neighbors_observed) {
-      MarchingCubes::meshCube(corner_coords, corner_sdf, next_mesh_index, mesh);
+  /// Appends the vertices [begin, end) of the source mesh as new triangles.
+  static void appendVertices(const Mesh& source, const size_t begin,
+                             const size_t end, Mesh* mesh) {
+    DCHECK(mesh != nullptr);
+    DCHECK_LE(end, source.vertices.size());
+    for (size_t i = begin; i < end; ++i) {
+      mesh->indices.push_back(mesh->vertices.size());
+      mesh->vertices.push_back(source.vertices[i]);
+      if (source.hasNormals()) {
+        mesh->normals.push_back(source.normals[i]);
+      }
+      if (source.hasColors()) {
+        mesh->colors.push_back(source.colors[i]);
+      }
     }
   }
 
@@ -363,7 +846,7 @@ class MeshIntegrator {
     DCHECK(mesh != nullptr);
 
     mesh->colors.clear();
-    mesh->colors.resize(mesh->indices.size());
+    mesh->colors.resize(mesh->vertices.size());
 
     // Use nearest-neighbor search.
     for (size_t i = 0; i < mesh->vertices.size(); i++) {
@@ -409,6 +892,9 @@ class MeshIntegrator {
   Eigen::Matrix<int, 3, 8> cube_index_offsets_;
 };
 
+template <typename VoxelType>
+constexpr size_t MeshIntegrator<VoxelType>::SdfHalo::kNoVertex;
+
 }  // namespace voxblox
 
 #endif  // VOXBLOX_MESH_MESH_INTEGRATOR_H_
@@ -1,6 +1,7 @@
 #ifndef VOXBLOX_MESH_MESH_LAYER_H_
 #define VOXBLOX_MESH_MESH_LAYER_H_
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <memory>
@@ -211,32 +212,29 @@ class MeshLayer {
         CHECK_EQ(has_indices, mesh->hasTriangles());
       }
 
-      // Copy the mesh content into the combined mesh. This is done in triplets
-      // for readability only, as one loop iteration will then copy one
-      // triangle.
-      for (size_t i = 0; i < mesh->vertices.size(); i += 3, new_index += 3) {
-        CHECK_LT(new_index + 2, mesh_size);
-
-        combined_mesh->vertices.push_back(mesh->vertices[i]);
-        combined_mesh->vertices.push_back(mesh->vertices[i + 1]);
-        combined_mesh->vertices.push_back(mesh->vertices[i + 2]);
-
-        if (has_colors) {
-          combined_mesh->colors.push_back(mesh->colors[i]);
-          combined_mesh->colors.push_back(mesh->colors[i + 1]);
-          combined_mesh->colors.push_back(mesh->colors[i + 2]);
-        }
-        if (has_normals) {
-          combined_mesh->normals.push_back(mesh->normals[i]);
-          combined_mesh->normals.push_back(mesh->normals[i + 1]);
-          combined_mesh->normals.push_back(mesh->normals[i + 2]);
-        }
-        if (has_indices) {
-          combined_mesh->indices.push_back(new_index);
-          combined_mesh->indices.push_back(new_index + 1);
-          combined_mesh->indices.push_back(new_index + 2);
+      // Copy the mesh content into the combined mesh. The triangles of block
+      // meshes with shared vertices index into their own block's vertices, so
+      // their indices are offset by the vertices copied so far.
+      CHECK_LE(new_index + mesh->vertices.size(), mesh_size);
+      combined_mesh->vertices.insert(combined_mesh->vertices.end(),
+                                     mesh->vertices.begin(),
+                                     mesh->vertices.end());
+      if (has_colors) {
+        combined_mesh->colors.insert(combined_mesh->colors.end(),
+                                     mesh->colors.begin(), mesh->colors.end());
+      }
+      if (has_normals) {
+        combined_mesh->normals.insert(combined_mesh->normals.end(),
+                                      mesh->normals.begin(),
+                                      mesh->normals.end());
+      }
+      if (has_indices) {
+        for (const VertexIndex index : mesh->indices) {
+          CHECK_LT(index, mesh->vertices.size());
+          combined_mesh->indices.push_back(new_index + index);
         }
       }
+      new_index += mesh->vertices.size();
     }
 
     // Verify combined mesh.
@@ -247,7 +245,7 @@ class MeshLayer {
       CHECK_EQ(combined_mesh->vertices.size(), combined_mesh->normals.size());
     }
 
-    CHECK_EQ(combined_mesh->vertices.size(), combined_mesh->indices.size());
+    CHECK_EQ(combined_mesh->indices.size() % 3u, 0u);
   }
 
   /**
@@ -261,13 +259,31 @@ class MeshLayer {
       Mesh* connected_mesh,
       const FloatingPoint approximate_vertex_proximity_threshold =
           1e-10) const {
+    constexpr size_t kFullResolution = 0u;
+    getConnectedLodMesh(kFullResolution, connected_mesh,
+                        approximate_vertex_proximity_threshold);
+  }
+
+  /**
+   * Like getConnectedMesh(), but takes every block mesh at the given level of
+   * detail, or at its coarsest one if it has fewer levels.
+   */
+  void getConnectedLodMesh(
+      const size_t lod_level, Mesh* connected_mesh,
+      const FloatingPoint approximate_vertex_proximity_threshold =
+          1e-10) const {
     BlockIndexList mesh_indices;
     getAllAllocatedMeshes(&mesh_indices);
 
     AlignedVector<Mesh::ConstPtr> meshes;
     meshes.reserve(mesh_indices.size());
     for (const BlockIndex& block_index : mesh_indices) {
-      meshes.push_back(getMeshPtrByIndex(block_index));
+      Mesh::ConstPtr mesh = getMeshPtrByIndex(block_index);
+      const size_t level = std::min(lod_level, mesh->getNumLodLevels() - 1u);
+      if (level > 0u) {
+        mesh = mesh->lod_meshes[level - 1u];
+      }
+      meshes.push_back(mesh);
     }
 
     createConnectedMesh(meshes, connected_mesh,
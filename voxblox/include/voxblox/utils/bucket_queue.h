@@ -1,8 +1,8 @@
 #ifndef VOXBLOX_UTILS_BUCKET_QUEUE_H_
 #define VOXBLOX_UTILS_BUCKET_QUEUE_H_
 
-#include <deque>
-#include <queue>
+#include <cmath>
+#include <memory>
 #include <vector>
 
 #include <glog/logging.h>
@@ -14,32 +14,49 @@ namespace voxblox {
  * Bucketed priority queue, mostly following L. Yatziv et al in
  * O(N) Implementation of the Fast Marching Algorithm, though skipping the
  * circular aspect (don't care about a bit more memory used for this).
+ *
+ * The elements of all buckets are stored in fixed-size chunks owned by the
+ * queue, and each bucket is a FIFO list of chunks. Chunks of emptied buckets
+ * are reused, and clear() keeps all chunks, so a queue that is reused across
+ * updates stops allocating once it has grown to the largest update.
  */
 template <typename T>
 class BucketQueue {
  public:
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
-  BucketQueue() : last_bucket_index_(0) {}
-  explicit BucketQueue(int num_buckets, double max_val)
-      : num_buckets_(num_buckets),
-        max_val_(max_val),
-        last_bucket_index_(0),
-        num_elements_(0) {
-    buckets_.resize(num_buckets_);
+  BucketQueue()
+      : num_buckets_(0),
+        max_val_(0.0),
+        front_bucket_index_(0),
+        num_elements_(0u),
+        free_chunks_(nullptr) {}
+  explicit BucketQueue(int num_buckets, double max_val) : BucketQueue() {
+    setNumBuckets(num_buckets, max_val);
   }
 
   /// WARNING: will CLEAR THE QUEUE!
   void setNumBuckets(int num_buckets, double max_val) {
+    CHECK_GT(num_buckets, 0);
     max_val_ = max_val;
     num_buckets_ = num_buckets;
-    buckets_.clear();
-    buckets_.resize(num_buckets_);
-    num_elements_ = 0;
+    clear();
+  }
+
+  /// Reserves the memory for num_elements elements.
+  void reserve(size_t num_elements) {
+    // Every bucket may have a partially filled chunk at each end.
+    const size_t num_chunks = (num_elements + kChunkSize - 1u) / kChunkSize +
+                              2u * static_cast<size_t>(num_buckets_);
+    while (chunks_.size() < num_chunks) {
+      chunks_.emplace_back(new Chunk());
+      chunks_.back()->next = free_chunks_;
+      free_chunks_ = chunks_.back().get();
+    }
   }
 
   void push(const T& key, double value) {
-    CHECK_NE(num_buckets_, 0);
+    DCHECK_NE(num_buckets_, 0);
     if (value > max_val_) {
       value = max_val_;
     }
@@ -48,55 +65,137 @@ class BucketQueue {
     if (bucket_index >= num_buckets_) {
       bucket_index = num_buckets_ - 1;
     }
-    if (bucket_index < last_bucket_index_) {
-      last_bucket_index_ = bucket_index;
+
+    Bucket& bucket = buckets_[bucket_index];
+    if (bucket.tail == bucket.tail_end) {
+      Chunk* chunk = allocateChunk();
+      if (bucket.head_chunk == nullptr) {
+        bucket.head = chunk->elements;
+        bucket.head_chunk = chunk;
+      } else {
+        bucket.tail_chunk->next = chunk;
+      }
+      bucket.tail_chunk = chunk;
+      bucket.tail = chunk->elements;
+      bucket.tail_end = chunk->elements + kChunkSize;
     }
-    buckets_[bucket_index].push(key);
-    num_elements_++;
+    *bucket.tail = key;
+    ++bucket.tail;
+
+    if (num_elements_ == 0u || bucket_index < front_bucket_index_) {
+      front_bucket_index_ = bucket_index;
+    }
+    ++num_elements_;
   }
 
   void pop() {
     if (empty()) {
       return;
     }
-    while (buckets_[last_bucket_index_].empty() &&
-           last_bucket_index_ < num_buckets_) {
-      last_bucket_index_++;
-    }
-    if (last_bucket_index_ < num_buckets_) {
-      buckets_[last_bucket_index_].pop();
-      num_elements_--;
+    --num_elements_;
+    Bucket& bucket = buckets_[front_bucket_index_];
+    ++bucket.head;
+    if (bucket.head == bucket.tail) {
+      // The bucket is empty. It keeps its last chunk, to be refilled from the
+      // start. Then move on to the next non-empty bucket.
+      bucket.head = bucket.head_chunk->elements;
+      bucket.tail = bucket.head;
+      if (num_elements_ > 0u) {
+        while (buckets_[front_bucket_index_].empty()) {
+          ++front_bucket_index_;
+        }
+        DCHECK_LT(front_bucket_index_, num_buckets_);
+      }
+    } else if (bucket.head == bucket.head_chunk->elements + kChunkSize) {
+      Chunk* next_chunk = bucket.head_chunk->next;
+      freeChunk(bucket.head_chunk);
+      bucket.head_chunk = next_chunk;
+      bucket.head = next_chunk->elements;
     }
   }
 
-  T front() {
-    CHECK_NE(num_buckets_, 0);
-    CHECK(!empty());
-    while (buckets_[last_bucket_index_].empty() &&
-           last_bucket_index_ < num_buckets_) {
-      last_bucket_index_++;
-    }
-    return buckets_[last_bucket_index_].front();
+  T front() const {
+    DCHECK_NE(num_buckets_, 0);
+    DCHECK(!empty());
+    return *buckets_[front_bucket_index_].head;
+  }
+
+  /// Index of the bucket the front element is in.
+  int frontBucketIndex() const {
+    DCHECK_NE(num_buckets_, 0);
+    DCHECK(!empty());
+    return front_bucket_index_;
   }
 
-  bool empty() { return num_elements_ == 0; }
+  bool empty() const { return num_elements_ == 0u; }
 
+  size_t size() const { return num_elements_; }
+
+  /// Empties the queue, but keeps the memory to be reused.
   void clear() {
-    buckets_.clear();
-    buckets_.resize(num_buckets_);
-    last_bucket_index_ = 0;
-    num_elements_ = 0;
+    buckets_.assign(num_buckets_, Bucket());
+    front_bucket_index_ = 0;
+    num_elements_ = 0u;
+    free_chunks_ = nullptr;
+    for (const std::unique_ptr<Chunk>& chunk : chunks_) {
+      chunk->next = free_chunks_;
+      free_chunks_ = chunk.get();
+    }
   }
 
  private:
+  static constexpr size_t kChunkSize = 64u;
+
+  struct Chunk {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    T elements[kChunkSize];
+    /// Next chunk of the same bucket, or of the free chunks.
+    Chunk* next = nullptr;
+  };
+
+  /// First and one past the last element of a bucket, and their chunks.
+  struct Bucket {
+    bool empty() const { return head == tail; }
+
+    T* head = nullptr;
+    Chunk* head_chunk = nullptr;
+    T* tail = nullptr;
+    T* tail_end = nullptr;
+    Chunk* tail_chunk = nullptr;
+  };
+
+  Chunk* allocateChunk() {
+    if (free_chunks_ == nullptr) {
+      chunks_.emplace_back(new Chunk());
+      free_chunks_ = chunks_.back().get();
+    }
+    Chunk* chunk = free_chunks_;
+    free_chunks_ = chunk->next;
+    chunk->next = nullptr;
+    return chunk;
+  }
+
+  void freeChunk(Chunk* chunk) {
+    chunk->next = free_chunks_;
+    free_chunks_ = chunk;
+  }
+
   int num_buckets_;
   double max_val_;
-  voxblox::AlignedVector<voxblox::AlignedQueue<T>> buckets_;
+  std::vector<Bucket> buckets_;
 
-  /// Speeds up retrivals.
-  int last_bucket_index_;
-  /// This is also to speed up empty checks.
+  /// Bucket of the front element, all buckets before it are empty.
+  int front_bucket_index_;
   size_t num_elements_;
+
+  /// The arena that owns all chunks, and the list of the unused ones.
+  std::vector<std::unique_ptr<Chunk> > chunks_;
+  Chunk* free_chunks_;
 };
+
+template <typename T>
+constexpr size_t BucketQueue<T>::kChunkSize;
+
 }  // namespace voxblox
 #endif  // VOXBLOX_UTILS_BUCKET_QUEUE_H_
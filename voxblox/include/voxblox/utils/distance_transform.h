@@ -0,0 +1,43 @@
+#ifndef VOXBLOX_UTILS_DISTANCE_TRANSFORM_H_
+#define VOXBLOX_UTILS_DISTANCE_TRANSFORM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace voxblox {
+
+/**
+ * One-dimensional squared euclidean distance transform of a sampled
+ * function, following P. Felzenszwalb and D. Huttenlocher, Distance
+ * Transforms of Sampled Functions. Computes
+ *   d(p) = min_q ((p - q)^2 + f(q))
+ * and the q that attains the minimum, in linear time. Applying it along each
+ * axis of a grid in turn gives the exact euclidean distance transform.
+ * Keeps its scratch memory, so use one instance per thread.
+ */
+class SquaredDistanceTransform1d {
+ public:
+  /// Samples with this value (or larger) are not considered in the minimum.
+  static constexpr float kInfinity = std::numeric_limits<float>::max();
+  static constexpr uint32_t kInvalidIndex =
+      std::numeric_limits<uint32_t>::max();
+
+  /**
+   * f, d and argmin hold n values each. Where all samples are infinite, d is
+   * set to kInfinity and argmin to kInvalidIndex.
+   */
+  void compute(const float* f, const size_t n, float* d, uint32_t* argmin);
+
+ private:
+  /// Position where the parabolas rooted at samples p < q intersect.
+  static float intersection(const float* f, const size_t p, const size_t q);
+
+  std::vector<size_t> vertices_;
+  std::vector<float> boundaries_;
+};
+
+}  // namespace voxblox
+
+#endif  // VOXBLOX_UTILS_DISTANCE_TRANSFORM_H_
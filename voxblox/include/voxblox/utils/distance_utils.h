@@ -2,6 +2,7 @@
 #define VOXBLOX_UTILS_DISTANCE_UTILS_H_
 
 #include "voxblox/core/block.h"
+#include "voxblox/core/block_query_cache.h"
 #include "voxblox/core/common.h"
 #include "voxblox/core/layer.h"
 #include "voxblox/core/voxel.h"
@@ -32,10 +33,14 @@ bool getSurfaceDistanceAlongRay(const Layer<VoxelType>& layer,
 
   bool surface_found = false;
 
+  // Consecutive steps mostly stay in the same block.
+  BlockQueryCache<VoxelType>& block_cache =
+      BlockQueryCache<VoxelType>::getThreadLocal();
+
   while (t < max_distance) {
     const Point current_pos = ray_origin + t * ray_direction;
     typename Block<VoxelType>::ConstPtr block_ptr =
-        layer.getBlockPtrByCoordinates(current_pos);
+        block_cache.getBlockPtrByCoordinates(layer, current_pos);
     if (!block_ptr) {
       // How much should we move up by? 1 voxel? 1 block? Could be close to the
       // block boundary though....
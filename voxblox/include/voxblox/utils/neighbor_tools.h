@@ -1,6 +1,8 @@
 #ifndef VOXBLOX_UTILS_NEIGHBOR_TOOLS_H_
 #define VOXBLOX_UTILS_NEIGHBOR_TOOLS_H_
 
+#include <array>
+
 #include "voxblox/core/common.h"
 #include "voxblox/core/layer.h"
 
@@ -112,6 +114,135 @@ class Neighborhood : public NeighborhoodLookupTables {
            (end_block_index - start_block_index) * voxels_per_side;
   }
 };
+
+/**
+ * Looks up the 26 neighbors of voxels in a layer without a hash map lookup per
+ * neighbor. The pointers to the up to 27 blocks around the block of the
+ * current voxel are resolved once, when they are first needed, and kept while
+ * the voxels stay in the same block. Neighbors of voxels in the interior of a
+ * block are found through precomputed linear index offsets.
+ */
+template <typename VoxelType>
+class BlockNeighborhood : public NeighborhoodLookupTables {
+ public:
+  explicit BlockNeighborhood(Layer<VoxelType>* layer)
+      : layer_(CHECK_NOTNULL(layer)),
+        voxels_per_side_(layer->voxels_per_side()),
+        global_index_(GlobalIndex::Zero()),
+        block_index_(BlockIndex::Zero()),
+        voxel_index_(VoxelIndex::Zero()),
+        linear_index_(0u),
+        is_interior_(false) {
+    const IndexElement vps = static_cast<IndexElement>(voxels_per_side_);
+    for (unsigned int i = 0u; i < Connectivity::kTwentySix; ++i) {
+      linear_offsets_[i] = static_cast<std::ptrdiff_t>(
+          kOffsets(0, i) + vps * (kOffsets(1, i) + vps * kOffsets(2, i)));
+    }
+    clearBlocks();
+  }
+
+  /**
+   * Moves to the voxel at the global index and returns it, or nullptr if its
+   * block is not allocated.
+   */
+  VoxelType* setGlobalIndex(const GlobalIndex& global_index) {
+    global_index_ = global_index;
+    BlockIndex block_index;
+    getBlockAndVoxelIndexFromGlobalVoxelIndex(global_index, voxels_per_side_,
+                                              &block_index, &voxel_index_);
+    if (block_index != block_index_) {
+      block_index_ = block_index;
+      clearBlocks();
+    }
+    Block<VoxelType>* block = getBlock(kCenterBlock);
+    if (block == nullptr) {
+      return nullptr;
+    }
+    linear_index_ = block->computeLinearIndexFromVoxelIndex(voxel_index_);
+    const IndexElement max_interior_index =
+        static_cast<IndexElement>(voxels_per_side_) - 2;
+    is_interior_ = (voxel_index_.array() >= 1).all() &&
+                   (voxel_index_.array() <= max_interior_index).all();
+    return &block->getVoxelByLinearIndex(linear_index_);
+  }
+
+  /**
+   * Returns the neighbor at neighbor_idx of the kOffsets table of the current
+   * voxel, or nullptr if the block of the neighbor is not allocated.
+   */
+  VoxelType* getNeighbor(const unsigned int neighbor_idx) {
+    DCHECK_LT(neighbor_idx, Connectivity::kTwentySix);
+    if (is_interior_) {
+      return &blocks_[kCenterBlock]->getVoxelByLinearIndex(
+          linear_index_ + linear_offsets_[neighbor_idx]);
+    }
+    const IndexElement vps = static_cast<IndexElement>(voxels_per_side_);
+    VoxelIndex neighbor_voxel_index = voxel_index_ + kOffsets.col(neighbor_idx);
+    size_t block_slot = kCenterBlock;
+    size_t block_slot_stride = 1u;
+    for (unsigned int i = 0u; i < 3u; ++i) {
+      if (neighbor_voxel_index(i) < 0) {
+        neighbor_voxel_index(i) += vps;
+        block_slot -= block_slot_stride;
+      } else if (neighbor_voxel_index(i) >= vps) {
+        neighbor_voxel_index(i) -= vps;
+        block_slot += block_slot_stride;
+      }
+      block_slot_stride *= 3u;
+    }
+    Block<VoxelType>* block = getBlock(block_slot);
+    if (block == nullptr) {
+      return nullptr;
+    }
+    return &block->getVoxelByVoxelIndex(neighbor_voxel_index);
+  }
+
+  /// Global index of the neighbor at neighbor_idx of the current voxel.
+  GlobalIndex getNeighborGlobalIndex(const unsigned int neighbor_idx) const {
+    return global_index_ + kLongOffsets.col(neighbor_idx);
+  }
+
+ private:
+  /// Slot of the block of the current voxel, blocks are ordered x, y, z.
+  static constexpr size_t kCenterBlock = 13u;
+  static constexpr size_t kNumBlocks = 27u;
+
+  void clearBlocks() {
+    blocks_.fill(nullptr);
+    resolved_blocks_.fill(false);
+  }
+
+  Block<VoxelType>* getBlock(const size_t block_slot) {
+    DCHECK_LT(block_slot, kNumBlocks);
+    if (!resolved_blocks_[block_slot]) {
+      const IndexElement slot = static_cast<IndexElement>(block_slot);
+      const BlockIndex offset(slot % 3 - 1, slot / 3 % 3 - 1, slot / 9 - 1);
+      blocks_[block_slot] =
+          layer_->getBlockPtrByIndex(block_index_ + offset).get();
+      resolved_blocks_[block_slot] = true;
+    }
+    return blocks_[block_slot];
+  }
+
+  Layer<VoxelType>* layer_;
+  const size_t voxels_per_side_;
+  std::array<std::ptrdiff_t, Connectivity::kTwentySix> linear_offsets_;
+
+  std::array<Block<VoxelType>*, kNumBlocks> blocks_;
+  std::array<bool, kNumBlocks> resolved_blocks_;
+
+  GlobalIndex global_index_;
+  BlockIndex block_index_;
+  VoxelIndex voxel_index_;
+  size_t linear_index_;
+  bool is_interior_;
+};
+
+template <typename VoxelType>
+constexpr size_t BlockNeighborhood<VoxelType>::kCenterBlock;
+template <typename VoxelType>
+constexpr size_t BlockNeighborhood<VoxelType>::kNumBlocks;
+
 }  // namespace voxblox
 
 #endif  // VOXBLOX_UTILS_NEIGHBOR_TOOLS_H_
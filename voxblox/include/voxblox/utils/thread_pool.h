@@ -0,0 +1,61 @@
+#ifndef VOXBLOX_UTILS_THREAD_POOL_H_
+#define VOXBLOX_UTILS_THREAD_POOL_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace voxblox {
+
+/**
+ * A fixed set of threads that run one function at a time, for algorithms
+ * that run many short parallel rounds. The threads are started once instead
+ * of being created and joined for every round.
+ */
+class ThreadPool {
+ public:
+  /// Starts num_threads - 1 threads, the caller of run() is the last one.
+  explicit ThreadPool(size_t num_threads);
+
+  ~ThreadPool();
+
+  size_t num_threads() const { return threads_.size() + 1u; }
+
+  /**
+   * Runs the function on up to max_threads threads, including the calling
+   * one, and returns once all of them returned. Concurrent calls run one
+   * after the other.
+   */
+  void run(const std::function<void()>& function,
+           size_t max_threads = static_cast<size_t>(-1));
+
+ private:
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  void threadFunction(const size_t thread_index);
+
+  std::vector<std::thread> threads_;
+
+  /// Held for the whole of run().
+  std::mutex run_mutex_;
+
+  /// Guards the members below.
+  std::mutex mutex_;
+  std::condition_variable round_started_;
+  std::condition_variable round_finished_;
+  const std::function<void()>* function_;
+  /// Threads 0 to num_active_threads_ - 1 take part in the current round.
+  size_t num_active_threads_;
+  size_t num_running_threads_;
+  uint64_t round_;
+  bool stop_;
+};
+
+}  // namespace voxblox
+
+#endif  // VOXBLOX_UTILS_THREAD_POOL_H_
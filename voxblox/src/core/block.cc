@@ -10,7 +10,6 @@ void serializeDirection(const Eigen::Vector3i& parent_direction,
   CHECK_NOTNULL(data);
   CHECK_EQ(*data, 0u);
 
-  // NOTE: these checks will fail until the TODO below is adressed.
   DCHECK_GE(parent_direction.x(), INT8_MIN);
   DCHECK_LE(parent_direction.x(), INT8_MAX);
 
@@ -20,10 +19,8 @@ void serializeDirection(const Eigen::Vector3i& parent_direction,
   DCHECK_GE(parent_direction.z(), INT8_MIN);
   DCHECK_LE(parent_direction.z(), INT8_MAX);
 
-  // TODO(helenol, mfehr):
-  // Serialization should never change the values, the parent values will either
-  // need to be truncated in the ESDF integrator or we need to use more bytes to
-  // serialize the ESDF voxel.
+  // The ESDF voxels store their parents in 8 bits per axis as well, so this
+  // never changes the values.
   const int8_t parent_direction_x =
       std::min(INT8_MAX, std::max(parent_direction.x(), INT8_MIN));
   const int8_t parent_direction_y =
@@ -68,6 +65,8 @@ void Block<TsdfVoxel>::deserializeFromIntegers(
   constexpr size_t kNumDataPacketsPerVoxel = 3u;
   const size_t num_data_packets = data.size();
   CHECK_EQ(num_voxels_ * kNumDataPacketsPerVoxel, num_data_packets);
+  // The deserialized voxels are not tracked by the free space summary.
+  resetNumSaturatedFreeVoxels();
   for (size_t voxel_idx = 0u, data_idx = 0u;
        voxel_idx < num_voxels_ && data_idx < num_data_packets;
        ++voxel_idx, data_idx += kNumDataPacketsPerVoxel) {
@@ -132,7 +131,7 @@ void Block<EsdfVoxel>::deserializeFromIntegers(
     voxel.in_queue = static_cast<bool>((bytes_2 & 0x00000004));
     voxel.fixed = static_cast<bool>((bytes_2 & 0x00000008));
 
-    voxel.parent = deserializeDirection(bytes_2);
+    voxel.parent = deserializeDirection(bytes_2).cast<int8_t>();
   }
 }
 
@@ -217,7 +216,7 @@ void Block<EsdfVoxel>::serializeToIntegers(std::vector<uint32_t>* data) const {
     data->push_back(*bytes_1_ptr);
 
     uint32_t bytes_2 = 0u;
-    serializeDirection(voxel.parent, &bytes_2);
+    serializeDirection(voxel.parent.cast<int>(), &bytes_2);
 
     uint8_t flag_byte = 0b00000000;
     flag_byte |= static_cast<uint8_t>(voxel.observed ? 0b00000001 : 0b00000000);
@@ -1,7 +1,23 @@
 #include "voxblox/core/esdf_map.h"
 
+#include <cmath>
+
 namespace voxblox {
 
+EsdfMap::Ptr EsdfMap::getSnapshot() {
+  Ptr snapshot = aligned_shared<EsdfMap>(esdf_layer_->getSnapshot());
+  if (coarse_esdf_layer_) {
+    snapshot->coarse_esdf_layer_ = coarse_esdf_layer_->getSnapshot();
+    snapshot->coarse_interpolator_.reset(
+        new Interpolator<EsdfVoxel>(snapshot->coarse_esdf_layer_.get()));
+  }
+  snapshot->coarse_fallback_distance_ = coarse_fallback_distance_;
+  snapshot->batch_query_threads_ = batch_query_threads_;
+  snapshot->batch_thread_pool_ = batch_thread_pool_;
+  snapshot->gradient_method_ = gradient_method_;
+  return snapshot;
+}
+
 bool EsdfMap::getDistanceAtPosition(const Eigen::Vector3d& position,
                                     double* distance) const {
   constexpr bool interpolate = true;
@@ -11,8 +27,35 @@ bool EsdfMap::getDistanceAtPosition(const Eigen::Vector3d& position,
 bool EsdfMap::getDistanceAtPosition(const Eigen::Vector3d& position,
                                     bool interpolate, double* distance) const {
   FloatingPoint distance_fp;
-  bool success = interpolator_.getDistance(position.cast<FloatingPoint>(),
-                                           &distance_fp, interpolate);
+  bool success = false;
+  // The tricubic distances come with the gradient.
+  const bool tricubic =
+      interpolate && gradient_method_ == GradientMethod::kTricubic;
+  Point gradient_fp;
+  if (tricubic) {
+    success = interpolator_.getDistanceAndGradient(
+        position.cast<FloatingPoint>(), &distance_fp, &gradient_fp,
+        gradient_method_);
+  } else {
+    success = interpolator_.getDistance(position.cast<FloatingPoint>(),
+                                        &distance_fp, interpolate);
+  }
+  if (coarse_interpolator_ &&
+      (!success || std::abs(distance_fp) >= coarse_fallback_distance_)) {
+    FloatingPoint coarse_distance;
+    const bool coarse_success =
+        tricubic ? coarse_interpolator_->getDistanceAndGradient(
+                       position.cast<FloatingPoint>(), &coarse_distance,
+                       &gradient_fp, gradient_method_)
+                 : coarse_interpolator_->getDistance(
+                       position.cast<FloatingPoint>(), &coarse_distance,
+                       interpolate);
+    if (coarse_success &&
+        (!success || std::abs(coarse_distance) > std::abs(distance_fp))) {
+      distance_fp = coarse_distance;
+      success = true;
+    }
+  }
   if (success) {
     *distance = static_cast<double>(distance_fp);
   }
@@ -32,16 +75,22 @@ bool EsdfMap::getDistanceAndGradientAtPosition(
     Eigen::Vector3d* gradient) const {
   FloatingPoint distance_fp = 0.0;
   Point gradient_fp = Point::Zero();
-  bool use_adaptive = false;
-  bool success = false;
-  if (use_adaptive) {
-    success = interpolator_.getAdaptiveDistanceAndGradient(
-        position.cast<FloatingPoint>(), &distance_fp, &gradient_fp);
-  } else {
-    success = interpolator_.getDistance(position.cast<FloatingPoint>(),
-                                        &distance_fp, interpolate);
-    success &= interpolator_.getGradient(position.cast<FloatingPoint>(),
-                                         &gradient_fp, interpolate);
+  bool success =
+      getDistanceAndGradient(interpolator_, position.cast<FloatingPoint>(),
+                             interpolate, &distance_fp, &gradient_fp);
+
+  if (coarse_interpolator_ &&
+      (!success || std::abs(distance_fp) >= coarse_fallback_distance_)) {
+    FloatingPoint coarse_distance = 0.0;
+    Point coarse_gradient = Point::Zero();
+    if (getDistanceAndGradient(*coarse_interpolator_,
+                               position.cast<FloatingPoint>(), interpolate,
+                               &coarse_distance, &coarse_gradient) &&
+        (!success || std::abs(coarse_distance) > std::abs(distance_fp))) {
+      distance_fp = coarse_distance;
+      gradient_fp = coarse_gradient;
+      success = true;
+    }
   }
 
   *distance = static_cast<double>(distance_fp);
@@ -50,14 +99,41 @@ bool EsdfMap::getDistanceAndGradientAtPosition(
   return success;
 }
 
+bool EsdfMap::getDistanceAndGradient(
+    const Interpolator<EsdfVoxel>& interpolator, const Point& position,
+    bool interpolate, FloatingPoint* distance, Point* gradient) const {
+  if (interpolate &&
+      gradient_method_ != GradientMethod::kCentralDifferences) {
+    return interpolator.getDistanceAndGradient(position, distance, gradient,
+                                               gradient_method_);
+  }
+  bool use_adaptive = false;
+  if (use_adaptive) {
+    return interpolator.getAdaptiveDistanceAndGradient(position, distance,
+                                                       gradient);
+  }
+  bool success = interpolator.getDistance(position, distance, interpolate);
+  success &= interpolator.getGradient(position, gradient, interpolate);
+  return success;
+}
+
 bool EsdfMap::isObserved(const Eigen::Vector3d& position) const {
+  BlockQueryCache<EsdfVoxel>& block_cache =
+      BlockQueryCache<EsdfVoxel>::getThreadLocal();
   // Get the block.
-  Block<EsdfVoxel>::Ptr block_ptr =
-      esdf_layer_->getBlockPtrByCoordinates(position.cast<FloatingPoint>());
+  Block<EsdfVoxel>::ConstPtr block_ptr = block_cache.getBlockPtrByCoordinates(
+      *esdf_layer_, position.cast<FloatingPoint>());
   if (block_ptr) {
     const EsdfVoxel& voxel =
         block_ptr->getVoxelByCoordinates(position.cast<FloatingPoint>());
-    return voxel.observed;
+    if (voxel.observed) {
+      return true;
+    }
+  }
+  if (coarse_esdf_layer_) {
+    const EsdfVoxel* coarse_voxel = block_cache.getVoxelPtrByCoordinates(
+        *coarse_esdf_layer_, position.cast<FloatingPoint>());
+    return coarse_voxel != nullptr && coarse_voxel->observed;
   }
   return false;
 }
@@ -77,8 +153,19 @@ void EsdfMap::batchGetDistanceAtPosition(
     throw std::runtime_error("Observed array smaller than number of queries");
   }
 
+  Pointcloud query_positions(positions.cols());
   for (int i = 0; i < positions.cols(); i++) {
-    observed[i] = getDistanceAtPosition(positions.col(i), &distances[i]);
+    query_positions[i] = positions.col(i).cast<FloatingPoint>();
+  }
+  std::vector<FloatingPoint> query_distances;
+  std::vector<uint8_t> success;
+  batchGetDistanceAndGradient(query_positions, &query_distances, nullptr,
+                              &success);
+  for (int i = 0; i < positions.cols(); i++) {
+    observed[i] = success[i];
+    if (success[i]) {
+      distances[i] = static_cast<double>(query_distances[i]);
+    }
   }
 }
 
@@ -102,12 +189,62 @@ void EsdfMap::batchGetDistanceAndGradientAtPosition(
     throw std::runtime_error("Gradients matrix smaller than number of queries");
   }
 
+  Pointcloud query_positions(positions.cols());
   for (int i = 0; i < positions.cols(); i++) {
-    Eigen::Vector3d gradient;
-    observed[i] = getDistanceAndGradientAtPosition(positions.col(i),
-                                                   &distances[i], &gradient);
+    query_positions[i] = positions.col(i).cast<FloatingPoint>();
+  }
+  std::vector<FloatingPoint> query_distances;
+  Pointcloud query_gradients;
+  std::vector<uint8_t> success;
+  batchGetDistanceAndGradient(query_positions, &query_distances,
+                              &query_gradients, &success);
+  for (int i = 0; i < positions.cols(); i++) {
+    observed[i] = success[i];
+    distances[i] = static_cast<double>(query_distances[i]);
+    gradients.col(i) = query_gradients[i].cast<double>();
+  }
+}
+
+void EsdfMap::batchGetDistanceAndGradient(
+    const Pointcloud& positions, std::vector<FloatingPoint>* distances,
+    Pointcloud* gradients, std::vector<uint8_t>* success) const {
+  CHECK_NOTNULL(distances);
+  CHECK_NOTNULL(success);
+  interpolator_.batchGetDistanceAndGradient(positions, distances, gradients,
+                                            success, batch_thread_pool_.get(),
+                                            gradient_method_);
+  if (!coarse_interpolator_) {
+    return;
+  }
 
-    gradients.col(i) = gradient;
+  // Same fallback as the single queries, for the queries that need it.
+  std::vector<size_t> fallback_queries;
+  Pointcloud fallback_positions;
+  for (size_t i = 0u; i < positions.size(); ++i) {
+    if (!(*success)[i] ||
+        std::abs((*distances)[i]) >= coarse_fallback_distance_) {
+      fallback_queries.push_back(i);
+      fallback_positions.push_back(positions[i]);
+    }
+  }
+  std::vector<FloatingPoint> coarse_distances;
+  Pointcloud coarse_gradients;
+  std::vector<uint8_t> coarse_success;
+  coarse_interpolator_->batchGetDistanceAndGradient(
+      fallback_positions, &coarse_distances,
+      gradients == nullptr ? nullptr : &coarse_gradients, &coarse_success,
+      batch_thread_pool_.get(), gradient_method_);
+  for (size_t i = 0u; i < fallback_queries.size(); ++i) {
+    const size_t query = fallback_queries[i];
+    if (coarse_success[i] &&
+        (!(*success)[query] ||
+         std::abs(coarse_distances[i]) > std::abs((*distances)[query]))) {
+      (*distances)[query] = coarse_distances[i];
+      if (gradients != nullptr) {
+        (*gradients)[query] = coarse_gradients[i];
+      }
+      (*success)[query] = 1u;
+    }
   }
 }
 
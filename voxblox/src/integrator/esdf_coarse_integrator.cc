@@ -0,0 +1,126 @@
+#include "voxblox/integrator/esdf_coarse_integrator.h"
+
+#include <cmath>
+#include <limits>
+
+namespace voxblox {
+
+EsdfCoarseIntegrator::EsdfCoarseIntegrator(
+    const EsdfIntegrator::Config& config, Layer<TsdfVoxel>* tsdf_layer,
+    Layer<EsdfVoxel>* coarse_esdf_layer)
+    : tsdf_layer_(CHECK_NOTNULL(tsdf_layer)),
+      min_weight_(config.min_weight),
+      downsampling_(static_cast<size_t>(
+          std::round(CHECK_NOTNULL(coarse_esdf_layer)->voxel_size() /
+                     tsdf_layer->voxel_size()))),
+      coarse_tsdf_layer_(coarse_esdf_layer->voxel_size(),
+                         coarse_esdf_layer->voxels_per_side()),
+      esdf_integrator_(config, &coarse_tsdf_layer_, coarse_esdf_layer) {
+  CHECK_GT(downsampling_, 0u);
+  CHECK_NEAR(downsampling_ * tsdf_layer_->voxel_size(),
+             coarse_esdf_layer->voxel_size(), 1e-6);
+  // Then every coarse block covers downsampling^3 whole TSDF blocks.
+  CHECK_EQ(coarse_esdf_layer->voxels_per_side(),
+           tsdf_layer_->voxels_per_side());
+  CHECK_EQ(tsdf_layer_->voxels_per_side() % downsampling_, 0u);
+}
+
+void EsdfCoarseIntegrator::setTsdfLayer(Layer<TsdfVoxel>* tsdf_layer) {
+  CHECK(tsdf_layer);
+  CHECK_NEAR(tsdf_layer->voxel_size(), tsdf_layer_->voxel_size(), 1e-6);
+  CHECK_EQ(tsdf_layer->voxels_per_side(), tsdf_layer_->voxels_per_side());
+  tsdf_layer_ = tsdf_layer;
+}
+
+void EsdfCoarseIntegrator::updateFromTsdfLayer() {
+  BlockIndexList tsdf_blocks;
+  tsdf_layer_->getAllUpdatedBlocks(Update::kCoarseEsdf, &tsdf_blocks);
+  constexpr bool kIncremental = true;
+  updateFromTsdfBlocks(tsdf_blocks, kIncremental);
+  for (const BlockIndex& block_index : tsdf_blocks) {
+    tsdf_layer_->resetUpdated(block_index, Update::kCoarseEsdf);
+  }
+}
+
+void EsdfCoarseIntegrator::updateFromTsdfLayerBatch() {
+  coarse_tsdf_layer_.removeAllBlocks();
+  BlockIndexList tsdf_blocks;
+  tsdf_layer_->getAllAllocatedBlocks(&tsdf_blocks);
+  for (const BlockIndex& block_index : tsdf_blocks) {
+    const Layer<TsdfVoxel>& tsdf_layer = *tsdf_layer_;
+    downsampleBlock(tsdf_layer.getBlockByIndex(block_index));
+    tsdf_layer_->resetUpdated(block_index, Update::kCoarseEsdf);
+  }
+  esdf_integrator_.updateFromTsdfLayerBatch();
+}
+
+void EsdfCoarseIntegrator::updateFromTsdfBlocks(
+    const BlockIndexList& tsdf_blocks, bool incremental) {
+  timing::Timer downsample_timer("esdf/coarse_downsample_tsdf");
+  // Only read from, so blocks shared with a snapshot are not copied.
+  const Layer<TsdfVoxel>& tsdf_layer = *tsdf_layer_;
+  IndexSet coarse_block_set;
+  for (const BlockIndex& block_index : tsdf_blocks) {
+    Block<TsdfVoxel>::ConstPtr tsdf_block =
+        tsdf_layer.getBlockPtrByIndex(block_index);
+    if (tsdf_block) {
+      coarse_block_set.insert(downsampleBlock(*tsdf_block));
+    }
+  }
+  downsample_timer.Stop();
+
+  const BlockIndexList coarse_blocks(coarse_block_set.begin(),
+                                     coarse_block_set.end());
+  esdf_integrator_.updateFromTsdfBlocks(coarse_blocks, incremental);
+}
+
+BlockIndex EsdfCoarseIntegrator::downsampleBlock(
+    const Block<TsdfVoxel>& tsdf_block) {
+  const IndexElement downsampling = static_cast<IndexElement>(downsampling_);
+  const IndexElement coarse_voxels_per_block =
+      static_cast<IndexElement>(tsdf_block.voxels_per_side()) / downsampling;
+
+  const BlockIndex block_index = tsdf_block.block_index();
+  BlockIndex coarse_block_index;
+  for (unsigned int i = 0u; i < 3u; ++i) {
+    coarse_block_index(i) = static_cast<IndexElement>(
+        std::floor(static_cast<FloatingPoint>(block_index(i)) / downsampling));
+  }
+  Block<TsdfVoxel>::Ptr coarse_block =
+      coarse_tsdf_layer_.allocateBlockPtrByIndex(coarse_block_index);
+  const VoxelIndex coarse_voxel_offset =
+      (block_index - coarse_block_index * downsampling) *
+      coarse_voxels_per_block;
+
+  for (IndexElement z = 0; z < coarse_voxels_per_block; ++z) {
+    for (IndexElement y = 0; y < coarse_voxels_per_block; ++y) {
+      for (IndexElement x = 0; x < coarse_voxels_per_block; ++x) {
+        // The observed voxel closest to the surface decides whether the
+        // coarse voxel is fixed, so thin surfaces don't get averaged away.
+        TsdfVoxel coarse_voxel;
+        FloatingPoint min_abs_distance =
+            std::numeric_limits<FloatingPoint>::max();
+        for (IndexElement dz = 0; dz < downsampling; ++dz) {
+          for (IndexElement dy = 0; dy < downsampling; ++dy) {
+            for (IndexElement dx = 0; dx < downsampling; ++dx) {
+              const TsdfVoxel& voxel =
+                  tsdf_block.getVoxelByVoxelIndex(VoxelIndex(
+                      x * downsampling + dx, y * downsampling + dy,
+                      z * downsampling + dz));
+              if (voxel.weight >= min_weight_ &&
+                  std::abs(voxel.distance) < min_abs_distance) {
+                min_abs_distance = std::abs(voxel.distance);
+                coarse_voxel = voxel;
+              }
+            }
+          }
+        }
+        coarse_block->getVoxelByVoxelIndex(coarse_voxel_offset +
+                                           VoxelIndex(x, y, z)) = coarse_voxel;
+      }
+    }
+  }
+  return coarse_block_index;
+}
+
+}  // namespace voxblox
@@ -1,18 +1,31 @@
 #include "voxblox/integrator/esdf_integrator.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <memory>
+
 #include "voxblox/utils/planning_utils.h"
+#include "voxblox/utils/thread_pool.h"
 
 namespace voxblox {
 
 EsdfIntegrator::EsdfIntegrator(const Config& config,
                                Layer<TsdfVoxel>* tsdf_layer,
                                Layer<EsdfVoxel>* esdf_layer)
-    : config_(config), tsdf_layer_(tsdf_layer), esdf_layer_(esdf_layer) {
+    : config_(config),
+      tsdf_layer_(tsdf_layer),
+      esdf_layer_(esdf_layer),
+      has_window_center_(false),
+      window_center_(BlockIndex::Zero()) {
   CHECK(tsdf_layer_);
   CHECK(esdf_layer_);
 
   voxels_per_side_ = esdf_layer_->voxels_per_side();
   voxel_size_ = esdf_layer_->voxel_size();
+  window_half_size_blocks_ = static_cast<IndexElement>(
+      std::ceil(config_.window_half_size_m / esdf_layer_->block_size()));
 
   CHECK_EQ(esdf_layer_->voxels_per_side(), tsdf_layer_->voxels_per_side());
   CHECK_NEAR(esdf_layer_->voxel_size(), tsdf_layer_->voxel_size(), 1e-6);
@@ -20,6 +33,13 @@ EsdfIntegrator::EsdfIntegrator(const Config& config,
   open_.setNumBuckets(config_.num_buckets, config_.max_distance_m);
 }
 
+void EsdfIntegrator::setTsdfLayer(Layer<TsdfVoxel>* tsdf_layer) {
+  CHECK(tsdf_layer);
+  CHECK_EQ(esdf_layer_->voxels_per_side(), tsdf_layer->voxels_per_side());
+  CHECK_NEAR(esdf_layer_->voxel_size(), tsdf_layer->voxel_size(), 1e-6);
+  tsdf_layer_ = tsdf_layer;
+}
+
 // Used for planning - allocates sphere around as observed but occupied,
 // and clears space in a sphere around current position.
 void EsdfIntegrator::addNewRobotPosition(const Point& position) {
@@ -91,39 +111,417 @@ void EsdfIntegrator::addNewRobotPosition(const Point& position) {
   clear_timer.Stop();
 }
 
+constexpr IndexElement EsdfIntegrator::kDistanceTransformChunkBlocks;
+constexpr IndexElement EsdfIntegrator::kDistanceTransformMaxGridSide;
+
 void EsdfIntegrator::updateFromTsdfLayerBatch() {
+  if (config_.distance_transform_batch) {
+    updateFromTsdfLayerBatchDistanceTransform();
+    return;
+  }
   esdf_layer_->removeAllBlocks();
   BlockIndexList tsdf_blocks;
   tsdf_layer_->getAllAllocatedBlocks(&tsdf_blocks);
-  tsdf_blocks.insert(tsdf_blocks.end(), updated_blocks_.begin(),
-                     updated_blocks_.end());
+  for (const BlockIndex& block_index : updated_blocks_) {
+    if (isBlockInWindow(block_index)) {
+      tsdf_blocks.push_back(block_index);
+    }
+  }
   updated_blocks_.clear();
   updateFromTsdfBlocks(tsdf_blocks);
 }
 
+void EsdfIntegrator::updateFromTsdfLayerBatchDistanceTransform() {
+  timing::Timer esdf_timer("esdf/distance_transform_batch");
+  esdf_layer_->removeAllBlocks();
+  updated_blocks_.clear();
+  open_.clear();
+  raise_ = AlignedQueue<GlobalIndex>();
+
+  BlockIndexList tsdf_blocks;
+  tsdf_layer_->getAllAllocatedBlocks(&tsdf_blocks);
+  if (tsdf_blocks.empty()) {
+    return;
+  }
+
+  // Only the fixed voxels up to the max distance around a chunk matter, so
+  // the chunks are made smaller if the grid with this halo would be too big.
+  // If even a single block with the halo is too big, the halo is cut, and
+  // with it the max distance.
+  const IndexElement vps = static_cast<IndexElement>(voxels_per_side_);
+  IndexElement halo_voxels = static_cast<IndexElement>(
+      std::ceil(config_.max_distance_m / voxel_size_));
+  IndexElement chunk_blocks = kDistanceTransformChunkBlocks;
+  while (chunk_blocks > 1 && chunk_blocks * vps + 2 * halo_voxels >
+                                kDistanceTransformMaxGridSide) {
+    --chunk_blocks;
+  }
+  if (vps + 2 * halo_voxels > kDistanceTransformMaxGridSide) {
+    halo_voxels =
+        std::max<IndexElement>((kDistanceTransformMaxGridSide - vps) / 2, 0);
+    LOG(WARNING) << "The distance transform is limited to "
+                 << halo_voxels * voxel_size_ << "m instead of the max "
+                 << "distance of " << config_.max_distance_m << "m.";
+  }
+  const FloatingPoint max_distance =
+      std::min(config_.max_distance_m, halo_voxels * voxel_size_);
+
+  // Allocate all ESDF blocks first, so the chunks can be filled in parallel.
+  AnyIndexHashMapType<BlockIndexList>::type chunk_map;
+  BlockIndex min_layer_block_index = tsdf_blocks.front();
+  BlockIndex max_layer_block_index = tsdf_blocks.front();
+  for (const BlockIndex& block_index : tsdf_blocks) {
+    esdf_layer_->allocateBlockPtrByIndex(block_index)->set_updated(true);
+    min_layer_block_index = min_layer_block_index.cwiseMin(block_index);
+    max_layer_block_index = max_layer_block_index.cwiseMax(block_index);
+    BlockIndex chunk_index;
+    for (unsigned int i = 0u; i < 3u; ++i) {
+      chunk_index(i) = static_cast<IndexElement>(
+          std::floor(static_cast<FloatingPoint>(block_index(i)) /
+                     chunk_blocks));
+    }
+    chunk_map[chunk_index].push_back(block_index);
+  }
+  const AlignedVector<std::pair<BlockIndex, BlockIndexList> > chunks(
+      chunk_map.begin(), chunk_map.end());
+
+  // There are no fixed voxels outside of the allocated blocks.
+  const GlobalIndex min_layer_voxel_index =
+      min_layer_block_index.cast<LongIndexElement>() * vps;
+  const GlobalIndex max_layer_voxel_index =
+      (max_layer_block_index + BlockIndex::Ones()).cast<LongIndexElement>() *
+          vps -
+      GlobalIndex::Ones();
+  const GlobalIndex halo = GlobalIndex::Constant(halo_voxels);
+  VLOG(3) << "[ESDF update]: Computing the distance transform of "
+          << tsdf_blocks.size() << " blocks in " << chunks.size()
+          << " chunks of up to " << chunk_blocks << " blocks per side.";
+
+  std::atomic<size_t> next_index(0u);
+  auto update_chunks = [&]() {
+    DistanceTransformChunk chunk;
+    size_t i;
+    while ((i = next_index++) < chunks.size()) {
+      const BlockIndexList& blocks = chunks[i].second;
+      BlockIndex min_chunk_block_index = blocks.front();
+      BlockIndex max_chunk_block_index = blocks.front();
+      for (const BlockIndex& block_index : blocks) {
+        min_chunk_block_index = min_chunk_block_index.cwiseMin(block_index);
+        max_chunk_block_index = max_chunk_block_index.cwiseMax(block_index);
+      }
+      const GlobalIndex min_voxel_index =
+          min_chunk_block_index.cast<LongIndexElement>() * vps - halo;
+      const GlobalIndex max_voxel_index =
+          (max_chunk_block_index + BlockIndex::Ones())
+                  .cast<LongIndexElement>() *
+              vps -
+          GlobalIndex::Ones() + halo;
+      updateChunkWithDistanceTransform(
+          min_voxel_index.cwiseMax(min_layer_voxel_index),
+          max_voxel_index.cwiseMin(max_layer_voxel_index), max_distance,
+          blocks, &chunk);
+    }
+  };
+  ThreadPool thread_pool(std::max<size_t>(
+      std::min(config_.integrator_threads, chunks.size()), 1u));
+  thread_pool.run(update_chunks);
+}
+
+void EsdfIntegrator::updateChunkWithDistanceTransform(
+    const GlobalIndex& min_voxel_index, const GlobalIndex& max_voxel_index,
+    const FloatingPoint max_distance, const BlockIndexList& blocks,
+    DistanceTransformChunk* chunk) const {
+  CHECK_NOTNULL(chunk);
+  // Only read from, so blocks shared with a snapshot are not copied.
+  const Layer<TsdfVoxel>& tsdf_layer = *tsdf_layer_;
+  const IndexElement vps = static_cast<IndexElement>(voxels_per_side_);
+  const FloatingPoint voxels_per_side_inv = 1.0 / voxels_per_side_;
+  // Size of the dense grid in voxels, and the strides of its axes.
+  const GlobalIndex grid_size =
+      max_voxel_index - min_voxel_index + GlobalIndex::Ones();
+  const size_t sizes[3] = {static_cast<size_t>(grid_size.x()),
+                           static_cast<size_t>(grid_size.y()),
+                           static_cast<size_t>(grid_size.z())};
+  const size_t strides[3] = {1u, sizes[0], sizes[0] * sizes[1]};
+  const size_t num_voxels = strides[2] * sizes[2];
+  CHECK_LT(num_voxels, SquaredDistanceTransform1d::kInvalidIndex);
+  constexpr float kInfinity = SquaredDistanceTransform1d::kInfinity;
+
+  // Copy the fixed voxels into the grid, the blocks at its border only
+  // partially.
+  chunk->fixed_distances.assign(num_voxels, kInfinity);
+  const BlockIndex min_block_index =
+      getBlockIndexFromGlobalVoxelIndex(min_voxel_index, voxels_per_side_inv);
+  const BlockIndex max_block_index =
+      getBlockIndexFromGlobalVoxelIndex(max_voxel_index, voxels_per_side_inv);
+  BlockIndex block_index;
+  for (block_index.z() = min_block_index.z();
+       block_index.z() <= max_block_index.z(); ++block_index.z()) {
+    for (block_index.y() = min_block_index.y();
+         block_index.y() <= max_block_index.y(); ++block_index.y()) {
+      for (block_index.x() = min_block_index.x();
+           block_index.x() <= max_block_index.x(); ++block_index.x()) {
+        Block<TsdfVoxel>::ConstPtr tsdf_block =
+            tsdf_layer.getBlockPtrByIndex(block_index);
+        if (!tsdf_block) {
+          continue;
+        }
+        // The voxels of the block inside of the grid, in grid coordinates.
+        const GlobalIndex block_origin =
+            block_index.cast<LongIndexElement>() * vps - min_voxel_index;
+        const GlobalIndex min_index =
+            block_origin.cwiseMax(GlobalIndex::Zero());
+        const GlobalIndex max_index =
+            (block_origin + GlobalIndex::Constant(vps - 1))
+                .cwiseMin(grid_size - GlobalIndex::Ones());
+        for (LongIndexElement z = min_index.z(); z <= max_index.z(); ++z) {
+          for (LongIndexElement y = min_index.y(); y <= max_index.y(); ++y) {
+            for (LongIndexElement x = min_index.x(); x <= max_index.x();
+                 ++x) {
+              const VoxelIndex voxel_index =
+                  (GlobalIndex(x, y, z) - block_origin)
+                      .cast<IndexElement>();
+              const TsdfVoxel& tsdf_voxel =
+                  tsdf_block->getVoxelByVoxelIndex(voxel_index);
+              if (tsdf_voxel.weight < config_.min_weight ||
+                  !isFixed(tsdf_voxel.distance)) {
+                continue;
+              }
+              chunk->fixed_distances[x + y * strides[1] + z * strides[2]] =
+                  tsdf_voxel.distance;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  const size_t max_size = std::max(sizes[0], std::max(sizes[1], sizes[2]));
+  chunk->squared_distances.resize(num_voxels);
+  chunk->closest_fixed_voxels.resize(num_voxels);
+  chunk->line_values.resize(max_size);
+  chunk->line_distances.resize(max_size);
+  chunk->line_closest_voxels.resize(max_size);
+  chunk->line_argmins.resize(max_size);
+
+  // Outside voxels get their distance from the fixed voxels outside, and
+  // inside voxels from the ones inside, as in the propagation.
+  for (const bool outside : {true, false}) {
+    for (size_t i = 0u; i < num_voxels; ++i) {
+      const float fixed_distance = chunk->fixed_distances[i];
+      const bool is_seed = fixed_distance < kInfinity &&
+                           (outside ? fixed_distance > 0.0f
+                                    : fixed_distance <= 0.0f);
+      chunk->squared_distances[i] = is_seed ? 0.0f : kInfinity;
+      chunk->closest_fixed_voxels[i] =
+          is_seed ? static_cast<uint32_t>(i)
+                  : SquaredDistanceTransform1d::kInvalidIndex;
+    }
+
+    // Separable transform, one axis after the other.
+    for (unsigned int axis = 0u; axis < 3u; ++axis) {
+      const unsigned int axis_a = (axis + 1u) % 3u;
+      const unsigned int axis_b = (axis + 2u) % 3u;
+      const size_t size = sizes[axis];
+      const size_t stride = strides[axis];
+      for (size_t a = 0u; a < sizes[axis_a]; ++a) {
+        for (size_t b = 0u; b < sizes[axis_b]; ++b) {
+          const size_t start = a * strides[axis_a] + b * strides[axis_b];
+          for (size_t q = 0u; q < size; ++q) {
+            const size_t grid_index = start + q * stride;
+            chunk->line_values[q] = chunk->squared_distances[grid_index];
+            chunk->line_closest_voxels[q] =
+                chunk->closest_fixed_voxels[grid_index];
+          }
+          chunk->transform.compute(chunk->line_values.data(), size,
+                                   chunk->line_distances.data(),
+                                   chunk->line_argmins.data());
+          for (size_t q = 0u; q < size; ++q) {
+            const size_t grid_index = start + q * stride;
+            const uint32_t argmin = chunk->line_argmins[q];
+            chunk->squared_distances[grid_index] = chunk->line_distances[q];
+            chunk->closest_fixed_voxels[grid_index] =
+                argmin == SquaredDistanceTransform1d::kInvalidIndex
+                    ? argmin
+                    : chunk->line_closest_voxels[argmin];
+          }
+        }
+      }
+    }
+
+    // Write the voxels of this sign of the blocks in the chunk.
+    for (const BlockIndex& block_index : blocks) {
+      Block<TsdfVoxel>::ConstPtr tsdf_block =
+          tsdf_layer.getBlockPtrByIndex(block_index);
+      Block<EsdfVoxel>::Ptr esdf_block =
+          esdf_layer_->getBlockPtrByIndex(block_index);
+      CHECK(tsdf_block);
+      CHECK(esdf_block);
+      const GlobalIndex block_origin =
+          block_index.cast<LongIndexElement>() * vps - min_voxel_index;
+      size_t linear_index = 0u;
+      for (IndexElement z = 0; z < vps; ++z) {
+        for (IndexElement y = 0; y < vps; ++y) {
+          for (IndexElement x = 0; x < vps; ++x, ++linear_index) {
+            const TsdfVoxel& tsdf_voxel =
+                tsdf_block->getVoxelByLinearIndex(linear_index);
+            EsdfVoxel& esdf_voxel =
+                esdf_block->getVoxelByLinearIndex(linear_index);
+            const GlobalIndex grid_voxel_index =
+                block_origin + GlobalIndex(x, y, z);
+            const size_t grid_index = grid_voxel_index.x() +
+                                      grid_voxel_index.y() * strides[1] +
+                                      grid_voxel_index.z() * strides[2];
+
+            const bool observed = tsdf_voxel.weight >= config_.min_weight;
+            if (!observed && !config_.add_occupied_crust) {
+              continue;
+            }
+            // Unobserved voxels of the crust are inside.
+            const bool voxel_outside = observed && tsdf_voxel.distance > 0.0f;
+            if (voxel_outside != outside) {
+              continue;
+            }
+            esdf_voxel.observed = true;
+            esdf_voxel.hallucinated = !observed;
+            esdf_voxel.in_queue = false;
+            esdf_voxel.parent.setZero();
+
+            const float fixed_distance = chunk->fixed_distances[grid_index];
+            esdf_voxel.fixed = fixed_distance < kInfinity;
+            if (esdf_voxel.fixed) {
+              esdf_voxel.distance = fixed_distance;
+              continue;
+            }
+
+            const FloatingPoint sign = outside ? 1.0 : -1.0;
+            esdf_voxel.distance = sign * config_.default_distance_m;
+            const uint32_t closest_index =
+                chunk->closest_fixed_voxels[grid_index];
+            if (closest_index == SquaredDistanceTransform1d::kInvalidIndex) {
+              continue;
+            }
+            const FloatingPoint distance =
+                std::sqrt(chunk->squared_distances[grid_index]) * voxel_size_ +
+                std::abs(chunk->fixed_distances[closest_index]);
+            if (distance > max_distance) {
+              continue;
+            }
+            esdf_voxel.distance = sign * distance;
+
+            const GlobalIndex closest_voxel_index(
+                closest_index % strides[1],
+                closest_index % strides[2] / strides[1],
+                closest_index / strides[2]);
+            const GlobalIndex parent = closest_voxel_index - grid_voxel_index;
+            if ((parent.array().abs() <= std::numeric_limits<int8_t>::max())
+                    .all()) {
+              esdf_voxel.parent = parent.cast<int8_t>();
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+void EsdfIntegrator::setWindowCenter(const Point& center) {
+  if (config_.window_half_size_m <= 0.0) {
+    return;
+  }
+  window_center_ = esdf_layer_->computeBlockIndexFromCoordinates(center);
+  has_window_center_ = true;
+}
+
+bool EsdfIntegrator::isBlockInWindow(const BlockIndex& block_index) const {
+  if (!has_window_center_) {
+    return true;
+  }
+  return ((block_index - window_center_).cwiseAbs().array() <=
+          window_half_size_blocks_)
+      .all();
+}
+
+void EsdfIntegrator::getUpdatedBlocksInWindow(BlockIndexList* tsdf_blocks) {
+  CHECK_NOTNULL(tsdf_blocks);
+  tsdf_blocks->clear();
+
+  // The ESDF layer only contains the blocks of the last window, and maybe
+  // some allocated around the robot, so this doesn't grow with the map.
+  BlockIndexList esdf_blocks;
+  esdf_layer_->getAllAllocatedBlocks(&esdf_blocks);
+  for (const BlockIndex& block_index : esdf_blocks) {
+    if (!isBlockInWindow(block_index)) {
+      esdf_layer_->removeBlock(block_index);
+    }
+  }
+
+  const IndexElement size = window_half_size_blocks_;
+  for (IndexElement z = -size; z <= size; ++z) {
+    for (IndexElement y = -size; y <= size; ++y) {
+      for (IndexElement x = -size; x <= size; ++x) {
+        const BlockIndex block_index = window_center_ + BlockIndex(x, y, z);
+        if (!tsdf_layer_->hasBlock(block_index)) {
+          continue;
+        }
+        const bool updated =
+            tsdf_layer_->getUpdatedSubBricks(block_index, Update::kEsdf) != 0u;
+        if (updated || !esdf_layer_->hasBlock(block_index)) {
+          tsdf_blocks->push_back(block_index);
+        }
+      }
+    }
+  }
+}
+
 void EsdfIntegrator::updateFromTsdfLayer(bool clear_updated_flag) {
   BlockIndexList tsdf_blocks;
-  tsdf_layer_->getAllUpdatedBlocks(Update::kEsdf, &tsdf_blocks);
-  tsdf_blocks.insert(tsdf_blocks.end(), updated_blocks_.begin(),
-                     updated_blocks_.end());
+  if (has_window_center_) {
+    getUpdatedBlocksInWindow(&tsdf_blocks);
+  } else {
+    tsdf_layer_->getAllUpdatedBlocks(Update::kEsdf, &tsdf_blocks);
+  }
+  // Only the sub-bricks that changed since the last update need to be
+  // propagated from the TSDF.
+  std::vector<Block<TsdfVoxel>::SubBrickMask> sub_brick_masks;
+  sub_brick_masks.reserve(tsdf_blocks.size() + updated_blocks_.size());
+  for (const BlockIndex& block_index : tsdf_blocks) {
+    sub_brick_masks.push_back(
+        tsdf_layer_->getUpdatedSubBricks(block_index, Update::kEsdf));
+  }
+  for (const BlockIndex& block_index : updated_blocks_) {
+    if (isBlockInWindow(block_index)) {
+      tsdf_blocks.push_back(block_index);
+    }
+  }
+  sub_brick_masks.resize(tsdf_blocks.size(),
+                         Block<TsdfVoxel>::kAllSubBricks);
   updated_blocks_.clear();
   const bool kIncremental = true;
-  updateFromTsdfBlocks(tsdf_blocks, kIncremental);
+  updateFromTsdfBlocks(tsdf_blocks, sub_brick_masks, kIncremental);
 
   if (clear_updated_flag) {
     for (const BlockIndex& block_index : tsdf_blocks) {
-      if (tsdf_layer_->hasBlock(block_index)) {
-        tsdf_layer_->getBlockByIndex(block_index)
-            .updated()
-            .reset(Update::kEsdf);
-      }
+      tsdf_layer_->resetUpdated(block_index, Update::kEsdf);
     }
   }
 }
 
 void EsdfIntegrator::updateFromTsdfBlocks(const BlockIndexList& tsdf_blocks,
                                           bool incremental) {
+  const std::vector<Block<TsdfVoxel>::SubBrickMask> sub_brick_masks(
+      tsdf_blocks.size(), Block<TsdfVoxel>::kAllSubBricks);
+  updateFromTsdfBlocks(tsdf_blocks, sub_brick_masks, incremental);
+}
+
+void EsdfIntegrator::updateFromTsdfBlocks(
+    const BlockIndexList& tsdf_blocks,
+    const std::vector<Block<TsdfVoxel>::SubBrickMask>& sub_brick_masks,
+    bool incremental) {
+  CHECK_EQ(tsdf_blocks.size(), sub_brick_masks.size());
   CHECK_EQ(tsdf_layer_->voxels_per_side(), esdf_layer_->voxels_per_side());
+  // Only read from, so blocks shared with a snapshot are not copied.
+  const Layer<TsdfVoxel>& tsdf_layer = *tsdf_layer_;
   timing::Timer esdf_timer("esdf");
 
   // Go through all blocks in TSDF and copy their values for relevant voxels.
@@ -133,21 +531,30 @@ void EsdfIntegrator::updateFromTsdfBlocks(const BlockIndexList& tsdf_blocks,
   timing::Timer propagate_timer("esdf/propagate_tsdf");
   VLOG(3) << "[ESDF update]: Propagating " << tsdf_blocks.size()
           << " updated blocks from the TSDF.";
-  for (const BlockIndex& block_index : tsdf_blocks) {
+  std::vector<size_t> linear_indices;
+  for (size_t i = 0u; i < tsdf_blocks.size(); ++i) {
+    const BlockIndex& block_index = tsdf_blocks[i];
     Block<TsdfVoxel>::ConstPtr tsdf_block =
-        tsdf_layer_->getBlockPtrByIndex(block_index);
+        tsdf_layer.getBlockPtrByIndex(block_index);
     if (!tsdf_block) {
       continue;
     }
 
+    // Newly allocated ESDF blocks need all of their voxels propagated, no
+    // matter which parts of the TSDF block changed.
+    Block<TsdfVoxel>::SubBrickMask sub_brick_mask = sub_brick_masks[i];
+    if (!esdf_layer_->hasBlock(block_index)) {
+      sub_brick_mask = Block<TsdfVoxel>::kAllSubBricks;
+    }
+
     // Allocate the same block in the ESDF layer.
     // Block indices are the same across all layers.
     Block<EsdfVoxel>::Ptr esdf_block =
         esdf_layer_->allocateBlockPtrByIndex(block_index);
     esdf_block->set_updated(true);
 
-    const size_t num_voxels_per_block = tsdf_block->num_voxels();
-    for (size_t lin_index = 0u; lin_index < num_voxels_per_block; ++lin_index) {
+    tsdf_block->getLinearIndicesOfSubBricks(sub_brick_mask, &linear_indices);
+    for (const size_t lin_index : linear_indices) {
       const TsdfVoxel& tsdf_voxel =
           tsdf_block->getVoxelByLinearIndex(lin_index);
       // If this voxel is unobserved in the original map, skip it.
@@ -309,24 +716,17 @@ void EsdfIntegrator::processRaiseSet() {
   //     queue.
   // (2) if the neighbor's parent differs, add it to open (we will have to
   //    update our current distances, of course).
-  GlobalIndexVector neighbors;
-  Neighborhood<>::IndexMatrix neighbor_indices;
+  BlockNeighborhood<EsdfVoxel> neighborhood(esdf_layer_);
   while (!raise_.empty()) {
     const GlobalIndex global_index = raise_.front();
     raise_.pop();
 
-    EsdfVoxel* voxel = esdf_layer_->getVoxelPtrByGlobalIndex(global_index);
+    EsdfVoxel* voxel = neighborhood.setGlobalIndex(global_index);
     CHECK_NOTNULL(voxel);
 
-    // Get the global indices of neighbors.
-    Neighborhood<>::getFromGlobalIndex(global_index, &neighbor_indices);
-
     // Go through the neighbors and see if we can update any of them.
-    for (unsigned int idx = 0u; idx < neighbor_indices.cols(); ++idx) {
-      const GlobalIndex& neighbor_index = neighbor_indices.col(idx);
-
-      EsdfVoxel* neighbor_voxel =
-          esdf_layer_->getVoxelPtrByGlobalIndex(neighbor_index);
+    for (unsigned int idx = 0u; idx < Connectivity::kTwentySix; ++idx) {
+      EsdfVoxel* neighbor_voxel = neighborhood.getNeighbor(idx);
       if (neighbor_voxel == nullptr) {
         continue;
       }
@@ -335,8 +735,12 @@ void EsdfIntegrator::processRaiseSet() {
       if (!neighbor_voxel->observed || neighbor_voxel->fixed) {
         continue;
       }
-      SignedIndex direction = (neighbor_index - global_index).cast<int>();
-      bool is_neighbors_parent = (neighbor_voxel->parent == -direction);
+      const GlobalIndex neighbor_index =
+          neighborhood.getNeighborGlobalIndex(idx);
+      const SignedIndex direction =
+          NeighborhoodLookupTables::kOffsets.col(idx);
+      bool is_neighbors_parent =
+          (neighbor_voxel->parent.cast<IndexElement>() == -direction);
       if (config_.full_euclidean_distance) {
         Point voxel_parent_direction =
             neighbor_voxel->parent.cast<FloatingPoint>().normalized();
@@ -369,17 +773,19 @@ void EsdfIntegrator::processRaiseSet() {
 }
 
 void EsdfIntegrator::processOpenSet() {
-  size_t num_updates = 0u;
-  size_t num_inside = 0u;
-  size_t num_outside = 0u;
-  size_t num_flipped = 0u;
-  Neighborhood<>::IndexMatrix neighbor_indices;
+  if (config_.integrator_threads > 1u) {
+    processOpenSetParallel();
+    return;
+  }
+
+  OpenSetStats stats;
+  BlockNeighborhood<EsdfVoxel> neighborhood(esdf_layer_);
 
   while (!open_.empty()) {
     GlobalIndex global_index = open_.front();
     open_.pop();
 
-    EsdfVoxel* voxel = esdf_layer_->getVoxelPtrByGlobalIndex(global_index);
+    EsdfVoxel* voxel = neighborhood.setGlobalIndex(global_index);
     CHECK_NOTNULL(voxel);
     voxel->in_queue = false;
 
@@ -389,18 +795,9 @@ void EsdfIntegrator::processOpenSet() {
       continue;
     }
 
-    Neighborhood<>::getFromGlobalIndex(global_index, &neighbor_indices);
-
     // Go through the neighbors and see if we can update any of them.
-    for (unsigned int idx = 0u; idx < neighbor_indices.cols(); ++idx) {
-      const GlobalIndex& neighbor_index = neighbor_indices.col(idx);
-      const SignedIndex& direction =
-          NeighborhoodLookupTables::kOffsets.col(idx);
-      FloatingPoint distance =
-          NeighborhoodLookupTables::kDistances[idx] * voxel_size_;
-
-      EsdfVoxel* neighbor_voxel =
-          esdf_layer_->getVoxelPtrByGlobalIndex(neighbor_index);
+    for (unsigned int idx = 0u; idx < Connectivity::kTwentySix; ++idx) {
+      EsdfVoxel* neighbor_voxel = neighborhood.getNeighbor(idx);
       if (neighbor_voxel == nullptr) {
         continue;
       }
@@ -411,88 +808,186 @@ void EsdfIntegrator::processOpenSet() {
         continue;
       }
 
-      SignedIndex new_parent = -direction;
-      if (config_.full_euclidean_distance) {
-        // In this case, the new parent is is actually the parent of the
-        // current voxel.
-        // And the distance is... Well, complicated.
-        new_parent = voxel->parent - direction;
-        distance = voxel_size_ * (new_parent.cast<FloatingPoint>().norm() -
-                                  voxel->parent.cast<FloatingPoint>().norm());
-
-        if (distance < 0.0) {
-          continue;
+      if (propagateToNeighbor(*voxel, idx, neighbor_voxel, &stats)) {
+        // Push into the queue if necessary.
+        if (config_.multi_queue || !neighbor_voxel->in_queue) {
+          open_.push(neighborhood.getNeighborGlobalIndex(idx),
+                     neighbor_voxel->distance);
+          neighbor_voxel->in_queue = true;
         }
       }
+    }
+  }
 
-      // Both are OUTSIDE the surface.
-      if (voxel->distance > 0 && neighbor_voxel->distance > 0) {
-        if (voxel->distance + distance + config_.min_diff_m <
-            neighbor_voxel->distance) {
-          num_updates++;
-          num_outside++;
-          neighbor_voxel->distance = voxel->distance + distance;
-          // Also update parent.
-          neighbor_voxel->parent = new_parent;
-          // Push into the queue if necessary.
-          if (config_.multi_queue || !neighbor_voxel->in_queue) {
-            open_.push(neighbor_index, neighbor_voxel->distance);
-            neighbor_voxel->in_queue = true;
-          }
-        }
-        // Next case is both INSIDE the surface.
-      } else if (voxel->distance <= 0 && neighbor_voxel->distance <= 0) {
-        if (voxel->distance - distance - config_.min_diff_m >
-            neighbor_voxel->distance) {
-          num_updates++;
-          num_inside++;
-          neighbor_voxel->distance = voxel->distance - distance;
-          // Also update parent.
-          neighbor_voxel->parent = new_parent;
-          // Push into the queue if necessary.
-          if (config_.multi_queue || !neighbor_voxel->in_queue) {
-            open_.push(neighbor_index, neighbor_voxel->distance);
-            neighbor_voxel->in_queue = true;
-          }
-        }
-        // Final case is if the signs are different.
-      } else {
-        const FloatingPoint potential_distance =
-            voxel->distance - signum(voxel->distance) * distance;
-        if (std::abs(potential_distance - neighbor_voxel->distance) >
-            distance) {
-          if (signum(potential_distance) == neighbor_voxel->distance) {
-            num_updates++;
-            num_flipped++;
-            neighbor_voxel->distance = potential_distance;
-            // Also update parent.
-            neighbor_voxel->parent = new_parent;
-            // Push into the queue if necessary.
-            if (config_.multi_queue || !neighbor_voxel->in_queue) {
-              open_.push(neighbor_index, neighbor_voxel->distance);
-              neighbor_voxel->in_queue = true;
-            }
-          } else {
-            num_updates++;
-            num_flipped++;
-            neighbor_voxel->distance =
-                signum(neighbor_voxel->distance) * distance;
-            // Also update parent.
-            neighbor_voxel->parent = new_parent;
-            // Push into the queue if necessary.
-            if (config_.multi_queue || !neighbor_voxel->in_queue) {
-              open_.push(neighbor_index, neighbor_voxel->distance);
-              neighbor_voxel->in_queue = true;
-            }
-          }
+  VLOG(3) << "[ESDF update]: made " << stats.num_updates
+          << " voxel updates, of which outside: " << stats.num_outside
+          << " inside: " << stats.num_inside
+          << " flipped: " << stats.num_flipped;
+}
+
+void EsdfIntegrator::processOpenSetParallel() {
+  EsdfBlockOpenSets block_open_sets(esdf_layer_, config_.num_buckets,
+                                    config_.max_distance_m);
+  block_open_sets.pushAll(&open_);
+
+  // The rounds are short, so the threads are only started once.
+  ThreadPool thread_pool(config_.integrator_threads);
+  block_open_sets.process(
+      &thread_pool,
+      [this](const int max_bucket_index, BlockOpenSet* block_open_set) {
+        propagateBlockOpenSet(max_bucket_index, block_open_set);
+      },
+      [this](const NeighborUpdate& update, EsdfVoxel* neighbor_voxel,
+             OpenSetStats* stats) {
+        return neighbor_voxel->observed && !neighbor_voxel->fixed &&
+               propagateToNeighbor(update.voxel, update.neighbor_idx,
+                                   neighbor_voxel, stats) &&
+               (config_.multi_queue || !neighbor_voxel->in_queue);
+      });
+
+  OpenSetStats stats;
+  for (const std::unique_ptr<BlockOpenSet>& block_open_set :
+       block_open_sets.block_open_sets()) {
+    stats.num_updates += block_open_set->stats.num_updates;
+    stats.num_inside += block_open_set->stats.num_inside;
+    stats.num_outside += block_open_set->stats.num_outside;
+    stats.num_flipped += block_open_set->stats.num_flipped;
+  }
+  VLOG(3) << "[ESDF update]: made " << stats.num_updates
+          << " voxel updates in " << block_open_sets.block_open_sets().size()
+          << " blocks and " << block_open_sets.num_rounds()
+          << " rounds, of which outside: " << stats.num_outside
+          << " inside: " << stats.num_inside
+          << " flipped: " << stats.num_flipped;
+}
+
+void EsdfIntegrator::propagateBlockOpenSet(
+    const int max_bucket_index, BlockOpenSet* block_open_set) const {
+  CHECK_NOTNULL(block_open_set);
+  Block<EsdfVoxel>& block = *block_open_set->block;
+  const BlockIndex block_index = block.block_index();
+  BucketQueue<size_t>& queue = block_open_set->queue;
+
+  while (!queue.empty() && queue.frontBucketIndex() <= max_bucket_index) {
+    const size_t linear_index = queue.front();
+    queue.pop();
+
+    EsdfVoxel& voxel = block.getVoxelByLinearIndex(linear_index);
+    voxel.in_queue = false;
+
+    // Skip voxels that are unobserved or outside the ranges we care about.
+    if (!voxel.observed || voxel.distance >= config_.max_distance_m ||
+        voxel.distance <= -config_.max_distance_m) {
+      continue;
+    }
+
+    const VoxelIndex voxel_index =
+        block.computeVoxelIndexFromLinearIndex(linear_index);
+    for (unsigned int idx = 0u; idx < NeighborhoodLookupTables::kOffsets.cols();
+         ++idx) {
+      const VoxelIndex neighbor_voxel_index =
+          voxel_index + NeighborhoodLookupTables::kOffsets.col(idx);
+      if (!block.isValidVoxelIndex(neighbor_voxel_index)) {
+        NeighborUpdate update;
+        update.neighbor_index = getGlobalVoxelIndexFromBlockAndVoxelIndex(
+            block_index, neighbor_voxel_index, voxels_per_side_);
+        update.neighbor_idx = idx;
+        update.voxel = voxel;
+        block_open_set->neighbor_updates.push_back(update);
+        continue;
+      }
+
+      EsdfVoxel& neighbor_voxel =
+          block.getVoxelByVoxelIndex(neighbor_voxel_index);
+      if (!neighbor_voxel.observed || neighbor_voxel.fixed) {
+        continue;
+      }
+      if (propagateToNeighbor(voxel, idx, &neighbor_voxel,
+                              &block_open_set->stats)) {
+        if (config_.multi_queue || !neighbor_voxel.in_queue) {
+          queue.push(
+              block.computeLinearIndexFromVoxelIndex(neighbor_voxel_index),
+              neighbor_voxel.distance);
+          neighbor_voxel.in_queue = true;
         }
       }
     }
   }
+}
+
+bool EsdfIntegrator::propagateToNeighbor(const EsdfVoxel& voxel,
+                                         const unsigned int neighbor_idx,
+                                         EsdfVoxel* neighbor_voxel,
+                                         OpenSetStats* stats) const {
+  DCHECK(neighbor_voxel != nullptr);
+  DCHECK(stats != nullptr);
+  const SignedIndex& direction =
+      NeighborhoodLookupTables::kOffsets.col(neighbor_idx);
+  FloatingPoint distance =
+      NeighborhoodLookupTables::kDistances[neighbor_idx] * voxel_size_;
+
+  SignedIndex new_parent = -direction;
+  if (config_.full_euclidean_distance) {
+    // In this case, the new parent is is actually the parent of the
+    // current voxel.
+    // And the distance is... Well, complicated.
+    const SignedIndex parent = voxel.parent.cast<IndexElement>();
+    const SignedIndex parent_of_neighbor = parent - direction;
+    // The parent offsets are stored in 8 bits. If the parent is too far away
+    // to be stored, the neighbor becomes the child of the voxel instead, as
+    // in the quasi-euclidean case.
+    constexpr IndexElement kMinParentOffset =
+        std::numeric_limits<int8_t>::min();
+    constexpr IndexElement kMaxParentOffset =
+        std::numeric_limits<int8_t>::max();
+    if ((parent_of_neighbor.array() >= kMinParentOffset).all() &&
+        (parent_of_neighbor.array() <= kMaxParentOffset).all()) {
+      new_parent = parent_of_neighbor;
+      distance = voxel_size_ * (new_parent.cast<FloatingPoint>().norm() -
+                                parent.cast<FloatingPoint>().norm());
+
+      if (distance < 0.0) {
+        return false;
+      }
+    }
+  }
 
-  VLOG(3) << "[ESDF update]: made " << num_updates
-          << " voxel updates, of which outside: " << num_outside
-          << " inside: " << num_inside << " flipped: " << num_flipped;
+  // Both are OUTSIDE the surface.
+  if (voxel.distance > 0 && neighbor_voxel->distance > 0) {
+    if (voxel.distance + distance + config_.min_diff_m <
+        neighbor_voxel->distance) {
+      stats->num_updates++;
+      stats->num_outside++;
+      neighbor_voxel->distance = voxel.distance + distance;
+      // Also update parent.
+      neighbor_voxel->parent = new_parent.cast<int8_t>();
+      return true;
+    }
+    // Next case is both INSIDE the surface.
+  } else if (voxel.distance <= 0 && neighbor_voxel->distance <= 0) {
+    if (voxel.distance - distance - config_.min_diff_m >
+        neighbor_voxel->distance) {
+      stats->num_updates++;
+      stats->num_inside++;
+      neighbor_voxel->distance = voxel.distance - distance;
+      // Also update parent.
+      neighbor_voxel->parent = new_parent.cast<int8_t>();
+      return true;
+    }
+    // Final case is if the signs are different. The surface lies between
+    // the voxels, so the neighbor is at most one step away from it. This only
+    // ever lowers the distance, like the cases above, so the result doesn't
+    // depend on the order in which the voxels are propagated.
+  } else if (distance + config_.min_diff_m <
+             std::abs(neighbor_voxel->distance)) {
+    stats->num_updates++;
+    stats->num_flipped++;
+    neighbor_voxel->distance = signum(neighbor_voxel->distance) * distance;
+    // Also update parent.
+    neighbor_voxel->parent = new_parent.cast<int8_t>();
+    return true;
+  }
+  return false;
 }
 
 bool EsdfIntegrator::updateVoxelFromNeighbors(const GlobalIndex& global_index) {
@@ -502,10 +997,13 @@ bool EsdfIntegrator::updateVoxelFromNeighbors(const GlobalIndex& global_index) {
   Neighborhood<>::IndexMatrix neighbor_indices;
   Neighborhood<>::getFromGlobalIndex(global_index, &neighbor_indices);
 
-  // Go through the neighbors and see if we can update any of them.
+  // Take the distance through the closest neighbor with the same sign, so
+  // the result doesn't depend on the order of the neighbors.
+  bool updated = false;
   for (unsigned int idx = 0u; idx < neighbor_indices.cols(); ++idx) {
     const GlobalIndex& neighbor_index = neighbor_indices.col(idx);
-    const FloatingPoint distance = Neighborhood<>::kDistances[idx];
+    const FloatingPoint distance =
+        Neighborhood<>::kDistances[idx] * voxel_size_;
 
     EsdfVoxel* neighbor_voxel =
         esdf_layer_->getVoxelPtrByGlobalIndex(neighbor_index);
@@ -518,15 +1016,16 @@ bool EsdfIntegrator::updateVoxelFromNeighbors(const GlobalIndex& global_index) {
       continue;
     }
     if (signum(neighbor_voxel->distance) == signum(voxel->distance)) {
-      if (std::abs(neighbor_voxel->distance) < std::abs(voxel->distance)) {
+      if (std::abs(neighbor_voxel->distance) + distance <
+          std::abs(voxel->distance)) {
         voxel->distance =
             neighbor_voxel->distance + signum(voxel->distance) * distance;
-        voxel->parent = -(neighbor_index - global_index).cast<int>();
-        return true;
+        voxel->parent = (neighbor_index - global_index).cast<int8_t>();
+        updated = true;
       }
     }
   }
-  return false;
+  return updated;
 }
 
 }  // namespace voxblox
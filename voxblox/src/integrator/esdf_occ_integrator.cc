@@ -1,5 +1,11 @@
 #include "voxblox/integrator/esdf_occ_integrator.h"
 
+#include <atomic>
+#include <limits>
+#include <memory>
+
+#include "voxblox/utils/thread_pool.h"
+
 namespace voxblox {
 
 EsdfOccIntegrator::EsdfOccIntegrator(const Config& config,
@@ -18,69 +24,126 @@ EsdfOccIntegrator::EsdfOccIntegrator(const Config& config,
 // Fixed is overloaded as occupied in this case.
 void EsdfOccIntegrator::updateFromOccLayerBatch() {
   esdf_layer_->removeAllBlocks();
+  clear();
   BlockIndexList occ_blocks;
   occ_layer_->getAllAllocatedBlocks(&occ_blocks);
   updateFromOccBlocks(occ_blocks);
 }
 
-void EsdfOccIntegrator::updateFromOccBlocks(const BlockIndexList& occ_blocks) {
+void EsdfOccIntegrator::updateFromOccLayer(bool clear_updated_flag) {
+  BlockIndexList occ_blocks;
+  occ_layer_->getAllUpdatedBlocks(Update::kEsdf, &occ_blocks);
+  std::vector<Block<OccupancyVoxel>::SubBrickMask> sub_brick_masks;
+  sub_brick_masks.reserve(occ_blocks.size());
+  for (const BlockIndex& block_index : occ_blocks) {
+    sub_brick_masks.push_back(
+        occ_layer_->getUpdatedSubBricks(block_index, Update::kEsdf));
+  }
+  const bool kIncremental = true;
+  updateFromOccBlocks(occ_blocks, sub_brick_masks, kIncremental);
+
+  if (clear_updated_flag) {
+    for (const BlockIndex& block_index : occ_blocks) {
+      occ_layer_->resetUpdated(block_index, Update::kEsdf);
+    }
+  }
+}
+
+void EsdfOccIntegrator::updateFromOccBlocks(const BlockIndexList& occ_blocks,
+                                            bool incremental) {
+  const std::vector<Block<OccupancyVoxel>::SubBrickMask> sub_brick_masks(
+      occ_blocks.size(), Block<OccupancyVoxel>::kAllSubBricks);
+  updateFromOccBlocks(occ_blocks, sub_brick_masks, incremental);
+}
+
+void EsdfOccIntegrator::updateFromOccBlocks(
+    const BlockIndexList& occ_blocks,
+    const std::vector<Block<OccupancyVoxel>::SubBrickMask>& sub_brick_masks,
+    bool incremental) {
+  CHECK_EQ(occ_blocks.size(), sub_brick_masks.size());
   DCHECK_EQ(occ_layer_->voxels_per_side(), esdf_layer_->voxels_per_side());
   timing::Timer esdf_timer("esdf_occ");
 
-  // Get a specific list of voxels in the TSDF layer, and propagate out from
-  // there.
-  // Go through all blocks in TSDF and copy their values for relevant voxels.
   size_t num_lower = 0u;
   size_t num_raise = 0u;
   size_t num_new = 0u;
-  timing::Timer propagate_timer("esdf_occ/propagate_tsdf");
+  timing::Timer propagate_timer("esdf_occ/propagate_occ");
   VLOG(3) << "[ESDF update]: Propagating " << occ_blocks.size()
-          << " updated blocks from the TSDF.";
-  for (const BlockIndex& block_index : occ_blocks) {
-    const Block<OccupancyVoxel>& occ_block =
-        occ_layer_->getBlockByIndex(block_index);
-
-    // Allocate the same block in the ESDF layer.
+          << " updated blocks from the occupancy layer.";
+
+  // Allocate all blocks first, so the neighborhood lookups below see them.
+  // Newly allocated ESDF blocks need all of their voxels propagated, no
+  // matter which parts of the occupancy block changed.
+  std::vector<Block<OccupancyVoxel>::SubBrickMask> masks = sub_brick_masks;
+  for (size_t i = 0u; i < occ_blocks.size(); ++i) {
+    if (!esdf_layer_->hasBlock(occ_blocks[i])) {
+      masks[i] = Block<OccupancyVoxel>::kAllSubBricks;
+    }
     // Block indices are the same across all layers.
-    Block<EsdfVoxel>::Ptr esdf_block =
-        esdf_layer_->allocateBlockPtrByIndex(block_index);
+    esdf_layer_->allocateBlockPtrByIndex(occ_blocks[i])->set_updated(true);
+  }
 
-    // TODO(helenol): assumes that TSDF and ESDF layer are the same size.
-    // This will not always be true...
-    const size_t num_voxels_per_block = occ_block.num_voxels();
+  BlockNeighborhood<EsdfVoxel> neighborhood(esdf_layer_);
+  std::vector<size_t> linear_indices;
+  for (size_t i = 0u; i < occ_blocks.size(); ++i) {
+    const BlockIndex& block_index = occ_blocks[i];
+    Block<OccupancyVoxel>::ConstPtr occ_block =
+        occ_layer_->getBlockPtrByIndex(block_index);
+    if (!occ_block) {
+      continue;
+    }
 
-    for (size_t lin_index = 0u; lin_index < num_voxels_per_block; ++lin_index) {
+    occ_block->getLinearIndicesOfSubBricks(masks[i], &linear_indices);
+    for (const size_t lin_index : linear_indices) {
       const OccupancyVoxel& occ_voxel =
-          occ_block.getVoxelByLinearIndex(lin_index);
-
+          occ_block->getVoxelByLinearIndex(lin_index);
       if (!occ_voxel.observed) {
         continue;
       }
+      const GlobalIndex global_index =
+          getGlobalVoxelIndexFromBlockAndVoxelIndex(
+              block_index,
+              occ_block->computeVoxelIndexFromLinearIndex(lin_index),
+              esdf_voxels_per_side_);
+      EsdfVoxel* esdf_voxel = neighborhood.setGlobalIndex(global_index);
+      CHECK_NOTNULL(esdf_voxel);
 
-      EsdfVoxel& esdf_voxel = esdf_block->getVoxelByLinearIndex(lin_index);
-      VoxelIndex voxel_index =
-          esdf_block->computeVoxelIndexFromLinearIndex(lin_index);
-      // Check for frontier voxels.
-      // This is the check for the lower frontier.
       // If the occupancy voxel is occupied... Count unknown as free.
-      if (occ_voxel.probability_log > 0.0) {
-        // Assume batch for now.
-        esdf_voxel.distance = 0.0;
-        esdf_voxel.observed = true;
-        esdf_voxel.fixed = true;
-        esdf_voxel.parent.setZero();
-
-        esdf_voxel.in_queue = true;
-        open_.push(std::make_pair(block_index, voxel_index),
-                   esdf_voxel.distance);
+      if (occ_voxel.probability_log > 0.0f) {
+        if (esdf_voxel->observed && esdf_voxel->fixed) {
+          continue;
+        }
+        // Lower: the voxel is a new source of the distances around it.
+        esdf_voxel->distance = 0.0f;
+        esdf_voxel->observed = true;
+        esdf_voxel->fixed = true;
+        esdf_voxel->parent.setZero();
+        if (!esdf_voxel->in_queue) {
+          open_.push(global_index, esdf_voxel->distance);
+          esdf_voxel->in_queue = true;
+        }
         num_lower++;
-      } else {
-        esdf_voxel.distance = config_.default_distance_m;
-        esdf_voxel.observed = true;
-        esdf_voxel.fixed = false;
-        esdf_voxel.parent.setZero();
-        // No need to push to open...
-        num_new++;
+      } else if (!esdf_voxel->observed || esdf_voxel->fixed) {
+        const bool was_occupied = esdf_voxel->observed;
+        esdf_voxel->distance = config_.default_distance_m;
+        esdf_voxel->observed = true;
+        esdf_voxel->fixed = false;
+        esdf_voxel->parent.setZero();
+        if (was_occupied) {
+          // Raise: everything that got its distance from this voxel has to
+          // find a new parent.
+          raise_.push(global_index);
+          num_raise++;
+        } else {
+          num_new++;
+        }
+        // A raised voxel gets its distance back once the raise is done.
+        if (incremental && !was_occupied &&
+            updateVoxelFromNeighbors(&neighborhood, esdf_voxel) &&
+            !esdf_voxel->in_queue) {
+          open_.push(global_index, esdf_voxel->distance);
+          esdf_voxel->in_queue = true;
+        }
       }
     }
   }
@@ -89,106 +152,222 @@ void EsdfOccIntegrator::updateFromOccBlocks(const BlockIndexList& occ_blocks) {
           << " New: " << num_new;
 
   timing::Timer raise_timer("esdf_occ/raise_esdf");
-  // Process the open set now.
-  // processRaiseSet();
+  processRaiseSet();
   raise_timer.Stop();
 
   timing::Timer update_timer("esdf_occ/update_esdf");
-  // Process the open set now.
   processOpenSet();
   update_timer.Stop();
 
   esdf_timer.Stop();
 }
 
+bool EsdfOccIntegrator::updateVoxelFromNeighbors(
+    BlockNeighborhood<EsdfVoxel>* neighborhood, EsdfVoxel* voxel) const {
+  CHECK_NOTNULL(neighborhood);
+  CHECK_NOTNULL(voxel);
+  bool updated = false;
+  for (unsigned int idx = 0u; idx < Connectivity::kTwentySix; ++idx) {
+    const EsdfVoxel* neighbor_voxel = neighborhood->getNeighbor(idx);
+    if (neighbor_voxel == nullptr || !neighbor_voxel->observed ||
+        neighbor_voxel->distance >= config_.max_distance_m) {
+      continue;
+    }
+    const FloatingPoint distance =
+        neighbor_voxel->distance +
+        NeighborhoodLookupTables::kDistances[idx] * esdf_voxel_size_;
+    if (distance < voxel->distance) {
+      voxel->distance = distance;
+      voxel->parent = NeighborhoodLookupTables::kOffsets.col(idx)
+                          .cast<int8_t>();
+      updated = true;
+    }
+  }
+  return updated;
+}
+
+void EsdfOccIntegrator::processRaiseSet() {
+  size_t num_updates = 0u;
+  BlockNeighborhood<EsdfVoxel> neighborhood(esdf_layer_);
+  while (!raise_.empty()) {
+    const GlobalIndex global_index = raise_.front();
+    raise_.pop();
+    if (neighborhood.setGlobalIndex(global_index) == nullptr) {
+      continue;
+    }
+
+    for (unsigned int idx = 0u; idx < Connectivity::kTwentySix; ++idx) {
+      EsdfVoxel* neighbor_voxel = neighborhood.getNeighbor(idx);
+      if (neighbor_voxel == nullptr || !neighbor_voxel->observed) {
+        continue;
+      }
+      const GlobalIndex neighbor_index =
+          neighborhood.getNeighborGlobalIndex(idx);
+      const bool is_neighbors_parent =
+          !neighbor_voxel->fixed &&
+          neighbor_voxel->parent.cast<IndexElement>() ==
+              -NeighborhoodLookupTables::kOffsets.col(idx);
+      if (is_neighbors_parent) {
+        // Invalidate the child, and its children in turn.
+        neighbor_voxel->distance = config_.default_distance_m;
+        neighbor_voxel->parent.setZero();
+        raise_.push(neighbor_index);
+      } else if (!neighbor_voxel->in_queue &&
+                 neighbor_voxel->distance < config_.max_distance_m) {
+        // Any other valid neighbor, occupied ones included, can propagate
+        // back into the invalidated voxels.
+        open_.push(neighbor_index, neighbor_voxel->distance);
+        neighbor_voxel->in_queue = true;
+      }
+    }
+    num_updates++;
+  }
+  VLOG(3) << "[ESDF update]: raised " << num_updates << " voxels.";
+}
+
+bool EsdfOccIntegrator::propagateToNeighbor(const FloatingPoint distance,
+                                            const unsigned int neighbor_idx,
+                                            EsdfVoxel* neighbor_voxel) const {
+  DCHECK(neighbor_voxel != nullptr);
+  // Do NOT update unobserved distances, and occupied voxels stay at zero.
+  if (!neighbor_voxel->observed || neighbor_voxel->fixed) {
+    return false;
+  }
+  const FloatingPoint neighbor_distance =
+      distance +
+      NeighborhoodLookupTables::kDistances[neighbor_idx] * esdf_voxel_size_;
+  if (neighbor_distance >= neighbor_voxel->distance) {
+    return false;
+  }
+  neighbor_voxel->distance = neighbor_distance;
+  neighbor_voxel->parent =
+      (-NeighborhoodLookupTables::kOffsets.col(neighbor_idx)).cast<int8_t>();
+  return true;
+}
+
 void EsdfOccIntegrator::processOpenSet() {
+  if (config_.integrator_threads > 1u) {
+    processOpenSetParallel();
+    return;
+  }
+
   size_t num_updates = 0u;
+  BlockNeighborhood<EsdfVoxel> neighborhood(esdf_layer_);
   while (!open_.empty()) {
-    VoxelKey kv = open_.front();
+    const GlobalIndex global_index = open_.front();
     open_.pop();
 
-    Block<EsdfVoxel>::Ptr esdf_block =
-        esdf_layer_->getBlockPtrByIndex(kv.first);
-    EsdfVoxel& esdf_voxel = esdf_block->getVoxelByVoxelIndex(kv.second);
-
-    // Again, no point updating unobserved voxels.
-    if (!esdf_voxel.observed) {
-      esdf_voxel.in_queue = false;
+    EsdfVoxel* esdf_voxel = neighborhood.setGlobalIndex(global_index);
+    if (esdf_voxel == nullptr) {
       continue;
     }
+    esdf_voxel->in_queue = false;
 
-    // Don't bother propagating this -- can't make any active difference.
-    if (esdf_voxel.distance >= config_.max_distance_m) {
-      esdf_voxel.in_queue = false;
+    // Again, no point updating unobserved voxels, and don't bother
+    // propagating voxels that can't make any active difference.
+    if (!esdf_voxel->observed ||
+        esdf_voxel->distance >= config_.max_distance_m) {
       continue;
     }
-    // See if you can update the neighbors.
-    AlignedVector<VoxelKey> neighbors;
-    AlignedVector<float> distances;
-    AlignedVector<Eigen::Vector3i> directions;
-    getNeighborsAndDistances(kv.first, kv.second, &neighbors, &distances,
-                             &directions);
-
-    // Do NOT update unobserved distances.
-    CHECK_EQ(neighbors.size(), distances.size());
-    for (size_t i = 0; i < neighbors.size(); ++i) {
-      BlockIndex neighbor_block_index = neighbors[i].first;
-      VoxelIndex neighbor_voxel_index = neighbors[i].second;
-
-      // Get the block for this voxel.
-      Block<EsdfVoxel>::Ptr neighbor_block;
-      if (neighbor_block_index == kv.first) {
-        neighbor_block = esdf_block;
-      } else {
-        neighbor_block = esdf_layer_->getBlockPtrByIndex(neighbor_block_index);
-      }
-      if (!neighbor_block) {
+
+    for (unsigned int idx = 0u; idx < Connectivity::kTwentySix; ++idx) {
+      EsdfVoxel* neighbor_voxel = neighborhood.getNeighbor(idx);
+      if (neighbor_voxel == nullptr ||
+          !propagateToNeighbor(esdf_voxel->distance, idx, neighbor_voxel)) {
         continue;
       }
-      CHECK(neighbor_block->isValidVoxelIndex(neighbor_voxel_index))
-          << "Neigbor voxel index: " << neighbor_voxel_index.transpose();
+      // ONLY propagate this if we're below the max distance!
+      if (neighbor_voxel->distance < config_.max_distance_m &&
+          !neighbor_voxel->in_queue) {
+        open_.push(neighborhood.getNeighborGlobalIndex(idx),
+                   neighbor_voxel->distance);
+        neighbor_voxel->in_queue = true;
+      }
+    }
+    num_updates++;
+  }
 
-      EsdfVoxel& neighbor_voxel =
-          neighbor_block->getVoxelByVoxelIndex(neighbor_voxel_index);
+  VLOG(3) << "[ESDF update]: made " << num_updates << " voxel updates.";
+}
 
-      if (!neighbor_voxel.observed) {
-        continue;
-      }
+void EsdfOccIntegrator::processOpenSetParallel() {
+  EsdfBlockOpenSets block_open_sets(esdf_layer_, config_.num_buckets,
+                                    config_.max_distance_m);
+  block_open_sets.pushAll(&open_);
+
+  // The rounds are short, so the threads are only started once.
+  ThreadPool thread_pool(config_.integrator_threads);
+  block_open_sets.process(
+      &thread_pool,
+      [this](const int max_bucket_index, BlockOpenSet* block_open_set) {
+        propagateBlockOpenSet(max_bucket_index, block_open_set);
+      },
+      [this](const NeighborUpdate& update, EsdfVoxel* neighbor_voxel,
+             NumUpdates* /*num_updates*/) {
+        return propagateToNeighbor(update.distance, update.neighbor_idx,
+                                   neighbor_voxel) &&
+               neighbor_voxel->distance < config_.max_distance_m &&
+               !neighbor_voxel->in_queue;
+      });
 
-      const FloatingPoint distance_to_neighbor =
-          distances[i] * esdf_voxel_size_;
-
-      if (!neighbor_voxel.fixed && esdf_voxel.distance + distance_to_neighbor <
-                                       neighbor_voxel.distance) {
-        neighbor_voxel.distance = esdf_voxel.distance + distance_to_neighbor;
-        // Also update parent.
-        neighbor_voxel.parent = -directions[i];
-        // ONLY propagate this if we're below the max distance!
-        if (neighbor_voxel.distance < config_.max_distance_m) {
-          if (!neighbor_voxel.in_queue) {
-            open_.push(neighbors[i], neighbor_voxel.distance);
-            neighbor_voxel.in_queue = true;
-          }
-        }
+  size_t num_updates = 0u;
+  for (const std::unique_ptr<BlockOpenSet>& block_open_set :
+       block_open_sets.block_open_sets()) {
+    num_updates += block_open_set->stats;
+  }
+  VLOG(3) << "[ESDF update]: made " << num_updates << " voxel updates in "
+          << block_open_sets.block_open_sets().size() << " blocks and "
+          << block_open_sets.num_rounds() << " rounds.";
+}
+
+void EsdfOccIntegrator::propagateBlockOpenSet(
+    const int max_bucket_index, BlockOpenSet* block_open_set) const {
+  CHECK_NOTNULL(block_open_set);
+  Block<EsdfVoxel>& block = *block_open_set->block;
+  const BlockIndex block_index = block.block_index();
+  const IndexElement vps = static_cast<IndexElement>(esdf_voxels_per_side_);
+  BucketQueue<size_t>& queue = block_open_set->queue;
+
+  while (!queue.empty() && queue.frontBucketIndex() <= max_bucket_index) {
+    const size_t linear_index = queue.front();
+    queue.pop();
+
+    EsdfVoxel& voxel = block.getVoxelByLinearIndex(linear_index);
+    voxel.in_queue = false;
+    if (!voxel.observed || voxel.distance >= config_.max_distance_m) {
+      continue;
+    }
+
+    const VoxelIndex voxel_index =
+        block.computeVoxelIndexFromLinearIndex(linear_index);
+    for (unsigned int idx = 0u; idx < Connectivity::kTwentySix; ++idx) {
+      const VoxelIndex neighbor_voxel_index =
+          voxel_index + NeighborhoodLookupTables::kOffsets.col(idx);
+      if ((neighbor_voxel_index.array() < 0).any() ||
+          (neighbor_voxel_index.array() >= vps).any()) {
+        NeighborUpdate update;
+        update.neighbor_index = getGlobalVoxelIndexFromBlockAndVoxelIndex(
+            block_index, voxel_index, esdf_voxels_per_side_) +
+            NeighborhoodLookupTables::kLongOffsets.col(idx);
+        update.neighbor_idx = idx;
+        update.distance = voxel.distance;
+        block_open_set->neighbor_updates.push_back(update);
+        continue;
       }
 
-      if (neighbor_voxel.fixed && esdf_voxel.distance - distance_to_neighbor >
-                                      neighbor_voxel.distance) {
-        neighbor_voxel.distance = esdf_voxel.distance - distance_to_neighbor;
-        // Also update parent.
-        neighbor_voxel.parent = -directions[i];
-        if (!neighbor_voxel.in_queue) {
-          open_.push(neighbors[i], neighbor_voxel.distance);
-          neighbor_voxel.in_queue = true;
-        }
+      const size_t neighbor_linear_index =
+          block.computeLinearIndexFromVoxelIndex(neighbor_voxel_index);
+      EsdfVoxel& neighbor_voxel =
+          block.getVoxelByLinearIndex(neighbor_linear_index);
+      if (propagateToNeighbor(voxel.distance, idx, &neighbor_voxel) &&
+          neighbor_voxel.distance < config_.max_distance_m &&
+          !neighbor_voxel.in_queue) {
+        queue.push(neighbor_linear_index, neighbor_voxel.distance);
+        neighbor_voxel.in_queue = true;
       }
     }
-
-    num_updates++;
-    esdf_voxel.in_queue = false;
+    ++block_open_set->stats;
   }
-
-  VLOG(3) << "[ESDF update]: made " << num_updates << " voxel updates.";
 }
 
 // Uses 26-connectivity and quasi-Euclidean distances.
@@ -66,16 +66,17 @@ size_t SortedThreadSafeIndex::getNextIndexImpl(size_t sequential_idx) {
   return indices_and_squared_norms_[sequential_idx].first;
 }
 
-// This class assumes PRE-SCALED coordinates, where one unit = one voxel size.
-// The indices are also returned in this scales coordinate system, which should
-// map to voxel indices.
-RayCaster::RayCaster(const Point& origin, const Point& point_G,
-                     const bool is_clearing_ray,
-                     const bool voxel_carving_enabled,
-                     const FloatingPoint max_ray_length_m,
-                     const FloatingPoint voxel_size_inv,
-                     const FloatingPoint truncation_distance,
-                     const bool cast_from_origin) {
+// Computes the scaled start and end point of a ray, depending on whether it
+// is a clearing ray and whether voxel carving is enabled.
+static void getScaledRayStartAndEnd(const Point& origin, const Point& point_G,
+                                    const bool is_clearing_ray,
+                                    const bool voxel_carving_enabled,
+                                    const FloatingPoint max_ray_length_m,
+                                    const FloatingPoint voxel_size_inv,
+                                    const FloatingPoint truncation_distance,
+                                    Point* start_scaled, Point* end_scaled) {
+  DCHECK(start_scaled != nullptr);
+  DCHECK(end_scaled != nullptr);
   const Ray unit_ray = (point_G - origin).normalized();
 
   Point ray_start, ray_end;
@@ -93,8 +94,25 @@ RayCaster::RayCaster(const Point& origin, const Point& point_G,
                     : (point_G - unit_ray * truncation_distance);
   }
 
-  const Point start_scaled = ray_start * voxel_size_inv;
-  const Point end_scaled = ray_end * voxel_size_inv;
+  *start_scaled = ray_start * voxel_size_inv;
+  *end_scaled = ray_end * voxel_size_inv;
+}
+
+// This class assumes PRE-SCALED coordinates, where one unit = one voxel size.
+// The indices are also returned in this scales coordinate system, which should
+// map to voxel indices.
+RayCaster::RayCaster(const Point& origin, const Point& point_G,
+                     const bool is_clearing_ray,
+                     const bool voxel_carving_enabled,
+                     const FloatingPoint max_ray_length_m,
+                     const FloatingPoint voxel_size_inv,
+                     const FloatingPoint truncation_distance,
+                     const bool cast_from_origin) {
+  Point start_scaled, end_scaled;
+  getScaledRayStartAndEnd(origin, point_G, is_clearing_ray,
+                          voxel_carving_enabled, max_ray_length_m,
+                          voxel_size_inv, truncation_distance, &start_scaled,
+                          &end_scaled);
 
   if (cast_from_origin) {
     setupRayCaster(start_scaled, end_scaled);
@@ -178,4 +196,301 @@ void RayCaster::setupRayCaster(const Point& start_scaled,
                                        : ray_step_signs_.z() / ray_scaled.z());
 }
 
+IntegerRayCaster::IntegerRayCaster(const Point& origin, const Point& point_G,
+                                   const bool is_clearing_ray,
+                                   const bool voxel_carving_enabled,
+                                   const FloatingPoint max_ray_length_m,
+                                   const FloatingPoint voxel_size_inv,
+                                   const FloatingPoint truncation_distance,
+                                   const bool cast_from_origin) {
+  Point start_scaled, end_scaled;
+  getScaledRayStartAndEnd(origin, point_G, is_clearing_ray,
+                          voxel_carving_enabled, max_ray_length_m,
+                          voxel_size_inv, truncation_distance, &start_scaled,
+                          &end_scaled);
+
+  if (cast_from_origin) {
+    setupRayCaster(start_scaled, end_scaled);
+  } else {
+    setupRayCaster(end_scaled, start_scaled);
+  }
+}
+
+IntegerRayCaster::IntegerRayCaster(const Point& start_scaled,
+                                   const Point& end_scaled) {
+  setupRayCaster(start_scaled, end_scaled);
+}
+
+void IntegerRayCaster::setupRayCaster(const Point& start_scaled,
+                                      const Point& end_scaled) {
+  if (std::isnan(start_scaled.x()) || std::isnan(start_scaled.y()) ||
+      std::isnan(start_scaled.z()) || std::isnan(end_scaled.x()) ||
+      std::isnan(end_scaled.y()) || std::isnan(end_scaled.z())) {
+    // Produces an empty ray.
+    ray_length_in_steps_ = 0u;
+    current_step_ = 1u;
+    return;
+  }
+
+  // Voxel indices are computed exactly like in the RayCaster, such that both
+  // casters agree on the first and last voxel.
+  curr_index_ = getGridIndexFromPoint<GlobalIndex>(start_scaled);
+  const GlobalIndex end_index = getGridIndexFromPoint<GlobalIndex>(end_scaled);
+  const GlobalIndex diff_index = end_index - curr_index_;
+
+  current_step_ = 0u;
+  ray_length_in_steps_ = std::abs(diff_index.x()) + std::abs(diff_index.y()) +
+                         std::abs(diff_index.z());
+
+  // Choose the fixed-point resolution such that none of the cross error terms
+  // can overflow, i.e. (max_extent * 2^bits)^2 < 2^62.
+  constexpr int kMaxFractionalBits = 24;
+  constexpr int kMinFractionalBits = 4;
+  const int64_t max_extent_in_voxels = diff_index.cwiseAbs().maxCoeff() + 2;
+  int fractional_bits = kMaxFractionalBits;
+  while (fractional_bits > kMinFractionalBits &&
+         max_extent_in_voxels >= (int64_t{1} << (31 - fractional_bits))) {
+    --fractional_bits;
+  }
+  const int64_t one = int64_t{1} << fractional_bits;
+  const FloatingPoint one_float = static_cast<FloatingPoint>(one);
+
+  // Converts the position within a voxel to fixed-point, [0, one).
+  auto to_fixed_point_fraction = [one, one_float](FloatingPoint fraction) {
+    const int64_t fixed =
+        static_cast<int64_t>(std::round(fraction * one_float));
+    return std::min(std::max(fixed, int64_t{0}), one - 1);
+  };
+
+  int64_t dist_to_boundary[3];
+  int64_t abs_extent[3];
+  for (int i = 0; i < 3; ++i) {
+    // Fixed-point coordinates relative to the start voxel.
+    const int64_t start_fixed = to_fixed_point_fraction(
+        start_scaled[i] - static_cast<FloatingPoint>(curr_index_[i]));
+    const int64_t end_fixed =
+        diff_index[i] * one +
+        to_fixed_point_fraction(end_scaled[i] -
+                                static_cast<FloatingPoint>(end_index[i]));
+    const int64_t extent = end_fixed - start_fixed;
+
+    if (extent > 0) {
+      ray_step_signs_[i] = 1;
+      dist_to_boundary[i] = one - start_fixed;
+    } else if (extent < 0) {
+      ray_step_signs_[i] = -1;
+      dist_to_boundary[i] = start_fixed;
+    } else {
+      // Never step along this axis, any positive distance to the boundary
+      // makes this axis lose all comparisons against the others.
+      ray_step_signs_[i] = 0;
+      dist_to_boundary[i] = one;
+    }
+    abs_extent[i] = std::abs(extent);
+  }
+
+  for (int i = 0; i < 3; ++i) {
+    cross_error_step_[i] = one * abs_extent[i];
+    for (int j = 0; j < 3; ++j) {
+      cross_error_[i][j] = dist_to_boundary[i] * abs_extent[j];
+    }
+  }
+}
+
+namespace {
+
+/**
+ * Advances the integer DDA state of a ray, see IntegerRayCaster, past the
+ * voxels inside the box from box_min to box_max. For every axis, the k-th step
+ * happens at ray parameter (n_i + (k - 1) * one) / |d_i|, so the step at which
+ * the ray leaves the box and the number of steps along the other axes before
+ * it can be computed directly from the cross error terms, with the same
+ * tie-breaking as the traversal. Returns the number of skipped voxels, which
+ * is at least remaining_steps if the ray ends inside the box. The state is
+ * only modified if the ray leaves the box before it ends.
+ */
+int64_t skipBoxSteps(const int64_t box_min[3], const int64_t box_max[3],
+                     const int64_t sign[3], const int64_t cross_error_step[3],
+                     const int64_t remaining_steps, int64_t index[3],
+                     int64_t cross_error[3][3]) {
+  int64_t steps_to_exit[3];
+  int exit_axis = -1;
+  for (int i = 0; i < 3; ++i) {
+    if (index[i] < box_min[i] || index[i] > box_max[i]) {
+      return 0;
+    }
+    if (sign[i] == 0) {
+      continue;
+    }
+    steps_to_exit[i] =
+        (sign[i] > 0) ? box_max[i] - index[i] + 1 : index[i] - box_min[i] + 1;
+    // Lower axes win ties, so a later axis only exits first if it is
+    // strictly earlier.
+    if (exit_axis < 0 ||
+        cross_error[i][exit_axis] +
+                (steps_to_exit[i] - 1) * cross_error_step[exit_axis] <
+            cross_error[exit_axis][i] +
+                (steps_to_exit[exit_axis] - 1) * cross_error_step[i]) {
+      exit_axis = i;
+    }
+  }
+  if (exit_axis < 0) {
+    // The ray doesn't move and ends inside of the box.
+    return remaining_steps;
+  }
+
+  const int e = exit_axis;
+  int64_t num_steps[3];
+  int64_t total_steps = 0;
+  for (int i = 0; i < 3; ++i) {
+    if (i == e) {
+      num_steps[i] = steps_to_exit[e];
+    } else {
+      // Number of steps along i with a ray parameter before the exit step.
+      const int64_t margin = cross_error[e][i] +
+                             (steps_to_exit[e] - 1) * cross_error_step[i] -
+                             cross_error[i][e];
+      if (i < e) {
+        num_steps[i] =
+            (margin < 0) ? 0 : margin / cross_error_step[e] + 1;
+      } else {
+        num_steps[i] =
+            (margin <= 0) ? 0 : (margin - 1) / cross_error_step[e] + 1;
+      }
+    }
+    total_steps += num_steps[i];
+  }
+  if (total_steps >= remaining_steps) {
+    return total_steps;
+  }
+
+  for (int i = 0; i < 3; ++i) {
+    index[i] += num_steps[i] * sign[i];
+    for (int j = 0; j < 3; ++j) {
+      if (j != i) {
+        cross_error[i][j] += num_steps[i] * cross_error_step[j];
+      }
+    }
+  }
+  return total_steps;
+}
+
+void getBlockVoxelBounds(const BlockIndex& block_index,
+                         const IndexElement voxels_per_side,
+                         int64_t box_min[3], int64_t box_max[3]) {
+  for (int i = 0; i < 3; ++i) {
+    box_min[i] = static_cast<int64_t>(block_index[i]) * voxels_per_side;
+    box_max[i] = box_min[i] + voxels_per_side - 1;
+  }
+}
+
+}  // namespace
+
+void IntegerRayCaster::skipBlock(const BlockIndex& block_index,
+                                 const IndexElement voxels_per_side) {
+  const int64_t remaining_steps =
+      static_cast<int64_t>(numRemainingRayIndices());
+  if (remaining_steps == 0) {
+    return;
+  }
+
+  int64_t box_min[3], box_max[3];
+  getBlockVoxelBounds(block_index, voxels_per_side, box_min, box_max);
+  int64_t index[3] = {curr_index_.x(), curr_index_.y(), curr_index_.z()};
+  const int64_t sign[3] = {ray_step_signs_.x(), ray_step_signs_.y(),
+                           ray_step_signs_.z()};
+
+  const int64_t num_skipped = skipBoxSteps(box_min, box_max, sign,
+                                           cross_error_step_, remaining_steps,
+                                           index, cross_error_);
+  if (num_skipped >= remaining_steps) {
+    current_step_ = ray_length_in_steps_ + 1u;
+    return;
+  }
+  curr_index_ = GlobalIndex(index[0], index[1], index[2]);
+  current_step_ += static_cast<uint>(num_skipped);
+}
+
+constexpr size_t PacketRayCaster::kMaxPacketSize;
+
+void PacketRayCaster::skipBlock(const size_t ray_id,
+                                const BlockIndex& block_index,
+                                const IndexElement voxels_per_side) {
+  DCHECK_LT(ray_id, num_rays_);
+  const int64_t remaining_steps = remaining_steps_[ray_id];
+  if (remaining_steps == 0) {
+    return;
+  }
+
+  int64_t box_min[3], box_max[3];
+  getBlockVoxelBounds(block_index, voxels_per_side, box_min, box_max);
+  int64_t index[3] = {x_[ray_id], y_[ray_id], z_[ray_id]};
+  const int64_t sign[3] = {sign_x_[ray_id], sign_y_[ray_id], sign_z_[ray_id]};
+  const int64_t cross_error_step[3] = {
+      error_step_x_[ray_id], error_step_y_[ray_id], error_step_z_[ray_id]};
+  int64_t cross_error[3][3] = {{0, xy_[ray_id], xz_[ray_id]},
+                               {yx_[ray_id], 0, yz_[ray_id]},
+                               {zx_[ray_id], zy_[ray_id], 0}};
+
+  const int64_t num_skipped =
+      skipBoxSteps(box_min, box_max, sign, cross_error_step, remaining_steps,
+                   index, cross_error);
+  if (num_skipped >= remaining_steps) {
+    remaining_steps_[ray_id] = 0;
+    return;
+  }
+  x_[ray_id] = index[0];
+  y_[ray_id] = index[1];
+  z_[ray_id] = index[2];
+  xy_[ray_id] = cross_error[0][1];
+  xz_[ray_id] = cross_error[0][2];
+  yx_[ray_id] = cross_error[1][0];
+  yz_[ray_id] = cross_error[1][2];
+  zx_[ray_id] = cross_error[2][0];
+  zy_[ray_id] = cross_error[2][1];
+  remaining_steps_[ray_id] -= num_skipped;
+}
+
+size_t PacketRayCaster::addRay(const Point& origin, const Point& point_G,
+                               const bool is_clearing_ray,
+                               const bool voxel_carving_enabled,
+                               const FloatingPoint max_ray_length_m,
+                               const FloatingPoint voxel_size_inv,
+                               const FloatingPoint truncation_distance,
+                               const bool cast_from_origin) {
+  return addRay(IntegerRayCaster(origin, point_G, is_clearing_ray,
+                                 voxel_carving_enabled, max_ray_length_m,
+                                 voxel_size_inv, truncation_distance,
+                                 cast_from_origin));
+}
+
+size_t PacketRayCaster::addRay(const Point& start_scaled,
+                               const Point& end_scaled) {
+  return addRay(IntegerRayCaster(start_scaled, end_scaled));
+}
+
+size_t PacketRayCaster::addRay(const IntegerRayCaster& ray_caster) {
+  CHECK(!isFull()) << "The ray packet is already full.";
+  const size_t ray_id = num_rays_++;
+
+  x_[ray_id] = ray_caster.curr_index_.x();
+  y_[ray_id] = ray_caster.curr_index_.y();
+  z_[ray_id] = ray_caster.curr_index_.z();
+  sign_x_[ray_id] = ray_caster.ray_step_signs_.x();
+  sign_y_[ray_id] = ray_caster.ray_step_signs_.y();
+  sign_z_[ray_id] = ray_caster.ray_step_signs_.z();
+  xy_[ray_id] = ray_caster.cross_error_[0][1];
+  xz_[ray_id] = ray_caster.cross_error_[0][2];
+  yx_[ray_id] = ray_caster.cross_error_[1][0];
+  yz_[ray_id] = ray_caster.cross_error_[1][2];
+  zx_[ray_id] = ray_caster.cross_error_[2][0];
+  zy_[ray_id] = ray_caster.cross_error_[2][1];
+  error_step_x_[ray_id] = ray_caster.cross_error_step_[0];
+  error_step_y_[ray_id] = ray_caster.cross_error_step_[1];
+  error_step_z_[ray_id] = ray_caster.cross_error_step_[2];
+  remaining_steps_[ray_id] =
+      static_cast<int64_t>(ray_caster.numRemainingRayIndices());
+  return ray_id;
+}
+
 }  // namespace voxblox
@@ -63,6 +63,15 @@ TsdfIntegratorBase::TsdfIntegratorBase(const Config& config,
   if (config_.allow_clear && !config_.voxel_carving_enabled) {
     config_.allow_clear = false;
   }
+  // Ray packets are formed from consecutive points and always handed out in
+  // mixed order, so other orders fall back to casting every ray on its own.
+  if (config_.use_ray_packets && config_.integration_order_mode != "mixed") {
+    LOG(WARNING) << "Ray packets only support the 'mixed' integration order "
+                    "mode, got '"
+                 << config_.integration_order_mode
+                 << "', disabling ray packets.";
+    config_.use_ray_packets = false;
+  }
 }
 
 void TsdfIntegratorBase::setLayer(Layer<TsdfVoxel>* layer) {
@@ -125,14 +134,44 @@ TsdfVoxel* TsdfIntegratorBase::allocateStorageAndGetVoxelPtr(
     }
   }
 
-  (*last_block)->updated().set();
-
   const VoxelIndex local_voxel_idx =
       getLocalFromGlobalVoxelIndex(global_voxel_idx, voxels_per_side_);
 
+  (*last_block)->setVoxelUpdated(local_voxel_idx);
+
   return &((*last_block)->getVoxelByVoxelIndex(local_voxel_idx));
 }
 
+// Thread safe.
+// Looks up the block of the voxel in the blocks last accessed by the other rays
+// of the packet before falling back to the layer.
+TsdfVoxel* TsdfIntegratorBase::allocateStorageAndGetVoxelPtr(
+    const GlobalIndex& global_voxel_idx, const size_t ray_id,
+    PacketBlockCache* block_cache) {
+  DCHECK(block_cache != nullptr);
+  DCHECK_LT(ray_id, PacketRayCaster::kMaxPacketSize);
+
+  Block<TsdfVoxel>::Ptr* last_block = &block_cache->blocks[ray_id];
+  BlockIndex* last_block_idx = &block_cache->block_indices[ray_id];
+
+  const BlockIndex block_idx =
+      getBlockIndexFromGlobalVoxelIndex(global_voxel_idx, voxels_per_side_inv_);
+  if ((block_idx != *last_block_idx) || (*last_block == nullptr)) {
+    for (size_t other_ray_id = 0u;
+         other_ray_id < PacketRayCaster::kMaxPacketSize; ++other_ray_id) {
+      if (block_cache->blocks[other_ray_id] != nullptr &&
+          block_cache->block_indices[other_ray_id] == block_idx) {
+        *last_block = block_cache->blocks[other_ray_id];
+        *last_block_idx = block_idx;
+        break;
+      }
+    }
+  }
+
+  return allocateStorageAndGetVoxelPtr(global_voxel_idx, last_block,
+                                       last_block_idx);
+}
+
 // NOT thread safe
 void TsdfIntegratorBase::updateLayerWithStoredBlocks() {
   BlockIndex last_block_idx;
@@ -151,8 +190,10 @@ void TsdfIntegratorBase::updateTsdfVoxel(const Point& origin,
                                          const Point& point_G,
                                          const GlobalIndex& global_voxel_idx,
                                          const Color& color, const float weight,
-                                         TsdfVoxel* tsdf_voxel) {
+                                         TsdfVoxel* tsdf_voxel,
+                                         Block<TsdfVoxel>* tsdf_block) {
   DCHECK(tsdf_voxel != nullptr);
+  DCHECK(tsdf_block != nullptr);
 
   const Point voxel_center =
       getCenterPointFromGridIndex(global_voxel_idx, voxel_size_);
@@ -193,6 +234,8 @@ void TsdfIntegratorBase::updateTsdfVoxel(const Point& origin,
     return;
   }
 
+  const bool was_saturated_free_space = isSaturatedFreeSpaceVoxel(*tsdf_voxel);
+
   const float new_sdf =
       (sdf * updated_weight + tsdf_voxel->distance * tsdf_voxel->weight) /
       new_weight;
@@ -206,6 +249,43 @@ void TsdfIntegratorBase::updateTsdfVoxel(const Point& origin,
       (new_sdf > 0.0) ? std::min(config_.default_truncation_distance, new_sdf)
                       : std::max(-config_.default_truncation_distance, new_sdf);
   tsdf_voxel->weight = std::min(config_.max_weight, new_weight);
+
+  // Keep the free space summary of the block up to date.
+  if (isSaturatedFreeSpaceVoxel(*tsdf_voxel) != was_saturated_free_space) {
+    tsdf_block->updateNumSaturatedFreeVoxels(was_saturated_free_space ? -1 : 1);
+  }
+}
+
+// Thread safe.
+bool TsdfIntegratorBase::isInSaturatedFreeSpace(
+    const GlobalIndex& global_voxel_idx, const Point& origin,
+    const Point& point_G, SaturatedFreeSpaceCache* cache) const {
+  DCHECK(cache != nullptr);
+
+  const BlockIndex block_idx =
+      getBlockIndexFromGlobalVoxelIndex(global_voxel_idx, voxels_per_side_inv_);
+  if (block_idx == cache->block_idx) {
+    return cache->is_saturated_free_space;
+  }
+  cache->block_idx = block_idx;
+  cache->is_saturated_free_space = false;
+
+  // Only read from, so blocks shared with a snapshot are not copied.
+  const Layer<TsdfVoxel>& layer = *layer_;
+  const Block<TsdfVoxel>::ConstPtr block = layer.getBlockPtrByIndex(block_idx);
+  if (!block || !block->isSaturatedFreeSpace()) {
+    return false;
+  }
+
+  // Every voxel center of the block lies within this radius around the block
+  // center, so this bounds the distance of all voxels to the surface.
+  const FloatingPoint block_radius = 0.5 * std::sqrt(3.0) * block_size_;
+  const Point block_center =
+      getCenterPointFromGridIndex(block_idx, block_size_);
+  cache->is_saturated_free_space =
+      computeDistance(origin, point_G, block_center) - block_radius >=
+      config_.default_truncation_distance;
+  return cache->is_saturated_free_space;
 }
 
 // Thread safe.
@@ -246,14 +326,26 @@ void SimpleTsdfIntegrator::integratePointCloud(const Transformation& T_G_C,
   timing::Timer integrate_timer("integrate/simple");
   CHECK_EQ(points_C.size(), colors.size());
 
-  std::unique_ptr<ThreadSafeIndex> index_getter(
-      ThreadSafeIndexFactory::get(config_.integration_order_mode, points_C));
+  std::unique_ptr<ThreadSafeIndex> index_getter;
+  if (config_.use_ray_packets) {
+    index_getter.reset(
+        new MixedThreadSafeIndex(getNumRayPackets(points_C.size())));
+  } else {
+    index_getter.reset(
+        ThreadSafeIndexFactory::get(config_.integration_order_mode, points_C));
+  }
 
   std::list<std::thread> integration_threads;
   for (size_t i = 0; i < config_.integrator_threads; ++i) {
-    integration_threads.emplace_back(&SimpleTsdfIntegrator::integrateFunction,
-                                     this, T_G_C, points_C, colors,
-                                     freespace_points, index_getter.get());
+    if (config_.use_ray_packets) {
+      integration_threads.emplace_back(
+          &SimpleTsdfIntegrator::integratePacketFunction, this, T_G_C,
+          points_C, colors, freespace_points, index_getter.get());
+    } else {
+      integration_threads.emplace_back(&SimpleTsdfIntegrator::integrateFunction,
+                                       this, T_G_C, points_C, colors,
+                                       freespace_points, index_getter.get());
+    }
   }
 
   for (std::thread& thread : integration_threads) {
@@ -285,21 +377,102 @@ void SimpleTsdfIntegrator::integrateFunction(const Transformation& T_G_C,
     const Point origin = T_G_C.getPosition();
     const Point point_G = T_G_C * point_C;
 
-    RayCaster ray_caster(origin, point_G, is_clearing,
-                         config_.voxel_carving_enabled,
-                         config_.max_ray_length_m, voxel_size_inv_,
-                         config_.default_truncation_distance);
+    IntegerRayCaster ray_caster(origin, point_G, is_clearing,
+                                config_.voxel_carving_enabled,
+                                config_.max_ray_length_m, voxel_size_inv_,
+                                config_.default_truncation_distance);
 
     Block<TsdfVoxel>::Ptr block = nullptr;
     BlockIndex block_idx;
+    SaturatedFreeSpaceCache saturated_free_space_cache;
     GlobalIndex global_voxel_idx;
     while (ray_caster.nextRayIndex(&global_voxel_idx)) {
+      if (config_.skip_saturated_free_space_blocks &&
+          isInSaturatedFreeSpace(global_voxel_idx, origin, point_G,
+                                 &saturated_free_space_cache)) {
+        ray_caster.skipBlock(saturated_free_space_cache.block_idx,
+                             voxels_per_side_);
+        continue;
+      }
+
       TsdfVoxel* voxel =
           allocateStorageAndGetVoxelPtr(global_voxel_idx, &block, &block_idx);
 
       const float weight = getVoxelWeight(point_C);
 
-      updateTsdfVoxel(origin, point_G, global_voxel_idx, color, weight, voxel);
+      updateTsdfVoxel(origin, point_G, global_voxel_idx, color, weight, voxel,
+                      block.get());
+    }
+  }
+}
+
+void SimpleTsdfIntegrator::integratePacketFunction(
+    const Transformation& T_G_C, const Pointcloud& points_C,
+    const Colors& colors, const bool freespace_points,
+    ThreadSafeIndex* packet_index_getter) {
+  DCHECK(packet_index_getter != nullptr);
+  constexpr size_t kMaxPacketSize = PacketRayCaster::kMaxPacketSize;
+
+  const Point origin = T_G_C.getPosition();
+
+  PacketRayCaster ray_packet;
+  Point ray_points_G[kMaxPacketSize];
+  Color ray_colors[kMaxPacketSize];
+  float ray_weights[kMaxPacketSize];
+
+  GlobalIndex ray_voxel_indices[kMaxPacketSize];
+  bool ray_active[kMaxPacketSize];
+  PacketBlockCache block_cache;
+  SaturatedFreeSpaceCache saturated_free_space_caches[kMaxPacketSize];
+
+  size_t packet_idx;
+  while (packet_index_getter->getNextIndex(&packet_idx)) {
+    ray_packet.clear();
+    const size_t first_point_idx = packet_idx * kMaxPacketSize;
+    const size_t end_point_idx =
+        std::min(first_point_idx + kMaxPacketSize, points_C.size());
+    for (size_t point_idx = first_point_idx; point_idx < end_point_idx;
+         ++point_idx) {
+      const Point& point_C = points_C[point_idx];
+      bool is_clearing;
+      if (!isPointValid(point_C, freespace_points, &is_clearing)) {
+        continue;
+      }
+
+      const Point point_G = T_G_C * point_C;
+      const size_t ray_id = ray_packet.addRay(
+          origin, point_G, is_clearing, config_.voxel_carving_enabled,
+          config_.max_ray_length_m, voxel_size_inv_,
+          config_.default_truncation_distance);
+      ray_points_G[ray_id] = point_G;
+      ray_colors[ray_id] = colors[point_idx];
+      ray_weights[ray_id] = getVoxelWeight(point_C);
+      saturated_free_space_caches[ray_id] = SaturatedFreeSpaceCache();
+    }
+
+    while (ray_packet.nextRayIndices(ray_voxel_indices, ray_active) > 0u) {
+      for (size_t ray_id = 0u; ray_id < ray_packet.numRays(); ++ray_id) {
+        if (!ray_active[ray_id]) {
+          continue;
+        }
+        const GlobalIndex& global_voxel_idx = ray_voxel_indices[ray_id];
+        if (config_.skip_saturated_free_space_blocks &&
+            isInSaturatedFreeSpace(global_voxel_idx, origin,
+                                   ray_points_G[ray_id],
+                                   &saturated_free_space_caches[ray_id])) {
+          ray_packet.skipBlock(ray_id,
+                               saturated_free_space_caches[ray_id].block_idx,
+                               voxels_per_side_);
+          continue;
+        }
+
+        TsdfVoxel* voxel = allocateStorageAndGetVoxelPtr(global_voxel_idx,
+                                                         ray_id, &block_cache);
+
+        updateTsdfVoxel(origin, ray_points_G[ray_id], global_voxel_idx,
+                        ray_colors[ray_id], ray_weights[ray_id], voxel,
+                        block_cache.blocks[ray_id].get());
+      }
     }
   }
 }
@@ -406,12 +579,22 @@ void MergedTsdfIntegrator::integrateVoxel(
 
   const Point merged_point_G = T_G_C * merged_point_C;
 
-  RayCaster ray_caster(origin, merged_point_G, clearing_ray,
-                       config_.voxel_carving_enabled, config_.max_ray_length_m,
-                       voxel_size_inv_, config_.default_truncation_distance);
+  IntegerRayCaster ray_caster(origin, merged_point_G, clearing_ray,
+                              config_.voxel_carving_enabled,
+                              config_.max_ray_length_m, voxel_size_inv_,
+                              config_.default_truncation_distance);
 
+  SaturatedFreeSpaceCache saturated_free_space_cache;
   GlobalIndex global_voxel_idx;
   while (ray_caster.nextRayIndex(&global_voxel_idx)) {
+    if (config_.skip_saturated_free_space_blocks &&
+        isInSaturatedFreeSpace(global_voxel_idx, origin, merged_point_G,
+                               &saturated_free_space_cache)) {
+      ray_caster.skipBlock(saturated_free_space_cache.block_idx,
+                           voxels_per_side_);
+      continue;
+    }
+
     if (enable_anti_grazing) {
       // Check if this one is already the the block hash map for this
       // insertion. Skip this to avoid grazing.
@@ -427,7 +610,7 @@ void MergedTsdfIntegrator::integrateVoxel(
         allocateStorageAndGetVoxelPtr(global_voxel_idx, &block, &block_idx);
 
     updateTsdfVoxel(origin, merged_point_G, global_voxel_idx, merged_color,
-                    merged_weight, voxel);
+                    merged_weight, voxel, block.get());
   }
 }
 
@@ -519,15 +702,17 @@ void FastTsdfIntegrator::integrateFunction(const Transformation& T_G_C,
     }
 
     constexpr bool cast_from_origin = false;
-    RayCaster ray_caster(origin, point_G, is_clearing,
-                         config_.voxel_carving_enabled,
-                         config_.max_ray_length_m, voxel_size_inv_,
-                         config_.default_truncation_distance, cast_from_origin);
+    IntegerRayCaster ray_caster(origin, point_G, is_clearing,
+                                config_.voxel_carving_enabled,
+                                config_.max_ray_length_m, voxel_size_inv_,
+                                config_.default_truncation_distance,
+                                cast_from_origin);
 
     int64_t consecutive_ray_collisions = 0;
 
     Block<TsdfVoxel>::Ptr block = nullptr;
     BlockIndex block_idx;
+    SaturatedFreeSpaceCache saturated_free_space_cache;
     while (ray_caster.nextRayIndex(&global_voxel_idx)) {
       // Check if the current voxel has been seen by any ray cast this scan.
       // If it has increment the consecutive_ray_collisions counter, otherwise
@@ -542,12 +727,119 @@ void FastTsdfIntegrator::integrateFunction(const Transformation& T_G_C,
         break;
       }
 
+      if (config_.skip_saturated_free_space_blocks &&
+          isInSaturatedFreeSpace(global_voxel_idx, origin, point_G,
+                                 &saturated_free_space_cache)) {
+        ray_caster.skipBlock(saturated_free_space_cache.block_idx,
+                             voxels_per_side_);
+        continue;
+      }
+
       TsdfVoxel* voxel =
           allocateStorageAndGetVoxelPtr(global_voxel_idx, &block, &block_idx);
 
       const float weight = getVoxelWeight(point_C);
 
-      updateTsdfVoxel(origin, point_G, global_voxel_idx, color, weight, voxel);
+      updateTsdfVoxel(origin, point_G, global_voxel_idx, color, weight, voxel,
+                      block.get());
+    }
+  }
+}
+
+void FastTsdfIntegrator::integratePacketFunction(
+    const Transformation& T_G_C, const Pointcloud& points_C,
+    const Colors& colors, const bool freespace_points,
+    ThreadSafeIndex* packet_index_getter) {
+  DCHECK(packet_index_getter != nullptr);
+  constexpr size_t kMaxPacketSize = PacketRayCaster::kMaxPacketSize;
+
+  const Point origin = T_G_C.getPosition();
+
+  PacketRayCaster ray_packet;
+  Point ray_points_G[kMaxPacketSize];
+  Color ray_colors[kMaxPacketSize];
+  float ray_weights[kMaxPacketSize];
+  int64_t consecutive_ray_collisions[kMaxPacketSize];
+
+  GlobalIndex ray_voxel_indices[kMaxPacketSize];
+  bool ray_active[kMaxPacketSize];
+  PacketBlockCache block_cache;
+  SaturatedFreeSpaceCache saturated_free_space_caches[kMaxPacketSize];
+
+  size_t packet_idx;
+  while (packet_index_getter->getNextIndex(&packet_idx) &&
+         (std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::steady_clock::now() - integration_start_time_)
+              .count() < config_.max_integration_time_s * 1000000)) {
+    ray_packet.clear();
+    const size_t first_point_idx = packet_idx * kMaxPacketSize;
+    const size_t end_point_idx =
+        std::min(first_point_idx + kMaxPacketSize, points_C.size());
+    for (size_t point_idx = first_point_idx; point_idx < end_point_idx;
+         ++point_idx) {
+      const Point& point_C = points_C[point_idx];
+      bool is_clearing;
+      if (!isPointValid(point_C, freespace_points, &is_clearing)) {
+        continue;
+      }
+
+      // Same start voxel subsampling as in integrateFunction.
+      const Point point_G = T_G_C * point_C;
+      const GlobalIndex start_voxel_idx = getGridIndexFromPoint<GlobalIndex>(
+          point_G, config_.start_voxel_subsampling_factor * voxel_size_inv_);
+      if (!start_voxel_approx_set_.replaceHash(start_voxel_idx)) {
+        continue;
+      }
+
+      constexpr bool cast_from_origin = false;
+      const size_t ray_id = ray_packet.addRay(
+          origin, point_G, is_clearing, config_.voxel_carving_enabled,
+          config_.max_ray_length_m, voxel_size_inv_,
+          config_.default_truncation_distance, cast_from_origin);
+      ray_points_G[ray_id] = point_G;
+      ray_colors[ray_id] = colors[point_idx];
+      ray_weights[ray_id] = getVoxelWeight(point_C);
+      consecutive_ray_collisions[ray_id] = 0;
+      saturated_free_space_caches[ray_id] = SaturatedFreeSpaceCache();
+    }
+
+    while (ray_packet.nextRayIndices(ray_voxel_indices, ray_active) > 0u) {
+      for (size_t ray_id = 0u; ray_id < ray_packet.numRays(); ++ray_id) {
+        if (!ray_active[ray_id]) {
+          continue;
+        }
+        const GlobalIndex& global_voxel_idx = ray_voxel_indices[ray_id];
+
+        // Terminate rays that only pass through voxels seen by other rays,
+        // see integrateFunction.
+        if (!voxel_observed_approx_set_.replaceHash(global_voxel_idx)) {
+          ++consecutive_ray_collisions[ray_id];
+        } else {
+          consecutive_ray_collisions[ray_id] = 0;
+        }
+        if (consecutive_ray_collisions[ray_id] >
+            config_.max_consecutive_ray_collisions) {
+          ray_packet.terminateRay(ray_id);
+          continue;
+        }
+
+        if (config_.skip_saturated_free_space_blocks &&
+            isInSaturatedFreeSpace(global_voxel_idx, origin,
+                                   ray_points_G[ray_id],
+                                   &saturated_free_space_caches[ray_id])) {
+          ray_packet.skipBlock(ray_id,
+                               saturated_free_space_caches[ray_id].block_idx,
+                               voxels_per_side_);
+          continue;
+        }
+
+        TsdfVoxel* voxel = allocateStorageAndGetVoxelPtr(global_voxel_idx,
+                                                         ray_id, &block_cache);
+
+        updateTsdfVoxel(origin, ray_points_G[ray_id], global_voxel_idx,
+                        ray_colors[ray_id], ray_weights[ray_id], voxel,
+                        block_cache.blocks[ray_id].get());
+      }
     }
   }
 }
@@ -568,14 +860,26 @@ void FastTsdfIntegrator::integratePointCloud(const Transformation& T_G_C,
     voxel_observed_approx_set_.resetApproxSet();
   }
 
-  std::unique_ptr<ThreadSafeIndex> index_getter(
-      ThreadSafeIndexFactory::get(config_.integration_order_mode, points_C));
+  std::unique_ptr<ThreadSafeIndex> index_getter;
+  if (config_.use_ray_packets) {
+    index_getter.reset(
+        new MixedThreadSafeIndex(getNumRayPackets(points_C.size())));
+  } else {
+    index_getter.reset(
+        ThreadSafeIndexFactory::get(config_.integration_order_mode, points_C));
+  }
 
   std::list<std::thread> integration_threads;
   for (size_t i = 0; i < config_.integrator_threads; ++i) {
-    integration_threads.emplace_back(&FastTsdfIntegrator::integrateFunction,
-                                     this, T_G_C, points_C, colors,
-                                     freespace_points, index_getter.get());
+    if (config_.use_ray_packets) {
+      integration_threads.emplace_back(
+          &FastTsdfIntegrator::integratePacketFunction, this, T_G_C, points_C,
+          colors, freespace_points, index_getter.get());
+    } else {
+      integration_threads.emplace_back(&FastTsdfIntegrator::integrateFunction,
+                                       this, T_G_C, points_C, colors,
+                                       freespace_points, index_getter.get());
+    }
   }
 
   for (std::thread& thread : integration_threads) {
@@ -604,7 +908,10 @@ std::string TsdfIntegratorBase::Config::print() const {
   ss << " - use_weight_dropoff:                        " << use_weight_dropoff << "\n";
   ss << " - use_sparsity_compensation_factor:          " << use_sparsity_compensation_factor << "\n";
   ss << " - sparsity_compensation_factor:              "  << sparsity_compensation_factor << "\n";
+  ss << " - skip_saturated_free_space_blocks:          " << skip_saturated_free_space_blocks << "\n";
   ss << " - integrator_threads:                        " << integrator_threads << "\n";
+  ss << " - integration_order_mode:                    " << integration_order_mode << "\n";
+  ss << " - use_ray_packets:                           " << use_ray_packets << "\n";
   ss << " MergedTsdfIntegrator: \n";
   ss << " - enable_anti_grazing:                       " << enable_anti_grazing << "\n";
   ss << " FastTsdfIntegrator: \n";
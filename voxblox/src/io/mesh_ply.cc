@@ -22,8 +22,173 @@
 
 #include "voxblox/io/mesh_ply.h"
 
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "voxblox/core/block_hash.h"
+#include "voxblox/mesh/mesh_utils.h"
+
 namespace voxblox {
 
+namespace {
+
+/// Binary records are collected and written in chunks of this many bytes.
+constexpr size_t kPlyBufferSize = 1u << 16;
+
+/// Removes the file at the path when it goes out of scope.
+class ScopedTemporaryFile {
+ public:
+  explicit ScopedTemporaryFile(const std::string& path) : path_(path) {}
+  ~ScopedTemporaryFile() { std::remove(path_.c_str()); }
+
+  const std::string& path() const { return path_; }
+
+ private:
+  const std::string path_;
+};
+
+void writePlyHeader(const io::PlyFormat format, const size_t num_vertices,
+                    const size_t num_faces, const bool has_normals,
+                    const bool has_colors, const bool has_faces,
+                    std::ostream* stream) {
+  DCHECK(stream != nullptr);
+  *stream << "ply\n";
+  *stream << "format " << io::getPlyFormatString(format) << "\n";
+  *stream << "element vertex " << num_vertices << "\n";
+  *stream << "property float x\n";
+  *stream << "property float y\n";
+  *stream << "property float z\n";
+  if (has_normals) {
+    *stream << "property float normal_x\n";
+    *stream << "property float normal_y\n";
+    *stream << "property float normal_z\n";
+  }
+  if (has_colors) {
+    *stream << "property uchar red\n";
+    *stream << "property uchar green\n";
+    *stream << "property uchar blue\n";
+    *stream << "property uchar alpha\n";
+  }
+  if (has_faces) {
+    *stream << "element face " << num_faces << "\n";
+    // pcl-1.7(ros::kinetic) breaks ply convention by not using
+    // "vertex_index"
+    *stream << "property list uchar int vertex_indices\n";
+  }
+  *stream << "end_header\n";
+}
+
+void writePlyVertices(const Mesh& mesh, const io::PlyFormat format,
+                      std::ostream* stream) {
+  DCHECK(stream != nullptr);
+  if (format == io::PlyFormat::kAscii) {
+    size_t vert_idx = 0;
+    for (const Point& vert : mesh.vertices) {
+      *stream << vert(0) << " " << vert(1) << " " << vert(2);
+
+      if (mesh.hasNormals()) {
+        const Point& normal = mesh.normals[vert_idx];
+        *stream << " " << normal.x() << " " << normal.y() << " "
+                << normal.z();
+      }
+      if (mesh.hasColors()) {
+        const Color& color = mesh.colors[vert_idx];
+        int r = static_cast<int>(color.r);
+        int g = static_cast<int>(color.g);
+        int b = static_cast<int>(color.b);
+        int a = static_cast<int>(color.a);
+        // Uint8 prints as character otherwise. :(
+        *stream << " " << r << " " << g << " " << b << " " << a;
+      }
+
+      // No std::endl, which would flush the stream after every vertex.
+      *stream << "\n";
+      vert_idx++;
+    }
+    return;
+  }
+
+  std::vector<char> buffer;
+  buffer.reserve(kPlyBufferSize + 64u);
+  for (size_t i = 0u; i < mesh.vertices.size(); ++i) {
+    const Point& vert = mesh.vertices[i];
+    io::appendLittleEndian(static_cast<float>(vert.x()), &buffer);
+    io::appendLittleEndian(static_cast<float>(vert.y()), &buffer);
+    io::appendLittleEndian(static_cast<float>(vert.z()), &buffer);
+    if (mesh.hasNormals()) {
+      const Point& normal = mesh.normals[i];
+      io::appendLittleEndian(static_cast<float>(normal.x()), &buffer);
+      io::appendLittleEndian(static_cast<float>(normal.y()), &buffer);
+      io::appendLittleEndian(static_cast<float>(normal.z()), &buffer);
+    }
+    if (mesh.hasColors()) {
+      const Color& color = mesh.colors[i];
+      buffer.push_back(static_cast<char>(color.r));
+      buffer.push_back(static_cast<char>(color.g));
+      buffer.push_back(static_cast<char>(color.b));
+      buffer.push_back(static_cast<char>(color.a));
+    }
+    if (buffer.size() >= kPlyBufferSize) {
+      stream->write(buffer.data(), buffer.size());
+      buffer.clear();
+    }
+  }
+  stream->write(buffer.data(), buffer.size());
+}
+
+/// Writes the triangles, with vertex_offset added to their indices.
+void writePlyFaces(const Mesh& mesh, const size_t vertex_offset,
+                   const io::PlyFormat format, std::ostream* stream) {
+  DCHECK(stream != nullptr);
+  if (format == io::PlyFormat::kAscii) {
+    for (size_t i = 0; i < mesh.indices.size(); i += 3) {
+      *stream << "3 ";
+
+      for (int j = 0; j < 3; j++) {
+        *stream << vertex_offset + mesh.indices.at(i + j) << " ";
+      }
+
+      *stream << "\n";
+    }
+    return;
+  }
+
+  std::vector<char> buffer;
+  buffer.reserve(kPlyBufferSize + 64u);
+  for (size_t i = 0u; i + 2u < mesh.indices.size(); i += 3u) {
+    buffer.push_back(3);
+    for (size_t j = 0u; j < 3u; ++j) {
+      DCHECK_LT(mesh.indices[i + j], mesh.vertices.size());
+      io::appendLittleEndian(
+          static_cast<int32_t>(vertex_offset + mesh.indices[i + j]), &buffer);
+    }
+    if (buffer.size() >= kPlyBufferSize) {
+      stream->write(buffer.data(), buffer.size());
+      buffer.clear();
+    }
+  }
+  stream->write(buffer.data(), buffer.size());
+}
+
+/// Index of the tile of tile_size blocks per side that contains the block.
+BlockIndex getTileIndexFromBlockIndex(const BlockIndex& block_index,
+                                      const IndexElement tile_size) {
+  BlockIndex tile_index;
+  for (int i = 0; i < 3; ++i) {
+    // The integer division rounds towards zero, tiles are floored.
+    tile_index(i) = block_index(i) / tile_size;
+    if (block_index(i) % tile_size < 0) {
+      --tile_index(i);
+    }
+  }
+  return tile_index;
+}
+
+}  // namespace
+
 bool convertMeshLayerToMesh(const MeshLayer& mesh_layer, Mesh* mesh,
                             const bool connected_mesh,
                             const FloatingPoint vertex_proximity_threshold) {
@@ -45,85 +210,136 @@ bool outputMeshLayerAsPly(const std::string& filename,
 
 bool outputMeshLayerAsPly(const std::string& filename,
                           const bool connected_mesh,
-                          const MeshLayer& mesh_layer) {
+                          const MeshLayer& mesh_layer,
+                          const io::PlyFormat format) {
   Mesh combined_mesh(mesh_layer.block_size(), Point::Zero());
 
   if (!convertMeshLayerToMesh(mesh_layer, &combined_mesh, connected_mesh)) {
     return false;
   }
 
-  bool success = outputMeshAsPly(filename, combined_mesh);
+  bool success = outputMeshAsPly(filename, combined_mesh, format);
   if (!success) {
     LOG(WARNING) << "Saving to PLY failed!";
   }
   return success;
 }
 
-bool outputMeshAsPly(const std::string& filename, const Mesh& mesh) {
-  std::ofstream stream(filename.c_str());
+bool outputMeshLayerAsPlyStreamed(
+    const std::string& filename, const MeshLayer& mesh_layer,
+    const io::PlyFormat format, const bool connected_mesh,
+    const size_t tile_size_in_blocks,
+    const FloatingPoint vertex_proximity_threshold) {
+  CHECK_GT(tile_size_in_blocks, 0u);
 
-  if (!stream) {
+  // Group the blocks into tiles, which are welded and written one by one.
+  typedef AnyIndexHashMapType<BlockIndexList>::type TileMap;
+  TileMap tiles;
+  BlockIndexList mesh_indices;
+  mesh_layer.getAllAllocatedMeshes(&mesh_indices);
+  bool has_normals = false;
+  bool has_colors = false;
+  bool found_vertices = false;
+  for (const BlockIndex& block_index : mesh_indices) {
+    const Mesh& mesh = mesh_layer.getMeshByIndex(block_index);
+    if (mesh.vertices.empty()) {
+      continue;
+    }
+    // Check assumption that all meshes have same configuration regarding
+    // colors and normals, as the header is written before the blocks.
+    if (!found_vertices) {
+      has_normals = mesh.hasNormals();
+      has_colors = mesh.hasColors();
+      found_vertices = true;
+    }
+    CHECK_EQ(has_normals, mesh.hasNormals());
+    CHECK_EQ(has_colors, mesh.hasColors());
+    tiles[getTileIndexFromBlockIndex(
+              block_index, static_cast<IndexElement>(tile_size_in_blocks))]
+        .push_back(block_index);
+  }
+  if (!found_vertices) {
     return false;
   }
 
-  size_t num_points = mesh.vertices.size();
-  stream << "ply" << std::endl;
-  stream << "format ascii 1.0" << std::endl;
-  stream << "element vertex " << num_points << std::endl;
-  stream << "property float x" << std::endl;
-  stream << "property float y" << std::endl;
-  stream << "property float z" << std::endl;
-  if (mesh.hasNormals()) {
-    stream << "property float normal_x" << std::endl;
-    stream << "property float normal_y" << std::endl;
-    stream << "property float normal_z" << std::endl;
-  }
-  if (mesh.hasColors()) {
-    stream << "property uchar red" << std::endl;
-    stream << "property uchar green" << std::endl;
-    stream << "property uchar blue" << std::endl;
-    stream << "property uchar alpha" << std::endl;
-  }
-  if (mesh.hasTriangles()) {
-    stream << "element face " << mesh.indices.size() / 3 << std::endl;
-    stream << "property list uchar int vertex_indices"
-           << std::endl;  // pcl-1.7(ros::kinetic) breaks ply convention by not
-                          // using "vertex_index"
-  }
-  stream << "end_header" << std::endl;
-  size_t vert_idx = 0;
-  for (const Point& vert : mesh.vertices) {
-    stream << vert(0) << " " << vert(1) << " " << vert(2);
+  // The header needs the number of elements, which is only known once all
+  // tiles are welded. So every tile is welded once, and its vertices and
+  // faces are buffered in temporary files that are appended after the
+  // header.
+  ScopedTemporaryFile vertex_file(filename + ".vertices.tmp");
+  ScopedTemporaryFile face_file(filename + ".faces.tmp");
+  std::fstream vertex_stream(vertex_file.path().c_str(),
+                             std::ios::in | std::ios::out | std::ios::trunc |
+                                 std::ios::binary);
+  std::fstream face_stream(face_file.path().c_str(),
+                           std::ios::in | std::ios::out | std::ios::trunc |
+                               std::ios::binary);
+  if (!vertex_stream || !face_stream) {
+    return false;
+  }
 
-    if (mesh.hasNormals()) {
-      const Point& normal = mesh.normals[vert_idx];
-      stream << " " << normal.x() << " " << normal.y() << " " << normal.z();
+  size_t num_vertices = 0u;
+  size_t num_faces = 0u;
+  const auto write_mesh = [&](const Mesh& mesh) {
+    writePlyVertices(mesh, format, &vertex_stream);
+    writePlyFaces(mesh, num_vertices, format, &face_stream);
+    num_vertices += mesh.vertices.size();
+    num_faces += mesh.indices.size() / 3u;
+  };
+  for (const TileMap::value_type& tile : tiles) {
+    AlignedVector<Mesh::ConstPtr> meshes;
+    for (const BlockIndex& block_index : tile.second) {
+      meshes.push_back(mesh_layer.getMeshPtrByIndex(block_index));
     }
-    if (mesh.hasColors()) {
-      const Color& color = mesh.colors[vert_idx];
-      int r = static_cast<int>(color.r);
-      int g = static_cast<int>(color.g);
-      int b = static_cast<int>(color.b);
-      int a = static_cast<int>(color.a);
-      // Uint8 prints as character otherwise. :(
-      stream << " " << r << " " << g << " " << b << " " << a;
+    if (connected_mesh) {
+      Mesh tile_mesh;
+      createConnectedMesh(meshes, &tile_mesh, vertex_proximity_threshold);
+      write_mesh(tile_mesh);
+    } else {
+      for (const Mesh::ConstPtr& mesh : meshes) {
+        write_mesh(*mesh);
+      }
     }
+  }
+  CHECK_LE(num_vertices,
+           static_cast<size_t>(std::numeric_limits<int32_t>::max()));
+  if (!vertex_stream || !face_stream) {
+    return false;
+  }
 
-    stream << std::endl;
-    vert_idx++;
+  std::ofstream stream(filename.c_str(), std::ios::out | std::ios::binary);
+  if (!stream) {
+    return false;
   }
-  if (mesh.hasTriangles()) {
-    for (size_t i = 0; i < mesh.indices.size(); i += 3) {
-      stream << "3 ";
+  constexpr bool kHasFaces = true;
+  writePlyHeader(format, num_vertices, num_faces, has_normals, has_colors,
+                 kHasFaces, &stream);
+  for (std::fstream* buffer_stream : {&vertex_stream, &face_stream}) {
+    buffer_stream->seekg(0);
+    // Empty buffers would set the failbit of the output stream.
+    if (buffer_stream->peek() != std::char_traits<char>::eof()) {
+      stream << buffer_stream->rdbuf();
+    }
+  }
+  return static_cast<bool>(stream);
+}
 
-      for (int j = 0; j < 3; j++) {
-        stream << mesh.indices.at(i + j) << " ";
-      }
+bool outputMeshAsPly(const std::string& filename, const Mesh& mesh,
+                     const io::PlyFormat format) {
+  std::ofstream stream(filename.c_str(), std::ios::out | std::ios::binary);
 
-      stream << std::endl;
-    }
+  if (!stream) {
+    return false;
   }
-  return true;
+  CHECK_LE(mesh.vertices.size(),
+           static_cast<size_t>(std::numeric_limits<int32_t>::max()));
+
+  writePlyHeader(format, mesh.vertices.size(), mesh.indices.size() / 3u,
+                 mesh.hasNormals(), mesh.hasColors(), mesh.hasTriangles(),
+                 &stream);
+  writePlyVertices(mesh, format, &stream);
+  writePlyFaces(mesh, 0u, format, &stream);
+  return static_cast<bool>(stream);
 }
 
 }  // namespace voxblox
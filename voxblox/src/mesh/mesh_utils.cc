@@ -0,0 +1,444 @@
+#include "voxblox/mesh/mesh_utils.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <thread>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "voxblox/utils/timing.h"
+
+namespace voxblox {
+
+namespace {
+
+/// Below this many vertices per thread, spawning threads doesn't pay off.
+constexpr size_t kMinVerticesPerThread = 1u << 15;
+
+/// Radix sort of the vertices by the hash of their quantized cell.
+constexpr size_t kRadixBits = 8u;
+constexpr size_t kRadixSize = 1u << kRadixBits;
+constexpr size_t kRadixMask = kRadixSize - 1u;
+constexpr size_t kNumRadixPasses = 32u / kRadixBits;
+
+/**
+ * The key only needs to group the vertices of a cell, so a 32 bit hash is
+ * enough. Cells with colliding keys are told apart after sorting.
+ */
+struct SortEntry {
+  uint32_t key;
+  uint32_t vertex_index;
+};
+
+typedef std::array<size_t, kRadixSize> RadixHistogram;
+
+/// Mixes the quantized cell into a well distributed 32 bit key.
+inline uint32_t getCellKey(const LongIndex& cell) {
+  uint64_t key = 0u;
+  for (int i = 0; i < 3; ++i) {
+    key ^= static_cast<uint64_t>(cell(i)) + 0x9e3779b97f4a7c15ull +
+           (key << 6) + (key >> 2);
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ull;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebull;
+    key ^= key >> 31;
+  }
+  return static_cast<uint32_t>(key ^ (key >> 32));
+}
+
+/// Splits [0, num_items) into one contiguous range per thread.
+void parallelFor(const size_t num_threads, const size_t num_items,
+                 const std::function<void(size_t, size_t, size_t)>& function) {
+  if (num_threads <= 1u) {
+    function(0u, 0u, num_items);
+    return;
+  }
+  std::vector<std::thread> threads;
+  for (size_t i = 0u; i < num_threads; ++i) {
+    threads.emplace_back(function, i, num_items * i / num_threads,
+                         num_items * (i + 1u) / num_threads);
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+/**
+ * Calls function(mesh, local_begin, local_end) for the parts of the global
+ * range [begin, end) that fall into each mesh, where offsets holds the global
+ * index of the first element of every mesh and the total at the end.
+ */
+void forEachMeshInRange(
+    const std::vector<size_t>& offsets, const size_t begin, const size_t end,
+    const std::function<void(size_t, size_t, size_t)>& function) {
+  if (begin >= end) {
+    return;
+  }
+  size_t mesh = std::upper_bound(offsets.begin(), offsets.end(), begin) -
+                offsets.begin() - 1u;
+  for (size_t i = begin; i < end; ++mesh) {
+    DCHECK_LT(mesh + 1u, offsets.size());
+    const size_t mesh_end = std::min(end, offsets[mesh + 1u]);
+    function(mesh, i - offsets[mesh], mesh_end - offsets[mesh]);
+    i = mesh_end;
+  }
+}
+
+/// Stable LSD radix sort of the entries by their key.
+void radixSort(const size_t num_threads, std::vector<SortEntry>* entries) {
+  DCHECK(entries != nullptr);
+  const size_t num_entries = entries->size();
+  std::vector<SortEntry> buffer(num_entries);
+  std::vector<RadixHistogram> histograms(num_threads);
+
+  for (size_t pass = 0u; pass < kNumRadixPasses; ++pass) {
+    const size_t shift = pass * kRadixBits;
+    const SortEntry* source = entries->data();
+    SortEntry* destination = buffer.data();
+
+    parallelFor(num_threads, num_entries,
+                [&](size_t thread_idx, size_t begin, size_t end) {
+                  RadixHistogram& histogram = histograms[thread_idx];
+                  histogram.fill(0u);
+                  for (size_t i = begin; i < end; ++i) {
+                    ++histogram[(source[i].key >> shift) & kRadixMask];
+                  }
+                });
+
+    // Turn the histograms into the first destination of every thread and
+    // digit, the threads stay in order to keep the sort stable.
+    size_t offset = 0u;
+    bool all_in_one_bucket = false;
+    for (size_t digit = 0u; digit < kRadixSize; ++digit) {
+      size_t digit_count = 0u;
+      for (RadixHistogram& histogram : histograms) {
+        const size_t count = histogram[digit];
+        histogram[digit] = offset;
+        offset += count;
+        digit_count += count;
+      }
+      all_in_one_bucket |= (digit_count == num_entries);
+    }
+    if (all_in_one_bucket) {
+      continue;
+    }
+
+    parallelFor(num_threads, num_entries,
+                [&](size_t thread_idx, size_t begin, size_t end) {
+                  RadixHistogram& histogram = histograms[thread_idx];
+                  for (size_t i = begin; i < end; ++i) {
+                    destination[histogram[(source[i].key >> shift) &
+                                          kRadixMask]++] = source[i];
+                  }
+                });
+    entries->swap(buffer);
+  }
+}
+
+/// Appends the vertices and triangles of the mesh to the other mesh.
+void appendMesh(const Mesh& mesh, Mesh* other_mesh) {
+  DCHECK(other_mesh != nullptr);
+  if (!mesh.hasVertices()) {
+    return;
+  }
+  CHECK_EQ(mesh.hasColors(), other_mesh->hasColors());
+  CHECK_EQ(mesh.hasNormals(), other_mesh->hasNormals());
+  const VertexIndex vertex_offset = other_mesh->vertices.size();
+  other_mesh->vertices.insert(other_mesh->vertices.end(),
+                              mesh.vertices.begin(), mesh.vertices.end());
+  other_mesh->colors.insert(other_mesh->colors.end(), mesh.colors.begin(),
+                            mesh.colors.end());
+  other_mesh->normals.insert(other_mesh->normals.end(), mesh.normals.begin(),
+                             mesh.normals.end());
+  other_mesh->indices.reserve(other_mesh->indices.size() +
+                              mesh.indices.size());
+  for (const VertexIndex index : mesh.indices) {
+    other_mesh->indices.push_back(vertex_offset + index);
+  }
+}
+
+}  // namespace
+
+void createConnectedMesh(
+    const AlignedVector<Mesh::ConstPtr>& meshes, Mesh* connected_mesh,
+    const FloatingPoint approximate_vertex_proximity_threshold,
+    const size_t num_threads) {
+  CHECK_NOTNULL(connected_mesh);
+  // The meshes are connected among themselves only, the vertices already in
+  // the output are kept as they are.
+  if (connected_mesh->hasVertices()) {
+    Mesh appended_mesh;
+    createConnectedMesh(meshes, &appended_mesh,
+                        approximate_vertex_proximity_threshold, num_threads);
+    appendMesh(appended_mesh, connected_mesh);
+    return;
+  }
+
+  // Gather the non-empty meshes and the global index of their first vertex
+  // and triangle index.
+  std::vector<const Mesh*> input_meshes;
+  std::vector<size_t> vertex_offsets(1u, 0u);
+  std::vector<size_t> index_offsets(1u, 0u);
+  for (const Mesh::ConstPtr& mesh : meshes) {
+    // Skip empty meshes.
+    if (mesh->vertices.empty()) {
+      continue;
+    }
+    // The block meshes either have 3 distinct vertices for every triangle or
+    // already share their vertices, the triangles are remapped either way.
+    CHECK_EQ(mesh->indices.size() % 3u, 0u);
+    if (!input_meshes.empty()) {
+      CHECK_EQ(input_meshes.front()->hasColors(), mesh->hasColors());
+      CHECK_EQ(input_meshes.front()->hasNormals(), mesh->hasNormals());
+    }
+    if (mesh->hasColors()) {
+      CHECK_EQ(mesh->vertices.size(), mesh->colors.size());
+    }
+    if (mesh->hasNormals()) {
+      CHECK_EQ(mesh->vertices.size(), mesh->normals.size());
+    }
+    input_meshes.push_back(mesh.get());
+    vertex_offsets.push_back(vertex_offsets.back() + mesh->vertices.size());
+    index_offsets.push_back(index_offsets.back() + mesh->indices.size());
+  }
+  if (input_meshes.empty()) {
+    return;
+  }
+  const bool has_colors = input_meshes.front()->hasColors();
+  const bool has_normals = input_meshes.front()->hasNormals();
+  const size_t num_vertices = vertex_offsets.back();
+  const size_t num_indices = index_offsets.back();
+  CHECK_LT(num_vertices, std::numeric_limits<uint32_t>::max());
+
+  const size_t used_threads = std::max<size_t>(
+      1u, std::min(num_threads, num_vertices / kMinVerticesPerThread));
+
+  // We scale the vertices by the inverse of the merging tolerance and then
+  // compute a discretized grid index in that scale. This exhibits the
+  // behaviour of merging two vertices that are closer than the threshold.
+  // We need to use a long long based index, to prevent overflows.
+  const double threshold_inv =
+      1. / static_cast<double>(approximate_vertex_proximity_threshold);
+  timing::Timer quantize_timer("connected_mesh/quantize");
+  LongIndexVector cells(num_vertices);
+  std::vector<SortEntry> entries(num_vertices);
+  Pointcloud normals(has_normals ? num_vertices : 0u);
+  parallelFor(used_threads, num_vertices, [&](size_t, size_t begin,
+                                              size_t end) {
+    forEachMeshInRange(vertex_offsets, begin, end, [&](size_t mesh_idx,
+                                                       size_t local_begin,
+                                                       size_t local_end) {
+      const Mesh& mesh = *input_meshes[mesh_idx];
+      const size_t offset = vertex_offsets[mesh_idx];
+      for (size_t i = local_begin; i < local_end; ++i) {
+        const Eigen::Vector3d scaled_vector =
+            mesh.vertices[i].cast<double>() * threshold_inv;
+        LongIndex& cell = cells[offset + i];
+        cell = LongIndex(std::round(scaled_vector.x()),
+                         std::round(scaled_vector.y()),
+                         std::round(scaled_vector.z()));
+        entries[offset + i].key = getCellKey(cell);
+        entries[offset + i].vertex_index = offset + i;
+        if (has_normals) {
+          normals[offset + i] = mesh.normals[i];
+        }
+      }
+    });
+  });
+
+  // After the stable sort, all vertices of a cell lie in the run of their
+  // key, ordered by their index.
+  quantize_timer.Stop();
+  timing::Timer sort_timer("connected_mesh/sort");
+  radixSort(used_threads, &entries);
+  sort_timer.Stop();
+
+  // Split the sorted entries into one range per thread, without splitting a
+  // run of equal keys.
+  std::vector<size_t> run_boundaries(used_threads + 1u, num_vertices);
+  for (size_t i = 0u; i < used_threads; ++i) {
+    size_t boundary = std::max(
+        i == 0u ? 0u : run_boundaries[i - 1u], num_vertices * i / used_threads);
+    while (boundary > 0u && boundary < num_vertices &&
+           entries[boundary].key == entries[boundary - 1u].key) {
+      ++boundary;
+    }
+    run_boundaries[i] = boundary;
+  }
+  const auto for_each_run = [&](
+      const std::function<void(size_t, size_t)>& function) {
+    parallelFor(used_threads, used_threads,
+                [&](size_t thread_idx, size_t, size_t) {
+                  const size_t end = run_boundaries[thread_idx + 1u];
+                  for (size_t run_begin = run_boundaries[thread_idx];
+                       run_begin < end;) {
+                    size_t run_end = run_begin + 1u;
+                    while (run_end < end &&
+                           entries[run_end].key == entries[run_begin].key) {
+                      ++run_end;
+                    }
+                    function(run_begin, run_end);
+                    run_begin = run_end;
+                  }
+                });
+  };
+
+  timing::Timer merge_timer("connected_mesh/merge");
+  // Find the first vertex of the cell of every sorted vertex. Runs only
+  // contain more than one cell on key collisions, so they are searched
+  // linearly.
+  std::vector<uint32_t> representatives(num_vertices);
+  std::vector<uint8_t> is_unique(num_vertices, 0u);
+  for_each_run([&](size_t run_begin, size_t run_end) {
+    for (size_t i = run_begin; i < run_end; ++i) {
+      const LongIndex& cell = cells[entries[i].vertex_index];
+      size_t first = run_begin;
+      while (cells[entries[first].vertex_index] != cell) {
+        ++first;
+      }
+      DCHECK_LE(first, i);
+      representatives[i] = entries[first].vertex_index;
+      if (first == i) {
+        is_unique[entries[i].vertex_index] = 1u;
+      }
+    }
+  });
+
+  // Number the unique vertices in the order of their first occurrence.
+  std::vector<size_t> chunk_offsets(used_threads + 1u, 0u);
+  parallelFor(used_threads, num_vertices,
+              [&](size_t thread_idx, size_t begin, size_t end) {
+                size_t num_unique = 0u;
+                for (size_t i = begin; i < end; ++i) {
+                  num_unique += is_unique[i];
+                }
+                chunk_offsets[thread_idx + 1u] = num_unique;
+              });
+  for (size_t i = 0u; i < used_threads; ++i) {
+    chunk_offsets[i + 1u] += chunk_offsets[i];
+  }
+  const size_t num_unique_vertices = chunk_offsets.back();
+
+  connected_mesh->vertices.resize(num_unique_vertices);
+  if (has_colors) {
+    connected_mesh->colors.resize(num_unique_vertices);
+  }
+  if (has_normals) {
+    connected_mesh->normals.resize(num_unique_vertices, Point::Zero());
+  }
+
+  std::vector<size_t> new_indices(num_vertices);
+  parallelFor(used_threads, num_vertices, [&](size_t thread_idx, size_t begin,
+                                              size_t end) {
+    size_t new_index = chunk_offsets[thread_idx];
+    forEachMeshInRange(vertex_offsets, begin, end, [&](size_t mesh_idx,
+                                                       size_t local_begin,
+                                                       size_t local_end) {
+      const Mesh& mesh = *input_meshes[mesh_idx];
+      const size_t offset = vertex_offsets[mesh_idx];
+      for (size_t i = local_begin; i < local_end; ++i) {
+        if (is_unique[offset + i] == 0u) {
+          continue;
+        }
+        DCHECK_LT(new_index, num_unique_vertices);
+        new_indices[offset + i] = new_index;
+        connected_mesh->vertices[new_index] = mesh.vertices[i];
+        if (has_colors) {
+          connected_mesh->colors[new_index] = mesh.colors[i];
+        }
+        ++new_index;
+      }
+    });
+    DCHECK_EQ(new_index, chunk_offsets[thread_idx + 1u]);
+  });
+
+  // Now the merged vertices get the new index of their cell's first vertex.
+  // The normals are summed in vertex order within every cell.
+  for_each_run([&](size_t run_begin, size_t run_end) {
+    for (size_t i = run_begin; i < run_end; ++i) {
+      const size_t vertex_index = entries[i].vertex_index;
+      const size_t new_index = new_indices[representatives[i]];
+      new_indices[vertex_index] = new_index;
+      if (has_normals) {
+        connected_mesh->normals[new_index] += normals[vertex_index];
+      }
+    }
+  });
+
+  // Renormalize normals, once all of them are summed up.
+  if (has_normals) {
+    parallelFor(used_threads, num_unique_vertices,
+                [&](size_t, size_t begin, size_t end) {
+                  for (size_t i = begin; i < end; ++i) {
+                    Point& normal = connected_mesh->normals[i];
+                    const FloatingPoint length = normal.norm();
+                    if (length > kEpsilon) {
+                      normal /= length;
+                    } else {
+                      normal = Point(0.0f, 0.0f, 1.0f);
+                    }
+                  }
+                });
+  }
+
+  merge_timer.Stop();
+
+  timing::Timer triangles_timer("connected_mesh/triangles");
+  // Append triangles and adjust their indices. We discard triangles where two
+  // or three vertices have been merged. The kept triangles are counted first,
+  // so every thread knows where to write.
+  const size_t num_triangles = num_indices / 3u;
+  VertexIndexList remapped_indices(num_indices);
+  std::fill(chunk_offsets.begin(), chunk_offsets.end(), 0u);
+  parallelFor(used_threads, num_triangles, [&](size_t thread_idx,
+                                               size_t begin, size_t end) {
+    size_t num_kept = 0u;
+    forEachMeshInRange(index_offsets, 3u * begin, 3u * end, [&](
+        size_t mesh_idx, size_t local_begin, size_t local_end) {
+      const Mesh& mesh = *input_meshes[mesh_idx];
+      const size_t vertex_offset = vertex_offsets[mesh_idx];
+      VertexIndex* remapped = &remapped_indices[index_offsets[mesh_idx]];
+      for (size_t i = local_begin; i < local_end; i += 3u) {
+        DCHECK_LT(mesh.indices[i], mesh.vertices.size());
+        DCHECK_LT(mesh.indices[i + 1u], mesh.vertices.size());
+        DCHECK_LT(mesh.indices[i + 2u], mesh.vertices.size());
+        remapped[i] = new_indices[vertex_offset + mesh.indices[i]];
+        remapped[i + 1u] = new_indices[vertex_offset + mesh.indices[i + 1u]];
+        remapped[i + 2u] = new_indices[vertex_offset + mesh.indices[i + 2u]];
+        num_kept += (remapped[i] != remapped[i + 1u]) &&
+                    (remapped[i + 1u] != remapped[i + 2u]) &&
+                    (remapped[i] != remapped[i + 2u]);
+      }
+    });
+    chunk_offsets[thread_idx + 1u] = num_kept;
+  });
+  for (size_t i = 0u; i < used_threads; ++i) {
+    chunk_offsets[i + 1u] += chunk_offsets[i];
+  }
+
+  connected_mesh->indices.resize(3u * chunk_offsets.back());
+  parallelFor(used_threads, num_triangles, [&](size_t thread_idx,
+                                               size_t begin, size_t end) {
+    VertexIndex* next_index =
+        connected_mesh->indices.data() + 3u * chunk_offsets[thread_idx];
+    for (size_t i = 3u * begin; i < 3u * end; i += 3u) {
+      const VertexIndex* triangle = &remapped_indices[i];
+      if ((triangle[0] != triangle[1]) && (triangle[1] != triangle[2]) &&
+          (triangle[0] != triangle[2])) {
+        *next_index++ = triangle[0];
+        *next_index++ = triangle[1];
+        *next_index++ = triangle[2];
+      }
+    }
+    DCHECK_EQ(next_index, connected_mesh->indices.data() +
+                              3u * chunk_offsets[thread_idx + 1u]);
+  });
+  triangles_timer.Stop();
+}
+
+}  // namespace voxblox
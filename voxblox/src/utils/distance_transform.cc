@@ -0,0 +1,66 @@
+#include "voxblox/utils/distance_transform.h"
+
+#include <glog/logging.h>
+
+namespace voxblox {
+
+constexpr float SquaredDistanceTransform1d::kInfinity;
+constexpr uint32_t SquaredDistanceTransform1d::kInvalidIndex;
+
+void SquaredDistanceTransform1d::compute(const float* f, const size_t n,
+                                         float* d, uint32_t* argmin) {
+  DCHECK(f != nullptr);
+  DCHECK(d != nullptr);
+  DCHECK(argmin != nullptr);
+  vertices_.resize(n);
+  boundaries_.resize(n + 1u);
+
+  // Lower envelope of the parabolas rooted at the finite samples.
+  int k = -1;
+  for (size_t q = 0u; q < n; ++q) {
+    if (f[q] >= kInfinity) {
+      continue;
+    }
+    float s = 0.0f;
+    while (k >= 0) {
+      s = intersection(f, vertices_[k], q);
+      if (s > boundaries_[k]) {
+        break;
+      }
+      --k;
+    }
+    ++k;
+    vertices_[k] = q;
+    boundaries_[k] = (k == 0) ? -kInfinity : s;
+    boundaries_[k + 1] = kInfinity;
+  }
+
+  if (k < 0) {
+    for (size_t q = 0u; q < n; ++q) {
+      d[q] = kInfinity;
+      argmin[q] = kInvalidIndex;
+    }
+    return;
+  }
+
+  k = 0;
+  for (size_t q = 0u; q < n; ++q) {
+    while (boundaries_[k + 1] < static_cast<float>(q)) {
+      ++k;
+    }
+    const size_t vertex = vertices_[k];
+    const float offset = static_cast<float>(q) - static_cast<float>(vertex);
+    d[q] = offset * offset + f[vertex];
+    argmin[q] = static_cast<uint32_t>(vertex);
+  }
+}
+
+float SquaredDistanceTransform1d::intersection(const float* f, const size_t p,
+                                               const size_t q) {
+  const float p_float = static_cast<float>(p);
+  const float q_float = static_cast<float>(q);
+  return ((f[q] + q_float * q_float) - (f[p] + p_float * p_float)) /
+         (2.0f * (q_float - p_float));
+}
+
+}  // namespace voxblox
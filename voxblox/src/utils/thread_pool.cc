@@ -0,0 +1,86 @@
+#include "voxblox/utils/thread_pool.h"
+
+#include <algorithm>
+
+#include <glog/logging.h>
+
+namespace voxblox {
+
+ThreadPool::ThreadPool(size_t num_threads)
+    : function_(nullptr),
+      num_active_threads_(0u),
+      num_running_threads_(0u),
+      round_(0u),
+      stop_(false) {
+  if (num_threads == 0u) {
+    LOG(WARNING) << "Automatic core count failed, defaulting to 1 threads";
+    num_threads = 1u;
+  }
+  threads_.reserve(num_threads - 1u);
+  for (size_t i = 0u; i + 1u < num_threads; ++i) {
+    threads_.emplace_back(&ThreadPool::threadFunction, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  round_started_.notify_all();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+void ThreadPool::run(const std::function<void()>& function,
+                     size_t max_threads) {
+  std::lock_guard<std::mutex> run_lock(run_mutex_);
+  const size_t num_active_threads =
+      std::min(std::max<size_t>(max_threads, 1u), num_threads()) - 1u;
+  if (num_active_threads > 0u) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      function_ = &function;
+      num_active_threads_ = num_active_threads;
+      num_running_threads_ = num_active_threads;
+      ++round_;
+    }
+    round_started_.notify_all();
+  }
+
+  function();
+
+  if (num_active_threads > 0u) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    round_finished_.wait(lock, [this]() { return num_running_threads_ == 0u; });
+    function_ = nullptr;
+  }
+}
+
+void ThreadPool::threadFunction(const size_t thread_index) {
+  uint64_t last_round = 0u;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    round_started_.wait(
+        lock, [this, last_round]() { return stop_ || round_ != last_round; });
+    if (stop_) {
+      return;
+    }
+    // A thread that is not part of the current round skips it, the round
+    // only ends once all of its threads finished.
+    last_round = round_;
+    if (thread_index >= num_active_threads_) {
+      continue;
+    }
+    const std::function<void()>& function = *function_;
+    lock.unlock();
+    function();
+    lock.lock();
+    if (--num_running_threads_ == 0u) {
+      round_finished_.notify_one();
+    }
+  }
+}
+
+}  // namespace voxblox
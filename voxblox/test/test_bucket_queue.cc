@@ -1,9 +1,104 @@
+#include <cmath>
+#include <deque>
+#include <iostream>
+#include <vector>
+
 #include <gtest/gtest.h>
 
 #include "voxblox/utils/bucket_queue.h"
+#include "voxblox/utils/timing.h"
 
 namespace voxblox {
 
+/// The previous bucket queue with one std::deque per bucket, for reference.
+template <typename T>
+class DequeBucketQueue {
+ public:
+  DequeBucketQueue(int num_buckets, double max_val)
+      : num_buckets_(num_buckets),
+        max_val_(max_val),
+        last_bucket_index_(0),
+        num_elements_(0u) {
+    buckets_.resize(num_buckets_);
+  }
+
+  void push(const T& key, double value) {
+    if (value > max_val_) {
+      value = max_val_;
+    }
+    int bucket_index =
+        std::floor(std::abs(value) / max_val_ * (num_buckets_ - 1));
+    if (bucket_index >= num_buckets_) {
+      bucket_index = num_buckets_ - 1;
+    }
+    if (bucket_index < last_bucket_index_) {
+      last_bucket_index_ = bucket_index;
+    }
+    buckets_[bucket_index].push_back(key);
+    num_elements_++;
+  }
+
+  void pop() {
+    skipEmptyBuckets();
+    buckets_[last_bucket_index_].pop_front();
+    num_elements_--;
+  }
+
+  T front() {
+    skipEmptyBuckets();
+    return buckets_[last_bucket_index_].front();
+  }
+
+  bool empty() const { return num_elements_ == 0u; }
+
+  void clear() {
+    buckets_.clear();
+    buckets_.resize(num_buckets_);
+    last_bucket_index_ = 0;
+    num_elements_ = 0u;
+  }
+
+ private:
+  void skipEmptyBuckets() {
+    while (buckets_[last_bucket_index_].empty()) {
+      last_bucket_index_++;
+    }
+  }
+
+  int num_buckets_;
+  double max_val_;
+  std::vector<std::deque<T> > buckets_;
+  int last_bucket_index_;
+  size_t num_elements_;
+};
+
+/**
+ * Simulates a wavefront propagation: every popped element pushes a few
+ * elements further away, until the queue is empty. Returns the popped keys.
+ */
+template <typename Queue>
+void propagateWavefront(const size_t num_seeds, const double max_distance,
+                        Queue* queue, std::vector<size_t>* popped_keys) {
+  std::srand(0);
+  std::vector<double> distances;
+  for (size_t i = 0u; i < num_seeds; ++i) {
+    distances.push_back(static_cast<double>(rand()) / RAND_MAX);  // NOLINT
+    queue->push(i, distances.back());
+  }
+  while (!queue->empty()) {
+    const size_t key = queue->front();
+    queue->pop();
+    popped_keys->push_back(key);
+    for (size_t i = 0u; i < 3u; ++i) {
+      const double distance = distances[key] + 0.1 * (i + 1u);
+      if (distance < max_distance && (key + i) % 4u == 0u) {
+        distances.push_back(distance);
+        queue->push(distances.size() - 1u, distance);
+      }
+    }
+  }
+}
+
 double randomDoubleInRange(double f_min, double f_max) {
   double f = static_cast<double>(rand()) / RAND_MAX;  // NOLINT
   return f_min + f * (f_max - f_min);
@@ -64,6 +159,70 @@ TEST(BucketQueueTest, GetSmallestValue) {
   }
 }
 
+TEST(BucketQueueTest, SizeAndReuse) {
+  constexpr int kNumBuckets = 20;
+  constexpr double kMaxDistance = 2.0;
+  constexpr size_t kNumElements = 1000u;
+  BucketQueue<size_t> bucket_queue(kNumBuckets, kMaxDistance);
+  bucket_queue.reserve(kNumElements);
+  EXPECT_TRUE(bucket_queue.empty());
+  EXPECT_EQ(bucket_queue.size(), 0u);
+
+  // Fill more than one chunk per bucket, and reuse the queue after clearing
+  // it and after emptying it.
+  DequeBucketQueue<size_t> deque_queue(kNumBuckets, kMaxDistance);
+  for (size_t round = 0u; round < 3u; ++round) {
+    for (size_t i = 0u; i < kNumElements; ++i) {
+      const double distance = -kMaxDistance + 0.004 * ((i * 7u) % 1000u);
+      bucket_queue.push(i, distance);
+      deque_queue.push(i, distance);
+      EXPECT_EQ(bucket_queue.size(), i + 1u);
+    }
+    if (round == 0u) {
+      bucket_queue.clear();
+      deque_queue.clear();
+      EXPECT_TRUE(bucket_queue.empty());
+      EXPECT_EQ(bucket_queue.size(), 0u);
+      continue;
+    }
+    for (size_t i = 0u; i < kNumElements; ++i) {
+      EXPECT_EQ(bucket_queue.size(), kNumElements - i);
+      EXPECT_EQ(bucket_queue.front(), deque_queue.front());
+      bucket_queue.pop();
+      deque_queue.pop();
+    }
+    EXPECT_TRUE(bucket_queue.empty());
+    // Popping an empty queue does nothing.
+    bucket_queue.pop();
+    EXPECT_EQ(bucket_queue.size(), 0u);
+  }
+}
+
+TEST(BucketQueueTest, BenchmarkWavefront) {
+  constexpr size_t kNumSeeds = 200000u;
+  constexpr double kMaxDistance = 4.0;
+  constexpr int kNumBuckets = 20;
+  constexpr size_t kNumUpdates = 5u;
+
+  DequeBucketQueue<size_t> deque_queue(kNumBuckets, kMaxDistance);
+  BucketQueue<size_t> bucket_queue(kNumBuckets, kMaxDistance);
+  for (size_t update = 0u; update < kNumUpdates; ++update) {
+    std::vector<size_t> deque_keys, keys;
+    deque_queue.clear();
+    timing::Timer deque_timer("bucket_queue/deque_reference");
+    propagateWavefront(kNumSeeds, kMaxDistance, &deque_queue, &deque_keys);
+    deque_timer.Stop();
+
+    bucket_queue.clear();
+    timing::Timer arena_timer("bucket_queue/arena");
+    propagateWavefront(kNumSeeds, kMaxDistance, &bucket_queue, &keys);
+    arena_timer.Stop();
+
+    EXPECT_GT(keys.size(), kNumSeeds);
+    EXPECT_TRUE(keys == deque_keys);
+  }
+}
+
 }  // namespace voxblox
 
 int main(int argc, char** argv) {
@@ -72,5 +231,7 @@ int main(int argc, char** argv) {
 
   int result = RUN_ALL_TESTS();
 
+  voxblox::timing::Timing::Print(std::cout);
+
   return result;
 }
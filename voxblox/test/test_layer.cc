@@ -1,12 +1,17 @@
+#include <list>
+#include <thread>
+
 #include <gtest/gtest.h>
 
 #include "voxblox/Block.pb.h"
 #include "voxblox/Layer.pb.h"
 #include "voxblox/core/block.h"
+#include "voxblox/core/block_query_cache.h"
 #include "voxblox/core/layer.h"
 #include "voxblox/core/voxel.h"
 #include "voxblox/test/layer_test_utils.h"
 #include "voxblox/utils/layer_utils.h"
+#include "voxblox/utils/neighbor_tools.h"
 
 using namespace voxblox;  // NOLINT
 
@@ -50,6 +55,205 @@ TEST_F(OccupancyLayerTest, DeepCopyConstructor) {
   EXPECT_TRUE(voxblox::utils::isSameLayer(new_layer, *layer_));
 }
 
+TEST_F(EsdfLayerTest, BlockNeighborhood) {
+  // Corners and edges of the allocated volume have unallocated neighbors,
+  // and going back to a block checks that the block pointers are reset.
+  const IndexElement half_range = kBlockVolumeDiameter / 2;
+  const BlockIndexList block_indices = {
+      BlockIndex(-half_range, -half_range, -half_range),
+      BlockIndex(half_range, 0, -half_range), BlockIndex(0, 0, 0),
+      BlockIndex(1, 0, 0), BlockIndex(0, 0, 0)};
+
+  BlockNeighborhood<EsdfVoxel> neighborhood(layer_.get());
+  size_t num_unallocated_neighbors = 0u;
+  for (const BlockIndex& block_index : block_indices) {
+    ASSERT_TRUE(layer_->hasBlock(block_index));
+    for (size_t i = 0u; i < layer_->voxels_per_side() *
+                                layer_->voxels_per_side() *
+                                layer_->voxels_per_side();
+         ++i) {
+      const VoxelIndex voxel_index =
+          layer_->getBlockByIndex(block_index)
+              .computeVoxelIndexFromLinearIndex(i);
+      const GlobalIndex global_index =
+          getGlobalVoxelIndexFromBlockAndVoxelIndex(
+              block_index, voxel_index, layer_->voxels_per_side());
+      EXPECT_EQ(neighborhood.setGlobalIndex(global_index),
+                layer_->getVoxelPtrByGlobalIndex(global_index));
+
+      for (unsigned int idx = 0u; idx < Connectivity::kTwentySix; ++idx) {
+        const GlobalIndex neighbor_index =
+            global_index + NeighborhoodLookupTables::kLongOffsets.col(idx);
+        EXPECT_EQ(neighborhood.getNeighborGlobalIndex(idx), neighbor_index);
+        EsdfVoxel* neighbor_voxel = neighborhood.getNeighbor(idx);
+        EXPECT_EQ(neighbor_voxel,
+                  layer_->getVoxelPtrByGlobalIndex(neighbor_index));
+        if (neighbor_voxel == nullptr) {
+          ++num_unallocated_neighbors;
+        }
+      }
+    }
+  }
+  EXPECT_GT(num_unallocated_neighbors, 0u);
+
+  // Voxels of unallocated blocks don't exist.
+  const GlobalIndex outside_index =
+      GlobalIndex::Constant((half_range + 1) * layer_->voxels_per_side());
+  EXPECT_EQ(neighborhood.setGlobalIndex(outside_index), nullptr);
+}
+
+TEST_F(TsdfLayerTest, BlockQueryCache) {
+  BlockQueryCache<TsdfVoxel> cache;
+  BlockIndexList block_indices;
+  layer_->getAllAllocatedBlocks(&block_indices);
+  ASSERT_GT(block_indices.size(), BlockQueryCache<TsdfVoxel>::kNumEntries);
+
+  // More blocks than entries, twice, so the entries are evicted in between.
+  for (size_t round = 0u; round < 2u; ++round) {
+    for (const BlockIndex& block_index : block_indices) {
+      EXPECT_EQ(cache.getBlockPtrByIndex(*layer_, block_index),
+                layer_->getBlockPtrByIndex(block_index));
+      EXPECT_EQ(cache.getBlockPtrByIndex(*layer_, block_index),
+                layer_->getBlockPtrByIndex(block_index));
+    }
+  }
+
+  // Entries of a copy of the layer don't mix with the ones of the layer.
+  const BlockIndex& block_index = block_indices.front();
+  const Layer<TsdfVoxel> layer_copy(*layer_);
+  EXPECT_NE(layer_copy.epoch(), layer_->epoch());
+  EXPECT_EQ(cache.getBlockPtrByIndex(layer_copy, block_index),
+            layer_copy.getBlockPtrByIndex(block_index));
+  EXPECT_NE(cache.getBlockPtrByIndex(layer_copy, block_index),
+            cache.getBlockPtrByIndex(*layer_, block_index));
+
+  // Removed blocks aren't returned anymore, allocated ones are found.
+  const uint64_t epoch = layer_->epoch();
+  layer_->removeBlock(block_index);
+  EXPECT_NE(layer_->epoch(), epoch);
+  EXPECT_FALSE(cache.getBlockPtrByIndex(*layer_, block_index));
+  Block<TsdfVoxel>::Ptr new_block =
+      layer_->allocateBlockPtrByIndex(block_index);
+  EXPECT_EQ(cache.getBlockPtrByIndex(*layer_, block_index), new_block);
+
+  const Point coords = new_block->origin();
+  EXPECT_EQ(cache.getVoxelPtrByCoordinates(*layer_, coords),
+            layer_->getVoxelPtrByCoordinates(coords));
+  layer_->removeAllBlocks();
+  EXPECT_FALSE(cache.getBlockPtrByCoordinates(*layer_, coords));
+  EXPECT_EQ(cache.getVoxelPtrByCoordinates(*layer_, coords), nullptr);
+}
+
+TEST_F(TsdfLayerTest, Snapshot) {
+  const Layer<TsdfVoxel> layer_before(*layer_);
+  Layer<TsdfVoxel>::Ptr snapshot = layer_->getSnapshot();
+  EXPECT_TRUE(voxblox::utils::isSameLayer(*snapshot, *layer_));
+
+  BlockIndexList block_indices;
+  layer_->getAllAllocatedBlocks(&block_indices);
+  ASSERT_FALSE(block_indices.empty());
+
+  // All threads write to every block, so they copy the shared blocks
+  // concurrently.
+  constexpr size_t kNumThreads = 4u;
+  std::list<std::thread> threads;
+  for (size_t thread_idx = 0u; thread_idx < kNumThreads; ++thread_idx) {
+    threads.emplace_back([&, thread_idx]() {
+      for (const BlockIndex& block_index : block_indices) {
+        Block<TsdfVoxel>::Ptr block = layer_->getBlockPtrByIndex(block_index);
+        ASSERT_TRUE(block);
+        for (size_t linear_index = thread_idx;
+             linear_index < block->num_voxels(); linear_index += kNumThreads) {
+          block->getVoxelByLinearIndex(linear_index).distance += 1.0f;
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_TRUE(voxblox::utils::isSameLayer(*snapshot, layer_before));
+  EXPECT_FALSE(voxblox::utils::isSameLayer(*layer_, layer_before));
+  for (const BlockIndex& block_index : block_indices) {
+    EXPECT_NE(layer_->getBlockPtrByIndex(block_index),
+              snapshot->getBlockPtrByIndex(block_index));
+  }
+
+  // Structural changes don't carry over either.
+  const BlockIndex& removed_index = block_indices.front();
+  layer_->removeBlock(removed_index);
+  EXPECT_TRUE(snapshot->hasBlock(removed_index));
+  const BlockIndex new_index = removed_index + BlockIndex::Constant(1000);
+  layer_->allocateBlockPtrByIndex(new_index);
+  EXPECT_FALSE(snapshot->hasBlock(new_index));
+
+  // Neither do writes to the snapshot.
+  const Layer<TsdfVoxel> layer_after(*layer_);
+  Layer<TsdfVoxel>::Ptr second_snapshot = layer_->getSnapshot();
+  for (const BlockIndex& block_index : block_indices) {
+    Block<TsdfVoxel>::Ptr block =
+        second_snapshot->getBlockPtrByIndex(block_index);
+    if (block) {
+      block->getVoxelByLinearIndex(0u).weight += 1.0f;
+    }
+  }
+  EXPECT_TRUE(voxblox::utils::isSameLayer(*layer_, layer_after));
+  EXPECT_TRUE(voxblox::utils::isSameLayer(*snapshot, layer_before));
+}
+
+TEST_F(TsdfLayerTest, SnapshotUpdateFlags) {
+  BlockIndexList block_indices;
+  layer_->getAllAllocatedBlocks(&block_indices);
+  ASSERT_GE(block_indices.size(), 2u);
+  const BlockIndex& updated_index = block_indices[0];
+  const BlockIndex& other_index = block_indices[1];
+  for (const BlockIndex& block_index : block_indices) {
+    for (size_t status = 0u; status < Update::kCount; ++status) {
+      layer_->resetUpdated(block_index, static_cast<Update::Status>(status));
+    }
+  }
+  layer_->getBlockPtrByIndex(updated_index)
+      ->setVoxelUpdated(VoxelIndex::Zero());
+  const Block<TsdfVoxel>::SubBrickMask mask =
+      layer_->getUpdatedSubBricks(updated_index, Update::kMesh);
+  EXPECT_EQ(mask, 1u);
+
+  // The flags stay visible in both layers after the snapshot.
+  Layer<TsdfVoxel>::Ptr snapshot = layer_->getSnapshot();
+  for (const Layer<TsdfVoxel>* layer : {layer_.get(), snapshot.get()}) {
+    BlockIndexList updated_blocks;
+    layer->getAllUpdatedBlocks(Update::kMesh, &updated_blocks);
+    ASSERT_EQ(updated_blocks.size(), 1u);
+    EXPECT_EQ(updated_blocks[0], updated_index);
+    EXPECT_EQ(layer->getUpdatedSubBricks(updated_index, Update::kMesh), mask);
+    EXPECT_EQ(layer->getUpdatedSubBricks(other_index, Update::kMesh), 0u);
+  }
+
+  // Clearing them in the layer neither copies the block nor changes the
+  // flags of the snapshot.
+  const Layer<TsdfVoxel>& const_layer = *layer_;
+  const Layer<TsdfVoxel>& const_snapshot = *snapshot;
+  const Block<TsdfVoxel>* shared_block =
+      const_snapshot.getBlockPtrByIndex(updated_index).get();
+  EXPECT_EQ(const_layer.getBlockPtrByIndex(updated_index).get(),
+            shared_block);
+  layer_->resetUpdated(updated_index, Update::kMesh);
+  EXPECT_EQ(layer_->getUpdatedSubBricks(updated_index, Update::kMesh), 0u);
+  EXPECT_EQ(layer_->getUpdatedSubBricks(updated_index, Update::kEsdf), mask);
+  EXPECT_EQ(snapshot->getUpdatedSubBricks(updated_index, Update::kMesh), mask);
+  EXPECT_EQ(const_layer.getBlockPtrByIndex(updated_index).get(),
+            shared_block);
+
+  // Writing after the snapshot flags the copy of the block as usual.
+  layer_->getBlockPtrByIndex(other_index)->setAllVoxelsUpdated();
+  EXPECT_EQ(layer_->getUpdatedSubBricks(other_index, Update::kMesh),
+            Block<TsdfVoxel>::kAllSubBricks);
+  EXPECT_EQ(snapshot->getUpdatedSubBricks(other_index, Update::kMesh), 0u);
+  layer_->resetUpdated(other_index, Update::kMesh);
+  EXPECT_EQ(layer_->getUpdatedSubBricks(other_index, Update::kMesh), 0u);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   google::InitGoogleLogging(argv[0]);
@@ -0,0 +1,309 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "voxblox/core/common.h"
+#include "voxblox/io/mesh_ply.h"
+#include "voxblox/io/ply_writer.h"
+#include "voxblox/mesh/mesh.h"
+#include "voxblox/mesh/mesh_layer.h"
+
+using namespace voxblox;  // NOLINT
+
+class MeshPlyTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    for (size_t i = 0u; i < 10u; ++i) {
+      const FloatingPoint x = 0.25f * i;
+      mesh_.vertices.emplace_back(x, -0.5f * x, 1.0f / (1.0f + x));
+      mesh_.normals.push_back(Point(x, 1.0f, -x).normalized());
+      mesh_.colors.emplace_back(10u * i, 255u - i, 3u * i, 200u);
+    }
+    for (size_t i = 0u; i + 2u < mesh_.vertices.size(); ++i) {
+      mesh_.indices.push_back(i);
+      mesh_.indices.push_back(i + 2u);
+      mesh_.indices.push_back(i + 1u);
+    }
+  }
+
+  /**
+   * Fills the mesh layer with a height field of separate triangles, split
+   * into the block meshes.
+   */
+  void createHeightFieldMeshLayer(MeshLayer* mesh_layer) const {
+    constexpr size_t kNumBlocks = 4u;
+    constexpr size_t kQuadsPerBlock = 5u;
+    const FloatingPoint quad_size = mesh_layer->block_size() / kQuadsPerBlock;
+    const auto get_point = [quad_size](size_t x, size_t y) {
+      return Point(quad_size * x, quad_size * y,
+                   0.5f + 0.1f * std::sin(0.7f * x + 0.3f * y));
+    };
+    for (size_t x = 0u; x < kNumBlocks * kQuadsPerBlock; ++x) {
+      for (size_t y = 0u; y < kNumBlocks * kQuadsPerBlock; ++y) {
+        Mesh::Ptr mesh = mesh_layer->allocateMeshPtrByIndex(
+            BlockIndex(x / kQuadsPerBlock, y / kQuadsPerBlock, 0));
+        const Point corners[4] = {get_point(x, y), get_point(x + 1u, y),
+                                  get_point(x + 1u, y + 1u),
+                                  get_point(x, y + 1u)};
+        for (size_t triangle = 0u; triangle < 2u; ++triangle) {
+          const Point& p0 = corners[0];
+          const Point& p1 = corners[triangle + 1u];
+          const Point& p2 = corners[triangle + 2u];
+          const Point normal = (p1 - p0).cross(p2 - p0).normalized();
+          for (const Point& point : {p0, p1, p2}) {
+            mesh->indices.push_back(mesh->vertices.size());
+            mesh->vertices.push_back(point);
+            mesh->normals.push_back(normal);
+            mesh->colors.emplace_back(x, y, 0u, 255u);
+          }
+        }
+      }
+    }
+  }
+
+  /// The triangle vertex positions, sorted for comparing meshes.
+  std::vector<std::array<float, 9> > getSortedTriangles(
+      const Mesh& mesh) const {
+    std::vector<std::array<float, 9> > triangles;
+    for (size_t i = 0u; i + 2u < mesh.indices.size(); i += 3u) {
+      std::array<float, 9> triangle;
+      for (size_t j = 0u; j < 3u; ++j) {
+        for (int k = 0; k < 3; ++k) {
+          triangle[3u * j + k] = mesh.vertices[mesh.indices[i + j]](k);
+        }
+      }
+      triangles.push_back(triangle);
+    }
+    std::sort(triangles.begin(), triangles.end());
+    return triangles;
+  }
+
+  /**
+   * Reads back the files written for the mesh above: vertices with position,
+   * normal and color, and triangles.
+   */
+  bool readMeshPly(const std::string& filename, std::string* format,
+                   Mesh* mesh) const {
+    std::ifstream stream(filename.c_str(), std::ios::in | std::ios::binary);
+    size_t num_vertices = 0u;
+    size_t num_faces = 0u;
+    std::string line;
+    while (std::getline(stream, line) && line != "end_header") {
+      std::istringstream line_stream(line);
+      std::string keyword, name;
+      line_stream >> keyword;
+      if (keyword == "format") {
+        line_stream >> *format;
+      } else if (keyword == "element") {
+        line_stream >> name;
+        line_stream >> (name == "vertex" ? num_vertices : num_faces);
+      }
+    }
+    if (!stream) {
+      return false;
+    }
+
+    const bool binary = (*format == "binary_little_endian");
+    for (size_t i = 0u; i < num_vertices; ++i) {
+      float values[6];
+      int color[4];
+      if (binary) {
+        stream.read(reinterpret_cast<char*>(values), sizeof(values));
+        uint8_t bytes[4];
+        stream.read(reinterpret_cast<char*>(bytes), sizeof(bytes));
+        for (size_t j = 0u; j < 4u; ++j) {
+          color[j] = bytes[j];
+        }
+      } else {
+        for (float& value : values) {
+          stream >> value;
+        }
+        for (int& channel : color) {
+          stream >> channel;
+        }
+      }
+      mesh->vertices.emplace_back(values[0], values[1], values[2]);
+      mesh->normals.emplace_back(values[3], values[4], values[5]);
+      mesh->colors.emplace_back(color[0], color[1], color[2], color[3]);
+    }
+    for (size_t i = 0u; i < num_faces; ++i) {
+      int num_face_vertices = 0;
+      int32_t face[3];
+      if (binary) {
+        uint8_t count = 0u;
+        stream.read(reinterpret_cast<char*>(&count), sizeof(count));
+        num_face_vertices = count;
+        stream.read(reinterpret_cast<char*>(face), sizeof(face));
+      } else {
+        stream >> num_face_vertices >> face[0] >> face[1] >> face[2];
+      }
+      EXPECT_EQ(num_face_vertices, 3);
+      for (const int32_t index : face) {
+        mesh->indices.push_back(index);
+      }
+    }
+    return static_cast<bool>(stream);
+  }
+
+  void expectMeshesNear(const Mesh& expected_mesh, const Mesh& mesh,
+                        const FloatingPoint tolerance) const {
+    ASSERT_EQ(expected_mesh.vertices.size(), mesh.vertices.size());
+    EXPECT_TRUE(expected_mesh.indices == mesh.indices);
+    for (size_t i = 0u; i < mesh.vertices.size(); ++i) {
+      EXPECT_NEAR((expected_mesh.vertices[i] - mesh.vertices[i]).norm(), 0.0f,
+                  tolerance);
+      EXPECT_NEAR((expected_mesh.normals[i] - mesh.normals[i]).norm(), 0.0f,
+                  tolerance);
+      EXPECT_EQ(expected_mesh.colors[i].r, mesh.colors[i].r);
+      EXPECT_EQ(expected_mesh.colors[i].g, mesh.colors[i].g);
+      EXPECT_EQ(expected_mesh.colors[i].b, mesh.colors[i].b);
+      EXPECT_EQ(expected_mesh.colors[i].a, mesh.colors[i].a);
+    }
+  }
+
+  Mesh mesh_;
+};
+
+TEST_F(MeshPlyTest, AsciiMesh) {
+  const std::string kFilename = "mesh_ascii.ply";
+  ASSERT_TRUE(outputMeshAsPly(kFilename, mesh_, io::PlyFormat::kAscii));
+
+  std::string format;
+  Mesh mesh;
+  ASSERT_TRUE(readMeshPly(kFilename, &format, &mesh));
+  EXPECT_EQ(format, "ascii");
+  // The default stream precision rounds to 6 digits.
+  expectMeshesNear(mesh_, mesh, 1e-5f);
+}
+
+TEST_F(MeshPlyTest, BinaryMesh) {
+  const std::string kFilename = "mesh_binary.ply";
+  ASSERT_TRUE(
+      outputMeshAsPly(kFilename, mesh_, io::PlyFormat::kBinaryLittleEndian));
+
+  std::string format;
+  Mesh mesh;
+  ASSERT_TRUE(readMeshPly(kFilename, &format, &mesh));
+  EXPECT_EQ(format, "binary_little_endian");
+  expectMeshesNear(mesh_, mesh, 0.0f);
+}
+
+TEST_F(MeshPlyTest, BinaryPlyWriter) {
+  const std::string kFilename = "points_binary.ply";
+  {
+    io::PlyWriter writer(kFilename, io::PlyFormat::kBinaryLittleEndian);
+    constexpr bool kHasColor = true;
+    writer.addVerticesWithProperties(mesh_.vertices.size(), kHasColor);
+    for (size_t i = 0u; i < mesh_.vertices.size(); ++i) {
+      EXPECT_TRUE(writer.writeVertex(mesh_.vertices[i], mesh_.colors[i]));
+    }
+    // All announced vertices are written.
+    EXPECT_FALSE(writer.writeVertex(mesh_.vertices[0], mesh_.colors[0]));
+    writer.closeFile();
+  }
+
+  std::ifstream stream(kFilename.c_str(), std::ios::in | std::ios::binary);
+  std::string line;
+  while (std::getline(stream, line) && line != "end_header") {
+  }
+  for (size_t i = 0u; i < mesh_.vertices.size(); ++i) {
+    float coords[3];
+    uint8_t color[3];
+    stream.read(reinterpret_cast<char*>(coords), sizeof(coords));
+    stream.read(reinterpret_cast<char*>(color), sizeof(color));
+    ASSERT_TRUE(static_cast<bool>(stream));
+    EXPECT_EQ(coords[0], mesh_.vertices[i].x());
+    EXPECT_EQ(coords[1], mesh_.vertices[i].y());
+    EXPECT_EQ(coords[2], mesh_.vertices[i].z());
+    EXPECT_EQ(color[0], mesh_.colors[i].r);
+    EXPECT_EQ(color[1], mesh_.colors[i].g);
+    EXPECT_EQ(color[2], mesh_.colors[i].b);
+  }
+  // Nothing follows the vertices.
+  EXPECT_EQ(stream.peek(), std::char_traits<char>::eof());
+}
+
+TEST_F(MeshPlyTest, StreamedMeshLayer) {
+  MeshLayer mesh_layer(1.0f);
+  createHeightFieldMeshLayer(&mesh_layer);
+
+  Mesh combined_mesh;
+  mesh_layer.getMesh(&combined_mesh);
+  Mesh connected_mesh;
+  mesh_layer.getConnectedMesh(&connected_mesh);
+  ASSERT_LT(connected_mesh.vertices.size(), combined_mesh.vertices.size());
+
+  const std::string kFilename = "mesh_layer_streamed.ply";
+  const std::string kReferenceFilename = "mesh_layer_reference.ply";
+  for (const io::PlyFormat format :
+       {io::PlyFormat::kAscii, io::PlyFormat::kBinaryLittleEndian}) {
+    // Read back the meshes written in one go, so they are rounded the same
+    // way in ASCII.
+    std::string format_string;
+    Mesh combined_reference, connected_reference;
+    ASSERT_TRUE(outputMeshAsPly(kReferenceFilename, combined_mesh, format));
+    ASSERT_TRUE(readMeshPly(kReferenceFilename, &format_string,
+                            &combined_reference));
+    ASSERT_TRUE(outputMeshAsPly(kReferenceFilename, connected_mesh, format));
+    ASSERT_TRUE(readMeshPly(kReferenceFilename, &format_string,
+                            &connected_reference));
+
+    // Separate triangles, as in the mesh layer.
+    Mesh mesh;
+    ASSERT_TRUE(outputMeshLayerAsPlyStreamed(kFilename, mesh_layer, format,
+                                             false));
+    ASSERT_TRUE(readMeshPly(kFilename, &format_string, &mesh));
+    EXPECT_EQ(mesh.vertices.size(), combined_mesh.vertices.size());
+    EXPECT_TRUE(getSortedTriangles(mesh) ==
+                getSortedTriangles(combined_reference));
+
+    // Welding everything in one tile gives the connected mesh.
+    constexpr size_t kLargeTileSize = 16u;
+    mesh = Mesh();
+    ASSERT_TRUE(outputMeshLayerAsPlyStreamed(kFilename, mesh_layer, format,
+                                             true, kLargeTileSize));
+    ASSERT_TRUE(readMeshPly(kFilename, &format_string, &mesh));
+    EXPECT_EQ(mesh.vertices.size(), connected_mesh.vertices.size());
+    EXPECT_TRUE(getSortedTriangles(mesh) ==
+                getSortedTriangles(connected_reference));
+
+    // Smaller tiles only keep the vertices on their borders apart.
+    constexpr size_t kSmallTileSize = 2u;
+    mesh = Mesh();
+    ASSERT_TRUE(outputMeshLayerAsPlyStreamed(kFilename, mesh_layer, format,
+                                             true, kSmallTileSize));
+    ASSERT_TRUE(readMeshPly(kFilename, &format_string, &mesh));
+    EXPECT_GT(mesh.vertices.size(), connected_mesh.vertices.size());
+    EXPECT_LT(mesh.vertices.size(), combined_mesh.vertices.size());
+    EXPECT_TRUE(getSortedTriangles(mesh) ==
+                getSortedTriangles(connected_reference));
+
+    // The counts in the header are written once, without any padding.
+    std::ifstream stream(kFilename.c_str(), std::ios::in | std::ios::binary);
+    std::string line;
+    while (std::getline(stream, line) && line.find("element") != 0u) {
+    }
+    EXPECT_EQ(line, "element vertex " + std::to_string(mesh.vertices.size()));
+    while (std::getline(stream, line) && line.find("element") != 0u) {
+    }
+    EXPECT_EQ(line,
+              "element face " + std::to_string(mesh.indices.size() / 3u));
+
+    // The temporary files are removed again.
+    EXPECT_FALSE(std::ifstream(kFilename + ".vertices.tmp").good());
+    EXPECT_FALSE(std::ifstream(kFilename + ".faces.tmp").good());
+  }
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  google::InitGoogleLogging(argv[0]);
+  return RUN_ALL_TESTS();
+}
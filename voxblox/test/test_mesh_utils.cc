@@ -0,0 +1,320 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "voxblox/core/block_hash.h"
+#include "voxblox/core/common.h"
+#include "voxblox/mesh/mesh.h"
+#include "voxblox/mesh/mesh_utils.h"
+#include "voxblox/utils/timing.h"
+
+using namespace voxblox;  // NOLINT
+
+class MeshUtilsTest : public ::testing::Test {
+ protected:
+  /**
+   * Creates a wavy height field as separate triangles, split into square
+   * meshes of quads_per_mesh quads per side like the block meshes.
+   */
+  void createHeightFieldMeshes(const size_t quads_per_side,
+                               const size_t quads_per_mesh,
+                               AlignedVector<Mesh::ConstPtr>* meshes) const {
+    meshes->clear();
+    for (size_t mesh_x = 0u; mesh_x < quads_per_side;
+         mesh_x += quads_per_mesh) {
+      for (size_t mesh_y = 0u; mesh_y < quads_per_side;
+           mesh_y += quads_per_mesh) {
+        Mesh::Ptr mesh = std::make_shared<Mesh>();
+        for (size_t x = mesh_x;
+             x < std::min(mesh_x + quads_per_mesh, quads_per_side); ++x) {
+          for (size_t y = mesh_y;
+               y < std::min(mesh_y + quads_per_mesh, quads_per_side); ++y) {
+            addTriangle(getPoint(x, y), getPoint(x + 1u, y),
+                        getPoint(x + 1u, y + 1u), mesh.get());
+            addTriangle(getPoint(x, y), getPoint(x + 1u, y + 1u),
+                        getPoint(x, y + 1u), mesh.get());
+          }
+        }
+        meshes->push_back(mesh);
+      }
+    }
+  }
+
+  Point getPoint(const size_t x, const size_t y) const {
+    const FloatingPoint px = kQuadSize * x;
+    const FloatingPoint py = kQuadSize * y;
+    return Point(px, py, 0.5f * std::sin(px) * std::cos(0.5f * py));
+  }
+
+  void addTriangle(const Point& p0, const Point& p1, const Point& p2,
+                   Mesh* mesh) const {
+    const Point normal = (p1 - p0).cross(p2 - p0).normalized();
+    for (const Point& point : {p0, p1, p2}) {
+      mesh->indices.push_back(mesh->vertices.size());
+      mesh->vertices.push_back(point);
+      mesh->normals.push_back(normal);
+      mesh->colors.emplace_back(
+          static_cast<uint8_t>(static_cast<int>(point.x() * 10.0f) % 256),
+          static_cast<uint8_t>(static_cast<int>(point.y() * 10.0f) % 256), 0u);
+    }
+  }
+
+  /// Straight-forward serial merging through a hash map.
+  void createConnectedMeshReference(const AlignedVector<Mesh::ConstPtr>& meshes,
+                                    const FloatingPoint threshold,
+                                    Mesh* connected_mesh) const {
+    LongIndexHashMapType<size_t>::type uniques;
+    const double threshold_inv = 1. / static_cast<double>(threshold);
+    for (const Mesh::ConstPtr& mesh : meshes) {
+      std::vector<size_t> new_indices(mesh->vertices.size());
+      for (size_t i = 0u; i < mesh->vertices.size(); ++i) {
+        const Eigen::Vector3d scaled_vector =
+            mesh->vertices[i].cast<double>() * threshold_inv;
+        const LongIndex cell(std::round(scaled_vector.x()),
+                             std::round(scaled_vector.y()),
+                             std::round(scaled_vector.z()));
+        const auto result =
+            uniques.emplace(cell, connected_mesh->vertices.size());
+        if (result.second) {
+          connected_mesh->vertices.push_back(mesh->vertices[i]);
+          connected_mesh->colors.push_back(mesh->colors[i]);
+          connected_mesh->normals.push_back(Point::Zero());
+        }
+        new_indices[i] = result.first->second;
+        connected_mesh->normals[new_indices[i]] += mesh->normals[i];
+      }
+      for (size_t i = 0u; i < mesh->indices.size(); i += 3u) {
+        const size_t vertex_0 = new_indices[mesh->indices[i]];
+        const size_t vertex_1 = new_indices[mesh->indices[i + 1u]];
+        const size_t vertex_2 = new_indices[mesh->indices[i + 2u]];
+        if (vertex_0 != vertex_1 && vertex_1 != vertex_2 &&
+            vertex_0 != vertex_2) {
+          connected_mesh->indices.push_back(vertex_0);
+          connected_mesh->indices.push_back(vertex_1);
+          connected_mesh->indices.push_back(vertex_2);
+        }
+      }
+    }
+    for (Point& normal : connected_mesh->normals) {
+      normal.normalize();
+    }
+  }
+
+  /**
+   * Normals as merged before the sort-based version: the summed normals were
+   * renormalized after every mesh, so the meshes were weighted equally
+   * instead of the triangles.
+   */
+  void createPerMeshNormalizedNormals(
+      const AlignedVector<Mesh::ConstPtr>& meshes,
+      const FloatingPoint threshold, Pointcloud* normals) const {
+    LongIndexHashMapType<size_t>::type uniques;
+    const double threshold_inv = 1. / static_cast<double>(threshold);
+    for (const Mesh::ConstPtr& mesh : meshes) {
+      for (size_t i = 0u; i < mesh->vertices.size(); ++i) {
+        const Eigen::Vector3d scaled_vector =
+            mesh->vertices[i].cast<double>() * threshold_inv;
+        const LongIndex cell(std::round(scaled_vector.x()),
+                             std::round(scaled_vector.y()),
+                             std::round(scaled_vector.z()));
+        const auto result = uniques.emplace(cell, normals->size());
+        if (result.second) {
+          normals->push_back(mesh->normals[i]);
+        } else {
+          (*normals)[result.first->second] += mesh->normals[i];
+        }
+      }
+      for (Point& normal : *normals) {
+        normal.normalize();
+      }
+    }
+  }
+
+  void expectMeshesEqual(const Mesh& expected_mesh, const Mesh& mesh) const {
+    ASSERT_EQ(expected_mesh.vertices.size(), mesh.vertices.size());
+    ASSERT_EQ(expected_mesh.colors.size(), mesh.colors.size());
+    ASSERT_EQ(expected_mesh.normals.size(), mesh.normals.size());
+    EXPECT_TRUE(expected_mesh.indices == mesh.indices);
+    for (size_t i = 0u; i < mesh.vertices.size(); ++i) {
+      EXPECT_TRUE(expected_mesh.vertices[i] == mesh.vertices[i]);
+      EXPECT_EQ(expected_mesh.colors[i].r, mesh.colors[i].r);
+      EXPECT_EQ(expected_mesh.colors[i].g, mesh.colors[i].g);
+      EXPECT_NEAR((expected_mesh.normals[i] - mesh.normals[i]).norm(), 0.0f,
+                  kEpsilon);
+    }
+  }
+
+  static constexpr FloatingPoint kQuadSize = 0.05f;
+};
+
+constexpr FloatingPoint MeshUtilsTest::kQuadSize;
+
+TEST_F(MeshUtilsTest, ConnectedMeshMatchesReference) {
+  constexpr size_t kQuadsPerSide = 200u;
+  constexpr size_t kQuadsPerMesh = 16u;
+  AlignedVector<Mesh::ConstPtr> meshes;
+  createHeightFieldMeshes(kQuadsPerSide, kQuadsPerMesh, &meshes);
+
+  // Merge the shared vertices only, then simplify to a coarser grid, which
+  // also removes collapsed triangles.
+  for (const FloatingPoint threshold : {1e-5f, 2.5f * kQuadSize}) {
+    Mesh expected_mesh;
+    createConnectedMeshReference(meshes, threshold, &expected_mesh);
+    for (const size_t num_threads : {1u, 4u}) {
+      Mesh connected_mesh;
+      createConnectedMesh(meshes, &connected_mesh, threshold, num_threads);
+      expectMeshesEqual(expected_mesh, connected_mesh);
+    }
+  }
+
+  Mesh connected_mesh;
+  createConnectedMesh(meshes, &connected_mesh, 1e-5f);
+  EXPECT_EQ(connected_mesh.vertices.size(),
+            (kQuadsPerSide + 1u) * (kQuadsPerSide + 1u));
+  EXPECT_EQ(connected_mesh.indices.size(),
+            6u * kQuadsPerSide * kQuadsPerSide);
+}
+
+TEST_F(MeshUtilsTest, ConnectedMeshOfSingleMesh) {
+  AlignedVector<Mesh::ConstPtr> meshes;
+  createHeightFieldMeshes(4u, 4u, &meshes);
+  ASSERT_EQ(meshes.size(), 1u);
+
+  Mesh expected_mesh;
+  createConnectedMeshReference(meshes, 1e-5f, &expected_mesh);
+  Mesh connected_mesh;
+  createConnectedMesh(*meshes.front(), &connected_mesh, 1e-5f);
+  expectMeshesEqual(expected_mesh, connected_mesh);
+  EXPECT_EQ(connected_mesh.vertices.size(), 25u);
+
+  // An empty input gives an empty mesh, and leaves a filled one as it is.
+  Mesh empty_mesh;
+  createConnectedMesh(Mesh(), &empty_mesh);
+  EXPECT_TRUE(empty_mesh.vertices.empty());
+  EXPECT_TRUE(empty_mesh.indices.empty());
+  createConnectedMesh(Mesh(), &connected_mesh);
+  expectMeshesEqual(expected_mesh, connected_mesh);
+}
+
+TEST_F(MeshUtilsTest, ConnectedMeshIsAppended) {
+  AlignedVector<Mesh::ConstPtr> meshes;
+  createHeightFieldMeshes(4u, 4u, &meshes);
+  ASSERT_EQ(meshes.size(), 1u);
+
+  Mesh single_mesh;
+  createConnectedMesh(meshes, &single_mesh, 1e-5f);
+
+  // The second mesh is connected on its own and follows the first one.
+  Mesh connected_mesh;
+  createConnectedMesh(meshes, &connected_mesh, 1e-5f);
+  createConnectedMesh(meshes, &connected_mesh, 1e-5f);
+  const size_t num_vertices = single_mesh.vertices.size();
+  const size_t num_indices = single_mesh.indices.size();
+  ASSERT_EQ(connected_mesh.vertices.size(), 2u * num_vertices);
+  ASSERT_EQ(connected_mesh.colors.size(), 2u * num_vertices);
+  ASSERT_EQ(connected_mesh.normals.size(), 2u * num_vertices);
+  ASSERT_EQ(connected_mesh.indices.size(), 2u * num_indices);
+  for (size_t i = 0u; i < num_vertices; ++i) {
+    EXPECT_EQ(connected_mesh.vertices[i], single_mesh.vertices[i]);
+    EXPECT_EQ(connected_mesh.vertices[num_vertices + i],
+              single_mesh.vertices[i]);
+  }
+  for (size_t i = 0u; i < num_indices; ++i) {
+    EXPECT_EQ(connected_mesh.indices[i], single_mesh.indices[i]);
+    EXPECT_EQ(connected_mesh.indices[num_indices + i],
+              num_vertices + single_mesh.indices[i]);
+  }
+}
+
+TEST_F(MeshUtilsTest, ConnectedMeshNormalsCloseToPerMeshNormalized) {
+  // The normals are no longer renormalized after every mesh, which changes
+  // the normals of vertices shared between meshes. On a smooth surface they
+  // still point in almost the same direction.
+  constexpr FloatingPoint kMaxAngleDeg = 1.0f;
+  const FloatingPoint min_cos_angle = std::cos(kMaxAngleDeg * M_PI / 180.0);
+  constexpr size_t kQuadsPerSide = 64u;
+  constexpr size_t kQuadsPerMesh = 16u;
+  AlignedVector<Mesh::ConstPtr> meshes;
+  createHeightFieldMeshes(kQuadsPerSide, kQuadsPerMesh, &meshes);
+
+  Pointcloud per_mesh_normals;
+  createPerMeshNormalizedNormals(meshes, 1e-5f, &per_mesh_normals);
+  Mesh connected_mesh;
+  createConnectedMesh(meshes, &connected_mesh, 1e-5f);
+  ASSERT_EQ(per_mesh_normals.size(), connected_mesh.normals.size());
+
+  FloatingPoint min_cos = 1.0f;
+  for (size_t i = 0u; i < per_mesh_normals.size(); ++i) {
+    min_cos =
+        std::min(min_cos, per_mesh_normals[i].dot(connected_mesh.normals[i]));
+  }
+  EXPECT_GE(min_cos, min_cos_angle);
+}
+
+TEST_F(MeshUtilsTest, BenchmarkConnectedMesh) {
+  // About a million triangles.
+  constexpr size_t kQuadsPerSide = 708u;
+  constexpr size_t kQuadsPerMesh = 16u;
+  AlignedVector<Mesh::ConstPtr> meshes;
+  createHeightFieldMeshes(kQuadsPerSide, kQuadsPerMesh, &meshes);
+
+  Mesh reference_mesh;
+  timing::Timer reference_timer("connected_mesh/hash_map_reference");
+  createConnectedMeshReference(meshes, 1e-5f, &reference_mesh);
+  reference_timer.Stop();
+
+  Mesh serial_mesh;
+  timing::Timer serial_timer("connected_mesh/1_thread");
+  createConnectedMesh(meshes, &serial_mesh, 1e-5f, 1u);
+  serial_timer.Stop();
+
+  Mesh parallel_mesh;
+  timing::Timer parallel_timer("connected_mesh/all_threads");
+  createConnectedMesh(meshes, &parallel_mesh, 1e-5f);
+  parallel_timer.Stop();
+
+  EXPECT_EQ(serial_mesh.indices.size(), 6u * kQuadsPerSide * kQuadsPerSide);
+  EXPECT_EQ(serial_mesh.vertices.size(),
+            (kQuadsPerSide + 1u) * (kQuadsPerSide + 1u));
+  EXPECT_TRUE(serial_mesh.indices == parallel_mesh.indices);
+  EXPECT_TRUE(serial_mesh.vertices == parallel_mesh.vertices);
+}
+
+TEST_F(MeshUtilsTest, OctNormalEncoding) {
+  constexpr FloatingPoint kMaxAngleDeg = 1.0f;
+  const FloatingPoint min_cos_angle = std::cos(kMaxAngleDeg * M_PI / 180.0);
+  std::vector<Point> normals = {Point::UnitX(),  -Point::UnitX(),
+                                Point::UnitY(),  -Point::UnitY(),
+                                Point::UnitZ(),  -Point::UnitZ(),
+                                Point(1, 1, -1), Point(-1, 1, -1e-3f)};
+  for (size_t i = 0u; i < 10000u; ++i) {
+    normals.push_back(Point::Random());
+  }
+  for (Point& normal : normals) {
+    if (normal.norm() < kEpsilon) {
+      continue;
+    }
+    normal.normalize();
+    uint8_t u, v;
+    encodeOctNormal(normal, &u, &v);
+    const Point decoded_normal = decodeOctNormal(u, v);
+    EXPECT_NEAR(decoded_normal.norm(), 1.0f, kEpsilon);
+    EXPECT_GE(decoded_normal.dot(normal), min_cos_angle)
+        << normal.transpose() << " decoded as " << decoded_normal.transpose();
+  }
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  google::InitGoogleLogging(argv[0]);
+
+  int result = RUN_ALL_TESTS();
+
+  timing::Timing::Print(std::cout);
+
+  return result;
+}
@@ -0,0 +1,450 @@
+#include <limits>
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include "voxblox/core/common.h"
+#include "voxblox/integrator/integrator_utils.h"
+
+using namespace voxblox;  // NOLINT
+
+class RayCasterTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    // Make sure this is deterministic.
+    gen_.seed(1);
+  }
+
+  Point randomPoint(const FloatingPoint range) {
+    std::uniform_real_distribution<FloatingPoint> dis(-range, range);
+    return Point(dis(gen_), dis(gen_), dis(gen_));
+  }
+
+  static void castFloatRay(const Point& start_scaled, const Point& end_scaled,
+                           AlignedVector<GlobalIndex>* indices) {
+    RayCaster ray_caster(start_scaled, end_scaled);
+    GlobalIndex ray_index;
+    while (ray_caster.nextRayIndex(&ray_index)) {
+      indices->push_back(ray_index);
+    }
+  }
+
+  static void castIntegerRay(const Point& start_scaled,
+                             const Point& end_scaled,
+                             AlignedVector<GlobalIndex>* indices) {
+    IntegerRayCaster ray_caster(start_scaled, end_scaled);
+    GlobalIndex ray_index;
+    while (ray_caster.nextRayIndex(&ray_index)) {
+      indices->push_back(ray_index);
+    }
+  }
+
+  // Reference traversal in long double precision, which evaluates the ray
+  // parameter of every boundary crossing directly instead of accumulating it.
+  static void castExactRay(const Point& start_scaled, const Point& end_scaled,
+                           AlignedVector<GlobalIndex>* indices) {
+    GlobalIndex curr_index = getGridIndexFromPoint<GlobalIndex>(start_scaled);
+    const GlobalIndex end_index =
+        getGridIndexFromPoint<GlobalIndex>(end_scaled);
+    const LongIndexElement num_steps =
+        (end_index - curr_index).cwiseAbs().sum();
+
+    long double start[3];
+    long double direction[3];
+    int step_sign[3];
+    LongIndexElement next_boundary[3];
+    for (int i = 0; i < 3; ++i) {
+      start[i] = static_cast<long double>(start_scaled[i]);
+      direction[i] = static_cast<long double>(end_scaled[i]) - start[i];
+      step_sign[i] = (direction[i] > 0) ? 1 : ((direction[i] < 0) ? -1 : 0);
+      next_boundary[i] = curr_index[i] + ((step_sign[i] > 0) ? 1 : 0);
+    }
+
+    for (LongIndexElement step = 0; step <= num_steps; ++step) {
+      indices->push_back(curr_index);
+      long double t[3];
+      for (int i = 0; i < 3; ++i) {
+        t[i] = (step_sign[i] == 0)
+                   ? std::numeric_limits<long double>::max()
+                   : (next_boundary[i] - start[i]) / direction[i];
+      }
+      const int axis =
+          (t[0] <= t[1] && t[0] <= t[2]) ? 0 : ((t[1] <= t[2]) ? 1 : 2);
+      curr_index[axis] += step_sign[axis];
+      next_boundary[axis] += step_sign[axis];
+    }
+  }
+
+  static void expectSameTraversal(const AlignedVector<GlobalIndex>& expected,
+                                  const AlignedVector<GlobalIndex>& actual) {
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t i = 0u; i < expected.size(); ++i) {
+      EXPECT_EQ(expected[i], actual[i]) << "Step " << i;
+    }
+  }
+
+  std::mt19937 gen_;
+};
+
+TEST_F(RayCasterTest, IntegerCasterMatchesFloatCaster) {
+  constexpr size_t kNumRays = 10000u;
+  constexpr FloatingPoint kRange = 1000.0;
+
+  // The float caster accumulates its ray parameters, hence its error grows
+  // with the ray length. Up to a couple of dozen voxels it is exact, and both
+  // casters need to produce identical traversals.
+  for (const FloatingPoint max_length : {1.0f, 3.0f, 10.0f, 20.0f}) {
+    for (size_t i = 0u; i < kNumRays; ++i) {
+      const Point start_scaled = randomPoint(kRange);
+      const Point end_scaled = start_scaled + randomPoint(max_length);
+
+      AlignedVector<GlobalIndex> float_indices;
+      castFloatRay(start_scaled, end_scaled, &float_indices);
+      AlignedVector<GlobalIndex> integer_indices;
+      castIntegerRay(start_scaled, end_scaled, &integer_indices);
+
+      expectSameTraversal(float_indices, integer_indices);
+    }
+  }
+}
+
+TEST_F(RayCasterTest, IntegerCasterMatchesExactTraversal) {
+  constexpr size_t kNumRays = 5000u;
+  constexpr FloatingPoint kRange = 100.0;
+
+  size_t num_float_caster_deviations = 0u;
+  for (size_t i = 0u; i < kNumRays; ++i) {
+    const Point start_scaled = randomPoint(kRange);
+    const Point end_scaled = randomPoint(kRange);
+
+    AlignedVector<GlobalIndex> exact_indices;
+    castExactRay(start_scaled, end_scaled, &exact_indices);
+    AlignedVector<GlobalIndex> float_indices;
+    castFloatRay(start_scaled, end_scaled, &float_indices);
+    AlignedVector<GlobalIndex> integer_indices;
+    castIntegerRay(start_scaled, end_scaled, &integer_indices);
+
+    expectSameTraversal(exact_indices, integer_indices);
+
+    // Both casters agree on the first and last voxel and on the length, the
+    // float caster can only take a different path in case of near ties.
+    ASSERT_EQ(float_indices.size(), integer_indices.size());
+    EXPECT_EQ(float_indices.front(), integer_indices.front());
+    EXPECT_EQ(float_indices.back(), integer_indices.back());
+    if (float_indices != integer_indices) {
+      ++num_float_caster_deviations;
+    }
+  }
+  EXPECT_LT(num_float_caster_deviations, kNumRays / 100u);
+}
+
+TEST_F(RayCasterTest, IntegerCasterMatchesFloatCasterWithSensorRays) {
+  constexpr size_t kNumRays = 2000u;
+  constexpr FloatingPoint kVoxelSizeInv = 1.0 / 0.2;
+  constexpr FloatingPoint kTruncationDistance = 0.4;
+  constexpr FloatingPoint kMaxRayLength = 5.0;
+
+  const Point origin(0.3, -1.2, 1.5);
+  for (size_t i = 0u; i < kNumRays; ++i) {
+    const Point point_G = origin + randomPoint(4.0);
+    for (const bool is_clearing_ray : {false, true}) {
+      for (const bool cast_from_origin : {false, true}) {
+        RayCaster float_caster(origin, point_G, is_clearing_ray, true,
+                               kMaxRayLength, kVoxelSizeInv,
+                               kTruncationDistance, cast_from_origin);
+        IntegerRayCaster integer_caster(origin, point_G, is_clearing_ray, true,
+                                        kMaxRayLength, kVoxelSizeInv,
+                                        kTruncationDistance, cast_from_origin);
+
+        AlignedVector<GlobalIndex> float_indices;
+        GlobalIndex ray_index;
+        while (float_caster.nextRayIndex(&ray_index)) {
+          float_indices.push_back(ray_index);
+        }
+        AlignedVector<GlobalIndex> integer_indices;
+        while (integer_caster.nextRayIndex(&ray_index)) {
+          integer_indices.push_back(ray_index);
+        }
+
+        expectSameTraversal(float_indices, integer_indices);
+      }
+    }
+  }
+}
+
+TEST_F(RayCasterTest, AxisAlignedAndDegenerateRays) {
+  // Rays that stay inside a single voxel.
+  AlignedVector<GlobalIndex> indices;
+  castIntegerRay(Point(0.5, 0.5, 0.5), Point(0.5, 0.5, 0.5), &indices);
+  ASSERT_EQ(indices.size(), 1u);
+  EXPECT_EQ(indices[0], GlobalIndex(0, 0, 0));
+
+  // Axis aligned rays in all directions.
+  for (int axis = 0; axis < 3; ++axis) {
+    for (const int sign : {-1, 1}) {
+      Point end_scaled(0.5, 0.5, 0.5);
+      end_scaled[axis] += sign * 10.0;
+      indices.clear();
+      castIntegerRay(Point(0.5, 0.5, 0.5), end_scaled, &indices);
+      ASSERT_EQ(indices.size(), 11u);
+      for (size_t i = 0u; i < indices.size(); ++i) {
+        GlobalIndex expected_index = GlobalIndex::Zero();
+        expected_index[axis] = sign * static_cast<LongIndexElement>(i);
+        EXPECT_EQ(indices[i], expected_index);
+      }
+    }
+  }
+
+  // NaN rays produce no indices.
+  indices.clear();
+  castIntegerRay(Point(NAN, 0.0, 0.0), Point(1.0, 1.0, 1.0), &indices);
+  EXPECT_TRUE(indices.empty());
+}
+
+TEST_F(RayCasterTest, BufferedIndicesMatchSingleIndices) {
+  constexpr size_t kNumRays = 1000u;
+  constexpr FloatingPoint kRange = 50.0;
+  constexpr size_t kBufferSize = 7u;
+
+  for (size_t i = 0u; i < kNumRays; ++i) {
+    const Point start_scaled = randomPoint(kRange);
+    const Point end_scaled = randomPoint(kRange);
+
+    AlignedVector<GlobalIndex> single_indices;
+    castIntegerRay(start_scaled, end_scaled, &single_indices);
+
+    IntegerRayCaster ray_caster(start_scaled, end_scaled);
+    EXPECT_EQ(ray_caster.numRemainingRayIndices(), single_indices.size());
+    AlignedVector<GlobalIndex> buffered_indices;
+    GlobalIndex buffer[kBufferSize];
+    size_t num_indices;
+    while ((num_indices = ray_caster.nextRayIndices(kBufferSize, buffer)) >
+           0u) {
+      buffered_indices.insert(buffered_indices.end(), buffer,
+                              buffer + num_indices);
+    }
+    EXPECT_EQ(ray_caster.numRemainingRayIndices(), 0u);
+    expectSameTraversal(single_indices, buffered_indices);
+
+    AlignedVector<GlobalIndex> cast_ray_indices;
+    castRay(start_scaled, end_scaled, &cast_ray_indices);
+    expectSameTraversal(single_indices, cast_ray_indices);
+  }
+}
+
+TEST_F(RayCasterTest, PacketCasterMatchesScalarCasters) {
+  constexpr size_t kNumPackets = 500u;
+  constexpr size_t kMaxPacketSize = PacketRayCaster::kMaxPacketSize;
+  constexpr FloatingPoint kVoxelSizeInv = 1.0 / 0.1;
+  constexpr FloatingPoint kTruncationDistance = 0.4;
+  constexpr FloatingPoint kMaxRayLength = 5.0;
+
+  // Keep the origin off the voxel boundaries, such that the last voxel of the
+  // rays cast towards it is unambiguous.
+  const Point origin(0.33, -1.17, 1.52);
+  std::uniform_real_distribution<FloatingPoint> spread_dis(0.0, 0.05);
+  PacketRayCaster ray_packet;
+  for (size_t packet_idx = 0u; packet_idx < kNumPackets; ++packet_idx) {
+    // Coherent rays, as produced by neighboring pixels of a depth image, and
+    // partially filled packets.
+    const size_t num_rays = packet_idx % kMaxPacketSize + 1u;
+    const Point center_G = origin + randomPoint(4.0);
+    const bool is_clearing_ray = (packet_idx % 3u) == 0u;
+    const bool cast_from_origin = (packet_idx % 2u) == 0u;
+
+    ray_packet.clear();
+    AlignedVector<AlignedVector<GlobalIndex>> integer_indices(num_rays);
+    AlignedVector<AlignedVector<GlobalIndex>> float_indices(num_rays);
+    for (size_t i = 0u; i < num_rays; ++i) {
+      const Point point_G = center_G + randomPoint(spread_dis(gen_));
+      EXPECT_EQ(ray_packet.addRay(origin, point_G, is_clearing_ray, true,
+                                  kMaxRayLength, kVoxelSizeInv,
+                                  kTruncationDistance, cast_from_origin),
+                i);
+
+      IntegerRayCaster integer_caster(origin, point_G, is_clearing_ray, true,
+                                      kMaxRayLength, kVoxelSizeInv,
+                                      kTruncationDistance, cast_from_origin);
+      RayCaster float_caster(origin, point_G, is_clearing_ray, true,
+                             kMaxRayLength, kVoxelSizeInv, kTruncationDistance,
+                             cast_from_origin);
+      GlobalIndex ray_index;
+      while (integer_caster.nextRayIndex(&ray_index)) {
+        integer_indices[i].push_back(ray_index);
+      }
+      while (float_caster.nextRayIndex(&ray_index)) {
+        float_indices[i].push_back(ray_index);
+      }
+    }
+    EXPECT_EQ(ray_packet.numRays(), num_rays);
+    EXPECT_EQ(ray_packet.isFull(), num_rays == kMaxPacketSize);
+
+    AlignedVector<AlignedVector<GlobalIndex>> packet_indices(num_rays);
+    GlobalIndex ray_indices[kMaxPacketSize];
+    bool ray_active[kMaxPacketSize];
+    size_t num_active_rays;
+    while ((num_active_rays =
+                ray_packet.nextRayIndices(ray_indices, ray_active)) > 0u) {
+      size_t num_counted_rays = 0u;
+      for (size_t i = 0u; i < kMaxPacketSize; ++i) {
+        if (ray_active[i]) {
+          ASSERT_LT(i, num_rays);
+          packet_indices[i].push_back(ray_indices[i]);
+          ++num_counted_rays;
+        }
+      }
+      EXPECT_EQ(num_active_rays, num_counted_rays);
+    }
+
+    // Every ray traverses exactly the voxels of the integer caster. The float
+    // caster can swap two steps near ties on long rays, see
+    // IntegerCasterMatchesExactTraversal, but covers the same span.
+    for (size_t i = 0u; i < num_rays; ++i) {
+      expectSameTraversal(integer_indices[i], packet_indices[i]);
+
+      ASSERT_EQ(float_indices[i].size(), packet_indices[i].size());
+      if (!packet_indices[i].empty()) {
+        EXPECT_EQ(float_indices[i].front(), packet_indices[i].front());
+        EXPECT_EQ(float_indices[i].back(), packet_indices[i].back());
+      }
+    }
+  }
+}
+
+TEST_F(RayCasterTest, PacketCasterTerminatesRays) {
+  constexpr size_t kMaxPacketSize = PacketRayCaster::kMaxPacketSize;
+  constexpr size_t kNumStepsBeforeTermination = 5u;
+
+  PacketRayCaster ray_packet;
+  AlignedVector<AlignedVector<GlobalIndex>> expected_indices;
+  for (size_t i = 0u; i < kMaxPacketSize; ++i) {
+    const Point start_scaled = randomPoint(10.0);
+    const Point end_scaled = start_scaled + Point(20.0, 10.0, 5.0);
+    ray_packet.addRay(start_scaled, end_scaled);
+
+    expected_indices.emplace_back();
+    castIntegerRay(start_scaled, end_scaled, &expected_indices.back());
+    // Every second ray is terminated early.
+    if (i % 2u == 1u) {
+      expected_indices.back().resize(kNumStepsBeforeTermination);
+    }
+  }
+  EXPECT_TRUE(ray_packet.isFull());
+
+  AlignedVector<AlignedVector<GlobalIndex>> packet_indices(kMaxPacketSize);
+  GlobalIndex ray_indices[kMaxPacketSize];
+  bool ray_active[kMaxPacketSize];
+  size_t step = 0u;
+  while (ray_packet.nextRayIndices(ray_indices, ray_active) > 0u) {
+    for (size_t i = 0u; i < kMaxPacketSize; ++i) {
+      if (ray_active[i]) {
+        packet_indices[i].push_back(ray_indices[i]);
+        if (i % 2u == 1u && step + 1u == kNumStepsBeforeTermination) {
+          ray_packet.terminateRay(i);
+        }
+      }
+    }
+    ++step;
+  }
+
+  for (size_t i = 0u; i < kMaxPacketSize; ++i) {
+    expectSameTraversal(expected_indices[i], packet_indices[i]);
+  }
+}
+
+TEST_F(RayCasterTest, SkippedBlocksMatchFullTraversal) {
+  constexpr size_t kNumRays = 2000u;
+  constexpr FloatingPoint kRange = 50.0;
+  constexpr size_t kMaxPacketSize = PacketRayCaster::kMaxPacketSize;
+
+  // Skips every block with an even sum of its indices.
+  auto should_skip = [](const BlockIndex& block_index) {
+    return (block_index.sum() % 2) == 0;
+  };
+
+  for (const IndexElement voxels_per_side : {1, 2, 8, 16}) {
+    const FloatingPoint voxels_per_side_inv = 1.0 / voxels_per_side;
+    auto get_block_index = [voxels_per_side_inv](const GlobalIndex& index) {
+      return getBlockIndexFromGlobalVoxelIndex(index, voxels_per_side_inv);
+    };
+
+    PacketRayCaster ray_packet;
+    AlignedVector<AlignedVector<GlobalIndex>> expected_packet_indices;
+    for (size_t i = 0u; i < kNumRays; ++i) {
+      // Axis aligned rays in every fourth ray.
+      const Point start_scaled = randomPoint(kRange);
+      Point end_scaled = randomPoint(kRange);
+      if (i % 4u == 0u) {
+        end_scaled.y() = start_scaled.y();
+        end_scaled.z() = start_scaled.z();
+      }
+
+      AlignedVector<GlobalIndex> full_indices;
+      castIntegerRay(start_scaled, end_scaled, &full_indices);
+      // The ray only loses the voxels after the first one in skipped blocks.
+      AlignedVector<GlobalIndex> expected_indices;
+      for (const GlobalIndex& index : full_indices) {
+        if (!expected_indices.empty()) {
+          const BlockIndex previous_block =
+              get_block_index(expected_indices.back());
+          if (should_skip(previous_block) &&
+              get_block_index(index) == previous_block) {
+            continue;
+          }
+        }
+        expected_indices.push_back(index);
+      }
+
+      IntegerRayCaster ray_caster(start_scaled, end_scaled);
+      AlignedVector<GlobalIndex> skipped_indices;
+      GlobalIndex ray_index;
+      while (ray_caster.nextRayIndex(&ray_index)) {
+        skipped_indices.push_back(ray_index);
+        const BlockIndex block_index = get_block_index(ray_index);
+        if (should_skip(block_index)) {
+          ray_caster.skipBlock(block_index, voxels_per_side);
+        }
+      }
+      expectSameTraversal(expected_indices, skipped_indices);
+
+      ray_packet.addRay(start_scaled, end_scaled);
+      expected_packet_indices.push_back(expected_indices);
+      if (!ray_packet.isFull() && i + 1u < kNumRays) {
+        continue;
+      }
+
+      // The same for all rays of a packet.
+      AlignedVector<AlignedVector<GlobalIndex>> packet_indices(
+          ray_packet.numRays());
+      GlobalIndex ray_indices[kMaxPacketSize];
+      bool ray_active[kMaxPacketSize];
+      while (ray_packet.nextRayIndices(ray_indices, ray_active) > 0u) {
+        for (size_t ray_id = 0u; ray_id < ray_packet.numRays(); ++ray_id) {
+          if (!ray_active[ray_id]) {
+            continue;
+          }
+          packet_indices[ray_id].push_back(ray_indices[ray_id]);
+          const BlockIndex block_index = get_block_index(ray_indices[ray_id]);
+          if (should_skip(block_index)) {
+            ray_packet.skipBlock(ray_id, block_index, voxels_per_side);
+          }
+        }
+      }
+      for (size_t ray_id = 0u; ray_id < ray_packet.numRays(); ++ray_id) {
+        expectSameTraversal(expected_packet_indices[ray_id],
+                            packet_indices[ray_id]);
+      }
+      ray_packet.clear();
+      expected_packet_indices.clear();
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  google::InitGoogleLogging(argv[0]);
+
+  int result = RUN_ALL_TESTS();
+
+  return result;
+}
@@ -1,10 +1,23 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <utility>
+#include <vector>
+
 #include <gtest/gtest.h>
 
+#include "voxblox/core/block_hash.h"
+#include "voxblox/core/esdf_map.h"
 #include "voxblox/core/layer.h"
 #include "voxblox/core/voxel.h"
+#include "voxblox/integrator/esdf_coarse_integrator.h"
 #include "voxblox/integrator/esdf_integrator.h"
+#include "voxblox/integrator/esdf_occ_integrator.h"
 #include "voxblox/integrator/tsdf_integrator.h"
 #include "voxblox/io/layer_io.h"
+#include "voxblox/mesh/mesh_integrator.h"
 #include "voxblox/simulation/simulation_world.h"
 #include "voxblox/utils/evaluation_utils.h"
 #include "voxblox/utils/layer_utils.h"
@@ -15,6 +28,128 @@ DECLARE_bool(alsologtostderr);
 DECLARE_bool(logtostderr);
 DECLARE_int32(v);
 
+typedef std::array<float, 12> TriangleData;
+
+// Triangle vertices and their red color channel, sorted for comparing meshes.
+std::vector<TriangleData> getSortedTriangles(const Mesh& mesh) {
+  std::vector<TriangleData> triangles;
+  for (size_t i = 0u; i + 2u < mesh.indices.size(); i += 3u) {
+    TriangleData triangle;
+    for (size_t j = 0u; j < 3u; ++j) {
+      const size_t vertex_index = mesh.indices[i + j];
+      triangle[4u * j] = mesh.vertices[vertex_index].x();
+      triangle[4u * j + 1u] = mesh.vertices[vertex_index].y();
+      triangle[4u * j + 2u] = mesh.vertices[vertex_index].z();
+      triangle[4u * j + 3u] =
+          mesh.hasColors() ? mesh.colors[vertex_index].r : 0u;
+    }
+    triangles.push_back(triangle);
+  }
+  std::sort(triangles.begin(), triangles.end());
+  return triangles;
+}
+
+// Reference for the block meshes: runs marching cubes on every cube of the
+// block on its own, looking up all of its corners in the layer.
+void meshBlockCubeByCube(const Layer<TsdfVoxel>& layer,
+                         const BlockIndex& block_index, const float min_weight,
+                         Mesh* mesh) {
+  Eigen::Matrix<IndexElement, 3, 8> cube_index_offsets;
+  // clang-format off
+  cube_index_offsets << 0, 1, 1, 0, 0, 1, 1, 0,
+                        0, 0, 1, 1, 0, 0, 1, 1,
+                        0, 0, 0, 0, 1, 1, 1, 1;
+  // clang-format on
+  const IndexElement vps = layer.voxels_per_side();
+  const FloatingPoint voxel_size = layer.voxel_size();
+
+  VertexIndex next_mesh_index = 0u;
+  VoxelIndex voxel_index;
+  for (voxel_index.x() = 0; voxel_index.x() < vps; ++voxel_index.x()) {
+    for (voxel_index.y() = 0; voxel_index.y() < vps; ++voxel_index.y()) {
+      for (voxel_index.z() = 0; voxel_index.z() < vps; ++voxel_index.z()) {
+        Eigen::Matrix<FloatingPoint, 3, 8> corner_coords;
+        Eigen::Matrix<FloatingPoint, 8, 1> corner_sdf;
+        bool all_corners_observed = true;
+        for (int i = 0; i < 8; ++i) {
+          const GlobalIndex corner_index =
+              getGlobalVoxelIndexFromBlockAndVoxelIndex(
+                  block_index,
+                  VoxelIndex(voxel_index + cube_index_offsets.col(i)), vps);
+          const TsdfVoxel* voxel = layer.getVoxelPtrByGlobalIndex(corner_index);
+          if (voxel == nullptr ||
+              !utils::getSdfIfValid(*voxel, min_weight, &corner_sdf(i))) {
+            all_corners_observed = false;
+            break;
+          }
+          corner_coords.col(i) =
+              getCenterPointFromGridIndex(corner_index, voxel_size);
+        }
+        if (all_corners_observed) {
+          MarchingCubes::meshCube(corner_coords, corner_sdf, &next_mesh_index,
+                                  mesh);
+        }
+      }
+    }
+  }
+}
+
+// Whether every triangle has a distinct counterpart with the same vertex order
+// and all values within the tolerance.
+bool trianglesAreNear(const std::vector<TriangleData>& triangles,
+                      const std::vector<TriangleData>& other_triangles,
+                      const float tolerance) {
+  if (triangles.size() != other_triangles.size()) {
+    return false;
+  }
+  // Bucket the other triangles by their first vertex, with buckets larger
+  // than the tolerance so only the neighboring buckets need to be searched.
+  const float bucket_size_inv = 0.1f / tolerance;
+  AnyIndexHashMapType<std::vector<size_t> >::type buckets;
+  for (size_t i = 0u; i < other_triangles.size(); ++i) {
+    const Point vertex(other_triangles[i][0], other_triangles[i][1],
+                       other_triangles[i][2]);
+    buckets[getGridIndexFromPoint<AnyIndex>(vertex, bucket_size_inv)]
+        .push_back(i);
+  }
+
+  std::vector<bool> matched(other_triangles.size(), false);
+  for (const TriangleData& triangle : triangles) {
+    const AnyIndex bucket_index = getGridIndexFromPoint<AnyIndex>(
+        Point(triangle[0], triangle[1], triangle[2]), bucket_size_inv);
+    bool found_match = false;
+    for (IndexElement dx = -1; dx <= 1 && !found_match; ++dx) {
+      for (IndexElement dy = -1; dy <= 1 && !found_match; ++dy) {
+        for (IndexElement dz = -1; dz <= 1 && !found_match; ++dz) {
+          const auto it = buckets.find(bucket_index + AnyIndex(dx, dy, dz));
+          if (it == buckets.end()) {
+            continue;
+          }
+          for (const size_t i : it->second) {
+            if (matched[i]) {
+              continue;
+            }
+            bool is_near = true;
+            for (size_t j = 0u; j < triangle.size() && is_near; ++j) {
+              is_near = std::abs(triangle[j] - other_triangles[i][j]) <=
+                        tolerance;
+            }
+            if (is_near) {
+              matched[i] = true;
+              found_match = true;
+              break;
+            }
+          }
+        }
+      }
+    }
+    if (!found_match) {
+      return false;
+    }
+  }
+  return true;
+}
+
 class SdfIntegratorsTest : public ::testing::TestWithParam<FloatingPoint> {
  public:
   SdfIntegratorsTest()
@@ -84,6 +219,30 @@ class SdfIntegratorsTest : public ::testing::TestWithParam<FloatingPoint> {
   }
 
  protected:
+  /**
+   * Integrates the pointclouds seen from every pose_step-th pose, calling
+   * after_integration after each of them if set.
+   */
+  void integrateEveryNthPose(
+      const size_t pose_step, TsdfIntegratorBase* integrator,
+      const std::function<void()>& after_integration =
+          std::function<void()>()) {
+    CHECK_NOTNULL(integrator);
+    for (size_t i = 0; i < poses_.size(); i += pose_step) {
+      Pointcloud ptcloud, ptcloud_C;
+      Colors colors;
+
+      world_.getPointcloudFromTransform(poses_[i], depth_camera_resolution_,
+                                        fov_h_rad_, max_dist_, &ptcloud,
+                                        &colors);
+      transformPointcloud(poses_[i].inverse(), ptcloud, &ptcloud_C);
+      integrator->integratePointCloud(poses_[i], ptcloud_C, colors);
+      if (after_integration) {
+        after_integration();
+      }
+    }
+  }
+
   SimulationWorld world_;
 
   // Camera settings
@@ -180,6 +339,208 @@ TEST_P(SdfIntegratorsTest, TsdfIntegrators) {
   io::SaveLayer(merged_layer, "tsdf_fast_test.voxblox", true);
 }
 
+TEST_P(SdfIntegratorsTest, TsdfIntegratorsWithRayPackets) {
+  TsdfIntegratorBase::Config config;
+  config.default_truncation_distance = truncation_distance_;
+  config.integrator_threads = 1;
+
+  Layer<TsdfVoxel> simple_layer(voxel_size_, voxels_per_side_);
+  SimpleTsdfIntegrator simple_integrator(config, &simple_layer);
+  Layer<TsdfVoxel> fast_layer(voxel_size_, voxels_per_side_);
+  FastTsdfIntegrator fast_integrator(config, &fast_layer);
+
+  config.use_ray_packets = true;
+  config.integrator_threads = 2;
+  Layer<TsdfVoxel> simple_packet_layer(voxel_size_, voxels_per_side_);
+  SimpleTsdfIntegrator simple_packet_integrator(config, &simple_packet_layer);
+  Layer<TsdfVoxel> fast_packet_layer(voxel_size_, voxels_per_side_);
+  FastTsdfIntegrator fast_packet_integrator(config, &fast_packet_layer);
+
+  constexpr size_t kPoseStep = 5u;
+  for (size_t i = 0; i < poses_.size(); i += kPoseStep) {
+    Pointcloud ptcloud, ptcloud_C;
+    Colors colors;
+
+    world_.getPointcloudFromTransform(poses_[i], depth_camera_resolution_,
+                                      fov_h_rad_, max_dist_, &ptcloud, &colors);
+    transformPointcloud(poses_[i].inverse(), ptcloud, &ptcloud_C);
+    simple_integrator.integratePointCloud(poses_[i], ptcloud_C, colors);
+    simple_packet_integrator.integratePointCloud(poses_[i], ptcloud_C, colors);
+    fast_integrator.integratePointCloud(poses_[i], ptcloud_C, colors);
+    fast_packet_integrator.integratePointCloud(poses_[i], ptcloud_C, colors);
+  }
+
+  // The packets traverse the same voxels as the integer ray caster, which only
+  // deviates from the float ray caster in a few steps near ties. Since the
+  // distances are truncated after every update, the different update order
+  // within a scan also leads to small differences.
+  utils::VoxelEvaluationDetails simple_packet_result;
+  utils::evaluateLayersRmse(simple_layer, simple_packet_layer,
+                            utils::VoxelEvaluationMode::kEvaluateAllVoxels,
+                            &simple_packet_result);
+  std::cout << "Simple Integrator with ray packets vs. without: "
+            << simple_packet_result.toString();
+  EXPECT_EQ(simple_layer.getNumberOfAllocatedBlocks(),
+            simple_packet_layer.getNumberOfAllocatedBlocks());
+  EXPECT_LT(simple_packet_result.rmse, voxel_size_ * 0.1);
+
+  utils::VoxelEvaluationDetails simple_gt_result, simple_packet_gt_result;
+  utils::evaluateLayersRmse(*tsdf_gt_, simple_layer,
+                            utils::VoxelEvaluationMode::kEvaluateAllVoxels,
+                            &simple_gt_result);
+  utils::evaluateLayersRmse(*tsdf_gt_, simple_packet_layer,
+                            utils::VoxelEvaluationMode::kEvaluateAllVoxels,
+                            &simple_packet_gt_result);
+  EXPECT_NEAR(simple_gt_result.num_overlapping_voxels,
+              simple_packet_gt_result.num_overlapping_voxels,
+              simple_gt_result.num_overlapping_voxels / 1000u);
+  EXPECT_NEAR(simple_gt_result.rmse, simple_packet_gt_result.rmse,
+              voxel_size_ * 0.01);
+
+  // The fast integrator drops rays depending on the integration order, so only
+  // compare the quality of both.
+  utils::VoxelEvaluationDetails fast_result, fast_packet_result;
+  utils::evaluateLayersRmse(*tsdf_gt_, fast_layer,
+                            utils::VoxelEvaluationMode::kEvaluateAllVoxels,
+                            &fast_result);
+  utils::evaluateLayersRmse(*tsdf_gt_, fast_packet_layer,
+                            utils::VoxelEvaluationMode::kEvaluateAllVoxels,
+                            &fast_packet_result);
+  std::cout << "Fast Integrator: " << fast_result.toString();
+  std::cout << "Fast Integrator with ray packets: "
+            << fast_packet_result.toString();
+
+  const size_t total_voxels = fast_result.num_overlapping_voxels +
+                              fast_result.num_non_overlapping_voxels;
+  const size_t one_percent_of_voxels = static_cast<size_t>(total_voxels * 0.01);
+  EXPECT_NEAR(fast_result.num_overlapping_voxels,
+              fast_packet_result.num_overlapping_voxels, one_percent_of_voxels);
+  EXPECT_LT(fast_packet_result.max_error, truncation_distance_ * 2);
+  EXPECT_LT(fast_packet_result.rmse, voxel_size_ * 2);
+
+  // Other integration orders fall back to casting single rays.
+  config.integration_order_mode = "sorted";
+  SimpleTsdfIntegrator sorted_integrator(config, &simple_packet_layer);
+  EXPECT_FALSE(sorted_integrator.getConfig().use_ray_packets);
+  MergedTsdfIntegrator merged_integrator(config, &simple_packet_layer);
+  EXPECT_FALSE(merged_integrator.getConfig().use_ray_packets);
+}
+
+TEST_P(SdfIntegratorsTest, TsdfIntegratorsSkipSaturatedFreeSpace) {
+  TsdfIntegratorBase::Config config;
+  config.integrator_threads = 1;
+  // Let the free space saturate after a few scans, and use small blocks and a
+  // narrow surface band, such that some blocks are entirely in free space.
+  config.use_const_weight = true;
+  config.max_weight = 2.0f;
+  config.default_truncation_distance = 2 * voxel_size_;
+  constexpr size_t kVoxelsPerSide = 2u;
+  Layer<TsdfVoxel> layer(voxel_size_, kVoxelsPerSide);
+  SimpleTsdfIntegrator integrator(config, &layer);
+
+  config.skip_saturated_free_space_blocks = true;
+  Layer<TsdfVoxel> skipping_layer(voxel_size_, kVoxelsPerSide);
+  SimpleTsdfIntegrator skipping_integrator(config, &skipping_layer);
+
+  constexpr size_t kPoseStep = 5u;
+  for (size_t i = 0; i < poses_.size(); i += kPoseStep) {
+    Pointcloud ptcloud, ptcloud_C;
+    Colors colors;
+
+    world_.getPointcloudFromTransform(poses_[i], depth_camera_resolution_,
+                                      fov_h_rad_, max_dist_, &ptcloud, &colors);
+    transformPointcloud(poses_[i].inverse(), ptcloud, &ptcloud_C);
+    integrator.integratePointCloud(poses_[i], ptcloud_C, colors);
+    skipping_integrator.integratePointCloud(poses_[i], ptcloud_C, colors);
+  }
+
+  // The summary of every block matches its voxels.
+  size_t num_saturated_blocks = 0u;
+  for (const Layer<TsdfVoxel>* tsdf_layer : {&layer, &skipping_layer}) {
+    BlockIndexList block_list;
+    tsdf_layer->getAllAllocatedBlocks(&block_list);
+    for (const BlockIndex& block_index : block_list) {
+      const Block<TsdfVoxel>& block = tsdf_layer->getBlockByIndex(block_index);
+      int num_saturated_free_voxels = 0;
+      for (size_t linear_index = 0u; linear_index < block.num_voxels();
+           ++linear_index) {
+        const TsdfVoxel& voxel = block.getVoxelByLinearIndex(linear_index);
+        if (voxel.weight >= config.max_weight &&
+            voxel.distance >= config.default_truncation_distance) {
+          ++num_saturated_free_voxels;
+        }
+      }
+      EXPECT_EQ(block.num_saturated_free_voxels(), num_saturated_free_voxels);
+      if (block.isSaturatedFreeSpace()) {
+        ++num_saturated_blocks;
+      }
+    }
+  }
+  EXPECT_GT(num_saturated_blocks, 0u);
+
+  // Skipping the saturated blocks doesn't change the result.
+  utils::VoxelEvaluationDetails result;
+  utils::evaluateLayersRmse(layer, skipping_layer,
+                            utils::VoxelEvaluationMode::kEvaluateAllVoxels,
+                            &result);
+  std::cout << "Simple Integrator with skipped free space vs. without: "
+            << result.toString();
+  EXPECT_EQ(layer.getNumberOfAllocatedBlocks(),
+            skipping_layer.getNumberOfAllocatedBlocks());
+  EXPECT_LT(result.max_error, 1e-4);
+}
+
+TEST(TsdfIntegratorTest, DeserializedBlocksAreNotSkipped) {
+  TsdfIntegratorBase::Config config;
+  config.integrator_threads = 1;
+  config.use_const_weight = true;
+  config.max_weight = 2.0f;
+  config.default_truncation_distance = 0.2;
+  config.skip_saturated_free_space_blocks = true;
+  constexpr FloatingPoint kVoxelSize = 0.1;
+  constexpr size_t kVoxelsPerSide = 2u;
+  Layer<TsdfVoxel> layer(kVoxelSize, kVoxelsPerSide);
+  SimpleTsdfIntegrator integrator(config, &layer);
+
+  // A wall far behind the block, such that its rays cover all of its voxels.
+  Pointcloud points_C;
+  for (FloatingPoint y = -1.0; y <= 1.0; y += 0.02) {
+    for (FloatingPoint z = -1.0; z <= 1.0; z += 0.02) {
+      points_C.emplace_back(2.0, y, z);
+    }
+  }
+  const Colors colors(points_C.size());
+  const Transformation T_G_C;
+  for (int i = 0; i < 2; ++i) {
+    integrator.integratePointCloud(T_G_C, points_C, colors);
+  }
+  const BlockIndex block_index(2, 0, 0);
+  Block<TsdfVoxel>::Ptr block = layer.getBlockPtrByIndex(block_index);
+  ASSERT_TRUE(block);
+  ASSERT_TRUE(block->isSaturatedFreeSpace());
+
+  // Receive a surface for the block, e.g. from another map.
+  Block<TsdfVoxel> surface_block(kVoxelsPerSide, kVoxelSize, block->origin());
+  for (size_t i = 0u; i < surface_block.num_voxels(); ++i) {
+    surface_block.getVoxelByLinearIndex(i).distance = 0.0f;
+    surface_block.getVoxelByLinearIndex(i).weight = 1.0f;
+  }
+  std::vector<uint32_t> data;
+  surface_block.serializeToIntegers(&data);
+  block->deserializeFromIntegers(data);
+  EXPECT_EQ(block->num_saturated_free_voxels(), 0);
+  EXPECT_FALSE(block->isSaturatedFreeSpace());
+
+  // The rays update the received voxels instead of skipping the block.
+  integrator.integratePointCloud(T_G_C, points_C, colors);
+  block = layer.getBlockPtrByIndex(block_index);
+  for (size_t i = 0u; i < block->num_voxels(); ++i) {
+    const TsdfVoxel& voxel = block->getVoxelByLinearIndex(i);
+    EXPECT_EQ(voxel.weight, config.max_weight);
+    EXPECT_GT(voxel.distance, 0.0f);
+  }
+}
+
 TEST_P(SdfIntegratorsTest, EsdfIntegrators) {
   // TSDF layer + integrator
   TsdfIntegratorBase::Config config;
@@ -283,6 +644,1148 @@ TEST_P(SdfIntegratorsTest, EsdfIntegrators) {
   io::SaveLayer(*esdf_gt_, "esdf_gt.voxblox", false);
 }
 
+TEST_P(SdfIntegratorsTest, EsdfIntegratorsParallel) {
+  TsdfIntegratorBase::Config config;
+  config.default_truncation_distance = truncation_distance_;
+  config.integrator_threads = 1;
+  Layer<TsdfVoxel> tsdf_layer(voxel_size_, voxels_per_side_);
+  MergedTsdfIntegrator tsdf_integrator(config, &tsdf_layer);
+
+  EsdfIntegrator::Config esdf_config;
+  esdf_config.max_distance_m = esdf_max_distance_;
+  esdf_config.default_distance_m = esdf_max_distance_;
+  esdf_config.min_distance_m = truncation_distance_ / 2.0;
+  // Propagate every change, so there is a single result no matter in which
+  // order the voxels are relaxed. Otherwise changes smaller than min_diff_m
+  // can add up along a path, differently for each order.
+  esdf_config.min_diff_m = 0.0;
+
+  // Serial and parallel integrators, both incremental and batch.
+  constexpr size_t kNumThreads = 4u;
+  Layer<EsdfVoxel> incremental_layer(voxel_size_, voxels_per_side_);
+  Layer<EsdfVoxel> incremental_parallel_layer(voxel_size_, voxels_per_side_);
+  Layer<EsdfVoxel> batch_layer(voxel_size_, voxels_per_side_);
+  Layer<EsdfVoxel> batch_parallel_layer(voxel_size_, voxels_per_side_);
+  EsdfIntegrator incremental_integrator(esdf_config, &tsdf_layer,
+                                        &incremental_layer);
+  EsdfIntegrator batch_integrator(esdf_config, &tsdf_layer, &batch_layer);
+  esdf_config.integrator_threads = kNumThreads;
+  EsdfIntegrator incremental_parallel_integrator(esdf_config, &tsdf_layer,
+                                                 &incremental_parallel_layer);
+  EsdfIntegrator batch_parallel_integrator(esdf_config, &tsdf_layer,
+                                           &batch_parallel_layer);
+
+  for (size_t i = 0; i < poses_.size(); i++) {
+    Pointcloud ptcloud, ptcloud_C;
+    Colors colors;
+
+    world_.getPointcloudFromTransform(poses_[i], depth_camera_resolution_,
+                                      fov_h_rad_, max_dist_, &ptcloud, &colors);
+    transformPointcloud(poses_[i].inverse(), ptcloud, &ptcloud_C);
+    tsdf_integrator.integratePointCloud(poses_[i], ptcloud_C, colors);
+
+    incremental_integrator.updateFromTsdfLayer(false);
+    constexpr bool clear_updated_flag = true;
+    incremental_parallel_integrator.updateFromTsdfLayer(clear_updated_flag);
+  }
+  batch_integrator.updateFromTsdfLayerBatch();
+  batch_parallel_integrator.updateFromTsdfLayerBatch();
+
+  // The voxels are relaxed in a different order, but they converge to the
+  // same distances.
+  constexpr FloatingPoint kRmseTolerance = 1e-3;
+  const std::vector<std::pair<const Layer<EsdfVoxel>*,
+                              const Layer<EsdfVoxel>*> > layer_pairs = {
+      {&incremental_layer, &incremental_parallel_layer},
+      {&batch_layer, &batch_parallel_layer}};
+  for (const auto& layer_pair : layer_pairs) {
+    const Layer<EsdfVoxel>& serial_layer = *layer_pair.first;
+    const Layer<EsdfVoxel>& parallel_layer = *layer_pair.second;
+    ASSERT_EQ(serial_layer.getNumberOfAllocatedBlocks(),
+              parallel_layer.getNumberOfAllocatedBlocks());
+
+    BlockIndexList blocks;
+    serial_layer.getAllAllocatedBlocks(&blocks);
+    size_t num_observed = 0u;
+    for (const BlockIndex& block_index : blocks) {
+      ASSERT_TRUE(parallel_layer.hasBlock(block_index));
+      const Block<EsdfVoxel>& serial_block =
+          serial_layer.getBlockByIndex(block_index);
+      const Block<EsdfVoxel>& parallel_block =
+          parallel_layer.getBlockByIndex(block_index);
+      for (size_t i = 0u; i < serial_block.num_voxels(); ++i) {
+        const EsdfVoxel& serial_voxel = serial_block.getVoxelByLinearIndex(i);
+        const EsdfVoxel& parallel_voxel =
+            parallel_block.getVoxelByLinearIndex(i);
+        ASSERT_EQ(serial_voxel.observed, parallel_voxel.observed);
+        if (!serial_voxel.observed) {
+          continue;
+        }
+        ++num_observed;
+        ASSERT_NEAR(serial_voxel.distance, parallel_voxel.distance,
+                    esdf_config.min_diff_m + kEpsilon)
+            << "Block " << block_index.transpose() << " voxel " << i;
+      }
+    }
+    EXPECT_GT(num_observed, 0u);
+
+    utils::VoxelEvaluationDetails serial_result, parallel_result;
+    utils::evaluateLayersRmse(*esdf_gt_, serial_layer,
+                              utils::VoxelEvaluationMode::kEvaluateAllVoxels,
+                              &serial_result);
+    utils::evaluateLayersRmse(*esdf_gt_, parallel_layer,
+                              utils::VoxelEvaluationMode::kEvaluateAllVoxels,
+                              &parallel_result);
+    std::cout << "Serial Integrator: " << serial_result.toString();
+    std::cout << "Parallel Integrator: " << parallel_result.toString();
+    EXPECT_EQ(serial_result.num_overlapping_voxels,
+              parallel_result.num_overlapping_voxels);
+    EXPECT_NEAR(serial_result.rmse, parallel_result.rmse, kRmseTolerance);
+  }
+}
+
+TEST_P(SdfIntegratorsTest, EsdfIntegratorsDistanceTransformBatch) {
+  TsdfIntegratorBase::Config config;
+  config.default_truncation_distance = truncation_distance_;
+  config.integrator_threads = 1;
+  Layer<TsdfVoxel> tsdf_layer(voxel_size_, voxels_per_side_);
+  MergedTsdfIntegrator tsdf_integrator(config, &tsdf_layer);
+
+  EsdfIntegrator::Config esdf_config;
+  esdf_config.max_distance_m = esdf_max_distance_;
+  esdf_config.default_distance_m = esdf_max_distance_;
+  esdf_config.min_distance_m = truncation_distance_ / 2.0;
+  esdf_config.min_diff_m = 0.0;
+  esdf_config.full_euclidean_distance = true;
+  Layer<EsdfVoxel> batch_layer(voxel_size_, voxels_per_side_);
+  Layer<EsdfVoxel> transform_layer(voxel_size_, voxels_per_side_);
+  EsdfIntegrator batch_integrator(esdf_config, &tsdf_layer, &batch_layer);
+  esdf_config.distance_transform_batch = true;
+  esdf_config.integrator_threads = 2u;
+  EsdfIntegrator transform_integrator(esdf_config, &tsdf_layer,
+                                      &transform_layer);
+
+  for (size_t i = 0; i < poses_.size(); i++) {
+    Pointcloud ptcloud, ptcloud_C;
+    Colors colors;
+    world_.getPointcloudFromTransform(poses_[i], depth_camera_resolution_,
+                                      fov_h_rad_, max_dist_, &ptcloud, &colors);
+    transformPointcloud(poses_[i].inverse(), ptcloud, &ptcloud_C);
+    tsdf_integrator.integratePointCloud(poses_[i], ptcloud_C, colors);
+  }
+  batch_integrator.updateFromTsdfLayerBatch();
+  transform_integrator.updateFromTsdfLayerBatch();
+
+  utils::VoxelEvaluationDetails batch_result, transform_result;
+  utils::evaluateLayersRmse(*esdf_gt_, batch_layer,
+                            utils::VoxelEvaluationMode::kEvaluateAllVoxels,
+                            &batch_result);
+  utils::evaluateLayersRmse(*esdf_gt_, transform_layer,
+                            utils::VoxelEvaluationMode::kEvaluateAllVoxels,
+                            &transform_result);
+  std::cout << "Batch Full Euclidean Integrator: " << batch_result.toString();
+  std::cout << "Distance Transform Batch Integrator: "
+            << transform_result.toString();
+
+  EXPECT_EQ(batch_result.num_overlapping_voxels,
+            transform_result.num_overlapping_voxels);
+  EXPECT_LT(transform_result.rmse, esdf_max_distance_ * voxel_size_);
+
+  // Every voxel gets the distance through the closest fixed voxel of its
+  // sign, which is less than min_distance_m above the smallest distance
+  // through any of them. Checked against brute force on a sample of the
+  // voxels.
+  AlignedVector<GlobalIndex> fixed_voxels;
+  std::vector<float> fixed_distances;
+  BlockIndexList tsdf_blocks;
+  tsdf_layer.getAllAllocatedBlocks(&tsdf_blocks);
+  for (const BlockIndex& block_index : tsdf_blocks) {
+    const Block<TsdfVoxel>& block = tsdf_layer.getBlockByIndex(block_index);
+    for (size_t i = 0u; i < block.num_voxels(); ++i) {
+      const TsdfVoxel& voxel = block.getVoxelByLinearIndex(i);
+      if (voxel.weight >= esdf_config.min_weight &&
+          std::abs(voxel.distance) < esdf_config.min_distance_m) {
+        fixed_voxels.push_back(getGlobalVoxelIndexFromBlockAndVoxelIndex(
+            block_index, block.computeVoxelIndexFromLinearIndex(i),
+            voxels_per_side_));
+        fixed_distances.push_back(voxel.distance);
+      }
+    }
+  }
+  ASSERT_FALSE(fixed_voxels.empty());
+
+  constexpr size_t kNumSamples = 2000u;
+  const size_t sample_step = std::max<size_t>(
+      transform_result.num_overlapping_voxels / kNumSamples, 1u);
+  size_t num_voxels = 0u;
+  size_t num_samples = 0u;
+  for (const BlockIndex& block_index : tsdf_blocks) {
+    const Block<EsdfVoxel>& block =
+        transform_layer.getBlockByIndex(block_index);
+    for (size_t linear_index = 0u; linear_index < block.num_voxels();
+         ++linear_index) {
+      const EsdfVoxel& voxel = block.getVoxelByLinearIndex(linear_index);
+      if (!voxel.observed || voxel.fixed || num_voxels++ % sample_step != 0) {
+        continue;
+      }
+      ++num_samples;
+      const GlobalIndex global_index =
+          getGlobalVoxelIndexFromBlockAndVoxelIndex(
+              block_index,
+              block.computeVoxelIndexFromLinearIndex(linear_index),
+              voxels_per_side_);
+      FloatingPoint min_distance = std::numeric_limits<FloatingPoint>::max();
+      for (size_t i = 0u; i < fixed_voxels.size(); ++i) {
+        if ((fixed_distances[i] > 0.0f) != (voxel.distance > 0.0f)) {
+          continue;
+        }
+        min_distance = std::min(
+            min_distance,
+            (fixed_voxels[i] - global_index).cast<FloatingPoint>().norm() *
+                    voxel_size_ +
+                std::abs(fixed_distances[i]));
+      }
+      if (std::abs(voxel.distance) == esdf_config.default_distance_m) {
+        EXPECT_GT(min_distance + esdf_config.min_distance_m,
+                  esdf_config.max_distance_m)
+            << "at " << global_index.transpose();
+        continue;
+      }
+      EXPECT_GE(std::abs(voxel.distance), min_distance - kEpsilon)
+          << "at " << global_index.transpose();
+      EXPECT_LT(std::abs(voxel.distance),
+                min_distance + esdf_config.min_distance_m)
+          << "at " << global_index.transpose();
+    }
+  }
+  EXPECT_GT(num_samples, 0u);
+}
+
+TEST_P(SdfIntegratorsTest, IncrementalMeshing) {
+  TsdfIntegratorBase::Config config;
+  config.default_truncation_distance = truncation_distance_;
+  config.integrator_threads = 1;
+  Layer<TsdfVoxel> tsdf_layer(voxel_size_, voxels_per_side_);
+  MergedTsdfIntegrator tsdf_integrator(config, &tsdf_layer);
+
+  MeshIntegratorConfig mesh_config;
+  mesh_config.incremental_meshing = true;
+  MeshLayer incremental_mesh_layer(tsdf_layer.block_size());
+  MeshIntegrator<TsdfVoxel> incremental_mesh_integrator(
+      mesh_config, &tsdf_layer, &incremental_mesh_layer);
+
+  size_t num_partial_updates = 0u;
+  for (size_t i = 0; i < poses_.size(); i += 5) {
+    Pointcloud ptcloud, ptcloud_C;
+    Colors colors;
+
+    world_.getPointcloudFromTransform(poses_[i], depth_camera_resolution_,
+                                      fov_h_rad_, max_dist_, &ptcloud, &colors);
+    transformPointcloud(poses_[i].inverse(), ptcloud, &ptcloud_C);
+    tsdf_integrator.integratePointCloud(poses_[i], ptcloud_C, colors);
+
+    constexpr bool only_mesh_updated_blocks = true;
+    constexpr bool clear_updated_flag = true;
+    incremental_mesh_integrator.generateMesh(only_mesh_updated_blocks,
+                                             clear_updated_flag);
+
+    // Consume the updates, as publishing the mesh would.
+    BlockIndexList updated_meshes;
+    incremental_mesh_layer.getAllUpdatedMeshes(&updated_meshes);
+    for (const BlockIndex& block_index : updated_meshes) {
+      Mesh& mesh = incremental_mesh_layer.getMeshByIndex(block_index);
+      EXPECT_TRUE(mesh.hasSubMeshes());
+      if (mesh.updated_sub_meshes != Block<TsdfVoxel>::kAllSubBricks) {
+        ++num_partial_updates;
+      }
+      mesh.updated = false;
+    }
+  }
+  EXPECT_GT(num_partial_updates, 0u);
+
+  // Meshing the final map from scratch has to give the same triangles.
+  mesh_config.incremental_meshing = false;
+  MeshLayer mesh_layer(tsdf_layer.block_size());
+  const Layer<TsdfVoxel>& const_tsdf_layer = tsdf_layer;
+  MeshIntegrator<TsdfVoxel> mesh_integrator(mesh_config, const_tsdf_layer,
+                                            &mesh_layer);
+  mesh_integrator.generateMesh(false, false);
+
+  BlockIndexList mesh_indices;
+  mesh_layer.getAllAllocatedMeshes(&mesh_indices);
+  EXPECT_EQ(mesh_indices.size(),
+            incremental_mesh_layer.getNumberOfAllocatedMeshes());
+  size_t num_triangles = 0u;
+  for (const BlockIndex& block_index : mesh_indices) {
+    Mesh::ConstPtr incremental_mesh =
+        incremental_mesh_layer.getMeshPtrByIndex(block_index);
+    ASSERT_TRUE(incremental_mesh != nullptr);
+    const std::vector<TriangleData> triangles =
+        getSortedTriangles(mesh_layer.getMeshByIndex(block_index));
+    EXPECT_TRUE(triangles == getSortedTriangles(*incremental_mesh))
+        << "Block " << block_index.transpose();
+    num_triangles += triangles.size();
+  }
+  EXPECT_GT(num_triangles, 0u);
+}
+
+TEST_P(SdfIntegratorsTest, MeshingFromSdfHalo) {
+  TsdfIntegratorBase::Config config;
+  config.default_truncation_distance = truncation_distance_;
+  Layer<TsdfVoxel> tsdf_layer(voxel_size_, voxels_per_side_);
+  MergedTsdfIntegrator tsdf_integrator(config, &tsdf_layer);
+
+  constexpr size_t kPoseStep = 10u;
+  integrateEveryNthPose(kPoseStep, &tsdf_integrator);
+
+  MeshIntegratorConfig mesh_config;
+  mesh_config.use_color = false;
+  MeshLayer mesh_layer(tsdf_layer.block_size());
+  const Layer<TsdfVoxel>& const_tsdf_layer = tsdf_layer;
+  MeshIntegrator<TsdfVoxel> mesh_integrator(mesh_config, const_tsdf_layer,
+                                            &mesh_layer);
+  mesh_integrator.generateMesh(false, false);
+
+  // Compare against extracting every cube on its own.
+  BlockIndexList block_indices;
+  tsdf_layer.getAllAllocatedBlocks(&block_indices);
+  size_t num_triangles = 0u;
+  for (const BlockIndex& block_index : block_indices) {
+    Mesh mesh;
+    meshBlockCubeByCube(tsdf_layer, block_index, mesh_config.min_weight,
+                        &mesh);
+
+    // The edge vertices are interpolated from the lower to the upper corner,
+    // so they only agree up to rounding.
+    constexpr float kTolerance = 1e-4f;
+    const std::vector<TriangleData> triangles = getSortedTriangles(mesh);
+    EXPECT_TRUE(trianglesAreNear(
+        triangles, getSortedTriangles(mesh_layer.getMeshByIndex(block_index)),
+        kTolerance))
+        << "Block " << block_index.transpose();
+    num_triangles += triangles.size();
+  }
+  EXPECT_GT(num_triangles, 0u);
+}
+
+TEST_P(SdfIntegratorsTest, MeshingWithSharedVertices) {
+  TsdfIntegratorBase::Config config;
+  config.default_truncation_distance = truncation_distance_;
+  Layer<TsdfVoxel> tsdf_layer(voxel_size_, voxels_per_side_);
+  MergedTsdfIntegrator tsdf_integrator(config, &tsdf_layer);
+
+  constexpr size_t kPoseStep = 10u;
+  integrateEveryNthPose(kPoseStep, &tsdf_integrator);
+
+  const Layer<TsdfVoxel>& const_tsdf_layer = tsdf_layer;
+  MeshIntegratorConfig mesh_config;
+  MeshLayer mesh_layer(tsdf_layer.block_size());
+  MeshIntegrator<TsdfVoxel> mesh_integrator(mesh_config, const_tsdf_layer,
+                                            &mesh_layer);
+  mesh_integrator.generateMesh(false, false);
+
+  mesh_config.share_vertices = true;
+  MeshLayer shared_mesh_layer(tsdf_layer.block_size());
+  MeshIntegrator<TsdfVoxel> shared_mesh_integrator(
+      mesh_config, const_tsdf_layer, &shared_mesh_layer);
+  shared_mesh_integrator.generateMesh(false, false);
+
+  // Both use the same edge vertices, so the triangles are exactly the same.
+  BlockIndexList mesh_indices;
+  mesh_layer.getAllAllocatedMeshes(&mesh_indices);
+  EXPECT_EQ(mesh_indices.size(),
+            shared_mesh_layer.getNumberOfAllocatedMeshes());
+  size_t num_vertices = 0u;
+  size_t num_shared_vertices = 0u;
+  for (const BlockIndex& block_index : mesh_indices) {
+    const Mesh& mesh = mesh_layer.getMeshByIndex(block_index);
+    Mesh::ConstPtr shared_mesh =
+        shared_mesh_layer.getMeshPtrByIndex(block_index);
+    ASSERT_TRUE(shared_mesh != nullptr);
+    EXPECT_EQ(shared_mesh->vertices.size(), shared_mesh->normals.size());
+    EXPECT_EQ(shared_mesh->vertices.size(), shared_mesh->colors.size());
+    for (const VertexIndex index : shared_mesh->indices) {
+      ASSERT_LT(index, shared_mesh->vertices.size());
+    }
+    EXPECT_TRUE(getSortedTriangles(mesh) == getSortedTriangles(*shared_mesh))
+        << "Block " << block_index.transpose();
+    num_vertices += mesh.vertices.size();
+    num_shared_vertices += shared_mesh->vertices.size();
+  }
+  EXPECT_GT(num_shared_vertices, 0u);
+  EXPECT_LT(2u * num_shared_vertices, num_vertices);
+
+  // Combining the block meshes has to keep the triangles.
+  Mesh combined_mesh, combined_shared_mesh;
+  mesh_layer.getMesh(&combined_mesh);
+  shared_mesh_layer.getMesh(&combined_shared_mesh);
+  EXPECT_EQ(combined_shared_mesh.vertices.size(), num_shared_vertices);
+  EXPECT_TRUE(getSortedTriangles(combined_mesh) ==
+              getSortedTriangles(combined_shared_mesh));
+}
+
+TEST_P(SdfIntegratorsTest, MeshingLevelsOfDetail) {
+  TsdfIntegratorBase::Config config;
+  config.default_truncation_distance = truncation_distance_;
+  Layer<TsdfVoxel> tsdf_layer(voxel_size_, voxels_per_side_);
+  MergedTsdfIntegrator tsdf_integrator(config, &tsdf_layer);
+
+  // Incremental meshing keeps the levels of detail up to date.
+  constexpr size_t kNumLodLevels = 2u;
+  MeshIntegratorConfig mesh_config;
+  mesh_config.incremental_meshing = true;
+  mesh_config.num_lod_levels = kNumLodLevels;
+  MeshLayer incremental_mesh_layer(tsdf_layer.block_size());
+  MeshIntegrator<TsdfVoxel> incremental_mesh_integrator(
+      mesh_config, &tsdf_layer, &incremental_mesh_layer);
+  constexpr size_t kPoseStep = 10u;
+  integrateEveryNthPose(kPoseStep, &tsdf_integrator, [&]() {
+    constexpr bool only_mesh_updated_blocks = true;
+    constexpr bool clear_updated_flag = true;
+    incremental_mesh_integrator.generateMesh(only_mesh_updated_blocks,
+                                             clear_updated_flag);
+  });
+
+  const Layer<TsdfVoxel>& const_tsdf_layer = tsdf_layer;
+  mesh_config = MeshIntegratorConfig();
+  MeshLayer mesh_layer(tsdf_layer.block_size());
+  MeshIntegrator<TsdfVoxel> mesh_integrator(mesh_config, const_tsdf_layer,
+                                            &mesh_layer);
+  mesh_integrator.generateMesh(false, false);
+
+  mesh_config.num_lod_levels = kNumLodLevels;
+  MeshLayer lod_mesh_layer(tsdf_layer.block_size());
+  MeshIntegrator<TsdfVoxel> lod_mesh_integrator(mesh_config, const_tsdf_layer,
+                                                &lod_mesh_layer);
+  lod_mesh_integrator.generateMesh(false, false);
+
+  BlockIndexList mesh_indices;
+  mesh_layer.getAllAllocatedMeshes(&mesh_indices);
+  std::vector<size_t> num_triangles(kNumLodLevels + 1u, 0u);
+  for (const BlockIndex& block_index : mesh_indices) {
+    Mesh::ConstPtr lod_mesh = lod_mesh_layer.getMeshPtrByIndex(block_index);
+    ASSERT_TRUE(lod_mesh != nullptr);
+    ASSERT_EQ(lod_mesh->getNumLodLevels(), kNumLodLevels + 1u);
+
+    // The full resolution mesh is unchanged.
+    EXPECT_TRUE(getSortedTriangles(mesh_layer.getMeshByIndex(block_index)) ==
+                getSortedTriangles(*lod_mesh))
+        << "Block " << block_index.transpose();
+
+    Mesh::ConstPtr incremental_mesh =
+        incremental_mesh_layer.getMeshPtrByIndex(block_index);
+    ASSERT_TRUE(incremental_mesh != nullptr);
+    ASSERT_EQ(incremental_mesh->getNumLodLevels(), kNumLodLevels + 1u);
+
+    for (size_t level = 0u; level <= kNumLodLevels; ++level) {
+      const Mesh& level_mesh = lod_mesh->getLodMesh(level);
+      EXPECT_TRUE(getSortedTriangles(level_mesh) ==
+                  getSortedTriangles(incremental_mesh->getLodMesh(level)))
+          << "Block " << block_index.transpose() << " level " << level;
+      EXPECT_EQ(level_mesh.vertices.size(), level_mesh.colors.size());
+      num_triangles[level] += level_mesh.indices.size() / 3u;
+
+      // The coarse surface stays within a coarse voxel of the fine one, plus
+      // one voxel for looking up the nearest voxel.
+      const FloatingPoint max_distance =
+          std::sqrt(3.0f) * voxel_size_ *
+          static_cast<FloatingPoint>((1 << level) + 1);
+      for (const Point& vertex : level_mesh.vertices) {
+        Block<TsdfVoxel>::ConstPtr block =
+            tsdf_layer.getBlockPtrByCoordinates(vertex);
+        ASSERT_TRUE(block != nullptr);
+        const TsdfVoxel& voxel = block->getVoxelByCoordinates(vertex);
+        if (voxel.weight > 0.0f) {
+          EXPECT_LE(std::abs(voxel.distance), max_distance);
+        }
+      }
+    }
+  }
+  EXPECT_GT(num_triangles[0], 0u);
+  EXPECT_LT(num_triangles[1], num_triangles[0]);
+  EXPECT_LT(num_triangles[2], num_triangles[1]);
+  EXPECT_GT(num_triangles[2], 0u);
+
+  // Levels beyond the coarsest one give the coarsest one.
+  Mesh connected_mesh;
+  lod_mesh_layer.getConnectedLodMesh(kNumLodLevels + 1u, &connected_mesh);
+  EXPECT_GT(connected_mesh.indices.size(), 0u);
+  EXPECT_LE(connected_mesh.indices.size(), 3u * num_triangles[kNumLodLevels]);
+}
+
+TEST(EsdfIntegratorTest, FullEuclideanFarParents) {
+  // A plane at x = 0, and a row of blocks that is long enough that the
+  // parents of the voxels at the end are too far away to be stored.
+  constexpr FloatingPoint kVoxelSize = 0.02;
+  constexpr size_t kVoxelsPerSide = 16u;
+  constexpr IndexElement kNumBlocks = 14;
+  constexpr FloatingPoint kTruncationDistance = 0.1;
+  constexpr FloatingPoint kFloatingPointTolerance = 1e-4;
+  Layer<TsdfVoxel> tsdf_layer(kVoxelSize, kVoxelsPerSide);
+  for (IndexElement x = 0; x < kNumBlocks; ++x) {
+    Block<TsdfVoxel>::Ptr block =
+        tsdf_layer.allocateBlockPtrByIndex(BlockIndex(x, 0, 0));
+    for (size_t i = 0u; i < block->num_voxels(); ++i) {
+      TsdfVoxel& voxel = block->getVoxelByLinearIndex(i);
+      const bool on_plane =
+          x == 0 && block->computeVoxelIndexFromLinearIndex(i).x() == 0;
+      voxel.distance = on_plane ? 0.0f : kTruncationDistance;
+      voxel.weight = 1.0f;
+    }
+  }
+
+  Layer<EsdfVoxel> esdf_layer(kVoxelSize, kVoxelsPerSide);
+  EsdfIntegrator::Config esdf_config;
+  esdf_config.full_euclidean_distance = true;
+  esdf_config.max_distance_m = 5.0;
+  esdf_config.default_distance_m = 5.0;
+  esdf_config.min_distance_m = kVoxelSize / 2.0;
+  esdf_config.min_diff_m = 0.0;
+  EsdfIntegrator esdf_integrator(esdf_config, &tsdf_layer, &esdf_layer);
+  esdf_integrator.updateFromTsdfLayerBatch();
+
+  ASSERT_GT(kNumBlocks * kVoxelsPerSide,
+            std::numeric_limits<int8_t>::max() + 1u);
+  for (IndexElement x = 0; x < kNumBlocks; ++x) {
+    const Block<EsdfVoxel>& block =
+        esdf_layer.getBlockByIndex(BlockIndex(x, 0, 0));
+    for (size_t i = 0u; i < block.num_voxels(); ++i) {
+      const EsdfVoxel& voxel = block.getVoxelByLinearIndex(i);
+      const GlobalIndex global_index =
+          getGlobalVoxelIndexFromBlockAndVoxelIndex(
+              block.block_index(), block.computeVoxelIndexFromLinearIndex(i),
+              kVoxelsPerSide);
+      ASSERT_TRUE(voxel.observed);
+      EXPECT_NEAR(voxel.distance, global_index.x() * kVoxelSize,
+                  kFloatingPointTolerance)
+          << "at " << global_index.transpose();
+    }
+  }
+}
+
+TEST(EsdfIntegratorTest, DistanceTransformBatchMatchesBruteForce) {
+  // A few fixed voxels in free space, the distances of all other voxels
+  // are the euclidean distance to the closest one plus its TSDF distance.
+  // The outside ones have the same TSDF distance, so the closest one is also
+  // the one with the smallest sum.
+  constexpr FloatingPoint kVoxelSize = 0.1;
+  constexpr size_t kVoxelsPerSide = 8u;
+  constexpr IndexElement kNumBlocks = 3;
+  constexpr FloatingPoint kTruncationDistance = 0.3;
+  constexpr FloatingPoint kFloatingPointTolerance = 1e-4;
+  const AlignedVector<GlobalIndex> fixed_voxels = {
+      GlobalIndex(2, 3, 4), GlobalIndex(20, 5, 1), GlobalIndex(11, 17, 22)};
+  const std::vector<float> fixed_distances = {0.05f, 0.05f, -0.02f};
+
+  Layer<TsdfVoxel> tsdf_layer(kVoxelSize, kVoxelsPerSide);
+  for (IndexElement x = 0; x < kNumBlocks; ++x) {
+    for (IndexElement y = 0; y < kNumBlocks; ++y) {
+      for (IndexElement z = 0; z < kNumBlocks; ++z) {
+        Block<TsdfVoxel>::Ptr block =
+            tsdf_layer.allocateBlockPtrByIndex(BlockIndex(x, y, z));
+        for (size_t i = 0u; i < block->num_voxels(); ++i) {
+          TsdfVoxel& voxel = block->getVoxelByLinearIndex(i);
+          voxel.distance = kTruncationDistance;
+          voxel.weight = 1.0f;
+        }
+      }
+    }
+  }
+  for (size_t i = 0u; i < fixed_voxels.size(); ++i) {
+    TsdfVoxel* voxel = tsdf_layer.getVoxelPtrByGlobalIndex(fixed_voxels[i]);
+    ASSERT_TRUE(voxel != nullptr);
+    voxel->distance = fixed_distances[i];
+  }
+
+  Layer<EsdfVoxel> esdf_layer(kVoxelSize, kVoxelsPerSide);
+  EsdfIntegrator::Config esdf_config;
+  esdf_config.distance_transform_batch = true;
+  esdf_config.max_distance_m = 10.0;
+  esdf_config.default_distance_m = 10.0;
+  esdf_config.min_distance_m = kTruncationDistance / 2.0;
+  EsdfIntegrator esdf_integrator(esdf_config, &tsdf_layer, &esdf_layer);
+  esdf_integrator.updateFromTsdfLayerBatch();
+
+  const IndexElement num_voxels = kNumBlocks * kVoxelsPerSide;
+  for (IndexElement x = 0; x < num_voxels; ++x) {
+    for (IndexElement y = 0; y < num_voxels; ++y) {
+      for (IndexElement z = 0; z < num_voxels; ++z) {
+        const GlobalIndex global_index(x, y, z);
+        const EsdfVoxel* voxel =
+            esdf_layer.getVoxelPtrByGlobalIndex(global_index);
+        ASSERT_TRUE(voxel != nullptr);
+        ASSERT_TRUE(voxel->observed);
+
+        // Only the fixed voxels outside are sources for the outside voxels.
+        FloatingPoint expected_distance = esdf_config.default_distance_m;
+        for (size_t i = 0u; i < fixed_voxels.size(); ++i) {
+          if (fixed_distances[i] <= 0.0f) {
+            continue;
+          }
+          const FloatingPoint distance =
+              (fixed_voxels[i] - global_index).cast<FloatingPoint>().norm() *
+                  kVoxelSize +
+              fixed_distances[i];
+          expected_distance = std::min(expected_distance, distance);
+        }
+        const bool fixed = std::find(fixed_voxels.begin(), fixed_voxels.end(),
+                                     global_index) != fixed_voxels.end();
+        if (fixed) {
+          expected_distance =
+              tsdf_layer.getVoxelPtrByGlobalIndex(global_index)->distance;
+        }
+        EXPECT_EQ(voxel->fixed, fixed);
+        EXPECT_NEAR(voxel->distance, expected_distance,
+                    kFloatingPointTolerance)
+            << "at " << global_index.transpose();
+        if (!fixed) {
+          const GlobalIndex parent =
+              global_index + voxel->parent.cast<LongIndexElement>();
+          EXPECT_TRUE(std::find(fixed_voxels.begin(), fixed_voxels.end(),
+                                parent) != fixed_voxels.end())
+              << "at " << global_index.transpose();
+        }
+      }
+    }
+  }
+}
+
+TEST(EsdfIntegratorTest, DistanceTransformBatchCutsHalo) {
+  // A single fixed voxel at the start of a row of blocks. With the max
+  // distance, a block and its halo wouldn't fit into the grid of a chunk, so
+  // the halo and with it the max distance are cut.
+  constexpr FloatingPoint kVoxelSize = 0.01;
+  constexpr size_t kVoxelsPerSide = 16u;
+  constexpr IndexElement kNumBlocks = 8;
+  constexpr FloatingPoint kFixedDistance = 0.001;
+  constexpr FloatingPoint kFloatingPointTolerance = 1e-4;
+  Layer<TsdfVoxel> tsdf_layer(kVoxelSize, kVoxelsPerSide);
+  for (IndexElement x = 0; x < kNumBlocks; ++x) {
+    Block<TsdfVoxel>::Ptr block =
+        tsdf_layer.allocateBlockPtrByIndex(BlockIndex(x, 0, 0));
+    for (size_t i = 0u; i < block->num_voxels(); ++i) {
+      TsdfVoxel& voxel = block->getVoxelByLinearIndex(i);
+      voxel.distance = 3.0 * kVoxelSize;
+      voxel.weight = 1.0f;
+    }
+  }
+  tsdf_layer.getVoxelPtrByGlobalIndex(GlobalIndex::Zero())->distance =
+      kFixedDistance;
+
+  Layer<EsdfVoxel> esdf_layer(kVoxelSize, kVoxelsPerSide);
+  EsdfIntegrator::Config esdf_config;
+  esdf_config.distance_transform_batch = true;
+  esdf_config.max_distance_m = 10.0;
+  esdf_config.default_distance_m = 10.0;
+  esdf_config.min_distance_m = kVoxelSize / 2.0;
+  EsdfIntegrator esdf_integrator(esdf_config, &tsdf_layer, &esdf_layer);
+  esdf_integrator.updateFromTsdfLayerBatch();
+
+  // The grid of a chunk has at most 128 voxels per side, so the halo around
+  // a block of 16 voxels is cut to 56.
+  constexpr FloatingPoint kMaxDistance = 56 * kVoxelSize;
+  constexpr IndexElement kNumVoxels =
+      kNumBlocks * static_cast<IndexElement>(kVoxelsPerSide);
+  for (IndexElement x = 1; x < kNumVoxels; ++x) {
+    const EsdfVoxel* voxel =
+        esdf_layer.getVoxelPtrByGlobalIndex(GlobalIndex(x, 0, 0));
+    ASSERT_TRUE(voxel != nullptr);
+    const FloatingPoint distance = x * kVoxelSize + kFixedDistance;
+    const FloatingPoint expected_distance =
+        distance <= kMaxDistance ? distance : esdf_config.default_distance_m;
+    EXPECT_NEAR(voxel->distance, expected_distance, kFloatingPointTolerance)
+        << "at " << x;
+  }
+}
+
+TEST(EsdfIntegratorTest, BenchmarkDistanceTransformBatch) {
+  // A sphere in the middle of a cube of blocks, all voxels observed.
+  constexpr FloatingPoint kVoxelSize = 0.05;
+  constexpr size_t kVoxelsPerSide = 16u;
+  constexpr IndexElement kNumBlocks = 6;
+  constexpr FloatingPoint kTruncationDistance = 4.0 * kVoxelSize;
+  constexpr size_t kNumThreads = 4u;
+  constexpr size_t kNumRuns = 3u;
+  Layer<TsdfVoxel> tsdf_layer(kVoxelSize, kVoxelsPerSide);
+  const FloatingPoint block_size = tsdf_layer.block_size();
+  const Point center = Point::Constant(kNumBlocks * block_size / 2.0);
+  const FloatingPoint radius = kNumBlocks * block_size / 4.0;
+  for (IndexElement x = 0; x < kNumBlocks; ++x) {
+    for (IndexElement y = 0; y < kNumBlocks; ++y) {
+      for (IndexElement z = 0; z < kNumBlocks; ++z) {
+        Block<TsdfVoxel>::Ptr block =
+            tsdf_layer.allocateBlockPtrByIndex(BlockIndex(x, y, z));
+        for (size_t i = 0u; i < block->num_voxels(); ++i) {
+          TsdfVoxel& voxel = block->getVoxelByLinearIndex(i);
+          const FloatingPoint distance =
+              (block->computeCoordinatesFromLinearIndex(i) - center).norm() -
+              radius;
+          voxel.distance = std::max(-kTruncationDistance,
+                                    std::min(kTruncationDistance, distance));
+          voxel.weight = 1.0f;
+        }
+      }
+    }
+  }
+
+  EsdfIntegrator::Config esdf_config;
+  esdf_config.max_distance_m = 2.0;
+  esdf_config.default_distance_m = 2.0;
+  esdf_config.min_distance_m = kTruncationDistance / 2.0;
+  esdf_config.full_euclidean_distance = true;
+  Layer<EsdfVoxel> batch_layer(kVoxelSize, kVoxelsPerSide);
+  EsdfIntegrator batch_integrator(esdf_config, &tsdf_layer, &batch_layer);
+  esdf_config.distance_transform_batch = true;
+  Layer<EsdfVoxel> transform_layer(kVoxelSize, kVoxelsPerSide);
+  EsdfIntegrator transform_integrator(esdf_config, &tsdf_layer,
+                                      &transform_layer);
+  esdf_config.integrator_threads = kNumThreads;
+  Layer<EsdfVoxel> parallel_transform_layer(kVoxelSize, kVoxelsPerSide);
+  EsdfIntegrator parallel_transform_integrator(esdf_config, &tsdf_layer,
+                                               &parallel_transform_layer);
+
+  for (size_t run = 0u; run < kNumRuns; ++run) {
+    timing::Timer batch_timer("benchmark/esdf_batch_propagation");
+    batch_integrator.updateFromTsdfLayerBatch();
+    batch_timer.Stop();
+
+    timing::Timer transform_timer("benchmark/esdf_batch_distance_transform");
+    transform_integrator.updateFromTsdfLayerBatch();
+    transform_timer.Stop();
+
+    timing::Timer parallel_transform_timer(
+        "benchmark/esdf_batch_distance_transform_parallel");
+    parallel_transform_integrator.updateFromTsdfLayerBatch();
+    parallel_transform_timer.Stop();
+  }
+
+  utils::VoxelEvaluationDetails transform_result, parallel_transform_result;
+  utils::evaluateLayersRmse(batch_layer, transform_layer,
+                            utils::VoxelEvaluationMode::kEvaluateAllVoxels,
+                            &transform_result);
+  utils::evaluateLayersRmse(transform_layer, parallel_transform_layer,
+                            utils::VoxelEvaluationMode::kEvaluateAllVoxels,
+                            &parallel_transform_result);
+  std::cout << "Distance Transform vs Propagation: "
+            << transform_result.toString();
+  EXPECT_EQ(transform_result.num_overlapping_voxels,
+            batch_layer.getNumberOfAllocatedBlocks() *
+                batch_layer.getBlockByIndex(BlockIndex::Zero()).num_voxels());
+  EXPECT_LT(transform_result.rmse, kVoxelSize);
+  EXPECT_EQ(parallel_transform_result.max_error, 0.0);
+}
+
+TEST(EsdfIntegratorTest, WindowedUpdates) {
+  // Planes at the start of every block along x, so the distances inside a
+  // block only depend on the block and its neighbors.
+  constexpr FloatingPoint kVoxelSize = 0.1;
+  constexpr size_t kVoxelsPerSide = 8u;
+  constexpr IndexElement kNumBlocksX = 12;
+  constexpr IndexElement kNumBlocksYZ = 3;
+  constexpr FloatingPoint kTruncationDistance = 0.3;
+  constexpr FloatingPoint kFloatingPointTolerance = 1e-4;
+  Layer<TsdfVoxel> tsdf_layer(kVoxelSize, kVoxelsPerSide);
+  for (IndexElement x = 0; x < kNumBlocksX; ++x) {
+    for (IndexElement y = 0; y < kNumBlocksYZ; ++y) {
+      for (IndexElement z = 0; z < kNumBlocksYZ; ++z) {
+        Block<TsdfVoxel>::Ptr block =
+            tsdf_layer.allocateBlockPtrByIndex(BlockIndex(x, y, z));
+        for (size_t i = 0u; i < block->num_voxels(); ++i) {
+          TsdfVoxel& voxel = block->getVoxelByLinearIndex(i);
+          const bool on_plane =
+              block->computeVoxelIndexFromLinearIndex(i).x() == 0;
+          voxel.distance = on_plane ? 0.0f : kTruncationDistance;
+          voxel.weight = 1.0f;
+        }
+        block->updated().set();
+      }
+    }
+  }
+
+  EsdfIntegrator::Config esdf_config;
+  esdf_config.max_distance_m = 2.0;
+  esdf_config.default_distance_m = 2.0;
+  esdf_config.min_distance_m = kVoxelSize / 2.0;
+  esdf_config.min_diff_m = 0.0;
+  Layer<EsdfVoxel> full_layer(kVoxelSize, kVoxelsPerSide);
+  EsdfIntegrator full_integrator(esdf_config, &tsdf_layer, &full_layer);
+  full_integrator.updateFromTsdfLayerBatch();
+
+  esdf_config.window_half_size_m = kVoxelSize * kVoxelsPerSide;
+  Layer<EsdfVoxel> window_layer(kVoxelSize, kVoxelsPerSide);
+  EsdfIntegrator window_integrator(esdf_config, &tsdf_layer, &window_layer);
+  const FloatingPoint block_size = window_layer.block_size();
+  for (const IndexElement center_x : {2, 3, 7}) {
+    const BlockIndex center(center_x, 1, 1);
+    window_integrator.setWindowCenter(
+        (center.cast<FloatingPoint>() + Point::Constant(0.5)) * block_size);
+    constexpr bool kClearUpdatedFlag = true;
+    window_integrator.updateFromTsdfLayer(kClearUpdatedFlag);
+
+    // Only the blocks one block around the center are left.
+    BlockIndexList window_blocks;
+    window_layer.getAllAllocatedBlocks(&window_blocks);
+    EXPECT_EQ(window_blocks.size(), 3u * 3u * 3u);
+    for (const BlockIndex& block_index : window_blocks) {
+      EXPECT_TRUE(window_integrator.isBlockInWindow(block_index));
+      EXPECT_LE((block_index - center).cwiseAbs().maxCoeff(), 1);
+    }
+
+    // The blocks inside the window match the update of the whole map.
+    const Block<EsdfVoxel>& window_block = window_layer.getBlockByIndex(center);
+    const Block<EsdfVoxel>& full_block = full_layer.getBlockByIndex(center);
+    for (size_t i = 0u; i < window_block.num_voxels(); ++i) {
+      EXPECT_TRUE(window_block.getVoxelByLinearIndex(i).observed);
+      EXPECT_NEAR(window_block.getVoxelByLinearIndex(i).distance,
+                  full_block.getVoxelByLinearIndex(i).distance,
+                  kFloatingPointTolerance);
+    }
+  }
+
+  // The flags of the blocks outside of the window are left for later.
+  BlockIndexList tsdf_blocks;
+  tsdf_layer.getAllAllocatedBlocks(&tsdf_blocks);
+  for (const BlockIndex& block_index : tsdf_blocks) {
+    const bool was_in_window =
+        (block_index.x() >= 1 && block_index.x() <= 4) ||
+        (block_index.x() >= 6 && block_index.x() <= 8);
+    EXPECT_EQ(tsdf_layer.getBlockByIndex(block_index).updated()[Update::kEsdf],
+              !was_in_window)
+        << "at " << block_index.transpose();
+  }
+}
+
+TEST(EsdfIntegratorTest, UpdateFromSnapshot) {
+  // A plane at the start of every block along x, as in WindowedUpdates.
+  constexpr FloatingPoint kVoxelSize = 0.1;
+  constexpr size_t kVoxelsPerSide = 8u;
+  constexpr IndexElement kNumBlocksX = 4;
+  constexpr IndexElement kNumBlocksYZ = 2;
+  constexpr FloatingPoint kTruncationDistance = 0.3;
+  Layer<TsdfVoxel> tsdf_layer(kVoxelSize, kVoxelsPerSide);
+  for (IndexElement x = 0; x < kNumBlocksX; ++x) {
+    for (IndexElement y = 0; y < kNumBlocksYZ; ++y) {
+      for (IndexElement z = 0; z < kNumBlocksYZ; ++z) {
+        Block<TsdfVoxel>::Ptr block =
+            tsdf_layer.allocateBlockPtrByIndex(BlockIndex(x, y, z));
+        for (size_t i = 0u; i < block->num_voxels(); ++i) {
+          TsdfVoxel& voxel = block->getVoxelByLinearIndex(i);
+          const bool on_plane =
+              block->computeVoxelIndexFromLinearIndex(i).x() == 0;
+          voxel.distance = on_plane ? 0.0f : kTruncationDistance;
+          voxel.weight = 1.0f;
+        }
+        block->setAllVoxelsUpdated();
+      }
+    }
+  }
+
+  EsdfIntegrator::Config esdf_config;
+  esdf_config.max_distance_m = 2.0;
+  esdf_config.default_distance_m = 2.0;
+  esdf_config.min_distance_m = kVoxelSize / 2.0;
+  esdf_config.min_diff_m = 0.0;
+  Layer<EsdfVoxel> live_esdf_layer(kVoxelSize, kVoxelsPerSide);
+  EsdfIntegrator live_integrator(esdf_config, &tsdf_layer, &live_esdf_layer);
+  constexpr bool kClearUpdatedFlag = true;
+  live_integrator.updateFromTsdfLayer(!kClearUpdatedFlag);
+
+  // Take over the flags from the layer, then change the layer, as the
+  // integration would while the ESDF is updated from the snapshot.
+  Layer<TsdfVoxel>::Ptr tsdf_snapshot = tsdf_layer.getSnapshot();
+  BlockIndexList updated_blocks;
+  tsdf_layer.getAllUpdatedBlocks(Update::kEsdf, &updated_blocks);
+  EXPECT_EQ(updated_blocks.size(),
+            static_cast<size_t>(kNumBlocksX * kNumBlocksYZ * kNumBlocksYZ));
+  for (const BlockIndex& block_index : updated_blocks) {
+    tsdf_layer.resetUpdated(block_index, Update::kEsdf);
+  }
+  const BlockIndex changed_block_index(1, 0, 0);
+  const VoxelIndex changed_voxel_index(4, 4, 4);
+  Block<TsdfVoxel>::Ptr changed_block =
+      tsdf_layer.getBlockPtrByIndex(changed_block_index);
+  changed_block->getVoxelByVoxelIndex(changed_voxel_index).distance = 0.0f;
+  changed_block->setVoxelUpdated(changed_voxel_index);
+
+  Layer<EsdfVoxel> snapshot_esdf_layer(kVoxelSize, kVoxelsPerSide);
+  EsdfIntegrator snapshot_integrator(esdf_config, &tsdf_layer,
+                                     &snapshot_esdf_layer);
+  snapshot_integrator.setTsdfLayer(tsdf_snapshot.get());
+  snapshot_integrator.updateFromTsdfLayer(kClearUpdatedFlag);
+
+  // The snapshot gives the ESDF of the layer before the change, and its
+  // flags are cleared without touching the ones of the layer.
+  BlockIndexList blocks;
+  live_esdf_layer.getAllAllocatedBlocks(&blocks);
+  ASSERT_EQ(blocks.size(), snapshot_esdf_layer.getNumberOfAllocatedBlocks());
+  for (const BlockIndex& block_index : blocks) {
+    const Block<EsdfVoxel>& live_block =
+        live_esdf_layer.getBlockByIndex(block_index);
+    const Block<EsdfVoxel>& snapshot_block =
+        snapshot_esdf_layer.getBlockByIndex(block_index);
+    for (size_t i = 0u; i < live_block.num_voxels(); ++i) {
+      EXPECT_EQ(live_block.getVoxelByLinearIndex(i).distance,
+                snapshot_block.getVoxelByLinearIndex(i).distance);
+    }
+  }
+  tsdf_snapshot->getAllUpdatedBlocks(Update::kEsdf, &updated_blocks);
+  EXPECT_TRUE(updated_blocks.empty());
+  tsdf_layer.getAllUpdatedBlocks(Update::kEsdf, &updated_blocks);
+  ASSERT_EQ(updated_blocks.size(), 1u);
+  EXPECT_EQ(updated_blocks.front(), changed_block_index);
+
+  // Reading the snapshot didn't copy the blocks it shares with the layer.
+  const Layer<TsdfVoxel>& const_tsdf_layer = tsdf_layer;
+  const Layer<TsdfVoxel>& const_tsdf_snapshot = *tsdf_snapshot;
+  tsdf_layer.getAllAllocatedBlocks(&blocks);
+  for (const BlockIndex& block_index : blocks) {
+    EXPECT_EQ(const_tsdf_layer.getBlockPtrByIndex(block_index) ==
+                  const_tsdf_snapshot.getBlockPtrByIndex(block_index),
+              block_index != changed_block_index);
+  }
+
+  // Back on the layer, the next update picks up the change.
+  snapshot_integrator.setTsdfLayer(&tsdf_layer);
+  snapshot_integrator.updateFromTsdfLayer(kClearUpdatedFlag);
+  tsdf_layer.getAllUpdatedBlocks(Update::kEsdf, &updated_blocks);
+  EXPECT_TRUE(updated_blocks.empty());
+  const EsdfVoxel& changed_voxel =
+      snapshot_esdf_layer.getBlockByIndex(changed_block_index)
+          .getVoxelByVoxelIndex(changed_voxel_index);
+  EXPECT_TRUE(changed_voxel.fixed);
+  EXPECT_EQ(changed_voxel.distance, 0.0f);
+}
+
+TEST(EsdfIntegratorTest, CoarseFarField) {
+  // A plane at x = 0 in a long row of blocks, much longer than the max
+  // distance of the fine ESDF.
+  constexpr FloatingPoint kVoxelSize = 0.1;
+  constexpr size_t kVoxelsPerSide = 8u;
+  constexpr size_t kDownsampling = 2u;
+  constexpr IndexElement kNumBlocksX = 16;
+  constexpr IndexElement kNumBlocksYZ = 2;
+  constexpr FloatingPoint kTruncationDistance = 0.3;
+  constexpr FloatingPoint kFineMaxDistance = 1.0;
+  constexpr FloatingPoint kCoarseMaxDistance = 20.0;
+  Layer<TsdfVoxel> tsdf_layer(kVoxelSize, kVoxelsPerSide);
+  for (IndexElement x = 0; x < kNumBlocksX; ++x) {
+    for (IndexElement y = 0; y < kNumBlocksYZ; ++y) {
+      for (IndexElement z = 0; z < kNumBlocksYZ; ++z) {
+        Block<TsdfVoxel>::Ptr block =
+            tsdf_layer.allocateBlockPtrByIndex(BlockIndex(x, y, z));
+        for (size_t i = 0u; i < block->num_voxels(); ++i) {
+          TsdfVoxel& voxel = block->getVoxelByLinearIndex(i);
+          const bool on_plane =
+              x == 0 && block->computeVoxelIndexFromLinearIndex(i).x() == 0;
+          voxel.distance = on_plane ? 0.0f : kTruncationDistance;
+          voxel.weight = 1.0f;
+        }
+      }
+    }
+  }
+
+  EsdfMap::Config esdf_map_config;
+  esdf_map_config.esdf_voxel_size = kVoxelSize;
+  esdf_map_config.esdf_voxels_per_side = kVoxelsPerSide;
+  esdf_map_config.esdf_coarse_downsampling = kDownsampling;
+  esdf_map_config.esdf_coarse_fallback_distance_m = kFineMaxDistance;
+  EsdfMap esdf_map(esdf_map_config);
+  ASSERT_TRUE(esdf_map.hasCoarseEsdfLayer());
+
+  EsdfIntegrator::Config esdf_config;
+  esdf_config.max_distance_m = kFineMaxDistance;
+  esdf_config.default_distance_m = kFineMaxDistance;
+  esdf_config.min_distance_m = kVoxelSize / 2.0;
+  EsdfIntegrator esdf_integrator(esdf_config, &tsdf_layer,
+                                 esdf_map.getEsdfLayerPtr());
+  esdf_config.max_distance_m = kCoarseMaxDistance;
+  esdf_config.default_distance_m = kCoarseMaxDistance;
+  EsdfCoarseIntegrator coarse_integrator(esdf_config, &tsdf_layer,
+                                         esdf_map.getCoarseEsdfLayerPtr());
+  EXPECT_EQ(coarse_integrator.downsampling(), kDownsampling);
+  esdf_integrator.updateFromTsdfLayerBatch();
+  coarse_integrator.updateFromTsdfLayerBatch();
+
+  // The coarse update consumes its own flags, and only those.
+  tsdf_layer.getBlockByIndex(BlockIndex(5, 1, 1)).setAllVoxelsUpdated();
+  BlockIndexList updated_blocks;
+  tsdf_layer.getAllUpdatedBlocks(Update::kCoarseEsdf, &updated_blocks);
+  EXPECT_EQ(updated_blocks.size(), 1u);
+  coarse_integrator.updateFromTsdfLayer();
+  tsdf_layer.getAllUpdatedBlocks(Update::kCoarseEsdf, &updated_blocks);
+  EXPECT_TRUE(updated_blocks.empty());
+  tsdf_layer.getAllUpdatedBlocks(Update::kEsdf, &updated_blocks);
+  EXPECT_FALSE(updated_blocks.empty());
+
+  // Every coarse block covers kDownsampling^3 fine blocks.
+  EXPECT_EQ(
+      esdf_map.getCoarseEsdfLayerConstPtr()->getNumberOfAllocatedBlocks() *
+          kDownsampling * kDownsampling * kDownsampling,
+      esdf_map.getEsdfLayer().getNumberOfAllocatedBlocks());
+
+  // Near the plane the distances come from the fine layer, further away
+  // from the coarse one, which is off by at most a coarse voxel.
+  const double coarse_voxel_size = kDownsampling * kVoxelSize;
+  const double plane_x = kVoxelSize / 2.0;
+  const double max_x = kNumBlocksX * kVoxelsPerSide * kVoxelSize - 1.0;
+  for (double x = plane_x + 0.25; x < max_x; x += 0.25) {
+    const Eigen::Vector3d position(x, kVoxelsPerSide * kVoxelSize,
+                                   kVoxelsPerSide * kVoxelSize);
+    double distance = 0.0;
+    ASSERT_TRUE(esdf_map.getDistanceAtPosition(position, &distance))
+        << "at " << x;
+    EXPECT_TRUE(esdf_map.isObserved(position));
+    const double tolerance =
+        x - plane_x < kFineMaxDistance - kVoxelSize ? 1e-4 : coarse_voxel_size;
+    EXPECT_NEAR(distance, x - plane_x, tolerance) << "at " << x;
+
+    double gradient_distance = 0.0;
+    Eigen::Vector3d gradient;
+    EXPECT_TRUE(esdf_map.getDistanceAndGradientAtPosition(
+        position, &gradient_distance, &gradient));
+    EXPECT_NEAR(gradient_distance, distance, 1e-6);
+  }
+
+  // The batch queries fall back to the coarse layer the same way.
+  Eigen::Matrix<double, 3, Eigen::Dynamic> positions(3, 0);
+  for (double x = plane_x + 0.25; x < max_x; x += 0.25) {
+    positions.conservativeResize(Eigen::NoChange, positions.cols() + 1);
+    positions.col(positions.cols() - 1) << x, kVoxelsPerSide * kVoxelSize,
+        kVoxelsPerSide * kVoxelSize;
+  }
+  Eigen::VectorXd distances(positions.cols());
+  Eigen::Matrix<double, 3, Eigen::Dynamic> gradients(3, positions.cols());
+  Eigen::VectorXi observed(positions.cols());
+  EsdfMap::EigenDRef<const Eigen::Matrix<double, 3, Eigen::Dynamic>>
+      positions_ref(positions);
+  EsdfMap::EigenDRef<Eigen::Matrix<double, 3, Eigen::Dynamic>> gradients_ref(
+      gradients);
+  esdf_map.setBatchQueryThreads(2u);
+  esdf_map.batchGetDistanceAndGradientAtPosition(positions_ref, distances,
+                                                 gradients_ref, observed);
+  for (int i = 0; i < positions.cols(); ++i) {
+    double distance = 0.0;
+    Eigen::Vector3d gradient;
+    ASSERT_EQ(observed[i] != 0, esdf_map.getDistanceAndGradientAtPosition(
+                                    positions.col(i), &distance, &gradient));
+    EXPECT_NEAR(distances[i], distance, 1e-4);
+    EXPECT_NEAR((gradients.col(i) - gradient).norm(), 0.0, 1e-4);
+  }
+}
+
+TEST(EsdfOccIntegratorTest, IncrementalMatchesBatch) {
+  constexpr FloatingPoint kVoxelSize = 0.1;
+  constexpr size_t kVoxelsPerSide = 8u;
+  constexpr IndexElement kNumBlocks = 3;
+  constexpr LongIndexElement kNumVoxels = kNumBlocks * kVoxelsPerSide;
+  Layer<OccupancyVoxel> occ_layer(kVoxelSize, kVoxelsPerSide);
+  for (IndexElement x = 0; x < kNumBlocks; ++x) {
+    for (IndexElement y = 0; y < kNumBlocks; ++y) {
+      for (IndexElement z = 0; z < kNumBlocks; ++z) {
+        Block<OccupancyVoxel>::Ptr block =
+            occ_layer.allocateBlockPtrByIndex(BlockIndex(x, y, z));
+        for (size_t i = 0u; i < block->num_voxels(); ++i) {
+          OccupancyVoxel& voxel = block->getVoxelByLinearIndex(i);
+          voxel.probability_log = -1.0f;
+          voxel.observed = true;
+        }
+        block->setAllVoxelsUpdated();
+      }
+    }
+  }
+  auto set_occupied = [&occ_layer](const GlobalIndex& global_index,
+                                   bool occupied) {
+    BlockIndex block_index;
+    VoxelIndex voxel_index;
+    getBlockAndVoxelIndexFromGlobalVoxelIndex(global_index, kVoxelsPerSide,
+                                              &block_index, &voxel_index);
+    Block<OccupancyVoxel>::Ptr block =
+        occ_layer.getBlockPtrByIndex(block_index);
+    block->getVoxelByVoxelIndex(voxel_index).probability_log =
+        occupied ? 1.0f : -1.0f;
+    block->setVoxelUpdated(voxel_index);
+  };
+  // A wall, and a pillar that is removed again later.
+  for (LongIndexElement y = 0; y < kNumVoxels; ++y) {
+    for (LongIndexElement z = 0; z < kNumVoxels; ++z) {
+      set_occupied(GlobalIndex(3, y, z), true);
+    }
+  }
+  const GlobalIndex pillar(15, 12, 0);
+  for (LongIndexElement z = 0; z < kNumVoxels; ++z) {
+    set_occupied(pillar + GlobalIndex(0, 0, z), true);
+  }
+
+  EsdfOccIntegrator::Config config;
+  config.max_distance_m = 1.5;
+  config.default_distance_m = 1.5;
+  Layer<EsdfVoxel> incremental_layer(kVoxelSize, kVoxelsPerSide);
+  Layer<EsdfVoxel> parallel_layer(kVoxelSize, kVoxelsPerSide);
+  EsdfOccIntegrator incremental_integrator(config, &occ_layer,
+                                           &incremental_layer);
+  config.integrator_threads = 4u;
+  EsdfOccIntegrator parallel_integrator(config, &occ_layer, &parallel_layer);
+
+  auto update = [&]() {
+    constexpr bool kClearUpdatedFlag = true;
+    parallel_integrator.updateFromOccLayer(!kClearUpdatedFlag);
+    incremental_integrator.updateFromOccLayer(kClearUpdatedFlag);
+  };
+  auto expect_matches_batch = [&]() {
+    Layer<EsdfVoxel> batch_layer(kVoxelSize, kVoxelsPerSide);
+    EsdfOccIntegrator::Config batch_config = config;
+    batch_config.integrator_threads = 1u;
+    EsdfOccIntegrator batch_integrator(batch_config, &occ_layer, &batch_layer);
+    batch_integrator.updateFromOccLayerBatch();
+
+    BlockIndexList blocks;
+    batch_layer.getAllAllocatedBlocks(&blocks);
+    ASSERT_EQ(blocks.size(), incremental_layer.getNumberOfAllocatedBlocks());
+    size_t num_compared = 0u;
+    for (const BlockIndex& block_index : blocks) {
+      const Block<EsdfVoxel>& batch_block =
+          batch_layer.getBlockByIndex(block_index);
+      const Block<EsdfVoxel>& incremental_block =
+          incremental_layer.getBlockByIndex(block_index);
+      const Block<EsdfVoxel>& parallel_block =
+          parallel_layer.getBlockByIndex(block_index);
+      for (size_t i = 0u; i < batch_block.num_voxels(); ++i) {
+        const EsdfVoxel& expected = batch_block.getVoxelByLinearIndex(i);
+        // Voxels beyond the max distance keep whatever they had.
+        if (expected.distance >= config.max_distance_m - kVoxelSize) {
+          continue;
+        }
+        ASSERT_TRUE(incremental_block.getVoxelByLinearIndex(i).observed);
+        EXPECT_EQ(expected.fixed,
+                  incremental_block.getVoxelByLinearIndex(i).fixed);
+        EXPECT_NEAR(expected.distance,
+                    incremental_block.getVoxelByLinearIndex(i).distance, 1e-4);
+        EXPECT_NEAR(expected.distance,
+                    parallel_block.getVoxelByLinearIndex(i).distance, 1e-4);
+        ++num_compared;
+      }
+    }
+    EXPECT_GT(num_compared, 0u);
+  };
+
+  update();
+  expect_matches_batch();
+
+  // Removing the pillar raises the distances around it.
+  for (LongIndexElement z = 0; z < kNumVoxels; ++z) {
+    set_occupied(pillar + GlobalIndex(0, 0, z), false);
+  }
+  update();
+  expect_matches_batch();
+
+  // Adding it back one voxel over lowers them again.
+  for (LongIndexElement z = 0; z < kNumVoxels; ++z) {
+    set_occupied(pillar + GlobalIndex(1, 0, z), true);
+  }
+  update();
+  expect_matches_batch();
+}
+
 INSTANTIATE_TEST_CASE_P(VoxelSizes, SdfIntegratorsTest,
                         ::testing::Values(0.1f, 0.2f, 0.3f, 0.4f, 0.5f));
 
@@ -0,0 +1,108 @@
+#include <atomic>
+#include <iostream>
+#include <list>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "voxblox/utils/thread_pool.h"
+#include "voxblox/utils/timing.h"
+
+using namespace voxblox;  // NOLINT
+
+TEST(ThreadPoolTest, RunsEveryRound) {
+  constexpr size_t kNumThreads = 4u;
+  constexpr size_t kNumRounds = 1000u;
+  ThreadPool thread_pool(kNumThreads);
+  EXPECT_EQ(thread_pool.num_threads(), kNumThreads);
+
+  std::vector<int> values(64u, 0);
+  for (size_t round = 0u; round < kNumRounds; ++round) {
+    // Every round depends on the previous one being finished.
+    std::atomic<size_t> next_index(0u);
+    thread_pool.run([&values, &next_index, round]() {
+      size_t i;
+      while ((i = next_index++) < values.size()) {
+        EXPECT_EQ(values[i], static_cast<int>(round));
+        ++values[i];
+      }
+    });
+  }
+  for (const int value : values) {
+    EXPECT_EQ(value, static_cast<int>(kNumRounds));
+  }
+}
+
+TEST(ThreadPoolTest, LimitsThreads) {
+  ThreadPool thread_pool(4u);
+  for (size_t max_threads = 0u; max_threads <= 6u; ++max_threads) {
+    std::atomic<size_t> num_calls(0u);
+    thread_pool.run([&num_calls]() { ++num_calls; }, max_threads);
+    EXPECT_EQ(num_calls, std::min<size_t>(std::max<size_t>(max_threads, 1u),
+                                          thread_pool.num_threads()));
+  }
+
+  // Without other threads the caller runs everything.
+  ThreadPool single_thread_pool(1u);
+  const std::thread::id caller_id = std::this_thread::get_id();
+  single_thread_pool.run(
+      [caller_id]() { EXPECT_EQ(std::this_thread::get_id(), caller_id); });
+}
+
+TEST(ThreadPoolTest, ConcurrentRuns) {
+  ThreadPool thread_pool(3u);
+  std::atomic<size_t> num_calls(0u);
+  std::list<std::thread> callers;
+  for (size_t i = 0u; i < 4u; ++i) {
+    callers.emplace_back([&thread_pool, &num_calls]() {
+      for (size_t round = 0u; round < 100u; ++round) {
+        thread_pool.run([&num_calls]() { ++num_calls; });
+      }
+    });
+  }
+  for (std::thread& caller : callers) {
+    caller.join();
+  }
+  EXPECT_EQ(num_calls, 4u * 100u * thread_pool.num_threads());
+}
+
+TEST(ThreadPoolTest, BenchmarkRounds) {
+  constexpr size_t kNumThreads = 4u;
+  constexpr size_t kNumRounds = 2000u;
+  std::atomic<size_t> num_calls(0u);
+  const auto count = [&num_calls]() { ++num_calls; };
+
+  timing::Timer threads_timer("rounds/new_threads");
+  for (size_t round = 0u; round < kNumRounds; ++round) {
+    std::list<std::thread> threads;
+    for (size_t i = 1u; i < kNumThreads; ++i) {
+      threads.emplace_back(count);
+    }
+    count();
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+  }
+  threads_timer.Stop();
+
+  timing::Timer pool_timer("rounds/thread_pool");
+  ThreadPool thread_pool(kNumThreads);
+  for (size_t round = 0u; round < kNumRounds; ++round) {
+    thread_pool.run(count);
+  }
+  pool_timer.Stop();
+
+  EXPECT_EQ(num_calls, 2u * kNumRounds * kNumThreads);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  google::InitGoogleLogging(argv[0]);
+
+  int result = RUN_ALL_TESTS();
+
+  timing::Timing::Print(std::cout);
+
+  return result;
+}
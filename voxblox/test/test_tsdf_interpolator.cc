@@ -1,3 +1,6 @@
+#include <cmath>
+#include <vector>
+
 #include <eigen-checks/entrypoint.h>
 #include <eigen-checks/gtest.h>
 #include <gtest/gtest.h>
@@ -166,6 +169,152 @@ TEST_F(TsdfMergeIntegratorTest, BetweenBlocks) {
   }
 }
 
+TEST_F(TsdfMergeIntegratorTest, BatchMatchesSingleQueries) {
+  Layer<TsdfVoxel> tsdf_layer(tsdf_voxel_size_, tsdf_voxels_per_side_);
+  for (int x = -1; x <= 1; ++x) {
+    for (int y = 0; y <= 1; ++y) {
+      Block<TsdfVoxel>::Ptr block_ptr =
+          tsdf_layer.allocateBlockPtrByIndex(BlockIndex(x, y, 0));
+      for (size_t i = 0u; i < block_ptr->num_voxels(); ++i) {
+        const Point center = block_ptr->computeCoordinatesFromLinearIndex(i);
+        TsdfVoxel& voxel = block_ptr->getVoxelByLinearIndex(i);
+        voxel.distance =
+            std::sin(0.3 * center.x()) + 0.1 * center.y() * center.z();
+        // Leave some holes the queries have to fail at.
+        voxel.weight = (i % 97u == 0u) ? 0.0f : 1.0f;
+      }
+    }
+  }
+  Interpolator<TsdfVoxel> interpolator(&tsdf_layer);
+
+  // Queries all over the blocks and a bit outside, in no particular order.
+  Pointcloud positions;
+  const FloatingPoint extent = tsdf_voxels_per_side_ * tsdf_voxel_size_;
+  for (size_t i = 0u; i < 5000u; ++i) {
+    positions.emplace_back(
+        -1.2 * extent + std::fmod(i * 0.731f, 3.4f * extent),
+        -0.2 * extent + std::fmod(i * 0.377f, 2.4f * extent),
+        -0.2 * extent + std::fmod(i * 0.193f, 1.4f * extent));
+  }
+
+  for (size_t num_threads = 1u; num_threads <= 3u; num_threads += 2u) {
+    std::vector<FloatingPoint> distances;
+    Pointcloud gradients;
+    std::vector<uint8_t> success;
+    interpolator.batchGetDistanceAndGradient(positions, &distances, &gradients,
+                                             &success, num_threads);
+    std::vector<FloatingPoint> distances_only;
+    std::vector<uint8_t> distances_only_success;
+    interpolator.batchGetDistanceAndGradient(positions, &distances_only,
+                                             nullptr, &distances_only_success,
+                                             num_threads);
+    ASSERT_EQ(success.size(), positions.size());
+
+    size_t num_succeeded = 0u;
+    for (size_t i = 0u; i < positions.size(); ++i) {
+      constexpr bool kInterpolate = true;
+      FloatingPoint distance;
+      const bool has_distance =
+          interpolator.getDistance(positions[i], &distance, kInterpolate);
+      ASSERT_EQ(has_distance, distances_only_success[i] != 0u);
+      if (has_distance) {
+        EXPECT_NEAR(distance, distances_only[i], 1e-4);
+      }
+      Point gradient;
+      const bool has_gradient =
+          has_distance &&
+          interpolator.getGradient(positions[i], &gradient, kInterpolate);
+      ASSERT_EQ(has_gradient, success[i] != 0u);
+      if (has_gradient) {
+        EXPECT_NEAR(distance, distances[i], 1e-4);
+        EXPECT_TRUE(EIGEN_MATRIX_NEAR(gradient, gradients[i], 1e-4));
+
+        // The single query defaults to the same gradient method.
+        FloatingPoint single_distance;
+        Point single_gradient;
+        ASSERT_TRUE(interpolator.getDistanceAndGradient(
+            positions[i], &single_distance, &single_gradient));
+        EXPECT_NEAR(single_distance, distances[i], 1e-4);
+        EXPECT_TRUE(EIGEN_MATRIX_NEAR(single_gradient, gradients[i], 1e-4));
+        ++num_succeeded;
+      }
+    }
+    EXPECT_GT(num_succeeded, positions.size() / 10u);
+  }
+}
+
+TEST_F(TsdfMergeIntegratorTest, AnalyticGradients) {
+  Layer<TsdfVoxel> linear_layer(tsdf_voxel_size_, tsdf_voxels_per_side_);
+  Layer<TsdfVoxel> smooth_layer(tsdf_voxel_size_, tsdf_voxels_per_side_);
+  const Point linear_gradient(0.3, -0.2, 0.6);
+  for (int x = 0; x <= 1; ++x) {
+    const BlockIndex block_index(x, 0, 0);
+    Block<TsdfVoxel>::Ptr linear_block =
+        linear_layer.allocateBlockPtrByIndex(block_index);
+    Block<TsdfVoxel>::Ptr smooth_block =
+        smooth_layer.allocateBlockPtrByIndex(block_index);
+    for (size_t i = 0u; i < linear_block->num_voxels(); ++i) {
+      const Point center = linear_block->computeCoordinatesFromLinearIndex(i);
+      TsdfVoxel& linear_voxel = linear_block->getVoxelByLinearIndex(i);
+      linear_voxel.distance = linear_gradient.dot(center) - 1.0f;
+      linear_voxel.weight = 1.0f;
+      TsdfVoxel& smooth_voxel = smooth_block->getVoxelByLinearIndex(i);
+      smooth_voxel.distance = std::sin(0.4 * center.x()) * center.y();
+      smooth_voxel.weight = 1.0f;
+    }
+  }
+  Interpolator<TsdfVoxel> linear_interpolator(&linear_layer);
+  Interpolator<TsdfVoxel> smooth_interpolator(&smooth_layer);
+
+  // Both methods are exact for linear distances, also across blocks.
+  for (float x = 1.5f; x < 18.5f; x += 0.37f) {
+    const Point point(x, 4.3f, 5.8f);
+    for (const GradientMethod method :
+         {GradientMethod::kTrilinear, GradientMethod::kTricubic}) {
+      FloatingPoint distance;
+      Point gradient;
+      ASSERT_TRUE(linear_interpolator.getDistanceAndGradient(
+          point, &distance, &gradient, method));
+      EXPECT_NEAR(distance, linear_gradient.dot(point) - 1.0f, 1e-4);
+      EXPECT_TRUE(EIGEN_MATRIX_NEAR(gradient, linear_gradient, 1e-4));
+    }
+  }
+
+  // The trilinear gradient is the derivative of the trilinear distance
+  // inside a voxel, the tricubic one is continuous across voxels.
+  constexpr FloatingPoint kStep = 1e-2;
+  for (float x = 2.501f; x < 17.0f; x += 1.0f) {
+    const Point point(x, 4.3f, 5.7f);
+    FloatingPoint distance;
+    Point gradient;
+    ASSERT_TRUE(smooth_interpolator.getDistanceAndGradient(
+        point, &distance, &gradient, GradientMethod::kTrilinear));
+    constexpr bool kInterpolate = true;
+    FloatingPoint interpolated_distance;
+    ASSERT_TRUE(smooth_interpolator.getDistance(point, &interpolated_distance,
+                                                kInterpolate));
+    EXPECT_NEAR(distance, interpolated_distance, 1e-4);
+    for (unsigned int i = 0u; i < 3u; ++i) {
+      Point offset = Point::Zero();
+      offset(i) = kStep;
+      FloatingPoint distance_plus;
+      ASSERT_TRUE(smooth_interpolator.getDistance(
+          point + offset, &distance_plus, kInterpolate));
+      EXPECT_NEAR(gradient(i), (distance_plus - distance) / kStep, 1e-2);
+    }
+
+    // x is just past the voxel centers the interpolation cells end at.
+    Point gradient_before;
+    Point gradient_after;
+    ASSERT_TRUE(smooth_interpolator.getDistanceAndGradient(
+        point - Point(0.002f, 0.0f, 0.0f), &distance, &gradient_before,
+        GradientMethod::kTricubic));
+    ASSERT_TRUE(smooth_interpolator.getDistanceAndGradient(
+        point, &distance, &gradient_after, GradientMethod::kTricubic));
+    EXPECT_TRUE(EIGEN_MATRIX_NEAR(gradient_before, gradient_after, 1e-2));
+  }
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   google::InitGoogleLogging(argv[0]);
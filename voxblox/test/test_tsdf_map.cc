@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <vector>
+
 #include <eigen-checks/entrypoint.h>
 #include <eigen-checks/gtest.h>
 #include <gtest/gtest.h>
@@ -322,6 +325,61 @@ TEST_F(TsdfMapTest, IndexLookups) {
   }
 }
 
+TEST_F(TsdfMapTest, SubBrickUpdateMasks) {
+  Block<TsdfVoxel>::Ptr block =
+      map_->getTsdfLayerPtr()->allocateNewBlock(BlockIndex(0, 0, 0));
+  // With 8 voxels per side, every sub-brick has 2 voxels per side.
+  EXPECT_EQ(2u, block->sub_brick_voxels_per_side());
+  EXPECT_EQ(0u, block->getUpdatedSubBricks(Update::kEsdf));
+
+  block->setVoxelUpdated(VoxelIndex(3, 0, 7));
+  block->setVoxelUpdated(VoxelIndex(2, 1, 6));
+  const Block<TsdfVoxel>::SubBrickMask expected_mask =
+      static_cast<Block<TsdfVoxel>::SubBrickMask>(1u) << (1u + 4u * 4u * 3u);
+  EXPECT_EQ(expected_mask, block->getUpdatedSubBricks(Update::kEsdf));
+  EXPECT_EQ(expected_mask, block->getUpdatedSubBricks(Update::kMesh));
+
+  std::vector<size_t> linear_indices;
+  block->getLinearIndicesOfSubBricks(expected_mask, &linear_indices);
+  ASSERT_EQ(8u, linear_indices.size());
+  EXPECT_TRUE(std::is_sorted(linear_indices.begin(), linear_indices.end()));
+  for (const size_t linear_index : linear_indices) {
+    const VoxelIndex voxel_index =
+        block->computeVoxelIndexFromLinearIndex(linear_index);
+    EXPECT_EQ(1, voxel_index.x() / 2);
+    EXPECT_EQ(0, voxel_index.y() / 2);
+    EXPECT_EQ(3, voxel_index.z() / 2);
+  }
+
+  // Resetting one update type leaves the others untouched.
+  block->resetUpdated(Update::kEsdf);
+  EXPECT_EQ(0u, block->getUpdatedSubBricks(Update::kEsdf));
+  EXPECT_FALSE(block->updated()[Update::kEsdf]);
+  EXPECT_EQ(expected_mask, block->getUpdatedSubBricks(Update::kMesh));
+
+  // Flagging the whole block marks all sub-bricks.
+  block->updated().set(Update::kEsdf);
+  EXPECT_EQ(Block<TsdfVoxel>::kAllSubBricks,
+            block->getUpdatedSubBricks(Update::kEsdf));
+  block->getLinearIndicesOfSubBricks(Block<TsdfVoxel>::kAllSubBricks,
+                                     &linear_indices);
+  ASSERT_EQ(block->num_voxels(), linear_indices.size());
+  for (size_t i = 0u; i < linear_indices.size(); ++i) {
+    EXPECT_EQ(i, linear_indices[i]);
+  }
+
+  // Sub-bricks also cover blocks whose size isn't a multiple of 4.
+  Block<TsdfVoxel> odd_block(6u, config_.tsdf_voxel_size, Point::Zero());
+  odd_block.getLinearIndicesOfSubBricks(Block<TsdfVoxel>::kAllSubBricks,
+                                        &linear_indices);
+  EXPECT_EQ(odd_block.num_voxels(), linear_indices.size());
+  odd_block.setVoxelUpdated(VoxelIndex(5, 5, 5));
+  odd_block.getLinearIndicesOfSubBricks(
+      odd_block.getUpdatedSubBricks(Update::kMap), &linear_indices);
+  ASSERT_EQ(8u, linear_indices.size());
+  EXPECT_EQ(odd_block.num_voxels() - 1u, linear_indices.back());
+}
+
 TEST_F(TsdfMapTest, ComputeBlockIndexFromOriginFromBlockIndexTest) {
   constexpr size_t kBlockVolumeDiameter = 100u;
   constexpr FloatingPoint kBlockSize = 0.32;
@@ -1,10 +1,13 @@
 #ifndef VOXBLOX_ROS_ESDF_SERVER_H_
 #define VOXBLOX_ROS_ESDF_SERVER_H_
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <string>
 
 #include <voxblox/core/esdf_map.h>
+#include <voxblox/integrator/esdf_coarse_integrator.h>
 #include <voxblox/integrator/esdf_integrator.h>
 #include <voxblox_msgs/Layer.h>
 
@@ -23,7 +26,7 @@ class EsdfServer : public TsdfServer {
              const TsdfMap::Config& tsdf_config,
              const TsdfIntegratorBase::Config& tsdf_integrator_config,
              const MeshIntegratorConfig& mesh_config);
-  virtual ~EsdfServer() {}
+  virtual ~EsdfServer() { stopAsyncSpinners(); }
 
   bool generateEsdfCallback(std_srvs::Empty::Request& request,     // NOLINT
                             std_srvs::Empty::Response& response);  // NOLINT
@@ -55,6 +58,13 @@ class EsdfServer : public TsdfServer {
     return esdf_map_;
   }
 
+  /**
+   * Returns a snapshot of the ESDF map, for planning queries that neither
+   * wait for nor see the updates of the map. Use this rather than
+   * getEsdfMapPtr() while the async spinners are running.
+   */
+  EsdfMap::Ptr getEsdfMapSnapshot();
+
   bool getClearSphere() const { return clear_sphere_for_planning_; }
   void setClearSphere(bool clear_sphere_for_planning) {
     clear_sphere_for_planning_ = clear_sphere_for_planning;
@@ -78,6 +88,25 @@ class EsdfServer : public TsdfServer {
   /// constructor.
   void setupRos();
 
+  /// The ESDF layer to publish or save, see getTsdfLayerForReading().
+  std::shared_ptr<const Layer<EsdfVoxel>> getEsdfLayerForReading();
+
+  /// Publish the clouds of the given ESDF layer, see publishPointclouds().
+  void publishAllUpdatedEsdfVoxels(const Layer<EsdfVoxel>& esdf_layer);
+  void publishEsdfSlices(const Layer<EsdfVoxel>& esdf_layer);
+  void publishTraversable(const Layer<EsdfVoxel>& esdf_layer);
+
+  /**
+   * The TSDF layer to update the ESDF from. With the async spinners, a
+   * snapshot that took over the ESDF update flags of the layer, so the
+   * integration can go on during the update, otherwise the layer itself.
+   * Expects esdf_map_mutex_ to be held, so the updates apply in order.
+   */
+  Layer<TsdfVoxel>::Ptr getTsdfLayerForEsdfUpdate();
+
+  /// Points the ESDF integrators at the TSDF layer to update from.
+  void setEsdfIntegratorsTsdfLayer(Layer<TsdfVoxel>* tsdf_layer);
+
   /// Publish markers for visualization.
   ros::Publisher esdf_pointcloud_pub_;
   ros::Publisher esdf_slice_pub_;
@@ -100,11 +129,19 @@ class EsdfServer : public TsdfServer {
   bool publish_traversable_;
   float traversability_radius_;
   bool incremental_update_;
-  int num_subscribers_esdf_map_;
+  std::atomic<int> num_subscribers_esdf_map_;
+
+  /**
+   * Guards the ESDF map and integrators. Held while the TSDF snapshot for an
+   * update is taken, so it is locked before tsdf_map_mutex_.
+   */
+  std::mutex esdf_map_mutex_;
 
   // ESDF maps.
   std::shared_ptr<EsdfMap> esdf_map_;
   std::unique_ptr<EsdfIntegrator> esdf_integrator_;
+  /// Only set if the ESDF map has a coarse far-field layer.
+  std::unique_ptr<EsdfCoarseIntegrator> esdf_coarse_integrator_;
 };
 
 }  // namespace voxblox
@@ -2,6 +2,7 @@
 #define VOXBLOX_ROS_INTENSITY_SERVER_H_
 
 #include <memory>
+#include <mutex>
 
 #include <cv_bridge/cv_bridge.h>
 #include <sensor_msgs/Image.h>
@@ -20,7 +21,7 @@ class IntensityServer : public TsdfServer {
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
   IntensityServer(const ros::NodeHandle& nh, const ros::NodeHandle& nh_private);
-  virtual ~IntensityServer() {}
+  virtual ~IntensityServer() { stopAsyncSpinners(); }
 
   virtual void updateMesh();
   virtual void publishPointclouds();
@@ -47,6 +48,8 @@ class IntensityServer : public TsdfServer {
   // and visualizing intensity data.
   std::shared_ptr<Layer<IntensityVoxel>> intensity_layer_;
   std::unique_ptr<IntensityIntegrator> intensity_integrator_;
+  /// Guards the intensity layer and integrator, locked after the others.
+  std::mutex intensity_layer_mutex_;
 
   // Visualization tools.
   std::shared_ptr<ColorMap> color_map_;
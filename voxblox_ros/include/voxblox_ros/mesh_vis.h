@@ -25,7 +25,11 @@
 #define VOXBLOX_ROS_MESH_VIS_H_
 
 #include <algorithm>
+#include <functional>
 #include <limits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <eigen_conversions/eigen_msg.h>
 #include <visualization_msgs/Marker.h>
@@ -35,6 +39,7 @@
 #include <voxblox/integrator/tsdf_integrator.h>
 #include <voxblox/mesh/mesh.h>
 #include <voxblox/mesh/mesh_layer.h>
+#include <voxblox/mesh/mesh_utils.h>
 #include <voxblox_msgs/Mesh.h>
 
 #include "voxblox_ros/conversions.h"
@@ -150,48 +155,264 @@ inline std_msgs::ColorRGBA getVertexColor(const Mesh::ConstPtr& mesh,
   return color_msg;
 }
 
-inline void generateVoxbloxMeshMsg(MeshLayer* mesh_layer, ColorMode color_mode,
-                                   voxblox_msgs::Mesh* mesh_msg) {
-  CHECK_NOTNULL(mesh_msg);
-  CHECK_NOTNULL(mesh_layer);
+/// Settings of the published mesh messages.
+struct MeshMsgConfig {
+  /**
+   * Blocks at least l * lod_distance away from the viewer are published at
+   * level of detail l, or at their coarsest level. Zero publishes all blocks
+   * at full resolution.
+   */
+  FloatingPoint lod_distance = 0.0f;
+  /**
+   * Bandwidth budget of a mesh message in vertices. Blocks are coarsened,
+   * the furthest ones first, until the message fits. They are refined again
+   * in later messages once the budget allows it. Zero means no limit.
+   */
+  size_t max_vertices_per_message = 0u;
+
+  /// Send the block meshes as unique vertices and indexed triangles.
+  bool use_indexed_triangles = true;
+  /// Send oct-encoded vertex normals instead of recomputing them on receipt.
+  bool send_normals = false;
+
+  /// Whether the levels of detail of the blocks need to be selected.
+  inline bool isLodEnabled() const {
+    return lod_distance > 0.0f || max_vertices_per_message > 0u;
+  }
+};
 
-  mesh_msg->header.stamp = ros::Time::now();
+/// Number of vertices of the mesh in a MeshBlock message.
+inline size_t getNumMeshMsgVertices(const Mesh& mesh) {
+  return mesh.hasTriangles() ? mesh.indices.size() : mesh.vertices.size();
+}
 
-  BlockIndexList mesh_indices;
-  mesh_layer->getAllUpdatedMeshes(&mesh_indices);
+/**
+ * The mesh of the block at the given level of detail, or at its coarsest one
+ * if the block has fewer levels.
+ */
+inline Mesh::ConstPtr getLodMeshPtr(const Mesh::ConstPtr& block_mesh,
+                                    const size_t lod_level) {
+  CHECK(block_mesh);
+  const size_t level = std::min(lod_level, block_mesh->getNumLodLevels() - 1u);
+  return (level == 0u) ? block_mesh : block_mesh->lod_meshes[level - 1u];
+}
 
-  mesh_msg->block_edge_length = mesh_layer->block_size();
-  mesh_msg->mesh_blocks.reserve(mesh_indices.size());
+/// State of the level of detail selection, kept between mesh messages.
+struct MeshLodState {
+  /**
+   * Viewer position at the last selection over all blocks. NaN if there was
+   * none yet.
+   */
+  Point viewer_position =
+      Point::Constant(std::numeric_limits<FloatingPoint>::quiet_NaN());
+  /// Whether that selection coarsened blocks to fit the bandwidth budget.
+  bool has_coarsened_blocks = false;
+};
+
+/**
+ * Selects the blocks to publish and their levels of detail. These are the
+ * updated blocks, and the blocks whose level of detail changed since they
+ * were last published.
+ *
+ * With a lod_state, the levels of the blocks that weren't updated are only
+ * reselected once the viewer moved by half the lod_distance since the last
+ * selection over all blocks, or while blocks that were coarsened to fit the
+ * bandwidth budget wait for their refinement. Their levels are thus at most
+ * one level off, but most messages don't visit all meshes. Without a
+ * lod_state, all blocks are reselected every time.
+ */
+inline void selectMeshLodLevels(const MeshLayer& mesh_layer,
+                                const MeshMsgConfig& msg_config,
+                                const Point& viewer_position,
+                                MeshLodState* lod_state,
+                                BlockIndexList* block_indices,
+                                std::vector<size_t>* lod_levels) {
+  CHECK_NOTNULL(block_indices);
+  CHECK_NOTNULL(lod_levels);
+  block_indices->clear();
+  lod_levels->clear();
+  if (!msg_config.isLodEnabled()) {
+    mesh_layer.getAllUpdatedMeshes(block_indices);
+    lod_levels->resize(block_indices->size(), 0u);
+    return;
+  }
+
+  bool select_all_blocks = true;
+  if (lod_state != nullptr && lod_state->viewer_position.allFinite() &&
+      !lod_state->has_coarsened_blocks) {
+    select_all_blocks =
+        msg_config.lod_distance > 0.0f &&
+        (viewer_position - lod_state->viewer_position).norm() >=
+            0.5f * msg_config.lod_distance;
+  }
 
+  BlockIndexList mesh_indices;
+  if (select_all_blocks) {
+    mesh_layer.getAllAllocatedMeshes(&mesh_indices);
+  } else {
+    mesh_layer.getAllUpdatedMeshes(&mesh_indices);
+  }
+  std::vector<Mesh::ConstPtr> meshes;
+  std::vector<std::pair<FloatingPoint, size_t> > distances;
+  std::vector<size_t> levels;
   for (const BlockIndex& block_index : mesh_indices) {
-    Mesh::Ptr mesh = mesh_layer->getMeshPtrByIndex(block_index);
+    Mesh::ConstPtr mesh = mesh_layer.getMeshPtrByIndex(block_index);
+    const Point block_center =
+        mesh_layer.block_size() *
+        (block_index.cast<FloatingPoint>() + Point::Constant(0.5f));
+    const FloatingPoint distance = (block_center - viewer_position).norm();
+    size_t level = 0u;
+    if (msg_config.lod_distance > 0.0f) {
+      level = std::min(
+          static_cast<size_t>(distance / msg_config.lod_distance),
+          mesh->getNumLodLevels() - 1u);
+    }
+    distances.emplace_back(distance, meshes.size());
+    meshes.push_back(mesh);
+    levels.push_back(level);
+  }
 
-    voxblox_msgs::MeshBlock mesh_block;
-    mesh_block.index[0] = block_index.x();
-    mesh_block.index[1] = block_index.y();
-    mesh_block.index[2] = block_index.z();
+  // Vertices a block adds to the message. Blocks that are neither updated
+  // nor change their level aren't sent.
+  auto get_num_vertices = [&meshes, &levels](const size_t i) -> size_t {
+    const Mesh& mesh = *meshes[i];
+    if (!mesh.updated && levels[i] == mesh.lod_level) {
+      return 0u;
+    }
+    return getNumMeshMsgVertices(mesh.getLodMesh(levels[i]));
+  };
+
+  bool has_coarsened_blocks = false;
+  if (msg_config.max_vertices_per_message > 0u) {
+    size_t num_vertices = 0u;
+    for (size_t i = 0u; i < meshes.size(); ++i) {
+      num_vertices += get_num_vertices(i);
+    }
+    std::sort(distances.begin(), distances.end(),
+              std::greater<std::pair<FloatingPoint, size_t> >());
+    bool coarsened = true;
+    while (num_vertices > msg_config.max_vertices_per_message && coarsened) {
+      coarsened = false;
+      for (const std::pair<FloatingPoint, size_t>& distance : distances) {
+        const size_t i = distance.second;
+        if (num_vertices <= msg_config.max_vertices_per_message) {
+          break;
+        }
+        if (levels[i] + 1u < meshes[i]->getNumLodLevels()) {
+          num_vertices -= get_num_vertices(i);
+          ++levels[i];
+          num_vertices += get_num_vertices(i);
+          coarsened = true;
+          has_coarsened_blocks = true;
+        }
+      }
+    }
+  }
 
-    mesh_block.x.reserve(mesh->vertices.size());
-    mesh_block.y.reserve(mesh->vertices.size());
-    mesh_block.z.reserve(mesh->vertices.size());
+  for (size_t i = 0u; i < meshes.size(); ++i) {
+    if (meshes[i]->updated || levels[i] != meshes[i]->lod_level) {
+      block_indices->push_back(mesh_indices[i]);
+      lod_levels->push_back(levels[i]);
+    }
+  }
 
-    // normal coloring is used by RViz plugin by default, so no need to send it
-    if (color_mode != kNormals) {
-      mesh_block.r.reserve(mesh->vertices.size());
-      mesh_block.g.reserve(mesh->vertices.size());
-      mesh_block.b.reserve(mesh->vertices.size());
+  if (lod_state != nullptr) {
+    if (select_all_blocks) {
+      lod_state->viewer_position = viewer_position;
     }
-    for (size_t i = 0u; i < mesh->vertices.size(); ++i) {
-      // We convert from an absolute global frame to a normalized local frame.
-      // Each vertex is given as its distance from the blocks origin in units of
-      // (2*block_size). This results in all points obtaining a value in the
-      // range 0 to 1. To enforce this 0 to 1 range we technically only need to
-      // divide by (block_size + voxel_size). The + voxel_size comes from the
-      // way marching cubes allows the mesh to interpolate between this and a
-      // neighboring block. We instead divide by (block_size + block_size) as
-      // the mesh layer has no knowledge of how many voxels are inside a block.
+    lod_state->has_coarsened_blocks = has_coarsened_blocks;
+  }
+}
+
+/// A vertex as it is sent in a mesh block message.
+struct MeshMsgVertexKey {
+  uint16_t x = 0u;
+  uint16_t y = 0u;
+  uint16_t z = 0u;
+  uint8_t r = 0u;
+  uint8_t g = 0u;
+  uint8_t b = 0u;
+  uint8_t normal_u = 0u;
+  uint8_t normal_v = 0u;
+
+  bool operator==(const MeshMsgVertexKey& other) const {
+    return x == other.x && y == other.y && z == other.z && r == other.r &&
+           g == other.g && b == other.b && normal_u == other.normal_u &&
+           normal_v == other.normal_v;
+  }
+};
+
+struct MeshMsgVertexKeyHash {
+  size_t operator()(const MeshMsgVertexKey& key) const {
+    const uint64_t position = static_cast<uint64_t>(key.x) |
+                              static_cast<uint64_t>(key.y) << 16 |
+                              static_cast<uint64_t>(key.z) << 32;
+    const uint64_t attributes = static_cast<uint64_t>(key.r) |
+                                static_cast<uint64_t>(key.g) << 8 |
+                                static_cast<uint64_t>(key.b) << 16 |
+                                static_cast<uint64_t>(key.normal_u) << 24 |
+                                static_cast<uint64_t>(key.normal_v) << 32;
+    return std::hash<uint64_t>()(position * 0x9e3779b97f4a7c15ull ^
+                                 attributes);
+  }
+};
+
+/**
+ * Fills the vertices of the mesh block message with the given vertex ranges of
+ * the mesh. With indexed triangles, the vertices that are sent the same way,
+ * i.e. with the same quantized position, color and encoded normal, are sent
+ * once. Returns false if a block has too many unique
+ * vertices for the uint16 indices, in which case the message is incomplete.
+ */
+inline bool fillMeshBlockMsg(const Mesh::ConstPtr& mesh,
+                             const std::vector<std::pair<size_t, size_t> >&
+                                 vertex_ranges,
+                             const BlockIndex& block_index,
+                             const FloatingPoint block_size_inv,
+                             const ColorMode color_mode,
+                             const bool use_indexed_triangles,
+                             const bool send_normals,
+                             voxblox_msgs::MeshBlock* mesh_block) {
+  CHECK(mesh);
+  CHECK_NOTNULL(mesh_block);
+  mesh_block->x.clear();
+  mesh_block->y.clear();
+  mesh_block->z.clear();
+  mesh_block->r.clear();
+  mesh_block->g.clear();
+  mesh_block->b.clear();
+  mesh_block->normals.clear();
+  mesh_block->triangles.clear();
+
+  size_t num_vertices = 0u;
+  for (const std::pair<size_t, size_t>& vertex_range : vertex_ranges) {
+    num_vertices += vertex_range.second - vertex_range.first;
+  }
+  const bool send_colors = color_mode != kNormals;
+  const bool has_normals = send_normals && mesh->hasNormals();
+
+  // The unique vertices by everything that is sent of them.
+  std::unordered_map<MeshMsgVertexKey, uint16_t, MeshMsgVertexKeyHash>
+      vertex_map;
+  if (use_indexed_triangles) {
+    vertex_map.reserve(num_vertices / 2u);
+    mesh_block->triangles.reserve(num_vertices);
+  }
+
+  for (const std::pair<size_t, size_t>& vertex_range : vertex_ranges) {
+    for (size_t k = vertex_range.first; k < vertex_range.second; ++k) {
+      const size_t i = mesh->hasTriangles() ? mesh->indices[k] : k;
+      // We convert from an absolute global frame to a normalized local
+      // frame. Each vertex is given as its distance from the blocks origin
+      // in units of (2*block_size). This results in all points obtaining a
+      // value in the range 0 to 1. To enforce this 0 to 1 range we
+      // technically only need to divide by (block_size + voxel_size). The +
+      // voxel_size comes from the way marching cubes allows the mesh to
+      // interpolate between this and a neighboring block. We instead divide
+      // by (block_size + block_size) as the mesh layer has no knowledge of
+      // how many voxels are inside a block.
       const Point normalized_verticies =
-          0.5f * (mesh_layer->block_size_inv() * mesh->vertices[i] -
+          0.5f * (block_size_inv * mesh->vertices[i] -
                   block_index.cast<FloatingPoint>());
 
       // check all points are in range [0, 1.0]
@@ -199,36 +420,158 @@ inline void generateVoxbloxMeshMsg(MeshLayer* mesh_layer, ColorMode color_mode,
       CHECK((normalized_verticies.array() >= 0.0).all());
 
       // convert to uint16_t fixed point representation
-      mesh_block.x.push_back(std::numeric_limits<uint16_t>::max() *
-                             normalized_verticies.x());
-      mesh_block.y.push_back(std::numeric_limits<uint16_t>::max() *
-                             normalized_verticies.y());
-      mesh_block.z.push_back(std::numeric_limits<uint16_t>::max() *
-                             normalized_verticies.z());
-
-      if (color_mode != kNormals) {
+      MeshMsgVertexKey vertex;
+      vertex.x = std::numeric_limits<uint16_t>::max() *
+                 normalized_verticies.x();
+      vertex.y = std::numeric_limits<uint16_t>::max() *
+                 normalized_verticies.y();
+      vertex.z = std::numeric_limits<uint16_t>::max() *
+                 normalized_verticies.z();
+      if (send_colors) {
         const std_msgs::ColorRGBA color_msg =
             getVertexColor(mesh, color_mode, i);
-        mesh_block.r.push_back(std::numeric_limits<uint8_t>::max() *
-                               color_msg.r);
-        mesh_block.g.push_back(std::numeric_limits<uint8_t>::max() *
-                               color_msg.g);
-        mesh_block.b.push_back(std::numeric_limits<uint8_t>::max() *
-                               color_msg.b);
+        vertex.r = std::numeric_limits<uint8_t>::max() * color_msg.r;
+        vertex.g = std::numeric_limits<uint8_t>::max() * color_msg.g;
+        vertex.b = std::numeric_limits<uint8_t>::max() * color_msg.b;
+      }
+      if (has_normals) {
+        encodeOctNormal(mesh->normals[i], &vertex.normal_u, &vertex.normal_v);
+      }
+
+      if (use_indexed_triangles) {
+        const size_t vertex_index = mesh_block->x.size();
+        const std::pair<std::unordered_map<MeshMsgVertexKey, uint16_t,
+                                           MeshMsgVertexKeyHash>::iterator,
+                        bool>
+            result = vertex_map.emplace(vertex, vertex_index);
+        if (!result.second) {
+          mesh_block->triangles.push_back(result.first->second);
+          continue;
+        }
+        if (vertex_index > std::numeric_limits<uint16_t>::max()) {
+          return false;
+        }
+        mesh_block->triangles.push_back(vertex_index);
+      }
+
+      mesh_block->x.push_back(vertex.x);
+      mesh_block->y.push_back(vertex.y);
+      mesh_block->z.push_back(vertex.z);
+      if (send_colors) {
+        mesh_block->r.push_back(vertex.r);
+        mesh_block->g.push_back(vertex.g);
+        mesh_block->b.push_back(vertex.b);
+      }
+      if (has_normals) {
+        mesh_block->normals.push_back(vertex.normal_u);
+        mesh_block->normals.push_back(vertex.normal_v);
       }
     }
+  }
+  return true;
+}
 
-    mesh_msg->mesh_blocks.push_back(mesh_block);
+/**
+ * Generates a message of the updated block meshes, selecting their levels of
+ * detail by their distance from the viewer and the bandwidth budget, see
+ * selectMeshLodLevels(). The lod_state may be null.
+ */
+inline void generateVoxbloxMeshMsg(MeshLayer* mesh_layer, ColorMode color_mode,
+                                   const MeshMsgConfig& msg_config,
+                                   const Point& viewer_position,
+                                   MeshLodState* lod_state,
+                                   voxblox_msgs::Mesh* mesh_msg) {
+  CHECK_NOTNULL(mesh_msg);
+  CHECK_NOTNULL(mesh_layer);
 
-    // delete empty mesh blocks after sending them
-    if (!mesh->hasVertices()) {
+  mesh_msg->header.stamp = ros::Time::now();
+
+  BlockIndexList mesh_indices;
+  std::vector<size_t> lod_levels;
+  selectMeshLodLevels(*mesh_layer, msg_config, viewer_position, lod_state,
+                      &mesh_indices, &lod_levels);
+
+  mesh_msg->block_edge_length = mesh_layer->block_size();
+  mesh_msg->mesh_blocks.reserve(mesh_indices.size());
+
+  for (size_t block_number = 0u; block_number < mesh_indices.size();
+       ++block_number) {
+    const BlockIndex& block_index = mesh_indices[block_number];
+    const size_t lod_level = lod_levels[block_number];
+    Mesh::Ptr block_mesh = mesh_layer->getMeshPtrByIndex(block_index);
+
+    // Empty mesh blocks are deleted after sending their removal.
+    if (!block_mesh->hasVertices()) {
+      mesh_msg->deleted_blocks.push_back(block_index.x());
+      mesh_msg->deleted_blocks.push_back(block_index.y());
+      mesh_msg->deleted_blocks.push_back(block_index.z());
       mesh_layer->removeMesh(block_index);
+      continue;
     }
 
-    mesh->updated = false;
+    const Mesh::ConstPtr mesh = getLodMeshPtr(block_mesh, lod_level);
+
+    voxblox_msgs::MeshBlock mesh_block;
+    mesh_block.index[0] = block_index.x();
+    mesh_block.index[1] = block_index.y();
+    mesh_block.index[2] = block_index.z();
+    mesh_block.lod_level = lod_level;
+
+    // Incrementally meshed blocks are sent as sub-meshes at full resolution,
+    // so the receiver can keep them. Only the updated ones are sent if the
+    // receiver already holds the others, i.e. the block was last sent at full
+    // resolution and only some of its sub-meshes changed since. The triangles
+    // are expanded along the mesh indices and then re-indexed for the
+    // message, so the sub-mesh sizes count triangle corners either way.
+    std::vector<std::pair<size_t, size_t> > vertex_ranges;
+    if (lod_level == 0u && mesh->hasSubMeshes()) {
+      const bool send_updated_only = block_mesh->updated &&
+                                     block_mesh->updated_sub_meshes != 0u &&
+                                     block_mesh->lod_level == 0u;
+      const Mesh::SubMeshMask sub_mesh_mask =
+          send_updated_only ? block_mesh->updated_sub_meshes
+                            : ~static_cast<Mesh::SubMeshMask>(0u);
+      mesh_block.sub_mesh_mask = sub_mesh_mask;
+      for (size_t i = 0u; i < Mesh::kNumSubMeshes; ++i) {
+        if ((sub_mesh_mask >> i & 1u) != 0u) {
+          const size_t begin = mesh->getSubMeshBegin(i);
+          const size_t end = mesh->getSubMeshEnd(i);
+          vertex_ranges.emplace_back(begin, end);
+          mesh_block.sub_mesh_num_vertices.push_back(end - begin);
+        }
+      }
+    } else {
+      mesh_block.sub_mesh_mask = 0u;
+      vertex_ranges.emplace_back(0u, getNumMeshMsgVertices(*mesh));
+    }
+
+    // Blocks with more unique vertices than uint16 indices can address are
+    // sent as separate triangles.
+    if (!fillMeshBlockMsg(mesh, vertex_ranges, block_index,
+                          mesh_layer->block_size_inv(), color_mode,
+                          msg_config.use_indexed_triangles,
+                          msg_config.send_normals, &mesh_block)) {
+      constexpr bool kUseIndexedTriangles = false;
+      CHECK(fillMeshBlockMsg(mesh, vertex_ranges, block_index,
+                             mesh_layer->block_size_inv(), color_mode,
+                             kUseIndexedTriangles, msg_config.send_normals,
+                             &mesh_block));
+    }
+
+    mesh_msg->mesh_blocks.push_back(mesh_block);
+
+    block_mesh->updated = false;
+    block_mesh->updated_sub_meshes = 0u;
+    block_mesh->lod_level = lod_level;
   }
 }
 
+inline void generateVoxbloxMeshMsg(MeshLayer* mesh_layer, ColorMode color_mode,
+                                   voxblox_msgs::Mesh* mesh_msg) {
+  generateVoxbloxMeshMsg(mesh_layer, color_mode, MeshMsgConfig(),
+                         Point::Zero(), nullptr, mesh_msg);
+}
+
 inline void generateVoxbloxMeshMsg(const MeshLayer::Ptr& mesh_layer,
                                    ColorMode color_mode,
                                    voxblox_msgs::Mesh* mesh_msg) {
@@ -237,6 +580,7 @@ inline void generateVoxbloxMeshMsg(const MeshLayer::Ptr& mesh_layer,
   generateVoxbloxMeshMsg(mesh_layer.get(), color_mode, mesh_msg);
 }
 
+/// Draws the block meshes at their last published levels of detail.
 inline void fillMarkerWithMesh(const MeshLayer::ConstPtr& mesh_layer,
                                ColorMode color_mode,
                                visualization_msgs::Marker* marker) {
@@ -256,7 +600,11 @@ inline void fillMarkerWithMesh(const MeshLayer::ConstPtr& mesh_layer,
   mesh_layer->getAllAllocatedMeshes(&mesh_indices);
 
   for (const BlockIndex& block_index : mesh_indices) {
-    Mesh::ConstPtr mesh = mesh_layer->getMeshPtrByIndex(block_index);
+    const Mesh::ConstPtr block_mesh =
+        mesh_layer->getMeshPtrByIndex(block_index);
+    // Drawn at the level of detail the block was last published at.
+    const Mesh::ConstPtr mesh =
+        getLodMeshPtr(block_mesh, block_mesh->lod_level);
 
     if (!mesh->hasVertices()) {
       continue;
@@ -270,7 +618,11 @@ inline void fillMarkerWithMesh(const MeshLayer::ConstPtr& mesh_layer,
       CHECK(mesh->hasNormals());
     }
 
-    for (size_t i = 0u; i < mesh->vertices.size(); i++) {
+    // Triangle lists hold separate triangles, so expand shared vertices.
+    const size_t num_vertices =
+        mesh->hasTriangles() ? mesh->indices.size() : mesh->vertices.size();
+    for (size_t k = 0u; k < num_vertices; k++) {
+      const size_t i = mesh->hasTriangles() ? mesh->indices[k] : k;
       geometry_msgs::Point point_msg;
       tf::pointEigenToMsg(mesh->vertices[i].cast<double>(), point_msg);
       marker->points.push_back(point_msg);
@@ -279,6 +631,7 @@ inline void fillMarkerWithMesh(const MeshLayer::ConstPtr& mesh_layer,
   }
 }
 
+/// Samples the block meshes at their last published levels of detail.
 inline void fillPointcloudWithMesh(
     const MeshLayer::ConstPtr& mesh_layer, ColorMode color_mode,
     pcl::PointCloud<pcl::PointXYZRGB>* pointcloud) {
@@ -289,7 +642,11 @@ inline void fillPointcloudWithMesh(
   mesh_layer->getAllAllocatedMeshes(&mesh_indices);
 
   for (const BlockIndex& block_index : mesh_indices) {
-    Mesh::ConstPtr mesh = mesh_layer->getMeshPtrByIndex(block_index);
+    const Mesh::ConstPtr block_mesh =
+        mesh_layer->getMeshPtrByIndex(block_index);
+    // Drawn at the level of detail the block was last published at.
+    const Mesh::ConstPtr mesh =
+        getLodMeshPtr(block_mesh, block_mesh->lod_level);
 
     if (!mesh->hasVertices()) {
       continue;
@@ -1,6 +1,9 @@
 #ifndef VOXBLOX_ROS_ROS_PARAMS_H_
 #define VOXBLOX_ROS_ROS_PARAMS_H_
 
+#include <algorithm>
+#include <string>
+
 #include <ros/node_handle.h>
 
 #include <voxblox/alignment/icp.h>
@@ -10,6 +13,8 @@
 #include <voxblox/integrator/tsdf_integrator.h>
 #include <voxblox/mesh/mesh_integrator.h>
 
+#include "voxblox_ros/mesh_vis.h"
+
 namespace voxblox {
 
 inline TsdfMap::Config getTsdfMapConfigFromRosParam(
@@ -104,9 +109,14 @@ inline TsdfIntegratorBase::Config getTsdfIntegratorConfigFromRosParam(
   nh_private.param("sparsity_compensation_factor",
                    integrator_config.sparsity_compensation_factor,
                    integrator_config.sparsity_compensation_factor);
+  nh_private.param("skip_saturated_free_space_blocks",
+                   integrator_config.skip_saturated_free_space_blocks,
+                   integrator_config.skip_saturated_free_space_blocks);
   nh_private.param("integration_order_mode",
                    integrator_config.integration_order_mode,
                    integrator_config.integration_order_mode);
+  nh_private.param("use_ray_packets", integrator_config.use_ray_packets,
+                   integrator_config.use_ray_packets);
 
   integrator_config.default_truncation_distance =
       static_cast<float>(truncation_distance);
@@ -123,6 +133,27 @@ inline EsdfMap::Config getEsdfMapConfigFromRosParam(
   esdf_config.esdf_voxel_size = tsdf_config.tsdf_voxel_size;
   esdf_config.esdf_voxels_per_side = tsdf_config.tsdf_voxels_per_side;
 
+  int coarse_downsampling =
+      static_cast<int>(esdf_config.esdf_coarse_downsampling);
+  nh_private.param("esdf_coarse_downsampling", coarse_downsampling,
+                   coarse_downsampling);
+  esdf_config.esdf_coarse_downsampling =
+      static_cast<size_t>(std::max(coarse_downsampling, 0));
+  // The coarse layer takes over where the fine ESDF stops.
+  nh_private.param("esdf_max_distance_m",
+                   esdf_config.esdf_coarse_fallback_distance_m,
+                   esdf_config.esdf_coarse_fallback_distance_m);
+
+  std::string gradient_method("central_differences");
+  nh_private.param("esdf_gradient_method", gradient_method, gradient_method);
+  if (gradient_method.compare("trilinear") == 0) {
+    esdf_config.gradient_method = GradientMethod::kTrilinear;
+  } else if (gradient_method.compare("tricubic") == 0) {
+    esdf_config.gradient_method = GradientMethod::kTricubic;
+  } else {
+    esdf_config.gradient_method = GradientMethod::kCentralDifferences;
+  }
+
   return esdf_config;
 }
 
@@ -157,6 +188,18 @@ inline EsdfIntegrator::Config getEsdfIntegratorConfigFromRosParam(
   nh_private.param("esdf_add_occupied_crust",
                    esdf_integrator_config.add_occupied_crust,
                    esdf_integrator_config.add_occupied_crust);
+  nh_private.param("esdf_distance_transform_batch",
+                   esdf_integrator_config.distance_transform_batch,
+                   esdf_integrator_config.distance_transform_batch);
+  nh_private.param("esdf_window_half_size_m",
+                   esdf_integrator_config.window_half_size_m,
+                   esdf_integrator_config.window_half_size_m);
+  int integrator_threads =
+      static_cast<int>(esdf_integrator_config.integrator_threads);
+  nh_private.param("esdf_integrator_threads", integrator_threads,
+                   integrator_threads);
+  esdf_integrator_config.integrator_threads =
+      static_cast<size_t>(std::max(integrator_threads, 1));
   if (esdf_integrator_config.default_distance_m <
       esdf_integrator_config.max_distance_m) {
     esdf_integrator_config.default_distance_m =
@@ -174,10 +217,42 @@ inline MeshIntegratorConfig getMeshIntegratorConfigFromRosParam(
                    mesh_integrator_config.min_weight);
   nh_private.param("mesh_use_color", mesh_integrator_config.use_color,
                    mesh_integrator_config.use_color);
+  nh_private.param("mesh_incremental",
+                   mesh_integrator_config.incremental_meshing,
+                   mesh_integrator_config.incremental_meshing);
+  nh_private.param("mesh_share_vertices",
+                   mesh_integrator_config.share_vertices,
+                   mesh_integrator_config.share_vertices);
+  int num_lod_levels =
+      static_cast<int>(mesh_integrator_config.num_lod_levels);
+  nh_private.param("mesh_lod_levels", num_lod_levels, num_lod_levels);
+  mesh_integrator_config.num_lod_levels =
+      static_cast<size_t>(std::max(num_lod_levels, 0));
 
   return mesh_integrator_config;
 }
 
+inline MeshMsgConfig getMeshMsgConfigFromRosParam(
+    const ros::NodeHandle& nh_private) {
+  MeshMsgConfig mesh_msg_config;
+
+  nh_private.param("mesh_lod_distance", mesh_msg_config.lod_distance,
+                   mesh_msg_config.lod_distance);
+  int max_vertices_per_message =
+      static_cast<int>(mesh_msg_config.max_vertices_per_message);
+  nh_private.param("mesh_max_vertices_per_message", max_vertices_per_message,
+                   max_vertices_per_message);
+  mesh_msg_config.max_vertices_per_message =
+      static_cast<size_t>(std::max(max_vertices_per_message, 0));
+  nh_private.param("mesh_indexed_triangles",
+                   mesh_msg_config.use_indexed_triangles,
+                   mesh_msg_config.use_indexed_triangles);
+  nh_private.param("mesh_send_normals", mesh_msg_config.send_normals,
+                   mesh_msg_config.send_normals);
+
+  return mesh_msg_config;
+}
+
 }  // namespace voxblox
 
 #endif  // VOXBLOX_ROS_ROS_PARAMS_H_
@@ -1,15 +1,19 @@
 #ifndef VOXBLOX_ROS_TSDF_SERVER_H_
 #define VOXBLOX_ROS_TSDF_SERVER_H_
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <queue>
 #include <string>
+#include <vector>
 
 #include <pcl/conversions.h>
 #include <pcl/filters/filter.h>
 #include <pcl/point_types.h>
 #include <pcl_conversions/pcl_conversions.h>
 #include <pcl_ros/point_cloud.h>
+#include <ros/callback_queue.h>
 #include <ros/ros.h>
 #include <sensor_msgs/PointCloud2.h>
 #include <std_srvs/Empty.h>
@@ -43,7 +47,7 @@ class TsdfServer {
              const TsdfMap::Config& config,
              const TsdfIntegratorBase::Config& integrator_config,
              const MeshIntegratorConfig& mesh_config);
-  virtual ~TsdfServer() {}
+  virtual ~TsdfServer();
 
   void getServerConfigFromRosParam(const ros::NodeHandle& nh_private);
 
@@ -99,6 +103,23 @@ class TsdfServer {
   std::shared_ptr<TsdfMap> getTsdfMapPtr() { return tsdf_map_; }
   std::shared_ptr<const TsdfMap> getTsdfMapPtr() const { return tsdf_map_; }
 
+  /**
+   * Returns a snapshot of the TSDF map that stays the same while the server
+   * keeps integrating, see Layer::getSnapshot(). Use this rather than
+   * getTsdfMapPtr() to read the map while the async spinners are running.
+   */
+  TsdfMap::Ptr getTsdfMapSnapshot();
+
+  /**
+   * If use_async_spinners is set, starts serving the sensor input, the timers
+   * and the services of the server from a thread each, so meshing,
+   * publishing and service calls don't hold up the integration. Call it once
+   * the server is constructed, the remaining callbacks still need ros::spin().
+   */
+  void startAsyncSpinners();
+  /// Stops the threads again and waits for their callbacks to return.
+  void stopAsyncSpinners();
+
   /// Accessors for setting and getting parameters.
   double getSliceLevel() const { return slice_level_; }
   void setSliceLevel(double slice_level) { slice_level_ = slice_level; }
@@ -128,9 +149,63 @@ class TsdfServer {
       std::queue<sensor_msgs::PointCloud2::Ptr>* queue,
       sensor_msgs::PointCloud2::Ptr* pointcloud_msg, Transformation* T_G_C);
 
+  /**
+   * Node handle with the callbacks going to the queue if the async spinners
+   * are used, and to the global queue otherwise.
+   */
+  ros::NodeHandle getNodeHandleWithQueue(const ros::NodeHandle& nh,
+                                         ros::CallbackQueue* queue) const;
+
+  /**
+   * The TSDF layer to publish or save. A snapshot if the callbacks run
+   * concurrently, otherwise the layer itself.
+   */
+  std::shared_ptr<const Layer<TsdfVoxel>> getTsdfLayerForReading();
+
+  /**
+   * Publish the clouds of the given TSDF layer, so publishPointclouds() takes
+   * a single snapshot for all of them.
+   */
+  void publishAllUpdatedTsdfVoxels(const Layer<TsdfVoxel>& tsdf_layer);
+  void publishTsdfSurfacePoints(const Layer<TsdfVoxel>& tsdf_layer);
+  void publishTsdfOccupiedNodes(const Layer<TsdfVoxel>& tsdf_layer);
+  void publishTsdfSlices(const Layer<TsdfVoxel>& tsdf_layer);
+
+  /**
+   * Updates the mesh layer from the TSDF layer and clears the mesh update
+   * flags of the TSDF blocks. With the async spinners, the mesh is extracted
+   * from a snapshot, so the integration can go on in the meantime. Expects
+   * mesh_mutex_ to be held. Returns the sensor position the mesh is for.
+   */
+  Point updateMeshLayer(bool only_mesh_updated_blocks);
+
   ros::NodeHandle nh_;
   ros::NodeHandle nh_private_;
 
+  /**
+   * Whether the sensor input, timer and service callbacks each have their own
+   * queue, served by one of the async spinners.
+   */
+  bool use_async_spinners_;
+  ros::CallbackQueue sensor_queue_;
+  ros::CallbackQueue timer_queue_;
+  ros::CallbackQueue service_queue_;
+  std::vector<std::unique_ptr<ros::AsyncSpinner>> async_spinners_;
+
+  /**
+   * Guards the TSDF map and integrator. Readers only hold it to take a
+   * snapshot. The mutexes of a server are always locked in this order:
+   * mesh_mutex_, the ESDF map mutex, tsdf_map_mutex_, the intensity layer
+   * mutex. The mesh and ESDF mutexes are held while the snapshot for their
+   * update is taken, the intensity layer is written while integrating.
+   */
+  std::mutex tsdf_map_mutex_;
+  /**
+   * Guards the mesh layer and integrator and the cached mesh message. Locked
+   * before tsdf_map_mutex_.
+   */
+  std::mutex mesh_mutex_;
+
   /// Data subscribers.
   ros::Subscriber pointcloud_sub_;
   ros::Subscriber freespace_pointcloud_sub_;
@@ -193,8 +268,19 @@ class TsdfServer {
    * not empty.
    */
   std::string mesh_filename_;
+  /// Write the mesh file as binary instead of ASCII PLY.
+  bool mesh_binary_ply_;
   /// How to color the mesh.
   ColorMode color_mode_;
+  /// Levels of detail and encoding of the published mesh.
+  MeshMsgConfig mesh_msg_config_;
+  /// Level of detail selection between mesh messages. Guarded by mesh_mutex_.
+  MeshLodState mesh_lod_state_;
+  /**
+   * Latest sensor position, from which the levels of detail are selected and
+   * beyond which the mesh is cleared. Guarded by tsdf_map_mutex_.
+   */
+  Point mesh_viewer_position_;
 
   /// Colormap to use for intensity pointclouds.
   std::shared_ptr<ColorMap> color_map_;
@@ -226,7 +312,8 @@ class TsdfServer {
 
   /// Subscriber settings.
   int pointcloud_queue_size_;
-  int num_subscribers_tsdf_map_;
+  /// Atomic, as the map is published from the timer and the services.
+  std::atomic<int> num_subscribers_tsdf_map_;
 
   // Maps and integrators.
   std::shared_ptr<TsdfMap> tsdf_map_;
@@ -238,6 +325,8 @@ class TsdfServer {
   // Mesh accessories.
   std::shared_ptr<MeshLayer> mesh_layer_;
   std::unique_ptr<MeshIntegrator<TsdfVoxel>> mesh_integrator_;
+  /// For the integrators meshing snapshots of the TSDF layer.
+  MeshIntegratorConfig mesh_config_;
   /// Optionally cached mesh message.
   voxblox_msgs::Mesh cached_mesh_msg_;
 
@@ -1,5 +1,7 @@
 #include "voxblox_ros/esdf_server.h"
 
+#include <algorithm>
+
 #include "voxblox_ros/conversions.h"
 #include "voxblox_ros/ros_params.h"
 
@@ -33,6 +35,20 @@ EsdfServer::EsdfServer(const ros::NodeHandle& nh,
   esdf_integrator_.reset(new EsdfIntegrator(esdf_integrator_config,
                                             tsdf_map_->getTsdfLayerPtr(),
                                             esdf_map_->getEsdfLayerPtr()));
+  if (esdf_map_->hasCoarseEsdfLayer()) {
+    // The coarse layer covers the far field, so it propagates further.
+    EsdfIntegrator::Config coarse_integrator_config = esdf_integrator_config;
+    coarse_integrator_config.max_distance_m = 10.0;
+    nh_private_.param("esdf_coarse_max_distance_m",
+                      coarse_integrator_config.max_distance_m,
+                      coarse_integrator_config.max_distance_m);
+    coarse_integrator_config.default_distance_m =
+        std::max(coarse_integrator_config.default_distance_m,
+                 coarse_integrator_config.max_distance_m);
+    esdf_coarse_integrator_.reset(new EsdfCoarseIntegrator(
+        coarse_integrator_config, tsdf_map_->getTsdfLayerPtr(),
+        esdf_map_->getCoarseEsdfLayerPtr()));
+  }
 
   setupRos();
 }
@@ -51,8 +67,10 @@ void EsdfServer::setupRos() {
       nh_private_.advertise<voxblox_msgs::Layer>("esdf_map_out", 1, false);
 
   // Set up subscriber.
-  esdf_map_sub_ = nh_private_.subscribe("esdf_map_in", 1,
-                                        &EsdfServer::esdfMapCallback, this);
+  ros::NodeHandle nh_private_sensor =
+      getNodeHandleWithQueue(nh_private_, &sensor_queue_);
+  esdf_map_sub_ = nh_private_sensor.subscribe(
+      "esdf_map_in", 1, &EsdfServer::esdfMapCallback, this);
 
   // Whether to clear each new pose as it comes in, and then set a sphere
   // around it to occupied.
@@ -72,17 +90,38 @@ void EsdfServer::setupRos() {
                     update_esdf_every_n_sec);
 
   if (update_esdf_every_n_sec > 0.0) {
+    ros::NodeHandle nh_private_timer =
+        getNodeHandleWithQueue(nh_private_, &timer_queue_);
     update_esdf_timer_ =
-        nh_private_.createTimer(ros::Duration(update_esdf_every_n_sec),
-                                &EsdfServer::updateEsdfEvent, this);
+        nh_private_timer.createTimer(ros::Duration(update_esdf_every_n_sec),
+                                     &EsdfServer::updateEsdfEvent, this);
+  }
+}
+
+EsdfMap::Ptr EsdfServer::getEsdfMapSnapshot() {
+  std::lock_guard<std::mutex> lock(esdf_map_mutex_);
+  return esdf_map_->getSnapshot();
+}
+
+std::shared_ptr<const Layer<EsdfVoxel>> EsdfServer::getEsdfLayerForReading() {
+  if (!use_async_spinners_) {
+    return std::shared_ptr<const Layer<EsdfVoxel>>(
+        esdf_map_, esdf_map_->getEsdfLayerConstPtr());
   }
+  std::lock_guard<std::mutex> lock(esdf_map_mutex_);
+  return esdf_map_->getEsdfLayerPtr()->getSnapshot();
 }
 
 void EsdfServer::publishAllUpdatedEsdfVoxels() {
+  publishAllUpdatedEsdfVoxels(*getEsdfLayerForReading());
+}
+
+void EsdfServer::publishAllUpdatedEsdfVoxels(
+    const Layer<EsdfVoxel>& esdf_layer) {
   // Create a pointcloud with distance = intensity.
   pcl::PointCloud<pcl::PointXYZI> pointcloud;
 
-  createDistancePointcloudFromEsdfLayer(esdf_map_->getEsdfLayer(), &pointcloud);
+  createDistancePointcloudFromEsdfLayer(esdf_layer, &pointcloud);
 
   pointcloud.header.frame_id = world_frame_;
   esdf_pointcloud_pub_.publish(pointcloud);
@@ -90,12 +129,15 @@ void EsdfServer::publishAllUpdatedEsdfVoxels() {
 
 void EsdfServer::publishSlices() {
   TsdfServer::publishSlices();
+  publishEsdfSlices(*getEsdfLayerForReading());
+}
 
+void EsdfServer::publishEsdfSlices(const Layer<EsdfVoxel>& esdf_layer) {
   pcl::PointCloud<pcl::PointXYZI> pointcloud;
 
   constexpr int kZAxisIndex = 2;
-  createDistancePointcloudFromEsdfLayerSlice(
-      esdf_map_->getEsdfLayer(), kZAxisIndex, slice_level_, &pointcloud);
+  createDistancePointcloudFromEsdfLayerSlice(esdf_layer, kZAxisIndex,
+                                             slice_level_, &pointcloud);
 
   pointcloud.header.frame_id = world_frame_;
   esdf_slice_pub_.publish(pointcloud);
@@ -104,12 +146,24 @@ void EsdfServer::publishSlices() {
 bool EsdfServer::generateEsdfCallback(
     std_srvs::Empty::Request& /*request*/,      // NOLINT
     std_srvs::Empty::Response& /*response*/) {  // NOLINT
-  const bool clear_esdf = true;
-  if (clear_esdf) {
-    esdf_integrator_->updateFromTsdfLayerBatch();
-  } else {
-    const bool clear_updated_flag = true;
-    esdf_integrator_->updateFromTsdfLayer(clear_updated_flag);
+  {
+    std::lock_guard<std::mutex> esdf_lock(esdf_map_mutex_);
+    const Layer<TsdfVoxel>::Ptr tsdf_layer = getTsdfLayerForEsdfUpdate();
+    setEsdfIntegratorsTsdfLayer(tsdf_layer.get());
+    const bool clear_esdf = true;
+    if (clear_esdf) {
+      if (esdf_coarse_integrator_) {
+        esdf_coarse_integrator_->updateFromTsdfLayerBatch();
+      }
+      esdf_integrator_->updateFromTsdfLayerBatch();
+    } else {
+      if (esdf_coarse_integrator_) {
+        esdf_coarse_integrator_->updateFromTsdfLayer();
+      }
+      const bool clear_updated_flag = true;
+      esdf_integrator_->updateFromTsdfLayer(clear_updated_flag);
+    }
+    setEsdfIntegratorsTsdfLayer(tsdf_map_->getTsdfLayerPtr());
   }
   publishAllUpdatedEsdfVoxels();
   publishSlices();
@@ -121,22 +175,30 @@ void EsdfServer::updateEsdfEvent(const ros::TimerEvent& /*event*/) {
 }
 
 void EsdfServer::publishPointclouds() {
-  publishAllUpdatedEsdfVoxels();
+  // One snapshot for all ESDF clouds. The TSDF slices are published with the
+  // other TSDF clouds.
+  const std::shared_ptr<const Layer<EsdfVoxel>> esdf_layer =
+      getEsdfLayerForReading();
+  publishAllUpdatedEsdfVoxels(*esdf_layer);
   if (publish_slices_) {
-    publishSlices();
+    publishEsdfSlices(*esdf_layer);
   }
 
   if (publish_traversable_) {
-    publishTraversable();
+    publishTraversable(*esdf_layer);
   }
 
   TsdfServer::publishPointclouds();
 }
 
 void EsdfServer::publishTraversable() {
+  publishTraversable(*getEsdfLayerForReading());
+}
+
+void EsdfServer::publishTraversable(const Layer<EsdfVoxel>& esdf_layer) {
   pcl::PointCloud<pcl::PointXYZI> pointcloud;
-  createFreePointcloudFromEsdfLayer(esdf_map_->getEsdfLayer(),
-                                    traversability_radius_, &pointcloud);
+  createFreePointcloudFromEsdfLayer(esdf_layer, traversability_radius_,
+                                    &pointcloud);
   pointcloud.header.frame_id = world_frame_;
   traversable_pub_.publish(pointcloud);
 }
@@ -157,8 +219,8 @@ void EsdfServer::publishMap(bool reset_remote_map) {
     const bool only_updated = !reset_remote_map;
     timing::Timer publish_map_timer("map/publish_esdf");
     voxblox_msgs::Layer layer_msg;
-    serializeLayerAsMsg<EsdfVoxel>(this->esdf_map_->getEsdfLayer(),
-                                   only_updated, &layer_msg);
+    serializeLayerAsMsg<EsdfVoxel>(*getEsdfLayerForReading(), only_updated,
+                                   &layer_msg);
     if (reset_remote_map) {
       layer_msg.action = static_cast<uint8_t>(MapDerializationAction::kReset);
     }
@@ -175,7 +237,7 @@ bool EsdfServer::saveMap(const std::string& file_path) {
 
   constexpr bool kClearFile = false;
   return success &&
-         io::SaveLayer(esdf_map_->getEsdfLayer(), file_path, kClearFile);
+         io::SaveLayer(*getEsdfLayerForReading(), file_path, kClearFile);
 }
 
 bool EsdfServer::loadMap(const std::string& file_path) {
@@ -183,23 +245,73 @@ bool EsdfServer::loadMap(const std::string& file_path) {
   bool success = TsdfServer::loadMap(file_path);
 
   constexpr bool kMultipleLayerSupport = true;
+  std::lock_guard<std::mutex> lock(esdf_map_mutex_);
   return success &&
          io::LoadBlocksFromFile(
              file_path, Layer<EsdfVoxel>::BlockMergingStrategy::kReplace,
              kMultipleLayerSupport, esdf_map_->getEsdfLayerPtr());
 }
 
+Layer<TsdfVoxel>::Ptr EsdfServer::getTsdfLayerForEsdfUpdate() {
+  if (!use_async_spinners_) {
+    // Nothing changes the layer during the update, so the integrators clear
+    // its update flags themselves.
+    return Layer<TsdfVoxel>::Ptr(tsdf_map_, tsdf_map_->getTsdfLayerPtr());
+  }
+
+  // Take over the update flags from the layer, as updateMeshLayer() does.
+  // The integrators then clear them in the snapshot only, which doesn't copy
+  // any blocks.
+  std::lock_guard<std::mutex> lock(tsdf_map_mutex_);
+  Layer<TsdfVoxel>* tsdf_layer = tsdf_map_->getTsdfLayerPtr();
+  Layer<TsdfVoxel>::Ptr tsdf_snapshot = tsdf_layer->getSnapshot();
+  BlockIndexList updated_blocks;
+  tsdf_layer->getAllUpdatedBlocks(Update::kEsdf, &updated_blocks);
+  for (const BlockIndex& block_index : updated_blocks) {
+    tsdf_layer->resetUpdated(block_index, Update::kEsdf);
+  }
+  if (esdf_coarse_integrator_) {
+    tsdf_layer->getAllUpdatedBlocks(Update::kCoarseEsdf, &updated_blocks);
+    for (const BlockIndex& block_index : updated_blocks) {
+      tsdf_layer->resetUpdated(block_index, Update::kCoarseEsdf);
+    }
+  }
+  return tsdf_snapshot;
+}
+
+void EsdfServer::setEsdfIntegratorsTsdfLayer(Layer<TsdfVoxel>* tsdf_layer) {
+  esdf_integrator_->setTsdfLayer(tsdf_layer);
+  if (esdf_coarse_integrator_) {
+    esdf_coarse_integrator_->setTsdfLayer(tsdf_layer);
+  }
+}
+
 void EsdfServer::updateEsdf() {
-  if (tsdf_map_->getTsdfLayer().getNumberOfAllocatedBlocks() > 0) {
+  std::lock_guard<std::mutex> esdf_lock(esdf_map_mutex_);
+  const Layer<TsdfVoxel>::Ptr tsdf_layer = getTsdfLayerForEsdfUpdate();
+  if (tsdf_layer->getNumberOfAllocatedBlocks() > 0) {
+    setEsdfIntegratorsTsdfLayer(tsdf_layer.get());
+    // The coarse layer consumes its own update flags.
+    if (esdf_coarse_integrator_) {
+      esdf_coarse_integrator_->updateFromTsdfLayer();
+    }
     const bool clear_updated_flag_esdf = true;
     esdf_integrator_->updateFromTsdfLayer(clear_updated_flag_esdf);
+    setEsdfIntegratorsTsdfLayer(tsdf_map_->getTsdfLayerPtr());
   }
 }
 
 void EsdfServer::updateEsdfBatch(bool full_euclidean) {
-  if (tsdf_map_->getTsdfLayer().getNumberOfAllocatedBlocks() > 0) {
+  std::lock_guard<std::mutex> esdf_lock(esdf_map_mutex_);
+  const Layer<TsdfVoxel>::Ptr tsdf_layer = getTsdfLayerForEsdfUpdate();
+  if (tsdf_layer->getNumberOfAllocatedBlocks() > 0) {
+    setEsdfIntegratorsTsdfLayer(tsdf_layer.get());
     esdf_integrator_->setFullEuclidean(full_euclidean);
     esdf_integrator_->updateFromTsdfLayerBatch();
+    if (esdf_coarse_integrator_) {
+      esdf_coarse_integrator_->updateFromTsdfLayerBatch();
+    }
+    setEsdfIntegratorsTsdfLayer(tsdf_map_->getTsdfLayerPtr());
   }
 }
 
@@ -208,6 +320,7 @@ float EsdfServer::getEsdfMaxDistance() const {
 }
 
 void EsdfServer::setEsdfMaxDistance(float max_distance) {
+  std::lock_guard<std::mutex> lock(esdf_map_mutex_);
   esdf_integrator_->setEsdfMaxDistance(max_distance);
 }
 
@@ -220,6 +333,10 @@ void EsdfServer::setTraversabilityRadius(float traversability_radius) {
 }
 
 void EsdfServer::newPoseCallback(const Transformation& T_G_C) {
+  std::lock_guard<std::mutex> lock(esdf_map_mutex_);
+  // Only has an effect if the ESDF is limited to a window around the robot.
+  esdf_integrator_->setWindowCenter(T_G_C.getPosition());
+
   if (clear_sphere_for_planning_) {
     esdf_integrator_->addNewRobotPosition(T_G_C.getPosition());
   }
@@ -233,8 +350,10 @@ void EsdfServer::newPoseCallback(const Transformation& T_G_C) {
 void EsdfServer::esdfMapCallback(const voxblox_msgs::Layer& layer_msg) {
   timing::Timer receive_map_timer("map/receive_esdf");
 
+  std::unique_lock<std::mutex> lock(esdf_map_mutex_);
   bool success =
       deserializeMsgToLayer<EsdfVoxel>(layer_msg, esdf_map_->getEsdfLayerPtr());
+  lock.unlock();
 
   if (!success) {
     ROS_ERROR_THROTTLE(10, "Got an invalid ESDF map message!");
@@ -245,9 +364,16 @@ void EsdfServer::esdfMapCallback(const voxblox_msgs::Layer& layer_msg) {
 }
 
 void EsdfServer::clear() {
-  esdf_map_->getEsdfLayerPtr()->removeAllBlocks();
-  esdf_integrator_->clear();
-  CHECK_EQ(esdf_map_->getEsdfLayerPtr()->getNumberOfAllocatedBlocks(), 0u);
+  {
+    std::lock_guard<std::mutex> lock(esdf_map_mutex_);
+    esdf_map_->getEsdfLayerPtr()->removeAllBlocks();
+    esdf_integrator_->clear();
+    CHECK_EQ(esdf_map_->getEsdfLayerPtr()->getNumberOfAllocatedBlocks(), 0u);
+    if (esdf_coarse_integrator_) {
+      esdf_map_->getCoarseEsdfLayerPtr()->removeAllBlocks();
+      esdf_coarse_integrator_->clear();
+    }
+  }
 
   TsdfServer::clear();
 
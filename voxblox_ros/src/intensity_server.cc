@@ -45,7 +45,9 @@ IntensityServer::IntensityServer(const ros::NodeHandle& nh,
   color_map_->setMaxValue(intensity_max_value);
 
   // Set up subscriber.
-  intensity_image_sub_ = nh_private_.subscribe(
+  ros::NodeHandle nh_private_sensor =
+      getNodeHandleWithQueue(nh_private_, &sensor_queue_);
+  intensity_image_sub_ = nh_private_sensor.subscribe(
       "intensity_image", 1, &IntensityServer::intensityImageCallback, this);
 }
 
@@ -54,6 +56,8 @@ void IntensityServer::updateMesh() {
 
   // Now recolor the mesh...
   timing::Timer publish_mesh_timer("intensity_mesh/publish");
+  std::lock_guard<std::mutex> mesh_lock(mesh_mutex_);
+  std::lock_guard<std::mutex> intensity_lock(intensity_layer_mutex_);
   recolorVoxbloxMeshMsgByIntensity(*intensity_layer_, color_map_,
                                    &cached_mesh_msg_);
   intensity_mesh_pub_.publish(cached_mesh_msg_);
@@ -64,7 +68,9 @@ void IntensityServer::publishPointclouds() {
   // Create a pointcloud with temperature = intensity.
   pcl::PointCloud<pcl::PointXYZI> pointcloud;
 
+  std::unique_lock<std::mutex> lock(intensity_layer_mutex_);
   createIntensityPointcloudFromIntensityLayer(*intensity_layer_, &pointcloud);
+  lock.unlock();
 
   pointcloud.header.frame_id = world_frame_;
   intensity_pointcloud_pub_.publish(pointcloud);
@@ -119,7 +125,9 @@ void IntensityServer::intensityImageCallback(
     }
   }
 
-  // Put this into the integrator.
+  // Put this into the integrator, which casts the rays in the TSDF layer.
+  std::lock_guard<std::mutex> tsdf_lock(tsdf_map_mutex_);
+  std::lock_guard<std::mutex> intensity_lock(intensity_layer_mutex_);
   intensity_integrator_->addIntensityBearingVectors(
       T_G_C.getPosition(), bearing_vectors, intensities);
 }
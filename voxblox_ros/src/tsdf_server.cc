@@ -1,5 +1,7 @@
 #include "voxblox_ros/tsdf_server.h"
 
+#include <algorithm>
+
 #include <minkindr_conversions/kindr_msg.h>
 #include <minkindr_conversions/kindr_tf.h>
 
@@ -21,6 +23,7 @@ TsdfServer::TsdfServer(const ros::NodeHandle& nh,
                        const MeshIntegratorConfig& mesh_config)
     : nh_(nh),
       nh_private_(nh_private),
+      use_async_spinners_(nh_private.param("use_async_spinners", false)),
       verbose_(true),
       world_frame_("world"),
       icp_corrected_frame_("icp_corrected"),
@@ -28,6 +31,8 @@ TsdfServer::TsdfServer(const ros::NodeHandle& nh,
       max_block_distance_from_body_(std::numeric_limits<FloatingPoint>::max()),
       slice_level_(0.5),
       use_freespace_pointcloud_(false),
+      mesh_binary_ply_(true),
+      mesh_viewer_position_(Point::Zero()),
       color_map_(new RainbowColorMap()),
       publish_pointclouds_on_update_(false),
       publish_slices_(false),
@@ -38,9 +43,20 @@ TsdfServer::TsdfServer(const ros::NodeHandle& nh,
       accumulate_icp_corrections_(true),
       pointcloud_queue_size_(1),
       num_subscribers_tsdf_map_(0),
-      transformer_(nh, nh_private) {
+      mesh_config_(mesh_config),
+      transformer_(getNodeHandleWithQueue(nh, &sensor_queue_), nh_private) {
   getServerConfigFromRosParam(nh_private);
 
+  // The transforms go with the sensor input, so they are looked up from the
+  // same thread they are received in.
+  ros::NodeHandle nh_sensor = getNodeHandleWithQueue(nh_, &sensor_queue_);
+  ros::NodeHandle nh_private_sensor =
+      getNodeHandleWithQueue(nh_private_, &sensor_queue_);
+  ros::NodeHandle nh_private_timer =
+      getNodeHandleWithQueue(nh_private_, &timer_queue_);
+  ros::NodeHandle nh_private_service =
+      getNodeHandleWithQueue(nh_private_, &service_queue_);
+
   // Advertise topics.
   surface_pointcloud_pub_ =
       nh_private_.advertise<pcl::PointCloud<pcl::PointXYZRGB> >(
@@ -56,8 +72,8 @@ TsdfServer::TsdfServer(const ros::NodeHandle& nh,
 
   nh_private_.param("pointcloud_queue_size", pointcloud_queue_size_,
                     pointcloud_queue_size_);
-  pointcloud_sub_ = nh_.subscribe("pointcloud", pointcloud_queue_size_,
-                                  &TsdfServer::insertPointcloud, this);
+  pointcloud_sub_ = nh_sensor.subscribe("pointcloud", pointcloud_queue_size_,
+                                       &TsdfServer::insertPointcloud, this);
 
   mesh_pub_ = nh_private_.advertise<voxblox_msgs::Mesh>("mesh", 1, true);
 
@@ -65,16 +81,16 @@ TsdfServer::TsdfServer(const ros::NodeHandle& nh,
   // a library, for example within a planner).
   tsdf_map_pub_ =
       nh_private_.advertise<voxblox_msgs::Layer>("tsdf_map_out", 1, false);
-  tsdf_map_sub_ = nh_private_.subscribe("tsdf_map_in", 1,
-                                        &TsdfServer::tsdfMapCallback, this);
+  tsdf_map_sub_ = nh_private_sensor.subscribe(
+      "tsdf_map_in", 1, &TsdfServer::tsdfMapCallback, this);
   nh_private_.param("publish_tsdf_map", publish_tsdf_map_, publish_tsdf_map_);
 
   if (use_freespace_pointcloud_) {
     // points that are not inside an object, but may also not be on a surface.
     // These will only be used to mark freespace beyond the truncation distance.
     freespace_pointcloud_sub_ =
-        nh_.subscribe("freespace_pointcloud", pointcloud_queue_size_,
-                      &TsdfServer::insertFreespacePointcloud, this);
+        nh_sensor.subscribe("freespace_pointcloud", pointcloud_queue_size_,
+                            &TsdfServer::insertFreespacePointcloud, this);
   }
 
   if (enable_icp_) {
@@ -113,17 +129,17 @@ TsdfServer::TsdfServer(const ros::NodeHandle& nh,
   icp_.reset(new ICP(getICPConfigFromRosParam(nh_private)));
 
   // Advertise services.
-  generate_mesh_srv_ = nh_private_.advertiseService(
+  generate_mesh_srv_ = nh_private_service.advertiseService(
       "generate_mesh", &TsdfServer::generateMeshCallback, this);
-  clear_map_srv_ = nh_private_.advertiseService(
+  clear_map_srv_ = nh_private_service.advertiseService(
       "clear_map", &TsdfServer::clearMapCallback, this);
-  save_map_srv_ = nh_private_.advertiseService(
+  save_map_srv_ = nh_private_service.advertiseService(
       "save_map", &TsdfServer::saveMapCallback, this);
-  load_map_srv_ = nh_private_.advertiseService(
+  load_map_srv_ = nh_private_service.advertiseService(
       "load_map", &TsdfServer::loadMapCallback, this);
-  publish_pointclouds_srv_ = nh_private_.advertiseService(
+  publish_pointclouds_srv_ = nh_private_service.advertiseService(
       "publish_pointclouds", &TsdfServer::publishPointcloudsCallback, this);
-  publish_tsdf_map_srv_ = nh_private_.advertiseService(
+  publish_tsdf_map_srv_ = nh_private_service.advertiseService(
       "publish_map", &TsdfServer::publishTsdfMapCallback, this);
 
   // If set, use a timer to progressively integrate the mesh.
@@ -133,8 +149,8 @@ TsdfServer::TsdfServer(const ros::NodeHandle& nh,
 
   if (update_mesh_every_n_sec > 0.0) {
     update_mesh_timer_ =
-        nh_private_.createTimer(ros::Duration(update_mesh_every_n_sec),
-                                &TsdfServer::updateMeshEvent, this);
+        nh_private_timer.createTimer(ros::Duration(update_mesh_every_n_sec),
+                                     &TsdfServer::updateMeshEvent, this);
   }
 
   double publish_map_every_n_sec = 1.0;
@@ -143,9 +159,55 @@ TsdfServer::TsdfServer(const ros::NodeHandle& nh,
 
   if (publish_map_every_n_sec > 0.0) {
     publish_map_timer_ =
-        nh_private_.createTimer(ros::Duration(publish_map_every_n_sec),
-                                &TsdfServer::publishMapEvent, this);
+        nh_private_timer.createTimer(ros::Duration(publish_map_every_n_sec),
+                                     &TsdfServer::publishMapEvent, this);
+  }
+}
+
+TsdfServer::~TsdfServer() { stopAsyncSpinners(); }
+
+ros::NodeHandle TsdfServer::getNodeHandleWithQueue(
+    const ros::NodeHandle& nh, ros::CallbackQueue* queue) const {
+  ros::NodeHandle nh_with_queue(nh);
+  if (use_async_spinners_) {
+    nh_with_queue.setCallbackQueue(CHECK_NOTNULL(queue));
+  }
+  return nh_with_queue;
+}
+
+void TsdfServer::startAsyncSpinners() {
+  if (!use_async_spinners_ || !async_spinners_.empty()) {
+    return;
+  }
+  // One thread per queue, as the sensor input has to be integrated in order.
+  for (ros::CallbackQueue* queue :
+       {&sensor_queue_, &timer_queue_, &service_queue_}) {
+    async_spinners_.emplace_back(new ros::AsyncSpinner(1, queue));
+    async_spinners_.back()->start();
+  }
+}
+
+void TsdfServer::stopAsyncSpinners() {
+  for (std::unique_ptr<ros::AsyncSpinner>& async_spinner : async_spinners_) {
+    async_spinner->stop();
+  }
+  async_spinners_.clear();
+}
+
+TsdfMap::Ptr TsdfServer::getTsdfMapSnapshot() {
+  std::lock_guard<std::mutex> lock(tsdf_map_mutex_);
+  return tsdf_map_->getSnapshot();
+}
+
+std::shared_ptr<const Layer<TsdfVoxel>> TsdfServer::getTsdfLayerForReading() {
+  if (!use_async_spinners_) {
+    // Nothing changes the layer while it's read, so it doesn't need the
+    // copies that writing after a snapshot would cause.
+    return std::shared_ptr<const Layer<TsdfVoxel>>(
+        tsdf_map_, tsdf_map_->getTsdfLayerConstPtr());
   }
+  std::lock_guard<std::mutex> lock(tsdf_map_mutex_);
+  return tsdf_map_->getTsdfLayerPtr()->getSnapshot();
 }
 
 void TsdfServer::getServerConfigFromRosParam(
@@ -181,9 +243,11 @@ void TsdfServer::getServerConfigFromRosParam(
 
   // Mesh settings.
   nh_private.param("mesh_filename", mesh_filename_, mesh_filename_);
+  nh_private.param("mesh_binary_ply", mesh_binary_ply_, mesh_binary_ply_);
   std::string color_mode("");
   nh_private.param("color_mode", color_mode, color_mode);
   color_mode_ = getColorModeFromString(color_mode);
+  mesh_msg_config_ = getMeshMsgConfigFromRosParam(nh_private);
 
   // Color map for intensity pointclouds.
   std::string intensity_colormap("rainbow");
@@ -257,9 +321,13 @@ void TsdfServer::processPointCloudMessageAndInsert(
       icp_corrected_transform_.setIdentity();
     }
     static Transformation T_offset;
-    const size_t num_icp_updates =
-        icp_->runICP(tsdf_map_->getTsdfLayer(), points_C,
-                     icp_corrected_transform_ * T_G_C, &T_G_C_refined);
+    size_t num_icp_updates;
+    {
+      std::lock_guard<std::mutex> lock(tsdf_map_mutex_);
+      num_icp_updates =
+          icp_->runICP(tsdf_map_->getTsdfLayer(), points_C,
+                       icp_corrected_transform_ * T_G_C, &T_G_C_refined);
+    }
     if (verbose_) {
       ROS_INFO("ICP refinement performed %zu successful update steps",
                num_icp_updates);
@@ -305,6 +373,8 @@ void TsdfServer::processPointCloudMessageAndInsert(
   ros::WallTime start = ros::WallTime::now();
   integratePointcloud(T_G_C_refined, points_C, colors, is_freespace_pointcloud);
   ros::WallTime end = ros::WallTime::now();
+
+  std::unique_lock<std::mutex> lock(tsdf_map_mutex_);
   if (verbose_) {
     ROS_INFO("Finished integrating in %f seconds, have %lu blocks.",
              (end - start).toSec(),
@@ -314,10 +384,13 @@ void TsdfServer::processPointCloudMessageAndInsert(
   timing::Timer block_remove_timer("remove_distant_blocks");
   tsdf_map_->getTsdfLayerPtr()->removeDistantBlocks(
       T_G_C.getPosition(), max_block_distance_from_body_);
-  mesh_layer_->clearDistantMesh(T_G_C.getPosition(),
-                                max_block_distance_from_body_);
   block_remove_timer.Stop();
 
+  // The distant parts of the mesh are cleared with the next mesh update, so
+  // this doesn't wait for the meshing.
+  mesh_viewer_position_ = T_G_C.getPosition();
+  lock.unlock();
+
   // Callback for inheriting classes.
   newPoseCallback(T_G_C);
 }
@@ -380,6 +453,7 @@ void TsdfServer::insertPointcloud(
 
   if (verbose_) {
     ROS_INFO_STREAM("Timings: " << std::endl << timing::Timing::Print());
+    std::lock_guard<std::mutex> lock(tsdf_map_mutex_);
     ROS_INFO_STREAM(
         "Layer memory: " << tsdf_map_->getTsdfLayer().getMemorySize());
   }
@@ -409,45 +483,61 @@ void TsdfServer::integratePointcloud(const Transformation& T_G_C,
                                      const Colors& colors,
                                      const bool is_freespace_pointcloud) {
   CHECK_EQ(ptcloud_C.size(), colors.size());
+  std::lock_guard<std::mutex> lock(tsdf_map_mutex_);
   tsdf_integrator_->integratePointCloud(T_G_C, ptcloud_C, colors,
                                         is_freespace_pointcloud);
 }
 
 void TsdfServer::publishAllUpdatedTsdfVoxels() {
+  publishAllUpdatedTsdfVoxels(*getTsdfLayerForReading());
+}
+
+void TsdfServer::publishAllUpdatedTsdfVoxels(
+    const Layer<TsdfVoxel>& tsdf_layer) {
   // Create a pointcloud with distance = intensity.
   pcl::PointCloud<pcl::PointXYZI> pointcloud;
 
-  createDistancePointcloudFromTsdfLayer(tsdf_map_->getTsdfLayer(), &pointcloud);
+  createDistancePointcloudFromTsdfLayer(tsdf_layer, &pointcloud);
 
   pointcloud.header.frame_id = world_frame_;
   tsdf_pointcloud_pub_.publish(pointcloud);
 }
 
 void TsdfServer::publishTsdfSurfacePoints() {
+  publishTsdfSurfacePoints(*getTsdfLayerForReading());
+}
+
+void TsdfServer::publishTsdfSurfacePoints(const Layer<TsdfVoxel>& tsdf_layer) {
   // Create a pointcloud with distance = intensity.
   pcl::PointCloud<pcl::PointXYZRGB> pointcloud;
-  const float surface_distance_thresh =
-      tsdf_map_->getTsdfLayer().voxel_size() * 0.75;
-  createSurfacePointcloudFromTsdfLayer(tsdf_map_->getTsdfLayer(),
-                                       surface_distance_thresh, &pointcloud);
+  const float surface_distance_thresh = tsdf_layer.voxel_size() * 0.75;
+  createSurfacePointcloudFromTsdfLayer(tsdf_layer, surface_distance_thresh,
+                                       &pointcloud);
 
   pointcloud.header.frame_id = world_frame_;
   surface_pointcloud_pub_.publish(pointcloud);
 }
 
 void TsdfServer::publishTsdfOccupiedNodes() {
+  publishTsdfOccupiedNodes(*getTsdfLayerForReading());
+}
+
+void TsdfServer::publishTsdfOccupiedNodes(const Layer<TsdfVoxel>& tsdf_layer) {
   // Create a pointcloud with distance = intensity.
   visualization_msgs::MarkerArray marker_array;
-  createOccupancyBlocksFromTsdfLayer(tsdf_map_->getTsdfLayer(), world_frame_,
-                                     &marker_array);
+  createOccupancyBlocksFromTsdfLayer(tsdf_layer, world_frame_, &marker_array);
   occupancy_marker_pub_.publish(marker_array);
 }
 
 void TsdfServer::publishSlices() {
+  publishTsdfSlices(*getTsdfLayerForReading());
+}
+
+void TsdfServer::publishTsdfSlices(const Layer<TsdfVoxel>& tsdf_layer) {
   pcl::PointCloud<pcl::PointXYZI> pointcloud;
 
-  createDistancePointcloudFromTsdfLayerSlice(tsdf_map_->getTsdfLayer(), 2,
-                                             slice_level_, &pointcloud);
+  createDistancePointcloudFromTsdfLayerSlice(tsdf_layer, 2, slice_level_,
+                                             &pointcloud);
 
   pointcloud.header.frame_id = world_frame_;
   tsdf_slice_pub_.publish(pointcloud);
@@ -468,8 +558,8 @@ void TsdfServer::publishMap(bool reset_remote_map) {
     const bool only_updated = !reset_remote_map;
     timing::Timer publish_map_timer("map/publish_tsdf");
     voxblox_msgs::Layer layer_msg;
-    serializeLayerAsMsg<TsdfVoxel>(this->tsdf_map_->getTsdfLayer(),
-                                   only_updated, &layer_msg);
+    serializeLayerAsMsg<TsdfVoxel>(*getTsdfLayerForReading(), only_updated,
+                                   &layer_msg);
     if (reset_remote_map) {
       layer_msg.action = static_cast<uint8_t>(MapDerializationAction::kReset);
     }
@@ -481,12 +571,15 @@ void TsdfServer::publishMap(bool reset_remote_map) {
 
 void TsdfServer::publishPointclouds() {
   // Combined function to publish all possible pointcloud messages -- surface
-  // pointclouds, updated points, and occupied points.
-  publishAllUpdatedTsdfVoxels();
-  publishTsdfSurfacePoints();
-  publishTsdfOccupiedNodes();
+  // pointclouds, updated points, and occupied points. They share one
+  // snapshot, so the integration copies the blocks it writes next only once.
+  const std::shared_ptr<const Layer<TsdfVoxel>> tsdf_layer =
+      getTsdfLayerForReading();
+  publishAllUpdatedTsdfVoxels(*tsdf_layer);
+  publishTsdfSurfacePoints(*tsdf_layer);
+  publishTsdfOccupiedNodes(*tsdf_layer);
   if (publish_slices_) {
-    publishSlices();
+    publishTsdfSlices(*tsdf_layer);
   }
 }
 
@@ -495,16 +588,17 @@ void TsdfServer::updateMesh() {
     ROS_INFO("Updating mesh.");
   }
 
+  std::unique_lock<std::mutex> mesh_lock(mesh_mutex_);
   timing::Timer generate_mesh_timer("mesh/update");
   constexpr bool only_mesh_updated_blocks = true;
-  constexpr bool clear_updated_flag = true;
-  mesh_integrator_->generateMesh(only_mesh_updated_blocks, clear_updated_flag);
+  const Point viewer_position = updateMeshLayer(only_mesh_updated_blocks);
   generate_mesh_timer.Stop();
 
   timing::Timer publish_mesh_timer("mesh/publish");
 
   voxblox_msgs::Mesh mesh_msg;
-  generateVoxbloxMeshMsg(mesh_layer_, color_mode_, &mesh_msg);
+  generateVoxbloxMeshMsg(mesh_layer_.get(), color_mode_, mesh_msg_config_,
+                         viewer_position, &mesh_lod_state_, &mesh_msg);
   mesh_msg.header.frame_id = world_frame_;
   mesh_pub_.publish(mesh_msg);
 
@@ -513,6 +607,7 @@ void TsdfServer::updateMesh() {
   }
 
   publish_mesh_timer.Stop();
+  mesh_lock.unlock();
 
   if (publish_pointclouds_ && !publish_pointclouds_on_update_) {
     publishPointclouds();
@@ -520,24 +615,23 @@ void TsdfServer::updateMesh() {
 }
 
 bool TsdfServer::generateMesh() {
+  std::lock_guard<std::mutex> mesh_lock(mesh_mutex_);
   timing::Timer generate_mesh_timer("mesh/generate");
   const bool clear_mesh = true;
+  Point viewer_position;
   if (clear_mesh) {
     constexpr bool only_mesh_updated_blocks = false;
-    constexpr bool clear_updated_flag = true;
-    mesh_integrator_->generateMesh(only_mesh_updated_blocks,
-                                   clear_updated_flag);
+    viewer_position = updateMeshLayer(only_mesh_updated_blocks);
   } else {
     constexpr bool only_mesh_updated_blocks = true;
-    constexpr bool clear_updated_flag = true;
-    mesh_integrator_->generateMesh(only_mesh_updated_blocks,
-                                   clear_updated_flag);
+    viewer_position = updateMeshLayer(only_mesh_updated_blocks);
   }
   generate_mesh_timer.Stop();
 
   timing::Timer publish_mesh_timer("mesh/publish");
   voxblox_msgs::Mesh mesh_msg;
-  generateVoxbloxMeshMsg(mesh_layer_, color_mode_, &mesh_msg);
+  generateVoxbloxMeshMsg(mesh_layer_.get(), color_mode_, mesh_msg_config_,
+                         viewer_position, &mesh_lod_state_, &mesh_msg);
   mesh_msg.header.frame_id = world_frame_;
   mesh_pub_.publish(mesh_msg);
 
@@ -545,7 +639,14 @@ bool TsdfServer::generateMesh() {
 
   if (!mesh_filename_.empty()) {
     timing::Timer output_mesh_timer("mesh/output");
-    const bool success = outputMeshLayerAsPly(mesh_filename_, *mesh_layer_);
+    constexpr bool kConnectedMesh = true;
+    const io::PlyFormat format = mesh_binary_ply_
+                                     ? io::PlyFormat::kBinaryLittleEndian
+                                     : io::PlyFormat::kAscii;
+    // Written block by block, so large maps don't need a second copy of the
+    // whole mesh in memory.
+    const bool success = outputMeshLayerAsPlyStreamed(
+        mesh_filename_, *mesh_layer_, format, kConnectedMesh);
     output_mesh_timer.Stop();
     if (success) {
       ROS_INFO("Output file as PLY: %s", mesh_filename_.c_str());
@@ -558,9 +659,41 @@ bool TsdfServer::generateMesh() {
   return true;
 }
 
+Point TsdfServer::updateMeshLayer(bool only_mesh_updated_blocks) {
+  std::unique_lock<std::mutex> lock(tsdf_map_mutex_);
+  const Point viewer_position = mesh_viewer_position_;
+  mesh_layer_->clearDistantMesh(viewer_position, max_block_distance_from_body_);
+
+  if (!use_async_spinners_) {
+    constexpr bool clear_updated_flag = true;
+    mesh_integrator_->generateMesh(only_mesh_updated_blocks,
+                                   clear_updated_flag);
+    return viewer_position;
+  }
+
+  // Take over the update flags from the layer, then mesh the snapshot
+  // without holding up the integration. The snapshot keeps its own copy of
+  // the flags, and clearing them in the layer doesn't copy any blocks.
+  Layer<TsdfVoxel>* tsdf_layer = tsdf_map_->getTsdfLayerPtr();
+  Layer<TsdfVoxel>::Ptr tsdf_snapshot = tsdf_layer->getSnapshot();
+  BlockIndexList updated_blocks;
+  tsdf_layer->getAllUpdatedBlocks(Update::kMesh, &updated_blocks);
+  for (const BlockIndex& block_index : updated_blocks) {
+    tsdf_layer->resetUpdated(block_index, Update::kMesh);
+  }
+  lock.unlock();
+
+  MeshIntegrator<TsdfVoxel> snapshot_mesh_integrator(
+      mesh_config_, *tsdf_snapshot, mesh_layer_.get());
+  constexpr bool clear_updated_flag = false;
+  snapshot_mesh_integrator.generateMesh(only_mesh_updated_blocks,
+                                        clear_updated_flag);
+  return viewer_position;
+}
+
 bool TsdfServer::saveMap(const std::string& file_path) {
   // Inheriting classes should add saving other layers to this function.
-  return io::SaveLayer(tsdf_map_->getTsdfLayer(), file_path);
+  return io::SaveLayer(*getTsdfLayerForReading(), file_path);
 }
 
 bool TsdfServer::loadMap(const std::string& file_path) {
@@ -568,6 +701,7 @@ bool TsdfServer::loadMap(const std::string& file_path) {
   // load
   // the TSDF layer.
   constexpr bool kMulitpleLayerSupport = true;
+  std::lock_guard<std::mutex> lock(tsdf_map_mutex_);
   bool success = io::LoadBlocksFromFile(
       file_path, Layer<TsdfVoxel>::BlockMergingStrategy::kReplace,
       kMulitpleLayerSupport, tsdf_map_->getTsdfLayerPtr());
@@ -626,8 +760,14 @@ void TsdfServer::publishMapEvent(const ros::TimerEvent& /*event*/) {
 }
 
 void TsdfServer::clear() {
-  tsdf_map_->getTsdfLayerPtr()->removeAllBlocks();
-  mesh_layer_->clear();
+  {
+    std::lock_guard<std::mutex> lock(tsdf_map_mutex_);
+    tsdf_map_->getTsdfLayerPtr()->removeAllBlocks();
+  }
+  {
+    std::lock_guard<std::mutex> mesh_lock(mesh_mutex_);
+    mesh_layer_->clear();
+  }
 
   // Publish a message to reset the map to all subscribers.
   if (publish_tsdf_map_) {
@@ -639,8 +779,10 @@ void TsdfServer::clear() {
 void TsdfServer::tsdfMapCallback(const voxblox_msgs::Layer& layer_msg) {
   timing::Timer receive_map_timer("map/receive_tsdf");
 
+  std::unique_lock<std::mutex> lock(tsdf_map_mutex_);
   bool success =
       deserializeMsgToLayer<TsdfVoxel>(layer_msg, tsdf_map_->getTsdfLayerPtr());
+  lock.unlock();
 
   if (!success) {
     ROS_ERROR_THROTTLE(10, "Got an invalid TSDF map message!");
@@ -11,6 +11,7 @@ int main(int argc, char** argv) {
   ros::NodeHandle nh_private("~");
 
   voxblox::TsdfServer node(nh, nh_private);
+  node.startAsyncSpinners();
 
   ros::spin();
   return 0;
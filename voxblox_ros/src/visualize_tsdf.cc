@@ -1,4 +1,5 @@
 #include <string>
+#include <vector>
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
@@ -19,6 +20,7 @@
 #include "voxblox_ros/mesh_pcl.h"
 #include "voxblox_ros/mesh_vis.h"
 #include "voxblox_ros/ptcloud_vis.h"
+#include "voxblox_ros/ros_params.h"
 
 namespace voxblox {
 class SimpleTsdfVisualizer {
@@ -28,7 +30,8 @@ class SimpleTsdfVisualizer {
         tsdf_surface_distance_threshold_factor_(2.0),
         tsdf_world_frame_("world"),
         tsdf_mesh_color_mode_(ColorMode::kColor),
-        tsdf_voxel_ply_output_path_("") {
+        tsdf_voxel_ply_output_path_(""),
+        mesh_viewer_position_(Point::Zero()) {
     ROS_DEBUG_STREAM("\tSetting up ROS publishers...");
 
     surface_pointcloud_pub_ =
@@ -76,6 +79,22 @@ class SimpleTsdfVisualizer {
       ros::shutdown();
     }
 
+    mesh_config_ = getMeshIntegratorConfigFromRosParam(nh_private_);
+    mesh_msg_config_ = getMeshMsgConfigFromRosParam(nh_private_);
+    // There is no sensor, the levels of detail are selected as seen from
+    // this position.
+    std::vector<double> viewer_position(3, 0.0);
+    nh_private_.param("mesh_viewer_position", viewer_position,
+                      viewer_position);
+    if (viewer_position.size() == 3u) {
+      mesh_viewer_position_ =
+          Point(viewer_position[0], viewer_position[1], viewer_position[2]);
+    } else {
+      ROS_FATAL_STREAM("The mesh viewer position needs 3 entries, got "
+                       << viewer_position.size());
+      ros::shutdown();
+    }
+
     ros::spinOnce();
   }
 
@@ -96,6 +115,9 @@ class SimpleTsdfVisualizer {
   ColorMode tsdf_mesh_color_mode_;
   std::string tsdf_voxel_ply_output_path_;
   std::string tsdf_mesh_output_path_;
+  MeshIntegratorConfig mesh_config_;
+  MeshMsgConfig mesh_msg_config_;
+  Point mesh_viewer_position_;
 };
 
 void SimpleTsdfVisualizer::run(const Layer<TsdfVoxel>& tsdf_layer) {
@@ -139,10 +161,9 @@ void SimpleTsdfVisualizer::run(const Layer<TsdfVoxel>& tsdf_layer) {
   {
     std::shared_ptr<MeshLayer> mesh_layer;
     mesh_layer.reset(new MeshLayer(tsdf_layer.block_size()));
-    MeshIntegratorConfig mesh_config;
     std::shared_ptr<MeshIntegrator<TsdfVoxel>> mesh_integrator;
-    mesh_integrator.reset(new MeshIntegrator<TsdfVoxel>(mesh_config, tsdf_layer,
-                                                        mesh_layer.get()));
+    mesh_integrator.reset(new MeshIntegrator<TsdfVoxel>(
+        mesh_config_, tsdf_layer, mesh_layer.get()));
 
     constexpr bool kOnlyMeshUpdatedBlocks = false;
     constexpr bool kClearUpdatedFlag = false;
@@ -150,7 +171,9 @@ void SimpleTsdfVisualizer::run(const Layer<TsdfVoxel>& tsdf_layer) {
 
     // Output as native voxblox mesh.
     voxblox_msgs::Mesh mesh_msg;
-    generateVoxbloxMeshMsg(mesh_layer, tsdf_mesh_color_mode_, &mesh_msg);
+    generateVoxbloxMeshMsg(mesh_layer.get(), tsdf_mesh_color_mode_,
+                           mesh_msg_config_, mesh_viewer_position_, nullptr,
+                           &mesh_msg);
     mesh_msg.header.frame_id = tsdf_world_frame_;
     mesh_pub_.publish(mesh_msg);
 
@@ -1,9 +1,13 @@
 #ifndef VOXBLOX_RVIZ_PLUGIN_VOXBLOX_MESH_VISUAL_H_
 #define VOXBLOX_RVIZ_PLUGIN_VOXBLOX_MESH_VISUAL_H_
 
+#include <map>
+#include <vector>
+
 #include <OGRE/OgreManualObject.h>
 
 #include <voxblox/core/block_hash.h>
+#include <voxblox/mesh/mesh.h>
 #include <voxblox_msgs/Mesh.h>
 
 namespace voxblox_rviz_plugin {
@@ -22,6 +26,18 @@ class VoxbloxMeshVisual {
   void setFrameOrientation(const Ogre::Quaternion& orientation);
 
  private:
+  /// Sub-meshes of a block, by sub-mesh index.
+  typedef std::map<size_t, voxblox::Mesh> SubMeshMap;
+
+  /**
+   * Replaces the received sub-meshes of the block and then replaces the mesh
+   * with the combination of all sub-meshes of the block.
+   */
+  void updateSubMeshes(const voxblox::BlockIndex& index,
+                       const voxblox::Mesh::SubMeshMask sub_mesh_mask,
+                       const std::vector<uint32_t>& sub_mesh_num_vertices,
+                       voxblox::Mesh* mesh);
+
   Ogre::SceneNode* frame_node_;
   Ogre::SceneManager* scene_manager_;
 
@@ -29,6 +45,8 @@ class VoxbloxMeshVisual {
   static unsigned int instance_counter_;
 
   voxblox::AnyIndexHashMapType<Ogre::ManualObject*>::type object_map_;
+  /// Blocks that are published as sub-meshes.
+  voxblox::AnyIndexHashMapType<SubMeshMap>::type sub_mesh_map_;
 };
 
 }  // namespace voxblox_rviz_plugin
@@ -27,16 +27,26 @@ VoxbloxMeshVisual::~VoxbloxMeshVisual() {
 }
 
 void VoxbloxMeshVisual::setMessage(const voxblox_msgs::Mesh::ConstPtr& msg) {
+  for (size_t i = 0u; i + 2u < msg->deleted_blocks.size(); i += 3u) {
+    const voxblox::BlockIndex index(msg->deleted_blocks[i],
+                                    msg->deleted_blocks[i + 1u],
+                                    msg->deleted_blocks[i + 2u]);
+    sub_mesh_map_.erase(index);
+    const voxblox::AnyIndexHashMapType<Ogre::ManualObject*>::type::iterator
+        it = object_map_.find(index);
+    if (it != object_map_.end()) {
+      scene_manager_->destroyManualObject(it->second);
+      object_map_.erase(it);
+    }
+  }
+
   for (const voxblox_msgs::MeshBlock& mesh_block : msg->mesh_blocks) {
     const voxblox::BlockIndex index(mesh_block.index[0], mesh_block.index[1],
                                     mesh_block.index[2]);
 
-    size_t vertex_index = 0u;
-    voxblox::Mesh mesh;
-    mesh.vertices.reserve(mesh_block.x.size());
-    mesh.indices.reserve(mesh_block.x.size());
-
     // translate vertex data from message to voxblox mesh
+    voxblox::Pointcloud block_vertices;
+    block_vertices.reserve(mesh_block.x.size());
     for (size_t i = 0; i < mesh_block.x.size(); ++i) {
       // Each vertex is given as its distance from the blocks origin in units of
       // (2*block_size), see mesh_vis.h for the slightly convoluted
@@ -55,27 +65,49 @@ void VoxbloxMeshVisual::setMessage(const voxblox_msgs::Mesh::ConstPtr& msg) {
           (static_cast<float>(mesh_block.z[i]) * point_conv_factor +
            static_cast<float>(index[2])) *
           msg->block_edge_length;
+      block_vertices.emplace_back(mesh_x, mesh_y, mesh_z);
+    }
 
-      mesh.indices.push_back(vertex_index++);
-      mesh.vertices.emplace_back(mesh_x, mesh_y, mesh_z);
+    // Indexed triangles are expanded to separate triangles, the format of the
+    // sub-meshes.
+    const bool has_triangles = !mesh_block.triangles.empty();
+    const size_t num_vertices =
+        has_triangles ? mesh_block.triangles.size() : mesh_block.x.size();
+    voxblox::Mesh mesh;
+    mesh.vertices.reserve(num_vertices);
+    mesh.indices.reserve(num_vertices);
+    for (size_t k = 0; k < num_vertices; ++k) {
+      const size_t i = has_triangles ? mesh_block.triangles[k] : k;
+      CHECK_LT(i, block_vertices.size());
+      mesh.indices.push_back(k);
+      mesh.vertices.push_back(block_vertices[i]);
     }
 
-    // calculate normals
+    // decode or calculate normals
     mesh.normals.reserve(mesh.vertices.size());
-    for (size_t i = 0; i < mesh.vertices.size(); i += 3) {
-      const voxblox::Point dir0 = mesh.vertices[i] - mesh.vertices[i + 1];
-      const voxblox::Point dir1 = mesh.vertices[i] - mesh.vertices[i + 2];
-      const voxblox::Point normal = dir0.cross(dir1).normalized();
-
-      mesh.normals.push_back(normal);
-      mesh.normals.push_back(normal);
-      mesh.normals.push_back(normal);
+    if (mesh_block.normals.size() == 2u * mesh_block.x.size()) {
+      for (size_t k = 0; k < num_vertices; ++k) {
+        const size_t i = has_triangles ? mesh_block.triangles[k] : k;
+        mesh.normals.push_back(voxblox::decodeOctNormal(
+            mesh_block.normals[2u * i], mesh_block.normals[2u * i + 1u]));
+      }
+    } else {
+      for (size_t i = 0; i + 2u < mesh.vertices.size(); i += 3) {
+        const voxblox::Point dir0 = mesh.vertices[i] - mesh.vertices[i + 1];
+        const voxblox::Point dir1 = mesh.vertices[i] - mesh.vertices[i + 2];
+        const voxblox::Point normal = dir0.cross(dir1).normalized();
+
+        mesh.normals.push_back(normal);
+        mesh.normals.push_back(normal);
+        mesh.normals.push_back(normal);
+      }
     }
 
     // add color information
     mesh.colors.reserve(mesh.vertices.size());
     const bool has_color = mesh_block.x.size() == mesh_block.r.size();
-    for (size_t i = 0; i < mesh_block.x.size(); ++i) {
+    for (size_t k = 0; k < num_vertices; ++k) {
+      const size_t i = has_triangles ? mesh_block.triangles[k] : k;
       voxblox::Color color;
       if (has_color) {
         color.r = mesh_block.r[i];
@@ -85,16 +117,24 @@ void VoxbloxMeshVisual::setMessage(const voxblox_msgs::Mesh::ConstPtr& msg) {
       } else {
         // reconstruct normals coloring
         color.r = std::numeric_limits<uint8_t>::max() *
-                  (mesh.normals[i].x() * 0.5f + 0.5f);
+                  (mesh.normals[k].x() * 0.5f + 0.5f);
         color.g = std::numeric_limits<uint8_t>::max() *
-                  (mesh.normals[i].y() * 0.5f + 0.5f);
+                  (mesh.normals[k].y() * 0.5f + 0.5f);
         color.b = std::numeric_limits<uint8_t>::max() *
-                  (mesh.normals[i].z() * 0.5f + 0.5f);
+                  (mesh.normals[k].z() * 0.5f + 0.5f);
       }
       color.a = std::numeric_limits<uint8_t>::max();
       mesh.colors.push_back(color);
     }
 
+    // Partial updates only contain the changed sub-meshes of the block.
+    if (mesh_block.sub_mesh_mask == 0u) {
+      sub_mesh_map_.erase(index);
+    } else {
+      updateSubMeshes(index, mesh_block.sub_mesh_mask,
+                      mesh_block.sub_mesh_num_vertices, &mesh);
+    }
+
     // connect mesh
     voxblox::Mesh connected_mesh;
     voxblox::createConnectedMesh(mesh, &connected_mesh);
@@ -105,7 +145,7 @@ void VoxbloxMeshVisual::setMessage(const voxblox_msgs::Mesh::ConstPtr& msg) {
         Ogre::ManualObject*>::type::const_iterator it = object_map_.find(index);
     if (it != object_map_.end()) {
       // delete empty mesh blocks
-      if (mesh_block.x.size() == 0) {
+      if (mesh.vertices.empty()) {
         scene_manager_->destroyManualObject(it->second);
         object_map_.erase(it);
         continue;
@@ -160,6 +200,54 @@ void VoxbloxMeshVisual::setMessage(const voxblox_msgs::Mesh::ConstPtr& msg) {
   }
 }  // namespace voxblox_rviz_plugin
 
+void VoxbloxMeshVisual::updateSubMeshes(
+    const voxblox::BlockIndex& index,
+    const voxblox::Mesh::SubMeshMask sub_mesh_mask,
+    const std::vector<uint32_t>& sub_mesh_num_vertices, voxblox::Mesh* mesh) {
+  CHECK_NOTNULL(mesh);
+  SubMeshMap& sub_meshes = sub_mesh_map_[index];
+
+  size_t begin = 0u;
+  size_t num_vertices_index = 0u;
+  for (size_t i = 0u; i < voxblox::Mesh::kNumSubMeshes; ++i) {
+    if ((sub_mesh_mask >> i & 1u) == 0u) {
+      continue;
+    }
+    CHECK_LT(num_vertices_index, sub_mesh_num_vertices.size());
+    const size_t end = begin + sub_mesh_num_vertices[num_vertices_index++];
+    CHECK_LE(end, mesh->vertices.size());
+    if (begin == end) {
+      sub_meshes.erase(i);
+      continue;
+    }
+
+    voxblox::Mesh& sub_mesh = sub_meshes[i];
+    sub_mesh.vertices.assign(mesh->vertices.begin() + begin,
+                             mesh->vertices.begin() + end);
+    sub_mesh.normals.assign(mesh->normals.begin() + begin,
+                            mesh->normals.begin() + end);
+    sub_mesh.colors.assign(mesh->colors.begin() + begin,
+                           mesh->colors.begin() + end);
+    begin = end;
+  }
+
+  // Assemble the mesh of the whole block from its sub-meshes.
+  mesh->clear();
+  for (const std::pair<const size_t, voxblox::Mesh>& kv : sub_meshes) {
+    const voxblox::Mesh& sub_mesh = kv.second;
+    for (size_t i = 0u; i < sub_mesh.vertices.size(); ++i) {
+      mesh->indices.push_back(mesh->vertices.size());
+      mesh->vertices.push_back(sub_mesh.vertices[i]);
+      mesh->normals.push_back(sub_mesh.normals[i]);
+      mesh->colors.push_back(sub_mesh.colors[i]);
+    }
+  }
+
+  if (sub_meshes.empty()) {
+    sub_mesh_map_.erase(index);
+  }
+}
+
 void VoxbloxMeshVisual::setFramePosition(const Ogre::Vector3& position) {
   frame_node_->setPosition(position);
 }